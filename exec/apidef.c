@@ -105,8 +105,11 @@ static struct corosync_api_v1 apidef_corosync_api_v1 = {
 	.ipc_response_send = cs_ipcs_response_send,
 	.ipc_dispatch_send = cs_ipcs_dispatch_send,
 	.ipc_dispatch_iov_send = cs_ipcs_dispatch_iov_send,
+	.ipc_dispatch_send_when_ready = cs_ipcs_dispatch_send_when_ready,
+	.ipc_response_send_when_ready = cs_ipcs_response_send_when_ready,
 	.ipc_refcnt_inc =  cs_ipc_refcnt_inc,
 	.ipc_refcnt_dec = cs_ipc_refcnt_dec,
+	.ipc_credentials_get = cs_ipcs_credentials_get,
 	.totem_nodeid_get = totempg_my_nodeid_get,
 	.totem_family_get = totempg_my_family_get,
 	.totem_ring_reenable = totempg_ring_reenable,
@@ -130,6 +133,8 @@ static struct corosync_api_v1 apidef_corosync_api_v1 = {
 	.schedwrk_create = schedwrk_create,
 	.schedwrk_create_nolock = schedwrk_create_nolock,
 	.schedwrk_destroy = schedwrk_destroy,
+	.schedwrk_create_prio = schedwrk_create_prio,
+	.schedwrk_budget_exhausted = schedwrk_budget_exhausted,
 	.sync_request = NULL, //sync_request,
 	.quorum_is_quorate = corosync_quorum_is_quorate,
 	.quorum_register_callback = corosync_quorum_register_callback,
@@ -52,6 +52,7 @@
 
 #include <corosync/corotypes.h>
 #include <qb/qbipc_common.h>
+#include <qb/qbutil.h>
 #include <corosync/cfg.h>
 #include <corosync/list.h>
 #include <corosync/mar_gen.h>
@@ -108,6 +109,20 @@ static char *cfg_exec_init_fn (struct corosync_api_v1 *corosync_api_v1);
 
 static struct corosync_api_v1 *api;
 
+/*
+ * Change of live map computed by config reload
+ */
+enum cfg_reload_change_type {
+	CFG_RELOAD_CHANGE_DELETE,
+	CFG_RELOAD_CHANGE_SET,
+};
+
+struct cfg_reload_change {
+	struct list_head list;
+	enum cfg_reload_change_type type;
+	char *key_name;
+};
+
 static int cfg_lib_init_fn (void *conn);
 
 static int cfg_lib_exit_fn (void *conn);
@@ -271,6 +286,16 @@ static char *cfg_exec_init_fn (
 	api = corosync_api_v1;
 
 	list_init(&trackers_list);
+
+	icmap_set_uint64("runtime.services.cfg.reload.count", 0);
+	icmap_set_uint64("runtime.services.cfg.reload.duration", 0);
+	icmap_set_uint64("runtime.services.cfg.reload.parse_time", 0);
+	icmap_set_uint64("runtime.services.cfg.reload.diff_time", 0);
+	icmap_set_uint64("runtime.services.cfg.reload.apply_time", 0);
+	icmap_set_uint32("runtime.services.cfg.reload.keys_added", 0);
+	icmap_set_uint32("runtime.services.cfg.reload.keys_modified", 0);
+	icmap_set_uint32("runtime.services.cfg.reload.keys_deleted", 0);
+
 	return (NULL);
 }
 
@@ -601,21 +626,81 @@ static void remove_ro_entries(icmap_map_t temp_map)
 	delete_and_notify_if_changed(temp_map, "totem.cluster_name");
 	delete_and_notify_if_changed(temp_map, "quorum.provider");
 	delete_and_notify_if_changed(temp_map, "qb.ipc_type");
+	delete_and_notify_if_changed(temp_map, "qb.ipc_threads");
+}
+
+static int cfg_reload_change_add(struct list_head *changes,
+	enum cfg_reload_change_type type,
+	const char *key_name)
+{
+	struct cfg_reload_change *change;
+
+	change = malloc(sizeof(*change));
+	if (change == NULL) {
+		return (-1);
+	}
+
+	change->key_name = strdup(key_name);
+	if (change->key_name == NULL) {
+		free(change);
+		return (-1);
+	}
+	change->type = type;
+	list_add_tail(&change->list, changes);
+
+	return (0);
+}
+
+static void cfg_reload_changes_free(struct list_head *changes)
+{
+	struct cfg_reload_change *change;
+
+	while (!list_empty(changes)) {
+		change = list_entry(changes->next, struct cfg_reload_change, list);
+		list_del(&change->list);
+		free(change->key_name);
+		free(change);
+	}
+}
+
+/*
+ * Keys which are computed at runtime and never come from config file. They
+ * must not be deleted by reload, otherwise every reload would be seen as
+ * a change.
+ */
+static const char *cfg_reload_runtime_keys[] = {
+	"nodelist.local_node_pos",
+	NULL
+};
+
+static int cfg_reload_key_is_runtime(const char *key_name)
+{
+	int i;
+
+	for (i = 0; cfg_reload_runtime_keys[i] != NULL; i++) {
+		if (strcmp(key_name, cfg_reload_runtime_keys[i]) == 0) {
+			return (1);
+		}
+	}
+
+	return (0);
 }
 
 /*
- * Remove entries that exist in the global map, but not in the temp_map, this will
- * cause delete notifications to be sent to any listeners.
+ * Find entries that exist in the global map, but not in the temp_map. They
+ * are added to changes list and deleted later by cfg_reload_changes_apply.
+ * Runtime keys (cfg_reload_runtime_keys) are skipped.
  *
  * NOTE: This routine depends entirely on the keys returned by the iterators
  * being in alpha-sorted order.
  */
-static void remove_deleted_entries(icmap_map_t temp_map, const char *prefix)
+static int find_deleted_entries(icmap_map_t temp_map, const char *prefix, struct list_head *changes)
 {
 	icmap_iter_t old_iter;
 	icmap_iter_t new_iter;
 	const char *old_key, *new_key;
 	int ret;
+	int res = 0;
 
 	old_iter = icmap_iter_init(prefix);
 	new_iter = icmap_iter_init_r(temp_map, prefix);
@@ -631,8 +716,10 @@ static void remove_deleted_entries(icmap_map_t temp_map, const char *prefix)
 			 * Continue until old is >= new
 			 */
 			do {
-				/* Remove it from icmap & send notifications */
-				icmap_delete(old_key);
+				if (!cfg_reload_key_is_runtime(old_key) &&
+				    cfg_reload_change_add(changes, CFG_RELOAD_CHANGE_DELETE, old_key) != 0) {
+					res = -1;
+				}
 
 				old_key = icmap_iter_next(old_iter, NULL, NULL);
 				ret = nullcheck_strcmp(old_key, new_key);
@@ -658,6 +745,98 @@ static void remove_deleted_entries(icmap_map_t temp_map, const char *prefix)
 	}
 	icmap_iter_finalize(new_iter);
 	icmap_iter_finalize(old_iter);
+
+	return (res);
+}
+
+/*
+ * Find entries of temp_map which are not in the global map or have different
+ * value there.
+ */
+static int find_changed_entries(icmap_map_t temp_map, struct list_head *changes)
+{
+	icmap_iter_t iter;
+	const char *key_name;
+	int res = 0;
+
+	iter = icmap_iter_init_r(temp_map, NULL);
+
+	while ((key_name = icmap_iter_next(iter, NULL, NULL)) != NULL) {
+		if (icmap_key_value_eq(temp_map, key_name, icmap_get_global_map(), key_name)) {
+			continue;
+		}
+
+		if (cfg_reload_change_add(changes, CFG_RELOAD_CHANGE_SET, key_name) != 0) {
+			res = -1;
+			break;
+		}
+	}
+
+	icmap_iter_finalize(iter);
+
+	return (res);
+}
+
+/*
+ * Apply changes found by find_deleted_entries and find_changed_entries to
+ * the global map. Unchanged keys are not touched, so they don't generate
+ * any notification.
+ */
+static cs_error_t cfg_reload_changes_apply(icmap_map_t temp_map,
+	struct list_head *changes,
+	uint32_t *keys_added,
+	uint32_t *keys_modified,
+	uint32_t *keys_deleted)
+{
+	struct list_head *iter;
+	struct cfg_reload_change *change;
+	icmap_value_types_t type;
+	size_t value_len;
+	char *value;
+	cs_error_t err;
+	cs_error_t res = CS_OK;
+
+	*keys_added = *keys_modified = *keys_deleted = 0;
+
+	for (iter = changes->next; iter != changes; iter = iter->next) {
+		change = list_entry(iter, struct cfg_reload_change, list);
+
+		if (change->type == CFG_RELOAD_CHANGE_DELETE) {
+			if (icmap_delete(change->key_name) == CS_OK) {
+				(*keys_deleted)++;
+			}
+			continue;
+		}
+
+		err = icmap_get_r(temp_map, change->key_name, NULL, &value_len, &type);
+		if (err != CS_OK) {
+			res = err;
+			continue;
+		}
+
+		value = malloc(value_len);
+		if (value == NULL) {
+			res = CS_ERR_NO_MEMORY;
+			continue;
+		}
+
+		err = icmap_get_r(temp_map, change->key_name, value, &value_len, &type);
+		if (err == CS_OK) {
+			if (icmap_get(change->key_name, NULL, NULL, NULL) == CS_OK) {
+				(*keys_modified)++;
+			} else {
+				(*keys_added)++;
+			}
+			err = icmap_set(change->key_name, value, value_len, type);
+		}
+		if (err != CS_OK) {
+			res = err;
+		}
+
+		free(value);
+	}
+
+	return (res);
 }
 
 /*
@@ -672,11 +851,22 @@ static void message_handler_req_exec_cfg_reload_config (
 	icmap_map_t temp_map;
 	const char *error_string;
 	int res = CS_OK;
+	struct list_head changes;
+	uint64_t start_time;
+	uint64_t parse_time;
+	uint64_t diff_time;
+	uint64_t apply_time;
+	uint32_t keys_added = 0;
+	uint32_t keys_modified = 0;
+	uint32_t keys_deleted = 0;
 
 	ENTER();
 
 	log_printf(LOGSYS_LEVEL_NOTICE, "Config reload requested by node %d", nodeid);
 
+	list_init(&changes);
+	start_time = qb_util_nano_current_get();
+
 	/*
 	 * Set up a new hashtable as a staging area.
 	 */
@@ -695,32 +885,80 @@ static void message_handler_req_exec_cfg_reload_config (
 		goto reload_return;
 	}
 
-	/* Tell interested listeners that we have started a reload */
-	icmap_set_uint8("config.reload_in_progress", 1);
+	parse_time = qb_util_nano_current_get();
 
-	/* Detect deleted entries and remove them from the main icmap hashtable */
-	remove_deleted_entries(temp_map, "logging.");
-	remove_deleted_entries(temp_map, "totem.");
-	remove_deleted_entries(temp_map, "nodelist.");
-	remove_deleted_entries(temp_map, "quorum.");
-	remove_deleted_entries(temp_map, "uidgid.");
+	/*
+	 * Compute difference between live config and new config first, so
+	 * nothing is changed (and no tracker is woken up) if config is the same.
+	 * Deleted entries must be found before read-only entries are removed
+	 * from the temporary map, otherwise they would be deleted from live config.
+	 */
+	if (find_deleted_entries(temp_map, "logging.", &changes) != 0 ||
+	    find_deleted_entries(temp_map, "totem.", &changes) != 0 ||
+	    find_deleted_entries(temp_map, "nodelist.", &changes) != 0 ||
+	    find_deleted_entries(temp_map, "quorum.", &changes) != 0 ||
+	    find_deleted_entries(temp_map, "uidgid.", &changes) != 0) {
+		log_printf(LOGSYS_LEVEL_ERROR, "Unable to compute config changes. config file reload cancelled\n");
+		res = CS_ERR_NO_MEMORY;
+		goto reload_fini;
+	}
 
 	/* Remove entries that cannot be changed */
 	remove_ro_entries(temp_map);
 
-	/*
-	 * Copy new keys into live config.
-	 * If this fails we will have a partially loaded config because some keys (above) might
-	 * have been reset to defaults - I'm not sure what to do here, we might have to quit.
-	 */
-	if ( (res = icmap_copy_map(icmap_get_global_map(), temp_map)) != CS_OK) {
-		log_printf (LOGSYS_LEVEL_ERROR, "Error making new config live. cmap database may be inconsistent\n");
+	if (find_changed_entries(temp_map, &changes) != 0) {
+		log_printf(LOGSYS_LEVEL_ERROR, "Unable to compute config changes. config file reload cancelled\n");
+		res = CS_ERR_NO_MEMORY;
+		goto reload_fini;
 	}
 
-	/* All done - let clients know */
-	icmap_set_uint8("config.reload_in_progress", 0);
+	diff_time = qb_util_nano_current_get();
+
+	if (!list_empty(&changes)) {
+		/* Tell interested listeners that we have started a reload */
+		icmap_set_uint8("config.reload_in_progress", 1);
+
+		/*
+		 * Apply changes to live config.
+		 * If this fails we will have a partially loaded config because some keys might
+		 * have been already changed - I'm not sure what to do here, we might have to quit.
+		 */
+		if ((res = cfg_reload_changes_apply(temp_map, &changes,
+		    &keys_added, &keys_modified, &keys_deleted)) != CS_OK) {
+			log_printf (LOGSYS_LEVEL_ERROR, "Error making new config live. cmap database may be inconsistent\n");
+		}
+
+		/*
+		 * Batched trackers get all changes of the reload as one
+		 * notification, delivered before reload is marked as done
+		 */
+		icmap_track_batch_flush();
+
+		/* All done - let clients know */
+		icmap_set_uint8("config.reload_in_progress", 0);
+	}
+
+	apply_time = qb_util_nano_current_get();
+
+	log_printf(LOGSYS_LEVEL_NOTICE, "Config reload: %u keys added, %u modified, %u deleted",
+	    keys_added, keys_modified, keys_deleted);
+
+	icmap_inc("runtime.services.cfg.reload.count");
+	icmap_set_uint64("runtime.services.cfg.reload.duration",
+	    (apply_time - start_time) / QB_TIME_NS_IN_USEC);
+	icmap_set_uint64("runtime.services.cfg.reload.parse_time",
+	    (parse_time - start_time) / QB_TIME_NS_IN_USEC);
+	icmap_set_uint64("runtime.services.cfg.reload.diff_time",
+	    (diff_time - parse_time) / QB_TIME_NS_IN_USEC);
+	icmap_set_uint64("runtime.services.cfg.reload.apply_time",
+	    (apply_time - diff_time) / QB_TIME_NS_IN_USEC);
+	icmap_set_uint32("runtime.services.cfg.reload.keys_added", keys_added);
+	icmap_set_uint32("runtime.services.cfg.reload.keys_modified", keys_modified);
+	icmap_set_uint32("runtime.services.cfg.reload.keys_deleted", keys_deleted);
 
 reload_fini:
+	cfg_reload_changes_free(&changes);
+
 	/* Finished with the temporary storage */
 	icmap_fini_r(temp_map);
 
@@ -50,6 +50,7 @@
 #include <corosync/corodefs.h>
 #include <corosync/list.h>
 #include <corosync/mar_gen.h>
+#include <corosync/cmap.h>
 #include <corosync/ipc_cmap.h>
 #include <corosync/logsys.h>
 #include <corosync/coroapi.h>
@@ -70,6 +71,16 @@ struct cmap_conn_info {
 typedef uint64_t cmap_iter_handle_t;
 typedef uint64_t cmap_track_handle_t;
 
+/*
+ * Iterator stored in iter_db. Key which didn't fit into page of
+ * iter_next_page is kept in pending_key and returned first next time.
+ */
+struct cmap_iter_info {
+	icmap_iter_t iter;
+	int pending;
+	char pending_key[ICMAP_KEYNAME_MAXLEN + 1];
+};
+
 struct cmap_track_user_data {
 	void *conn;
 	cmap_track_handle_t track_handle;
@@ -102,6 +113,9 @@ static void message_handler_req_lib_cmap_iter_next(void *conn, const void *messa
 static void message_handler_req_lib_cmap_iter_finalize(void *conn, const void *message);
 static void message_handler_req_lib_cmap_track_add(void *conn, const void *message);
 static void message_handler_req_lib_cmap_track_delete(void *conn, const void *message);
+static void message_handler_req_lib_cmap_get_multi(void *conn, const void *message);
+static void message_handler_req_lib_cmap_set_multi(void *conn, const void *message);
+static void message_handler_req_lib_cmap_iter_next_page(void *conn, const void *message);
 
 static void cmap_notify_fn(int32_t event,
 		const char *key_name,
@@ -183,6 +197,18 @@ static struct corosync_lib_handler cmap_lib_engine[] =
 		.lib_handler_fn				= message_handler_req_lib_cmap_track_delete,
 		.flow_control				= CS_LIB_FLOW_CONTROL_NOT_REQUIRED
 	},
+	{ /* 9 */
+		.lib_handler_fn				= message_handler_req_lib_cmap_get_multi,
+		.flow_control				= CS_LIB_FLOW_CONTROL_NOT_REQUIRED
+	},
+	{ /* 10 */
+		.lib_handler_fn				= message_handler_req_lib_cmap_set_multi,
+		.flow_control				= CS_LIB_FLOW_CONTROL_NOT_REQUIRED
+	},
+	{ /* 11 */
+		.lib_handler_fn				= message_handler_req_lib_cmap_iter_next_page,
+		.flow_control				= CS_LIB_FLOW_CONTROL_NOT_REQUIRED
+	},
 };
 
 static struct corosync_exec_handler cmap_exec_engine[] =
@@ -211,7 +237,8 @@ struct corosync_service_engine cmap_service_engine = {
 	.sync_init				= cmap_sync_init,
 	.sync_process				= cmap_sync_process,
 	.sync_activate				= cmap_sync_activate,
-	.sync_abort				= cmap_sync_abort
+	.sync_abort				= cmap_sync_abort,
+	.sync_mode				= CS_SYNC_PARALLEL
 };
 
 struct corosync_service_engine *cmap_get_service_engine_ver0 (void)
@@ -318,7 +345,7 @@ static int cmap_lib_exit_fn (void *conn)
 {
 	struct cmap_conn_info *conn_info = (struct cmap_conn_info *)api->ipc_private_data_get (conn);
 	hdb_handle_t iter_handle = 0;
-	icmap_iter_t *iter;
+	struct cmap_iter_info *iter_info;
 	hdb_handle_t track_handle = 0;
 	icmap_track_t *track;
 
@@ -326,9 +353,9 @@ static int cmap_lib_exit_fn (void *conn)
 
 	hdb_iterator_reset(&conn_info->iter_db);
         while (hdb_iterator_next(&conn_info->iter_db,
-                (void*)&iter, &iter_handle) == 0) {
+                (void*)&iter_info, &iter_handle) == 0) {
 
-		icmap_iter_finalize(*iter);
+		icmap_iter_finalize(iter_info->iter);
 
 		(void)hdb_handle_put (&conn_info->iter_db, iter_handle);
         }
@@ -550,7 +577,7 @@ static void message_handler_req_lib_cmap_iter_init(void *conn, const void *messa
 	struct res_lib_cmap_iter_init res_lib_cmap_iter_init;
 	cs_error_t ret;
 	icmap_iter_t iter;
-	icmap_iter_t *hdb_iter;
+	struct cmap_iter_info *iter_info;
 	cmap_iter_handle_t handle = 0ULL;
 	const char *prefix;
 	struct cmap_conn_info *conn_info = (struct cmap_conn_info *)api->ipc_private_data_get (conn);
@@ -567,17 +594,18 @@ static void message_handler_req_lib_cmap_iter_init(void *conn, const void *messa
 		goto reply_send;
 	}
 
-	ret = hdb_error_to_cs(hdb_handle_create(&conn_info->iter_db, sizeof(iter), &handle));
+	ret = hdb_error_to_cs(hdb_handle_create(&conn_info->iter_db, sizeof(*iter_info), &handle));
 	if (ret != CS_OK) {
 		goto reply_send;
 	}
 
-	ret = hdb_error_to_cs(hdb_handle_get(&conn_info->iter_db, handle, (void *)&hdb_iter));
+	ret = hdb_error_to_cs(hdb_handle_get(&conn_info->iter_db, handle, (void *)&iter_info));
 	if (ret != CS_OK) {
 		goto reply_send;
 	}
 
-	*hdb_iter = iter;
+	iter_info->iter = iter;
+	iter_info->pending = 0;
 
 	(void)hdb_handle_put (&conn_info->iter_db, handle);
 
@@ -591,24 +619,45 @@ reply_send:
 	api->ipc_response_send(conn, &res_lib_cmap_iter_init, sizeof(res_lib_cmap_iter_init));
 }
 
+/*
+ * Next key of iteration. Key put back by iter_next_page is returned first,
+ * unless it was deleted meanwhile.
+ */
+static const char *cmap_iter_info_next(
+	struct cmap_iter_info *iter_info,
+	size_t *value_len,
+	icmap_value_types_t *type)
+{
+
+	if (iter_info->pending) {
+		iter_info->pending = 0;
+
+		if (icmap_get(iter_info->pending_key, NULL, value_len, type) == CS_OK) {
+			return (iter_info->pending_key);
+		}
+	}
+
+	return (icmap_iter_next(iter_info->iter, value_len, type));
+}
+
 static void message_handler_req_lib_cmap_iter_next(void *conn, const void *message)
 {
 	const struct req_lib_cmap_iter_next *req_lib_cmap_iter_next = message;
 	struct res_lib_cmap_iter_next res_lib_cmap_iter_next;
 	cs_error_t ret;
-	icmap_iter_t *iter;
+	struct cmap_iter_info *iter_info;
 	size_t value_len = 0;
 	icmap_value_types_t type = 0;
 	const char *res = NULL;
 	struct cmap_conn_info *conn_info = (struct cmap_conn_info *)api->ipc_private_data_get (conn);
 
 	ret = hdb_error_to_cs(hdb_handle_get(&conn_info->iter_db,
-				req_lib_cmap_iter_next->iter_handle, (void *)&iter));
+				req_lib_cmap_iter_next->iter_handle, (void *)&iter_info));
 	if (ret != CS_OK) {
 		goto reply_send;
 	}
 
-	res = icmap_iter_next(*iter, &value_len, &type);
+	res = cmap_iter_info_next(iter_info, &value_len, &type);
 	if (res == NULL) {
 		ret = CS_ERR_NO_SECTIONS;
 	}
@@ -637,16 +686,16 @@ static void message_handler_req_lib_cmap_iter_finalize(void *conn, const void *m
 	const struct req_lib_cmap_iter_finalize *req_lib_cmap_iter_finalize = message;
 	struct res_lib_cmap_iter_finalize res_lib_cmap_iter_finalize;
 	cs_error_t ret;
-	icmap_iter_t *iter;
+	struct cmap_iter_info *iter_info;
 	struct cmap_conn_info *conn_info = (struct cmap_conn_info *)api->ipc_private_data_get (conn);
 
 	ret = hdb_error_to_cs(hdb_handle_get(&conn_info->iter_db,
-				req_lib_cmap_iter_finalize->iter_handle, (void *)&iter));
+				req_lib_cmap_iter_finalize->iter_handle, (void *)&iter_info));
 	if (ret != CS_OK) {
 		goto reply_send;
 	}
 
-	icmap_iter_finalize(*iter);
+	icmap_iter_finalize(iter_info->iter);
 
 	(void)hdb_handle_destroy(&conn_info->iter_db, req_lib_cmap_iter_finalize->iter_handle);
 
@@ -661,6 +710,295 @@ reply_send:
 	api->ipc_response_send(conn, &res_lib_cmap_iter_finalize, sizeof(res_lib_cmap_iter_finalize));
 }
 
+static void cmap_multi_key_name_get(char *key_name, const mar_name_t *name)
+{
+	size_t len = name->length;
+
+	if (len >= CS_MAX_NAME_LENGTH) {
+		len = CS_MAX_NAME_LENGTH - 1;
+	}
+
+	memcpy(key_name, name->value, len);
+	key_name[len] = '\0';
+}
+
+/*
+ * Fill item with key and its value. Space is number of bytes available for
+ * whole item. If value doesn't fit, item is filled without value and error
+ * is set to CS_ERR_NO_SPACE. Returns size of item.
+ */
+static size_t cmap_multi_item_fill(
+	struct cmap_multi_item *item,
+	const char *key_name,
+	size_t space)
+{
+	size_t value_len;
+	icmap_value_types_t type;
+	cs_error_t ret;
+
+	memset(item, 0, sizeof(*item));
+	item->key_name.length = strlen(key_name);
+	memcpy(item->key_name.value, key_name, item->key_name.length);
+
+	ret = icmap_get(key_name, NULL, &value_len, &type);
+	if (ret == CS_OK && CMAP_MULTI_ITEM_SIZE(value_len) > space) {
+		ret = CS_ERR_NO_SPACE;
+	}
+
+	if (ret == CS_OK) {
+		ret = icmap_get(key_name, item->value, &value_len, &type);
+	}
+
+	item->error = ret;
+	if (ret == CS_OK || ret == CS_ERR_NO_SPACE) {
+		item->type = type;
+		item->value_len = value_len;
+	}
+
+	return (ret == CS_OK ? CMAP_MULTI_ITEM_SIZE(value_len) : sizeof(*item));
+}
+
+static void message_handler_req_lib_cmap_get_multi(void *conn, const void *message)
+{
+	const struct req_lib_cmap_get_multi *req_lib_cmap_get_multi = message;
+	struct res_lib_cmap_get_multi *res_lib_cmap_get_multi;
+	struct res_lib_cmap_get_multi error_res_lib_cmap_get_multi;
+	struct cmap_multi_item *item;
+	char key_name[CS_MAX_NAME_LENGTH];
+	char *res_buf;
+	size_t res_size;
+	uint32_t i;
+	cs_error_t ret;
+
+	if (req_lib_cmap_get_multi->header.size < sizeof(*req_lib_cmap_get_multi) ||
+	    req_lib_cmap_get_multi->no_items > (req_lib_cmap_get_multi->header.size -
+	    sizeof(*req_lib_cmap_get_multi)) / sizeof(mar_name_t)) {
+		ret = CS_ERR_INVALID_PARAM;
+		goto error_exit;
+	}
+
+	res_buf = calloc(1, CMAP_MULTI_MSG_MAX_SIZE);
+	if (res_buf == NULL) {
+		ret = CS_ERR_NO_MEMORY;
+		goto error_exit;
+	}
+
+	res_size = sizeof(*res_lib_cmap_get_multi);
+	for (i = 0; i < req_lib_cmap_get_multi->no_items; i++) {
+		if (CMAP_MULTI_MSG_MAX_SIZE - res_size < sizeof(*item)) {
+			break;
+		}
+
+		cmap_multi_key_name_get(key_name, &req_lib_cmap_get_multi->key_names[i]);
+		item = (struct cmap_multi_item *)(res_buf + res_size);
+
+		res_size += cmap_multi_item_fill(item, key_name, CMAP_MULTI_MSG_MAX_SIZE - res_size);
+		if (item->error == CS_ERR_NO_SPACE && i > 0) {
+			/*
+			 * Library asks again for rest of keys
+			 */
+			res_size -= sizeof(*item);
+			break;
+		}
+	}
+
+	res_lib_cmap_get_multi = (struct res_lib_cmap_get_multi *)res_buf;
+	res_lib_cmap_get_multi->header.size = res_size;
+	res_lib_cmap_get_multi->header.id = MESSAGE_RES_CMAP_GET_MULTI;
+	res_lib_cmap_get_multi->header.error = CS_OK;
+	res_lib_cmap_get_multi->no_items = i;
+
+	api->ipc_response_send(conn, res_buf, res_size);
+	free(res_buf);
+
+	return ;
+
+error_exit:
+	memset(&error_res_lib_cmap_get_multi, 0, sizeof(error_res_lib_cmap_get_multi));
+	error_res_lib_cmap_get_multi.header.size = sizeof(error_res_lib_cmap_get_multi);
+	error_res_lib_cmap_get_multi.header.id = MESSAGE_RES_CMAP_GET_MULTI;
+	error_res_lib_cmap_get_multi.header.error = ret;
+
+	api->ipc_response_send(conn, &error_res_lib_cmap_get_multi, sizeof(error_res_lib_cmap_get_multi));
+}
+
+static void message_handler_req_lib_cmap_set_multi(void *conn, const void *message)
+{
+	const struct req_lib_cmap_set_multi *req_lib_cmap_set_multi = message;
+	struct res_lib_cmap_set_multi *res_lib_cmap_set_multi;
+	struct res_lib_cmap_set_multi error_res_lib_cmap_set_multi;
+	const struct cmap_multi_item *item;
+	char key_name[CS_MAX_NAME_LENGTH];
+	size_t msg_size = req_lib_cmap_set_multi->header.size;
+	size_t res_size;
+	size_t pos;
+	uint32_t i;
+	cs_error_t ret;
+
+	if (msg_size < sizeof(*req_lib_cmap_set_multi) ||
+	    req_lib_cmap_set_multi->no_items > (msg_size - sizeof(*req_lib_cmap_set_multi)) /
+	    sizeof(struct cmap_multi_item)) {
+		ret = CS_ERR_INVALID_PARAM;
+		goto error_exit;
+	}
+
+	res_size = sizeof(*res_lib_cmap_set_multi) +
+	    req_lib_cmap_set_multi->no_items * sizeof(mar_uint32_t);
+	res_lib_cmap_set_multi = malloc(res_size);
+	if (res_lib_cmap_set_multi == NULL) {
+		ret = CS_ERR_NO_MEMORY;
+		goto error_exit;
+	}
+
+	memset(res_lib_cmap_set_multi, 0, res_size);
+
+	pos = sizeof(*req_lib_cmap_set_multi);
+	for (i = 0; i < req_lib_cmap_set_multi->no_items; i++) {
+		item = (const struct cmap_multi_item *)((const char *)message + pos);
+
+		if (msg_size - pos < sizeof(*item) ||
+		    item->value_len > msg_size - pos - sizeof(*item)) {
+			/*
+			 * Truncated message. Rest of items is invalid too.
+			 */
+			res_lib_cmap_set_multi->errors[i] = CS_ERR_INVALID_PARAM;
+			continue;
+		}
+
+		cmap_multi_key_name_get(key_name, &item->key_name);
+
+		if (icmap_is_key_ro(key_name)) {
+			ret = CS_ERR_ACCESS;
+		} else {
+			ret = icmap_set(key_name, item->value, item->value_len, item->type);
+		}
+		res_lib_cmap_set_multi->errors[i] = ret;
+
+		pos += CMAP_MULTI_ITEM_SIZE(item->value_len);
+		if (pos > msg_size) {
+			pos = msg_size;
+		}
+	}
+
+	res_lib_cmap_set_multi->header.size = res_size;
+	res_lib_cmap_set_multi->header.id = MESSAGE_RES_CMAP_SET_MULTI;
+	res_lib_cmap_set_multi->header.error = CS_OK;
+	res_lib_cmap_set_multi->no_items = req_lib_cmap_set_multi->no_items;
+
+	api->ipc_response_send(conn, res_lib_cmap_set_multi, res_size);
+	free(res_lib_cmap_set_multi);
+
+	return ;
+
+error_exit:
+	memset(&error_res_lib_cmap_set_multi, 0, sizeof(error_res_lib_cmap_set_multi));
+	error_res_lib_cmap_set_multi.header.size = sizeof(error_res_lib_cmap_set_multi);
+	error_res_lib_cmap_set_multi.header.id = MESSAGE_RES_CMAP_SET_MULTI;
+	error_res_lib_cmap_set_multi.header.error = ret;
+
+	api->ipc_response_send(conn, &error_res_lib_cmap_set_multi, sizeof(error_res_lib_cmap_set_multi));
+}
+
+static void message_handler_req_lib_cmap_iter_next_page(void *conn, const void *message)
+{
+	const struct req_lib_cmap_iter_next_page *req_lib_cmap_iter_next_page = message;
+	struct res_lib_cmap_iter_next_page *res_lib_cmap_iter_next_page;
+	struct res_lib_cmap_iter_next_page error_res_lib_cmap_iter_next_page;
+	struct cmap_iter_info *iter_info;
+	struct cmap_multi_item *item;
+	struct cmap_conn_info *conn_info = (struct cmap_conn_info *)api->ipc_private_data_get (conn);
+	const char *key_name;
+	char *res_buf;
+	size_t res_size;
+	size_t space;
+	size_t item_size;
+	size_t values_used;
+	size_t value_len;
+	icmap_value_types_t type;
+	uint32_t no_items;
+	cs_error_t ret;
+
+	res_buf = calloc(1, CMAP_MULTI_MSG_MAX_SIZE);
+	if (res_buf == NULL) {
+		ret = CS_ERR_NO_MEMORY;
+		goto error_exit;
+	}
+
+	ret = hdb_error_to_cs(hdb_handle_get(&conn_info->iter_db,
+				req_lib_cmap_iter_next_page->iter_handle, (void *)&iter_info));
+	if (ret != CS_OK) {
+		free(res_buf);
+		goto error_exit;
+	}
+
+	res_size = sizeof(*res_lib_cmap_iter_next_page);
+	values_used = 0;
+	no_items = 0;
+
+	while (no_items < req_lib_cmap_iter_next_page->max_items &&
+	    CMAP_MULTI_MSG_MAX_SIZE - res_size >= sizeof(*item)) {
+		key_name = cmap_iter_info_next(iter_info, &value_len, &type);
+		if (key_name == NULL) {
+			break;
+		}
+
+		/*
+		 * Value must fit into both response and library buffer
+		 */
+		space = CMAP_MULTI_MSG_MAX_SIZE - res_size;
+		if (req_lib_cmap_iter_next_page->values_size - values_used < space - sizeof(*item)) {
+			space = sizeof(*item) + req_lib_cmap_iter_next_page->values_size - values_used;
+		}
+
+		item = (struct cmap_multi_item *)(res_buf + res_size);
+		item_size = cmap_multi_item_fill(item, key_name, space);
+
+		if (item->error == CS_ERR_NOT_EXIST) {
+			/*
+			 * Deleted since icmap_iter_next
+			 */
+			continue;
+		}
+
+		if (item->error == CS_ERR_NO_SPACE && no_items > 0) {
+			if (key_name != iter_info->pending_key) {
+				memcpy(iter_info->pending_key, key_name, strlen(key_name) + 1);
+			}
+			iter_info->pending = 1;
+			memset(item, 0, sizeof(*item));
+			break;
+		}
+
+		if (item->error == CS_OK) {
+			values_used += item_size - sizeof(*item);
+		}
+		res_size += item_size;
+		no_items++;
+	}
+
+	(void)hdb_handle_put (&conn_info->iter_db, req_lib_cmap_iter_next_page->iter_handle);
+
+	res_lib_cmap_iter_next_page = (struct res_lib_cmap_iter_next_page *)res_buf;
+	res_lib_cmap_iter_next_page->header.size = res_size;
+	res_lib_cmap_iter_next_page->header.id = MESSAGE_RES_CMAP_ITER_NEXT_PAGE;
+	res_lib_cmap_iter_next_page->header.error = (no_items > 0 ? CS_OK : CS_ERR_NO_SECTIONS);
+	res_lib_cmap_iter_next_page->no_items = no_items;
+
+	api->ipc_response_send(conn, res_buf, res_size);
+	free(res_buf);
+
+	return ;
+
+error_exit:
+	memset(&error_res_lib_cmap_iter_next_page, 0, sizeof(error_res_lib_cmap_iter_next_page));
+	error_res_lib_cmap_iter_next_page.header.size = sizeof(error_res_lib_cmap_iter_next_page);
+	error_res_lib_cmap_iter_next_page.header.id = MESSAGE_RES_CMAP_ITER_NEXT_PAGE;
+	error_res_lib_cmap_iter_next_page.header.error = ret;
+
+	api->ipc_response_send(conn, &error_res_lib_cmap_iter_next_page,
+	    sizeof(error_res_lib_cmap_iter_next_page));
+}
+
 static void cmap_notify_fn(int32_t event,
 		const char *key_name,
 		struct icmap_notify_value new_val,
@@ -697,6 +1035,83 @@ static void cmap_notify_fn(int32_t event,
 	api->ipc_dispatch_iov_send(cmap_track_user_data->conn, iov, 3);
 }
 
+static void cmap_notify_batch_send(struct cmap_track_user_data *cmap_track_user_data,
+		char *buf, size_t size, uint32_t no_items)
+{
+	struct res_lib_cmap_notify_batch_callback *res;
+
+	res = (struct res_lib_cmap_notify_batch_callback *)buf;
+	res->header.size = size;
+	res->header.id = MESSAGE_RES_CMAP_NOTIFY_BATCH_CALLBACK;
+	res->header.error = CS_OK;
+	res->track_inst_handle = cmap_track_user_data->track_inst_handle;
+	res->no_items = no_items;
+
+	api->ipc_dispatch_send(cmap_track_user_data->conn, buf, size);
+}
+
+static void cmap_notify_batch_fn(const struct icmap_notify_batch_entry *entries,
+		size_t no_entries,
+		void *user_data)
+{
+	struct cmap_track_user_data *cmap_track_user_data = (struct cmap_track_user_data *)user_data;
+	struct cmap_notify_batch_item *item;
+	char *buf;
+	size_t size;
+	size_t item_size;
+	uint32_t no_items;
+	size_t i;
+
+	buf = malloc(CMAP_MULTI_MSG_MAX_SIZE);
+	if (buf == NULL) {
+		log_printf(LOGSYS_LEVEL_ERROR, "Can't alloc memory for batch notification");
+		return ;
+	}
+
+	memset(buf, 0, sizeof(struct res_lib_cmap_notify_batch_callback));
+	size = sizeof(struct res_lib_cmap_notify_batch_callback);
+	no_items = 0;
+
+	for (i = 0; i < no_entries; i++) {
+		item_size = CMAP_NOTIFY_BATCH_ITEM_SIZE(entries[i].new_value.len, entries[i].old_value.len);
+
+		if (CMAP_MULTI_MSG_MAX_SIZE - size < item_size && no_items > 0) {
+			cmap_notify_batch_send(cmap_track_user_data, buf, size, no_items);
+
+			memset(buf, 0, sizeof(struct res_lib_cmap_notify_batch_callback));
+			size = sizeof(struct res_lib_cmap_notify_batch_callback);
+			no_items = 0;
+		}
+
+		item = (struct cmap_notify_batch_item *)(buf + size);
+		memset(item, 0, item_size);
+
+		item->key_name.length = strlen(entries[i].key_name);
+		memcpy(item->key_name.value, entries[i].key_name, item->key_name.length);
+		item->event = entries[i].event;
+		item->new_value_type = entries[i].new_value.type;
+		item->old_value_type = entries[i].old_value.type;
+		item->new_value_len = entries[i].new_value.len;
+		item->old_value_len = entries[i].old_value.len;
+		if (entries[i].new_value.len > 0) {
+			memcpy(item->new_value, entries[i].new_value.data, entries[i].new_value.len);
+		}
+		if (entries[i].old_value.len > 0) {
+			memcpy(item->new_value + entries[i].new_value.len, entries[i].old_value.data,
+			    entries[i].old_value.len);
+		}
+
+		size += item_size;
+		no_items++;
+	}
+
+	if (no_items > 0) {
+		cmap_notify_batch_send(cmap_track_user_data, buf, size, no_items);
+	}
+
+	free(buf);
+}
+
 static void message_handler_req_lib_cmap_track_add(void *conn, const void *message)
 {
 	const struct req_lib_cmap_track_add *req_lib_cmap_track_add = message;
@@ -724,11 +1139,19 @@ static void message_handler_req_lib_cmap_track_add(void *conn, const void *messa
 		key_name = NULL;
 	}
 
-	ret = icmap_track_add(key_name,
-			req_lib_cmap_track_add->track_type,
-			cmap_notify_fn,
-			cmap_track_user_data,
-			&track);
+	if (req_lib_cmap_track_add->track_type & CMAP_TRACK_BATCH) {
+		ret = icmap_track_add_batch(key_name,
+				req_lib_cmap_track_add->track_type & ~CMAP_TRACK_BATCH,
+				cmap_notify_batch_fn,
+				cmap_track_user_data,
+				&track);
+	} else {
+		ret = icmap_track_add(key_name,
+				req_lib_cmap_track_add->track_type,
+				cmap_notify_fn,
+				cmap_track_user_data,
+				&track);
+	}
 	if (ret != CS_OK) {
 		free(cmap_track_user_data);
 
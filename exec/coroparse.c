@@ -51,6 +51,7 @@
 #include <dirent.h>
 #include <limits.h>
 #include <stddef.h>
+#include <inttypes.h>
 #include <grp.h>
 #include <pwd.h>
 
@@ -126,7 +127,12 @@ struct main_cp_cb_data {
 
 static int read_config_file_into_icmap(
 	const char **error_string, icmap_map_t config_map);
+static const char *coroparse_config_filename(void);
 static char error_string_response[512];
+/*
+ * Set when parser resolved user or group name, so result depends on NSS
+ */
+static int coroparse_names_resolved;
 
 static int uid_determine (const char *req_user)
 {
@@ -143,6 +149,7 @@ static int uid_determine (const char *req_user)
 	if (*ep == '\0' && id >= 0 && id <= UINT_MAX) {
 		return (id);
 	}
+	coroparse_names_resolved = 1;
 
 	pwdlinelen = sysconf (_SC_GETPW_R_SIZE_MAX);
 
@@ -197,6 +204,7 @@ static int gid_determine (const char *req_group)
 	if (*ep == '\0' && id >= 0 && id <= UINT_MAX) {
 		return (id);
 	}
+	coroparse_names_resolved = 1;
 
 	grplinelen = sysconf (_SC_GETGR_R_SIZE_MAX);
 
@@ -248,15 +256,6 @@ static char *strchr_rs (const char *haystack, int byte)
 	return ((char *) end_address);
 }
 
-int coroparse_configparse (icmap_map_t config_map, const char **error_string)
-{
-	if (read_config_file_into_icmap(error_string, config_map)) {
-		return -1;
-	}
-
-	return 0;
-}
-
 static char *remove_whitespace(char *string, int remove_colon_and_brace)
 {
 	char *start;
@@ -609,6 +608,7 @@ static int main_config_parser_cb(const char *path,
 			    (strcmp(path, "totem.max_network_delay") == 0) ||
 			    (strcmp(path, "totem.window_size") == 0) ||
 			    (strcmp(path, "totem.max_messages") == 0) ||
+			    (strcmp(path, "totem.schedwrk_budget") == 0) ||
 			    (strcmp(path, "totem.miss_count_const") == 0) ||
 			    (strcmp(path, "totem.netmtu") == 0)) {
 				val_type = ICMAP_VALUETYPE_UINT32;
@@ -679,6 +679,15 @@ static int main_config_parser_cb(const char *path,
 					return (0);
 				}
 			}
+			if ((strcmp(path, "qb.ipc_threads") == 0) ||
+			    (strncmp(path, "qb.ipc_weight.", strlen("qb.ipc_weight.")) == 0)) {
+				val_type = ICMAP_VALUETYPE_UINT32;
+				if (safe_atoq(value, &val, val_type) != 0) {
+					goto atoi_error;
+				}
+				icmap_set_uint32_r(config_map, path, val);
+				add_as_string = 0;
+			}
 			break;
 
 		case MAIN_CP_CB_DATA_STATE_INTERFACE:
@@ -1307,9 +1316,8 @@ static int read_config_file_into_icmap(
 	struct main_cp_cb_data data;
 	enum main_cp_cb_data_state state = MAIN_CP_CB_DATA_STATE_NORMAL;
 
-	filename = getenv ("COROSYNC_MAIN_CONFIG_FILE");
-	if (!filename)
-		filename = COROSYSCONFDIR "/corosync.conf";
+	coroparse_names_resolved = 0;
+	filename = coroparse_config_filename();
 
 	fp = fopen (filename, "r");
 	if (fp == NULL) {
@@ -1340,3 +1348,1009 @@ static int read_config_file_into_icmap(
 
 	return res;
 }
+
+/*
+ * Binary cache of parsed configuration.
+ *
+ * After successful parse, content of resulting map is stored together with list of
+ * source files (main config file, NSS files used to resolve user and group names,
+ * uidgid.d directory and files in it) with their mtime, size and hash of their
+ * content. When all of them match on next start (or reload), map is loaded directly
+ * from cache and text parser is not run at all. When names were resolved by NSS
+ * service other than files, result can change without any file changing, so cache
+ * is not written.
+ *
+ * All data are in host byte order and every record is aligned to 8 bytes.
+ */
+#define COROPARSE_CACHE_MAGIC		0x43504343
+#define COROPARSE_CACHE_VERSION		2
+#define COROPARSE_CACHE_SUFFIX		".cache"
+#define COROPARSE_CACHE_MAX_SIZE	(64 * 1024 * 1024)
+#define COROPARSE_HASH_INIT		14695981039346656037ULL
+#define COROPARSE_HASH_PRIME		1099511628211ULL
+#define COROPARSE_ALIGN(len)		(((len) + 7) & ~((size_t)7))
+
+struct coroparse_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;
+	/*
+	 * Hash of all data following header
+	 */
+	uint64_t checksum;
+	/*
+	 * Hash of names and content of all source files
+	 */
+	uint64_t source_hash;
+	uint32_t no_sources;
+	uint32_t no_items;
+};
+
+struct coroparse_cache_source {
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	/*
+	 * -1 for non-existing file
+	 */
+	int64_t size;
+	uint32_t name_len;
+	uint32_t is_dir;
+	/*
+	 * Followed by name (including trailing zero)
+	 */
+};
+
+struct coroparse_cache_item {
+	uint32_t key_len;
+	uint32_t type;
+	uint64_t value_len;
+	/*
+	 * Followed by key name (including trailing zero) and value
+	 */
+};
+
+struct coroparse_source {
+	char *name;
+	int is_dir;
+	int exists;
+	struct stat st;
+};
+
+struct coroparse_buf {
+	char *data;
+	size_t len;
+	size_t allocated;
+};
+
+static const char *coroparse_config_filename(void)
+{
+	const char *filename;
+
+	filename = getenv ("COROSYNC_MAIN_CONFIG_FILE");
+	if (!filename)
+		filename = COROSYSCONFDIR "/corosync.conf";
+
+	return (filename);
+}
+
+/*
+ * Returns name of cache file or NULL if cache is disabled (environment variable
+ * COROSYNC_MAIN_CONFIG_CACHE_FILE set to empty string)
+ */
+static const char *coroparse_cache_filename(void)
+{
+	static char cache_filename[PATH_MAX];
+	const char *filename;
+
+	filename = getenv ("COROSYNC_MAIN_CONFIG_CACHE_FILE");
+	if (filename != NULL) {
+		return (filename[0] != '\0' ? filename : NULL);
+	}
+
+	snprintf(cache_filename, sizeof(cache_filename), "%s%s", coroparse_config_filename(),
+	    COROPARSE_CACHE_SUFFIX);
+
+	return (cache_filename);
+}
+
+static uint64_t coroparse_hash(uint64_t hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= COROPARSE_HASH_PRIME;
+	}
+
+	return (hash);
+}
+
+static int coroparse_file_hash(const char *filename, uint64_t *hash)
+{
+	FILE *fp;
+	char buf[4096];
+	size_t len;
+	int res = 0;
+
+	fp = fopen (filename, "r");
+	if (fp == NULL) {
+		return (-1);
+	}
+
+	*hash = coroparse_hash(*hash, filename, strlen(filename) + 1);
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		*hash = coroparse_hash(*hash, buf, len);
+	}
+
+	if (ferror(fp)) {
+		res = -1;
+	}
+
+	fclose(fp);
+
+	return (res);
+}
+
+static int coroparse_source_cmp(const void *a, const void *b)
+{
+	const struct coroparse_source *s1 = a;
+	const struct coroparse_source *s2 = b;
+
+	return (strcmp(s1->name, s2->name));
+}
+
+static void coroparse_sources_free(struct coroparse_source *sources, size_t no_sources)
+{
+	size_t i;
+
+	for (i = 0; i < no_sources; i++) {
+		free(sources[i].name);
+	}
+	free(sources);
+}
+
+static int coroparse_source_add(struct coroparse_source **sources, size_t *no_sources,
+	const char *name, int is_dir)
+{
+	struct coroparse_source *new_sources;
+	struct coroparse_source *source;
+
+	new_sources = realloc(*sources, sizeof(**sources) * (*no_sources + 1));
+	if (new_sources == NULL) {
+		return (-1);
+	}
+	*sources = new_sources;
+
+	source = &(*sources)[*no_sources];
+	memset(source, 0, sizeof(*source));
+
+	source->name = strdup(name);
+	if (source->name == NULL) {
+		return (-1);
+	}
+	source->is_dir = is_dir;
+	source->exists = (stat(name, &source->st) == 0);
+
+	(*no_sources)++;
+
+	return (0);
+}
+
+/*
+ * NSS databases used by uid_determine and gid_determine
+ */
+static const char *coroparse_nss_files[] = {
+	"/etc/nsswitch.conf",
+	"/etc/passwd",
+	"/etc/group",
+};
+
+/*
+ * Returns 1 if passwd and group databases are looked up only in files (also when
+ * nsswitch.conf doesn't exist, which is the libc default)
+ */
+static int coroparse_nss_files_only(void)
+{
+	FILE *fp;
+	char line[1024];
+	char *p;
+	char *token;
+	char *saveptr;
+	int res = 1;
+
+	fp = fopen (coroparse_nss_files[0], "r");
+	if (fp == NULL) {
+		return (errno == ENOENT);
+	}
+
+	while (res && fgets(line, sizeof(line), fp) != NULL) {
+		if ((p = strchr(line, '#')) != NULL) {
+			*p = '\0';
+		}
+
+		p = line + strspn(line, " \t");
+		if (strncmp(p, "passwd:", strlen("passwd:")) == 0) {
+			p += strlen("passwd:");
+		} else if (strncmp(p, "group:", strlen("group:")) == 0) {
+			p += strlen("group:");
+		} else {
+			continue;
+		}
+
+		for (token = strtok_r(p, " \t\n", &saveptr); token != NULL;
+		    token = strtok_r(NULL, " \t\n", &saveptr)) {
+			if (token[0] == '[') {
+				/*
+				 * Action like [NOTFOUND=return]
+				 */
+				continue;
+			}
+			if (strcmp(token, "files") != 0) {
+				res = 0;
+				break;
+			}
+		}
+	}
+
+	fclose(fp);
+
+	return (res);
+}
+
+/*
+ * Get list of files which parsed configuration depends on. Order is main config file,
+ * NSS files, uidgid.d directory and sorted list of regular files in it.
+ */
+static int coroparse_sources_get(struct coroparse_source **sources, size_t *no_sources)
+{
+	const char *dirname;
+	char filename[PATH_MAX + FILENAME_MAX + 1];
+	DIR *dp;
+	struct dirent *dirent;
+	struct stat stat_buf;
+	size_t first_file;
+	size_t i;
+
+	*sources = NULL;
+	*no_sources = 0;
+
+	if (coroparse_source_add(sources, no_sources, coroparse_config_filename(), 0) != 0) {
+		goto error_free;
+	}
+
+	for (i = 0; i < sizeof(coroparse_nss_files) / sizeof(coroparse_nss_files[0]); i++) {
+		if (coroparse_source_add(sources, no_sources, coroparse_nss_files[i], 0) != 0) {
+			goto error_free;
+		}
+	}
+
+	dirname = COROSYSCONFDIR "/uidgid.d";
+	if (coroparse_source_add(sources, no_sources, dirname, 1) != 0) {
+		goto error_free;
+	}
+
+	dp = opendir (dirname);
+	if (dp == NULL) {
+		return (0);
+	}
+
+	first_file = *no_sources;
+	while ((dirent = readdir(dp)) != NULL) {
+		snprintf(filename, sizeof (filename), "%s/%s", dirname, dirent->d_name);
+		if (stat (filename, &stat_buf) != 0 || !S_ISREG(stat_buf.st_mode)) {
+			continue;
+		}
+
+		if (coroparse_source_add(sources, no_sources, filename, 0) != 0) {
+			closedir(dp);
+			goto error_free;
+		}
+	}
+	closedir(dp);
+
+	qsort(*sources + first_file, *no_sources - first_file, sizeof(**sources), coroparse_source_cmp);
+
+	return (0);
+
+error_free:
+	coroparse_sources_free(*sources, *no_sources);
+	*sources = NULL;
+	*no_sources = 0;
+
+	return (-1);
+}
+
+static int coroparse_sources_hash(const struct coroparse_source *sources, size_t no_sources,
+	uint64_t *hash)
+{
+	size_t i;
+
+	*hash = COROPARSE_HASH_INIT;
+
+	for (i = 0; i < no_sources; i++) {
+		if (sources[i].is_dir || !sources[i].exists) {
+			continue;
+		}
+
+		if (coroparse_file_hash(sources[i].name, hash) != 0) {
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Get list of source files together with hash of their content. Snapshot is taken
+ * before parsing and compared with current state (coroparse_sources_changed) before
+ * cache is written, so cache is never stored for files changed during parsing.
+ */
+static int coroparse_sources_snapshot(struct coroparse_source **sources, size_t *no_sources,
+	uint64_t *hash, const char **error_string)
+{
+
+	if (coroparse_sources_get(sources, no_sources) != 0) {
+		*error_string = "Can't get list of configuration files";
+		return (-1);
+	}
+
+	if (coroparse_sources_hash(*sources, *no_sources, hash) != 0) {
+		*error_string = "Can't read configuration files";
+		coroparse_sources_free(*sources, *no_sources);
+		*sources = NULL;
+		*no_sources = 0;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Returns 1 if any source file was added, removed or changed (mtime, size or content)
+ * since snapshot was taken
+ */
+static int coroparse_sources_changed(const struct coroparse_source *sources, size_t no_sources,
+	uint64_t hash)
+{
+	struct coroparse_source *cur_sources;
+	size_t cur_no_sources;
+	uint64_t cur_hash;
+	const char *error_string;
+	size_t i;
+	int res = 1;
+
+	if (coroparse_sources_snapshot(&cur_sources, &cur_no_sources, &cur_hash,
+	    &error_string) != 0) {
+		return (1);
+	}
+
+	if (cur_no_sources != no_sources || cur_hash != hash) {
+		goto exit_free;
+	}
+
+	for (i = 0; i < no_sources; i++) {
+		if (strcmp(cur_sources[i].name, sources[i].name) != 0 ||
+		    cur_sources[i].is_dir != sources[i].is_dir ||
+		    cur_sources[i].exists != sources[i].exists) {
+			goto exit_free;
+		}
+
+		if (sources[i].exists &&
+		    (cur_sources[i].st.st_size != sources[i].st.st_size ||
+		    cur_sources[i].st.st_mtim.tv_sec != sources[i].st.st_mtim.tv_sec ||
+		    cur_sources[i].st.st_mtim.tv_nsec != sources[i].st.st_mtim.tv_nsec)) {
+			goto exit_free;
+		}
+	}
+
+	res = 0;
+
+exit_free:
+	coroparse_sources_free(cur_sources, cur_no_sources);
+
+	return (res);
+}
+
+static int coroparse_buf_append(struct coroparse_buf *buf, const void *data, size_t len)
+{
+	char *new_data;
+	size_t new_size;
+
+	if (buf->len + COROPARSE_ALIGN(len) > buf->allocated) {
+		new_size = (buf->allocated > 0 ? buf->allocated * 2 : 64 * 1024);
+		while (buf->len + COROPARSE_ALIGN(len) > new_size) {
+			new_size *= 2;
+		}
+
+		new_data = realloc(buf->data, new_size);
+		if (new_data == NULL) {
+			return (-1);
+		}
+		buf->data = new_data;
+		buf->allocated = new_size;
+	}
+
+	memset(buf->data + buf->len, 0, COROPARSE_ALIGN(len));
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += COROPARSE_ALIGN(len);
+
+	return (0);
+}
+
+/*
+ * Write config_map parsed from sources (snapshot taken by coroparse_sources_snapshot
+ * before parsing) to cache. Nothing is written when sources changed since snapshot.
+ */
+static int coroparse_cache_write(const char *cache_filename, icmap_map_t config_map,
+	const struct coroparse_source *sources, size_t no_sources, uint64_t source_hash,
+	const char **error_string)
+{
+	struct coroparse_buf buf;
+	struct coroparse_cache_header header;
+	struct coroparse_cache_source cache_source;
+	struct coroparse_cache_item cache_item;
+	icmap_iter_t iter;
+	const char *key_name;
+	size_t value_len;
+	icmap_value_types_t type;
+	char *value = NULL;
+	char *new_value;
+	size_t value_allocated = 0;
+	char tmp_filename[PATH_MAX];
+	size_t i;
+	int fd;
+	int res = -1;
+
+	memset(&buf, 0, sizeof(buf));
+	memset(&header, 0, sizeof(header));
+
+	if (coroparse_names_resolved && !coroparse_nss_files_only()) {
+		/*
+		 * Don't leave behind cache which may have been valid before
+		 */
+		(void)unlink(cache_filename);
+		*error_string = "User or group names are resolved by NSS service other than files";
+		return (-1);
+	}
+
+	header.source_hash = source_hash;
+
+	if (coroparse_buf_append(&buf, &header, sizeof(header)) != 0) {
+		goto no_memory;
+	}
+
+	for (i = 0; i < no_sources; i++) {
+		memset(&cache_source, 0, sizeof(cache_source));
+
+		if (sources[i].exists) {
+			cache_source.mtime_sec = sources[i].st.st_mtim.tv_sec;
+			cache_source.mtime_nsec = sources[i].st.st_mtim.tv_nsec;
+			cache_source.size = sources[i].st.st_size;
+		} else {
+			cache_source.size = -1;
+		}
+		cache_source.name_len = strlen(sources[i].name) + 1;
+		cache_source.is_dir = sources[i].is_dir;
+
+		if (coroparse_buf_append(&buf, &cache_source, sizeof(cache_source)) != 0 ||
+		    coroparse_buf_append(&buf, sources[i].name, cache_source.name_len) != 0) {
+			goto no_memory;
+		}
+		header.no_sources++;
+	}
+
+	iter = icmap_iter_init_r(config_map, NULL);
+	while ((key_name = icmap_iter_next(iter, &value_len, &type)) != NULL) {
+		if (value_len > value_allocated) {
+			new_value = realloc(value, value_len);
+			if (new_value == NULL) {
+				icmap_iter_finalize(iter);
+				goto no_memory;
+			}
+			value = new_value;
+			value_allocated = value_len;
+		}
+
+		if (icmap_get_r(config_map, key_name, value, &value_len, &type) != CS_OK) {
+			continue;
+		}
+
+		memset(&cache_item, 0, sizeof(cache_item));
+		cache_item.key_len = strlen(key_name) + 1;
+		cache_item.type = type;
+		cache_item.value_len = value_len;
+
+		if (coroparse_buf_append(&buf, &cache_item, sizeof(cache_item)) != 0 ||
+		    coroparse_buf_append(&buf, key_name, cache_item.key_len) != 0 ||
+		    coroparse_buf_append(&buf, value, value_len) != 0) {
+			icmap_iter_finalize(iter);
+			goto no_memory;
+		}
+		header.no_items++;
+	}
+	icmap_iter_finalize(iter);
+
+	header.magic = COROPARSE_CACHE_MAGIC;
+	header.version = COROPARSE_CACHE_VERSION;
+	header.size = buf.len;
+	header.checksum = coroparse_hash(COROPARSE_HASH_INIT, buf.data + sizeof(header),
+	    buf.len - sizeof(header));
+	memcpy(buf.data, &header, sizeof(header));
+
+	if (coroparse_sources_changed(sources, no_sources, source_hash)) {
+		*error_string = "Configuration files changed during parsing";
+		goto free_buf;
+	}
+
+	/*
+	 * Write to temporary file and rename, so reader never sees partial cache
+	 */
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s.XXXXXX", cache_filename);
+	fd = mkstemp(tmp_filename);
+	if (fd == -1) {
+		snprintf (error_string_response, sizeof(error_string_response),
+		    "Can't create configuration cache %s: %s", tmp_filename, strerror(errno));
+		*error_string = error_string_response;
+		goto free_buf;
+	}
+
+	if (write(fd, buf.data, buf.len) != (ssize_t)buf.len || fsync(fd) != 0) {
+		snprintf (error_string_response, sizeof(error_string_response),
+		    "Can't write configuration cache %s: %s", tmp_filename, strerror(errno));
+		*error_string = error_string_response;
+		close(fd);
+		unlink(tmp_filename);
+		goto free_buf;
+	}
+	close(fd);
+
+	if (rename(tmp_filename, cache_filename) != 0) {
+		snprintf (error_string_response, sizeof(error_string_response),
+		    "Can't rename configuration cache to %s: %s", cache_filename, strerror(errno));
+		*error_string = error_string_response;
+		unlink(tmp_filename);
+		goto free_buf;
+	}
+
+	res = 0;
+	goto free_buf;
+
+no_memory:
+	*error_string = "Can't alloc memory for configuration cache";
+free_buf:
+	free(value);
+	free(buf.data);
+
+	return (res);
+}
+
+/*
+ * Read whole cache file and check its integrity. Returned buffer must be freed by caller.
+ */
+static int coroparse_cache_read(const char *cache_filename, char **data, size_t *data_len,
+	const char **error_string)
+{
+	struct coroparse_cache_header *header;
+	struct stat stat_buf;
+	char *buf;
+	int fd;
+
+	fd = open(cache_filename, O_RDONLY);
+	if (fd == -1) {
+		snprintf (error_string_response, sizeof(error_string_response),
+		    "Can't open configuration cache %s: %s", cache_filename, strerror(errno));
+		*error_string = error_string_response;
+		return (-1);
+	}
+
+	if (fstat(fd, &stat_buf) != 0 || stat_buf.st_size < sizeof(*header) ||
+	    stat_buf.st_size > COROPARSE_CACHE_MAX_SIZE) {
+		*error_string = "Configuration cache has invalid size";
+		close(fd);
+		return (-1);
+	}
+
+	buf = malloc(stat_buf.st_size);
+	if (buf == NULL) {
+		*error_string = "Can't alloc memory for configuration cache";
+		close(fd);
+		return (-1);
+	}
+
+	if (read(fd, buf, stat_buf.st_size) != stat_buf.st_size) {
+		*error_string = "Can't read configuration cache";
+		free(buf);
+		close(fd);
+		return (-1);
+	}
+	close(fd);
+
+	header = (struct coroparse_cache_header *)buf;
+	if (header->magic != COROPARSE_CACHE_MAGIC || header->version != COROPARSE_CACHE_VERSION ||
+	    header->size != stat_buf.st_size ||
+	    header->checksum != coroparse_hash(COROPARSE_HASH_INIT, buf + sizeof(*header),
+	    stat_buf.st_size - sizeof(*header))) {
+		*error_string = "Configuration cache is corrupted or has unsupported version";
+		free(buf);
+		return (-1);
+	}
+
+	*data = buf;
+	*data_len = stat_buf.st_size;
+
+	return (0);
+}
+
+/*
+ * Return pointer to record of given size at *pos and move pos after record (and data_len
+ * following bytes of data). Returns NULL when record doesn't fit into buffer.
+ */
+static const void *coroparse_cache_record(const char *data, size_t data_len, size_t *pos,
+	size_t record_len)
+{
+	const void *record;
+
+	if (record_len > data_len || *pos > data_len - record_len) {
+		return (NULL);
+	}
+
+	record = data + *pos;
+	*pos += COROPARSE_ALIGN(record_len);
+
+	return (record);
+}
+
+/*
+ * Load items from cache into config_map. Cache is used only if all source files still
+ * have same mtime, size and content.
+ */
+static int coroparse_cache_load(const char *cache_filename, icmap_map_t config_map,
+	const char **error_string)
+{
+	const struct coroparse_cache_header *header;
+	const struct coroparse_cache_source *cache_source;
+	const struct coroparse_cache_item *cache_item;
+	const char *name;
+	const char *value;
+	struct coroparse_source *sources;
+	size_t no_sources;
+	uint64_t source_hash;
+	char *data;
+	size_t data_len;
+	size_t pos;
+	uint32_t i;
+	int res = -1;
+
+	if (coroparse_cache_read(cache_filename, &data, &data_len, error_string) != 0) {
+		return (-1);
+	}
+	header = (const struct coroparse_cache_header *)data;
+
+	if (coroparse_sources_get(&sources, &no_sources) != 0) {
+		*error_string = "Can't get list of configuration files";
+		free(data);
+		return (-1);
+	}
+
+	*error_string = "Configuration files changed";
+
+	if (header->no_sources != no_sources) {
+		goto exit_free;
+	}
+
+	pos = COROPARSE_ALIGN(sizeof(*header));
+	for (i = 0; i < header->no_sources; i++) {
+		cache_source = coroparse_cache_record(data, data_len, &pos, sizeof(*cache_source));
+		if (cache_source == NULL) {
+			goto exit_corrupted;
+		}
+		name = coroparse_cache_record(data, data_len, &pos, cache_source->name_len);
+		if (name == NULL || cache_source->name_len == 0 || name[cache_source->name_len - 1] != '\0') {
+			goto exit_corrupted;
+		}
+
+		if (strcmp(name, sources[i].name) != 0 || cache_source->is_dir != sources[i].is_dir) {
+			goto exit_free;
+		}
+
+		if (!sources[i].exists) {
+			if (cache_source->size != -1) {
+				goto exit_free;
+			}
+			continue;
+		}
+
+		if (cache_source->size != sources[i].st.st_size ||
+		    cache_source->mtime_sec != sources[i].st.st_mtim.tv_sec ||
+		    cache_source->mtime_nsec != sources[i].st.st_mtim.tv_nsec) {
+			goto exit_free;
+		}
+	}
+
+	if (coroparse_sources_hash(sources, no_sources, &source_hash) != 0 ||
+	    source_hash != header->source_hash) {
+		goto exit_free;
+	}
+
+	for (i = 0; i < header->no_items; i++) {
+		cache_item = coroparse_cache_record(data, data_len, &pos, sizeof(*cache_item));
+		if (cache_item == NULL) {
+			goto exit_corrupted;
+		}
+		name = coroparse_cache_record(data, data_len, &pos, cache_item->key_len);
+		if (name == NULL || cache_item->key_len == 0 || name[cache_item->key_len - 1] != '\0') {
+			goto exit_corrupted;
+		}
+		value = coroparse_cache_record(data, data_len, &pos, cache_item->value_len);
+		if (value == NULL) {
+			goto exit_corrupted;
+		}
+
+		if (icmap_set_r(config_map, name, value, cache_item->value_len,
+		    cache_item->type) != CS_OK) {
+			goto exit_corrupted;
+		}
+	}
+
+	res = 0;
+	goto exit_free;
+
+exit_corrupted:
+	*error_string = "Configuration cache is corrupted";
+exit_free:
+	coroparse_sources_free(sources, no_sources);
+	free(data);
+
+	return (res);
+}
+
+int coroparse_configparse (icmap_map_t config_map, const char **error_string)
+{
+	const char *cache_filename;
+	const char *cache_error_string;
+	char cache_error[256];
+	icmap_map_t temp_map;
+	struct coroparse_source *sources;
+	size_t no_sources;
+	uint64_t source_hash;
+	int snapshot_res;
+	int res;
+
+	cache_filename = coroparse_cache_filename();
+	if (cache_filename == NULL) {
+		return (read_config_file_into_icmap(error_string, config_map) ? -1 : 0);
+	}
+
+	/*
+	 * Both cache and parser fill temporary map, so config_map is never left
+	 * with partial configuration
+	 */
+	if (icmap_init_r(&temp_map) != CS_OK) {
+		*error_string = "Failed to initialize temporary configuration map";
+		return -1;
+	}
+
+	if (coroparse_cache_load(cache_filename, temp_map, &cache_error_string) == 0) {
+		snprintf (error_string_response, sizeof(error_string_response),
+			"Successfully read main configuration file '%s' (from cache '%s').",
+			coroparse_config_filename(), cache_filename);
+		*error_string = error_string_response;
+		res = 0;
+	} else {
+		icmap_fini_r(temp_map);
+		if (icmap_init_r(&temp_map) != CS_OK) {
+			*error_string = "Failed to initialize temporary configuration map";
+			return -1;
+		}
+
+		snapshot_res = coroparse_sources_snapshot(&sources, &no_sources, &source_hash,
+		    &cache_error_string);
+		res = read_config_file_into_icmap(error_string, temp_map);
+		if (res == 0 &&
+		    (snapshot_res != 0 ||
+		    coroparse_cache_write(cache_filename, temp_map, sources, no_sources, source_hash,
+		    &cache_error_string) != 0)) {
+			/*
+			 * Cache is only optimization, so failure is not fatal
+			 */
+			snprintf (cache_error, sizeof(cache_error), "%s", cache_error_string);
+			snprintf (error_string_response, sizeof(error_string_response),
+				"Successfully read main configuration file '%s' (cache not written: %s).",
+				coroparse_config_filename(), cache_error);
+			*error_string = error_string_response;
+		}
+		coroparse_sources_free(sources, no_sources);
+	}
+
+	if (res == 0 && icmap_copy_map(config_map, temp_map) != CS_OK) {
+		*error_string = "Failed to copy configuration map";
+		res = -1;
+	}
+
+	icmap_fini_r(temp_map);
+
+	return (res ? -1 : 0);
+}
+
+int coroparse_cache_build (const char **error_string)
+{
+	const char *cache_filename;
+	icmap_map_t temp_map;
+	struct coroparse_source *sources;
+	size_t no_sources;
+	uint64_t source_hash;
+	int res;
+
+	cache_filename = coroparse_cache_filename();
+	if (cache_filename == NULL) {
+		*error_string = "Configuration cache is disabled";
+		return -1;
+	}
+
+	if (coroparse_sources_snapshot(&sources, &no_sources, &source_hash, error_string) != 0) {
+		return -1;
+	}
+
+	if (icmap_init_r(&temp_map) != CS_OK) {
+		*error_string = "Failed to initialize temporary configuration map";
+		coroparse_sources_free(sources, no_sources);
+		return -1;
+	}
+
+	res = read_config_file_into_icmap(error_string, temp_map);
+	if (res == 0) {
+		res = coroparse_cache_write(cache_filename, temp_map, sources, no_sources,
+		    source_hash, error_string);
+	}
+	coroparse_sources_free(sources, no_sources);
+
+	if (res == 0) {
+		snprintf (error_string_response, sizeof(error_string_response),
+			"Configuration cache '%s' successfully built.", cache_filename);
+		*error_string = error_string_response;
+	}
+
+	icmap_fini_r(temp_map);
+
+	return (res ? -1 : 0);
+}
+
+int coroparse_cache_dump (FILE *fp, const char **error_string)
+{
+	const struct coroparse_cache_header *header;
+	const struct coroparse_cache_source *cache_source;
+	const struct coroparse_cache_item *cache_item;
+	const char *cache_filename;
+	const char *name;
+	const char *value;
+	const char *cache_error_string;
+	icmap_map_t temp_map;
+	char *data;
+	size_t data_len;
+	size_t pos;
+	uint32_t i;
+	union {
+		int8_t i8;
+		uint8_t u8;
+		int16_t i16;
+		uint16_t u16;
+		int32_t i32;
+		uint32_t u32;
+		int64_t i64;
+		uint64_t u64;
+		float flt;
+		double dbl;
+	} v;
+
+	cache_filename = coroparse_cache_filename();
+	if (cache_filename == NULL) {
+		*error_string = "Configuration cache is disabled";
+		return -1;
+	}
+
+	if (coroparse_cache_read(cache_filename, &data, &data_len, error_string) != 0) {
+		return -1;
+	}
+	header = (const struct coroparse_cache_header *)data;
+
+	fprintf(fp, "Cache file: %s\n", cache_filename);
+	fprintf(fp, "Size: %"PRIu64" bytes, %u items\n", header->size, header->no_items);
+	fprintf(fp, "Source hash: %016"PRIx64"\n", header->source_hash);
+
+	/*
+	 * Check validity against current files
+	 */
+	if (icmap_init_r(&temp_map) == CS_OK) {
+		if (coroparse_cache_load(cache_filename, temp_map, &cache_error_string) == 0) {
+			fprintf(fp, "Status: valid\n");
+		} else {
+			fprintf(fp, "Status: not used (%s)\n", cache_error_string);
+		}
+		icmap_fini_r(temp_map);
+	}
+
+	pos = COROPARSE_ALIGN(sizeof(*header));
+	for (i = 0; i < header->no_sources; i++) {
+		cache_source = coroparse_cache_record(data, data_len, &pos, sizeof(*cache_source));
+		name = (cache_source != NULL ?
+		    coroparse_cache_record(data, data_len, &pos, cache_source->name_len) : NULL);
+		if (name == NULL || cache_source->name_len == 0 || name[cache_source->name_len - 1] != '\0') {
+			goto exit_corrupted;
+		}
+
+		if (cache_source->size == -1) {
+			fprintf(fp, "Source: %s (not present)\n", name);
+		} else {
+			fprintf(fp, "Source: %s (mtime %"PRId64".%09"PRId64", size %"PRId64")\n", name,
+			    cache_source->mtime_sec, cache_source->mtime_nsec, cache_source->size);
+		}
+	}
+
+	for (i = 0; i < header->no_items; i++) {
+		cache_item = coroparse_cache_record(data, data_len, &pos, sizeof(*cache_item));
+		name = (cache_item != NULL ?
+		    coroparse_cache_record(data, data_len, &pos, cache_item->key_len) : NULL);
+		if (name == NULL || cache_item->key_len == 0 || name[cache_item->key_len - 1] != '\0') {
+			goto exit_corrupted;
+		}
+		value = coroparse_cache_record(data, data_len, &pos, cache_item->value_len);
+		if (value == NULL) {
+			goto exit_corrupted;
+		}
+
+		memset(&v, 0, sizeof(v));
+		memcpy(&v, value, (cache_item->value_len < sizeof(v) ? cache_item->value_len : sizeof(v)));
+
+		fprintf(fp, "%s ", name);
+		switch (cache_item->type) {
+		case ICMAP_VALUETYPE_INT8:
+			fprintf(fp, "(i8) = %"PRId8"\n", v.i8);
+			break;
+		case ICMAP_VALUETYPE_UINT8:
+			fprintf(fp, "(u8) = %"PRIu8"\n", v.u8);
+			break;
+		case ICMAP_VALUETYPE_INT16:
+			fprintf(fp, "(i16) = %"PRId16"\n", v.i16);
+			break;
+		case ICMAP_VALUETYPE_UINT16:
+			fprintf(fp, "(u16) = %"PRIu16"\n", v.u16);
+			break;
+		case ICMAP_VALUETYPE_INT32:
+			fprintf(fp, "(i32) = %"PRId32"\n", v.i32);
+			break;
+		case ICMAP_VALUETYPE_UINT32:
+			fprintf(fp, "(u32) = %"PRIu32"\n", v.u32);
+			break;
+		case ICMAP_VALUETYPE_INT64:
+			fprintf(fp, "(i64) = %"PRId64"\n", v.i64);
+			break;
+		case ICMAP_VALUETYPE_UINT64:
+			fprintf(fp, "(u64) = %"PRIu64"\n", v.u64);
+			break;
+		case ICMAP_VALUETYPE_FLOAT:
+			fprintf(fp, "(flt) = %.3f\n", v.flt);
+			break;
+		case ICMAP_VALUETYPE_DOUBLE:
+			fprintf(fp, "(dbl) = %.3lf\n", v.dbl);
+			break;
+		case ICMAP_VALUETYPE_STRING:
+			fprintf(fp, "(str) = %.*s\n", (int)strnlen(value, cache_item->value_len), value);
+			break;
+		default:
+			fprintf(fp, "(bin) = %"PRIu64" bytes\n", cache_item->value_len);
+			break;
+		}
+	}
+
+	free(data);
+	*error_string = "";
+
+	return 0;
+
+exit_corrupted:
+	*error_string = "Configuration cache is corrupted";
+	free(data);
+
+	return -1;
+}
@@ -47,6 +47,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <errno.h>
 #include <time.h>
@@ -55,7 +56,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <qb/qbmap.h>
+#include <qb/qbutil.h>
 
 #include <corosync/corotypes.h>
 #include <qb/qbipc_common.h>
@@ -63,6 +66,7 @@
 #include <corosync/list.h>
 #include <corosync/logsys.h>
 #include <corosync/coroapi.h>
+#include <corosync/icmap.h>
 
 #include <corosync/cpg.h>
 #include <corosync/ipc_cpg.h>
@@ -85,13 +89,75 @@ enum cpg_message_req_types {
 	MESSAGE_REQ_EXEC_CPG_DOWNLIST_OLD = 4,
 	MESSAGE_REQ_EXEC_CPG_DOWNLIST = 5,
 	MESSAGE_REQ_EXEC_CPG_PARTIAL_MCAST = 6,
+	MESSAGE_REQ_EXEC_CPG_JOINLIST_COMPACT = 7,
+	MESSAGE_REQ_EXEC_CPG_MCAST_FIFO_LOCAL = 8,
 };
 
+/*
+ * Version of sync messages understood by this node. It's announced in a
+ * trailer of the downlist message (ignored by older nodes) and compact
+ * joinlist or local delivery of FIFO messages is used only when all members
+ * announce it.
+ */
+#define CPG_SYNC_VERSION_COMPACT	1
+#define CPG_SYNC_VERSION_FIFO_LOCAL	2
+#define CPG_SYNC_VERSION		CPG_SYNC_VERSION_FIFO_LOCAL
+#define CPG_SYNC_TRAILER_MAGIC		0x43504753
+
+/*
+ * How long to wait for downlists before joinlist is sent in old format
+ */
+#define CPG_SYNC_DOWNLIST_WAIT		(1000 * QB_TIME_NS_IN_MSEC)
+
+/*
+ * Compact joinlist goes through totempg_groups_mcast_joined, which puts
+ * group header (group count, lengths and names) in front of it. Whole
+ * message must fit into MESSAGE_SIZE_MAX assembly buffer of receivers.
+ * Corosync sends in one group with short name, so reserve is plenty.
+ */
+#define CPG_JOINLIST_COMPACT_HDR_RESERVE	1024
+#define CPG_JOINLIST_COMPACT_MSG_MAX	(MESSAGE_SIZE_MAX - CPG_JOINLIST_COMPACT_HDR_RESERVE)
+
 struct zcb_mapped {
 	struct list_head list;
 	void *addr;
 	size_t size;
 };
+
+/*
+ * Shared delivery arena (CPG_MODEL_V1_DELIVER_SHARED). One arena exists for
+ * every group and uid of local members. Message is copied into the arena only
+ * once and members get just a descriptor. Slot is reused after all members it
+ * was delivered to release it.
+ */
+#define CPG_SHM_ARENA_SIZE		(8 * 1024 * 1024)
+#define CPG_SHM_SLOTS_MAX		1024
+#define CPG_SHM_DELIVER_MIN_SIZE	1024
+#define CPG_SHM_UMASK			077
+
+struct cpg_shm_slot {
+	size_t offset;
+	size_t len;
+	uint32_t refs;
+};
+
+struct cpg_shm_arena {
+	struct list_head list;
+	mar_cpg_name_t group_name;
+	uid_t uid;
+	uint64_t id;
+	char path[CPG_ZC_PATH_LEN];
+	char *addr;
+	size_t size;
+	size_t data_head;
+	size_t data_tail;
+	uint64_t seq_next;
+	uint64_t seq_tail;
+	uint64_t alloc_token; /* Message for which alloc_seq was allocated */
+	uint64_t alloc_seq;
+	unsigned int attached;
+	struct cpg_shm_slot slots[CPG_SHM_SLOTS_MAX];
+};
 /*
  * state`		exec deliver
  * match group name, pid -> if matched deliver for YES:
@@ -159,9 +225,18 @@ struct cpg_pd {
 	int initial_totem_conf_sent;
 	uint64_t transition_counter; /* These two are used when sending fragmented messages */
 	uint64_t initial_transition_counter;
+	uint32_t partial_msgid; /* Pipelined fragmented message being received */
+	uint32_t partial_seq_next;
+	uint32_t mcast_in_flight; /* Own messages sent through totem and not yet delivered */
 	struct list_head list;
+	struct cpg_group *group; /* Set while group_name is set */
+	struct list_head group_list;
 	struct list_head iteration_instance_list_head;
 	struct list_head zcb_mapped_list_head;
+	struct cpg_shm_arena *shm_arena;
+	int shm_active;
+	uint64_t shm_seq_first; /* Shared deliveries not yet released by library */
+	uint64_t shm_seq_next;
 };
 
 struct cpg_iteration_instance {
@@ -175,6 +250,12 @@ DECLARE_HDB_DATABASE(cpg_iteration_handle_t_db,NULL);
 
 DECLARE_LIST_INIT(cpg_pd_list_head);
 
+DECLARE_LIST_INIT(cpg_shm_arena_list_head);
+
+static uint64_t cpg_shm_arena_id_next = 1;
+
+static uint64_t cpg_shm_deliver_token = 0;
+
 static unsigned int my_member_list[PROCESSOR_COUNT_MAX];
 
 static unsigned int my_member_list_entries;
@@ -194,9 +275,38 @@ struct process_info {
 	uint32_t pid;
 	mar_cpg_name_t group;
 	struct list_head list; /* on the group_info members list */
+	struct list_head group_list; /* on the cpg_group pi list */
 };
 DECLARE_LIST_INIT(process_info_list_head);
 
+/*
+ * Index of groups. Group exists while it has local member (cpg_pd) or
+ * process_info entry, so delivery only walks members of given group.
+ */
+struct cpg_group_node {
+	unsigned int nodeid;
+	unsigned int refs; /* Number of process_info entries from node */
+};
+
+struct cpg_group {
+	struct list_head list; /* Hash chain */
+	mar_cpg_name_t name;
+	struct list_head cpd_head;
+	struct list_head pi_head; /* Sorted same way as process_info_list_head */
+	unsigned int pi_entries;
+	struct cpg_group_node *nodes;
+	unsigned int nodes_entries;
+	unsigned int nodes_allocated;
+};
+
+static struct list_head cpg_group_hash[GROUP_HASH_SIZE];
+
+static char *cpg_confchg_buf = NULL;
+
+static size_t cpg_confchg_buf_size = 0;
+
+static mar_cpg_address_t cpg_confchg_left_sorted[CPG_MEMBERS_MAX];
+
 struct join_list_entry {
 	uint32_t pid;
 	mar_cpg_name_t group_name;
@@ -227,6 +337,10 @@ static void message_handler_req_exec_cpg_mcast (
 	const void *message,
 	unsigned int nodeid);
 
+static void message_handler_req_exec_cpg_mcast_fifo_local (
+	const void *message,
+	unsigned int nodeid);
+
 static void message_handler_req_exec_cpg_partial_mcast (
 	const void *message,
 	unsigned int nodeid);
@@ -239,6 +353,10 @@ static void message_handler_req_exec_cpg_downlist (
 	const void *message,
 	unsigned int nodeid);
 
+static void message_handler_req_exec_cpg_joinlist_compact (
+	const void *message,
+	unsigned int nodeid);
+
 static void exec_cpg_procjoin_endian_convert (void *msg);
 
 static void exec_cpg_joinlist_endian_convert (void *msg);
@@ -251,6 +369,8 @@ static void exec_cpg_downlist_endian_convert_old (void *msg);
 
 static void exec_cpg_downlist_endian_convert (void *msg);
 
+static void exec_cpg_joinlist_compact_endian_convert (void *msg);
+
 static void message_handler_req_lib_cpg_join (void *conn, const void *message);
 
 static void message_handler_req_lib_cpg_leave (void *conn, const void *message);
@@ -261,6 +381,12 @@ static void message_handler_req_lib_cpg_mcast (void *conn, const void *message);
 
 static void message_handler_req_lib_cpg_partial_mcast (void *conn, const void *message);
 
+static void message_handler_req_lib_cpg_partial_mcast_pipelined (void *conn, const void *message);
+
+static void message_handler_req_lib_cpg_send_ready (void *conn, const void *message);
+
+static void message_handler_req_lib_cpg_partial_send_wait (void *conn, const void *message);
+
 static void message_handler_req_lib_cpg_membership (void *conn,
 						    const void *message);
 
@@ -291,6 +417,14 @@ static void message_handler_req_lib_cpg_zc_execute (
 	void *conn,
 	const void *message);
 
+static void message_handler_req_lib_cpg_shm_attach (
+	void *conn,
+	const void *message);
+
+static void message_handler_req_lib_cpg_shm_release (
+	void *conn,
+	const void *message);
+
 static int cpg_node_joinleave_send (unsigned int pid, const mar_cpg_name_t *group_name, int fn, int reason);
 
 static int cpg_exec_send_downlist(void);
@@ -299,12 +433,16 @@ static int cpg_exec_send_joinlist(void);
 
 static void downlist_messages_delete (void);
 
+static uint32_t cpg_sync_version_min (void);
+
 static void downlist_master_choose_and_send (void);
 
 static void joinlist_inform_clients (void);
 
 static void joinlist_messages_delete (void);
 
+static void joinlist_compact_bufs_delete (void);
+
 static void cpg_sync_init (
 	const unsigned int *trans_list,
 	size_t trans_list_entries,
@@ -330,6 +468,8 @@ static void do_proc_leave(
 	unsigned int nodeid,
 	int reason);
 
+static void process_info_del(struct process_info *pi);
+
 static int notify_lib_totem_membership (
 	void *conn,
 	int member_list_entries,
@@ -338,6 +478,16 @@ static int notify_lib_totem_membership (
 static inline int zcb_all_free (
 	struct cpg_pd *cpd);
 
+static int cpg_shm_deliver (
+	struct cpg_pd *cpd,
+	const struct res_lib_cpg_deliver_callback *res,
+	const void *msg);
+
+static void cpg_shm_arenas_gc (void);
+
+static void cpg_shm_detach (
+	struct cpg_pd *cpd);
+
 static char *cpg_print_group_name (
 	const mar_cpg_name_t *group);
 
@@ -398,6 +548,26 @@ static struct corosync_lib_handler cpg_lib_engine[] =
 		.lib_handler_fn				= message_handler_req_lib_cpg_partial_mcast,
 		.flow_control				= CS_LIB_FLOW_CONTROL_REQUIRED
 	},
+	{ /* 13 - MESSAGE_REQ_CPG_SHM_ATTACH */
+		.lib_handler_fn				= message_handler_req_lib_cpg_shm_attach,
+		.flow_control				= CS_LIB_FLOW_CONTROL_NOT_REQUIRED
+	},
+	{ /* 14 - MESSAGE_REQ_CPG_SHM_RELEASE */
+		.lib_handler_fn				= message_handler_req_lib_cpg_shm_release,
+		.flow_control				= CS_LIB_FLOW_CONTROL_NOT_REQUIRED
+	},
+	{ /* 15 - MESSAGE_REQ_CPG_PARTIAL_MCAST_PIPELINED */
+		.lib_handler_fn				= message_handler_req_lib_cpg_partial_mcast_pipelined,
+		.flow_control				= CS_LIB_FLOW_CONTROL_REQUIRED
+	},
+	{ /* 16 - MESSAGE_REQ_CPG_SEND_READY */
+		.lib_handler_fn				= message_handler_req_lib_cpg_send_ready,
+		.flow_control				= CS_LIB_FLOW_CONTROL_NOT_REQUIRED
+	},
+	{ /* 17 - MESSAGE_REQ_CPG_PARTIAL_SEND_WAIT */
+		.lib_handler_fn				= message_handler_req_lib_cpg_partial_send_wait,
+		.flow_control				= CS_LIB_FLOW_CONTROL_NOT_REQUIRED
+	},
 
 };
 
@@ -431,6 +601,14 @@ static struct corosync_exec_handler cpg_exec_engine[] =
 		.exec_handler_fn	= message_handler_req_exec_cpg_partial_mcast,
 		.exec_endian_convert_fn	= exec_cpg_partial_mcast_endian_convert
 	},
+	{ /* 7 - MESSAGE_REQ_EXEC_CPG_JOINLIST_COMPACT */
+		.exec_handler_fn	= message_handler_req_exec_cpg_joinlist_compact,
+		.exec_endian_convert_fn	= exec_cpg_joinlist_compact_endian_convert
+	},
+	{ /* 8 - MESSAGE_REQ_EXEC_CPG_MCAST_FIFO_LOCAL */
+		.exec_handler_fn	= message_handler_req_exec_cpg_mcast_fifo_local,
+		.exec_endian_convert_fn	= exec_cpg_mcast_endian_convert
+	},
 };
 
 struct corosync_service_engine cpg_service_engine = {
@@ -451,7 +629,8 @@ struct corosync_service_engine cpg_service_engine = {
 	.sync_init                              = cpg_sync_init,
 	.sync_process                           = cpg_sync_process,
 	.sync_activate                          = cpg_sync_activate,
-	.sync_abort                             = cpg_sync_abort
+	.sync_abort                             = cpg_sync_abort,
+	.sync_mode                              = CS_SYNC_PARALLEL
 };
 
 struct corosync_service_engine *cpg_get_service_engine_ver0 (void)
@@ -501,8 +680,29 @@ struct req_exec_cpg_downlist {
 	mar_uint32_t nodeids[PROCESSOR_COUNT_MAX]  __attribute__((aligned(8)));
 };
 
+/*
+ * Follows nodeids (rounded up to 8 bytes) in downlist message
+ */
+struct req_exec_cpg_downlist_trailer {
+	mar_uint32_t magic __attribute__((aligned(8)));
+	mar_uint32_t sync_version __attribute__((aligned(8)));
+};
+
+/*
+ * Data contains for every group: name length (1 byte), name, number of pids
+ * and pids in increasing order. Numbers are encoded as varints, pids as
+ * difference from previous pid in the group.
+ */
+struct req_exec_cpg_joinlist_compact {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+	mar_uint32_t version __attribute__((aligned(8)));
+	mar_uint32_t groups __attribute__((aligned(8)));
+	mar_uint8_t data[] __attribute__((aligned(8)));
+};
+
 struct downlist_msg {
 	mar_uint32_t sender_nodeid;
+	mar_uint32_t sync_version;
 	mar_uint32_t old_members __attribute__((aligned(8)));
 	mar_uint32_t left_nodes __attribute__((aligned(8)));
 	mar_uint32_t nodeids[PROCESSOR_COUNT_MAX]  __attribute__((aligned(8)));
@@ -518,9 +718,188 @@ struct joinlist_msg {
 
 static struct req_exec_cpg_downlist g_req_exec_cpg_downlist;
 
+struct joinlist_compact_buf {
+	struct list_head list;
+	size_t size;
+	char data[] __attribute__((aligned(8)));
+};
+
+static struct list_head joinlist_compact_send_head;
+
+static int joinlist_built;
+
+static uint64_t sync_start_time;
+
+static uint64_t sync_joinlist_bytes;
+
+static uint32_t sync_joinlist_msgs;
+
+/*
+ * Lowest sync version of current members. Zero while sync is in progress.
+ */
+static uint32_t cpg_cluster_sync_version;
+
 /*
  * Function print group name. It's not reentrant
  */
+static unsigned int cpg_group_hash_fn (const mar_cpg_name_t *name)
+{
+	uint32_t hash = 2166136261U;
+	uint32_t len;
+	uint32_t i;
+
+	len = name->length;
+	if (len > CPG_MAX_NAME_LENGTH) {
+		len = CPG_MAX_NAME_LENGTH;
+	}
+
+	for (i = 0; i < len; i++) {
+		hash = (hash ^ (unsigned char)name->value[i]) * 16777619U;
+	}
+
+	return (hash % GROUP_HASH_SIZE);
+}
+
+static struct cpg_group *cpg_group_find (const mar_cpg_name_t *name)
+{
+	struct list_head *iter;
+	struct list_head *head = &cpg_group_hash[cpg_group_hash_fn (name)];
+	struct cpg_group *group;
+
+	for (iter = head->next; iter != head; iter = iter->next) {
+		group = list_entry (iter, struct cpg_group, list);
+
+		if (mar_name_compare (&group->name, name) == 0) {
+			return (group);
+		}
+	}
+
+	return (NULL);
+}
+
+static struct cpg_group *cpg_group_get (const mar_cpg_name_t *name)
+{
+	struct cpg_group *group;
+
+	group = cpg_group_find (name);
+	if (group != NULL) {
+		return (group);
+	}
+
+	group = calloc (1, sizeof (struct cpg_group));
+	if (group == NULL) {
+		return (NULL);
+	}
+	memcpy (&group->name, name, sizeof (group->name));
+	list_init (&group->cpd_head);
+	list_init (&group->pi_head);
+	list_add (&group->list, &cpg_group_hash[cpg_group_hash_fn (name)]);
+
+	return (group);
+}
+
+/*
+ * Free group if nothing references it any longer
+ */
+static void cpg_group_release (struct cpg_group *group)
+{
+	if (group == NULL || !list_empty (&group->cpd_head) || !list_empty (&group->pi_head)) {
+		return ;
+	}
+
+	list_del (&group->list);
+	free (group->nodes);
+	free (group);
+}
+
+static struct cpg_group_node *cpg_group_node_find (struct cpg_group *group, unsigned int nodeid)
+{
+	unsigned int i;
+
+	for (i = 0; i < group->nodes_entries; i++) {
+		if (group->nodes[i].nodeid == nodeid) {
+			return (&group->nodes[i]);
+		}
+	}
+
+	return (NULL);
+}
+
+static int cpg_group_node_add (struct cpg_group *group, unsigned int nodeid)
+{
+	struct cpg_group_node *node;
+	struct cpg_group_node *new_nodes;
+	unsigned int new_allocated;
+
+	node = cpg_group_node_find (group, nodeid);
+	if (node != NULL) {
+		node->refs++;
+		return (0);
+	}
+
+	if (group->nodes_entries == group->nodes_allocated) {
+		new_allocated = (group->nodes_allocated == 0 ? 4 : group->nodes_allocated * 2);
+		new_nodes = realloc (group->nodes, new_allocated * sizeof (struct cpg_group_node));
+		if (new_nodes == NULL) {
+			return (-1);
+		}
+		group->nodes = new_nodes;
+		group->nodes_allocated = new_allocated;
+	}
+
+	node = &group->nodes[group->nodes_entries++];
+	node->nodeid = nodeid;
+	node->refs = 1;
+
+	return (0);
+}
+
+static void cpg_group_node_del (struct cpg_group *group, unsigned int nodeid)
+{
+	struct cpg_group_node *node;
+
+	node = cpg_group_node_find (group, nodeid);
+	if (node == NULL) {
+		return ;
+	}
+
+	if (--node->refs == 0) {
+		*node = group->nodes[--group->nodes_entries];
+	}
+}
+
+static int cpg_group_cpd_add (struct cpg_pd *cpd)
+{
+	struct cpg_group *group;
+
+	group = cpg_group_get (&cpd->group_name);
+	if (group == NULL) {
+		return (-1);
+	}
+
+	cpd->group = group;
+	list_add_tail (&cpd->group_list, &group->cpd_head);
+
+	return (0);
+}
+
+/*
+ * Remove cpd from its group. Group itself is not freed, caller must call
+ * cpg_group_release.
+ */
+static struct cpg_group *cpg_group_cpd_del (struct cpg_pd *cpd)
+{
+	struct cpg_group *group = cpd->group;
+
+	if (group != NULL) {
+		list_del (&cpd->group_list);
+		list_init (&cpd->group_list);
+		cpd->group = NULL;
+	}
+
+	return (group);
+}
+
 static char *cpg_print_group_name(const mar_cpg_name_t *group)
 {
 	static char res[CPG_MAX_NAME_LENGTH * 4 + 1];
@@ -560,6 +939,12 @@ static void cpg_sync_init (
 	int found;
 
 	my_sync_state = CPGSYNC_DOWNLIST;
+	sync_start_time = qb_util_nano_current_get ();
+	joinlist_compact_bufs_delete ();
+	joinlist_built = 0;
+	sync_joinlist_bytes = 0;
+	sync_joinlist_msgs = 0;
+	cpg_cluster_sync_version = 0;
 
 	memcpy (my_member_list, member_list, member_list_entries *
 		sizeof (unsigned int));
@@ -602,11 +987,26 @@ static int cpg_sync_process (void)
 		my_sync_state = CPGSYNC_JOINLIST;
 	}
 	if (my_sync_state == CPGSYNC_JOINLIST) {
+		if (downlist_state == CPG_DOWNLIST_WAITING_FOR_MESSAGES &&
+		    qb_util_nano_current_get () - sync_start_time < CPG_SYNC_DOWNLIST_WAIT) {
+			/*
+			 * Format of joinlist depends on sync versions of all members
+			 */
+			return (-1);
+		}
 		res = cpg_exec_send_joinlist();
 	}
 	return (res);
 }
 
+static void cpg_sync_stats_update (void)
+{
+	icmap_set_uint64 ("runtime.services.cpg.sync.duration",
+		(qb_util_nano_current_get () - sync_start_time) / QB_TIME_NS_IN_USEC);
+	icmap_set_uint32 ("runtime.services.cpg.sync.joinlist_msgs", sync_joinlist_msgs);
+	icmap_set_uint64 ("runtime.services.cpg.sync.joinlist_bytes", sync_joinlist_bytes);
+}
+
 static void cpg_sync_activate (void)
 {
 	memcpy (my_old_member_list, my_member_list,
@@ -619,11 +1019,14 @@ static void cpg_sync_activate (void)
 
 	joinlist_inform_clients ();
 
+	cpg_cluster_sync_version = cpg_sync_version_min ();
 	downlist_messages_delete ();
 	downlist_state = CPG_DOWNLIST_NONE;
 	joinlist_messages_delete ();
 
 	notify_lib_totem_membership (NULL, my_member_list_entries, my_member_list);
+
+	cpg_sync_stats_update ();
 }
 
 static void cpg_sync_abort (void)
@@ -631,6 +1034,7 @@ static void cpg_sync_abort (void)
 	downlist_state = CPG_DOWNLIST_NONE;
 	downlist_messages_delete ();
 	joinlist_messages_delete ();
+	joinlist_compact_bufs_delete ();
 }
 
 static int notify_lib_totem_membership (
@@ -670,6 +1074,45 @@ static int notify_lib_totem_membership (
 	return CS_OK;
 }
 
+static int cpg_address_cmp (const void *a, const void *b)
+{
+	const mar_cpg_address_t *addr_a = a;
+	const mar_cpg_address_t *addr_b = b;
+
+	if (addr_a->nodeid != addr_b->nodeid) {
+		return (addr_a->nodeid < addr_b->nodeid ? -1 : 1);
+	}
+
+	if (addr_a->pid != addr_b->pid) {
+		return (addr_a->pid < addr_b->pid ? -1 : 1);
+	}
+
+	return (0);
+}
+
+/*
+ * Confchg response is built once per group into this buffer and sent to all
+ * local members. Buffer only grows.
+ */
+static int cpg_confchg_buf_reserve (size_t size)
+{
+	char *new_buf;
+
+	if (size <= cpg_confchg_buf_size) {
+		return (0);
+	}
+
+	new_buf = realloc (cpg_confchg_buf, size);
+	if (new_buf == NULL) {
+		return (-1);
+	}
+
+	cpg_confchg_buf = new_buf;
+	cpg_confchg_buf_size = size;
+
+	return (0);
+}
+
 static int notify_lib_joinlist(
 	const mar_cpg_name_t *group_name,
 	void *conn,
@@ -681,65 +1124,68 @@ static int notify_lib_joinlist(
 {
 	int size;
 	char *buf;
-	struct list_head *iter;
+	struct list_head *iter, *iter_next;
+	struct list_head empty_head;
+	struct list_head *pi_head, *cpd_head;
+	struct cpg_group *group;
 	int count;
+	int i;
 	struct res_lib_cpg_confchg_callback *res;
 	mar_cpg_address_t *retgi;
+	mar_cpg_address_t *left_sorted;
 
 	count = 0;
 
-	for (iter = process_info_list_head.next; iter != &process_info_list_head; iter = iter->next) {
-		struct process_info *pi = list_entry (iter, struct process_info, list);
-		if (mar_name_compare (&pi->group, group_name) == 0) {
-			int i;
-			int founded = 0;
-
-			for (i = 0; i < left_list_entries; i++) {
-				if (left_list[i].nodeid == pi->nodeid && left_list[i].pid == pi->pid) {
-					founded++;
-				}
-			}
-
-			if (!founded)
-				count++;
-		}
-	}
+	group = cpg_group_find (group_name);
+	list_init (&empty_head);
+	pi_head = (group != NULL ? &group->pi_head : &empty_head);
+	cpd_head = (group != NULL ? &group->cpd_head : &empty_head);
 
+	/*
+	 * Response is sized for all group members, real member count is known
+	 * after left processes are filtered out
+	 */
 	size = sizeof(struct res_lib_cpg_confchg_callback) +
-		sizeof(mar_cpg_address_t) * (count + left_list_entries + joined_list_entries);
-	buf = alloca(size);
-	if (!buf)
+		sizeof(mar_cpg_address_t) * ((group != NULL ? group->pi_entries : 0) +
+		left_list_entries + joined_list_entries);
+	if (cpg_confchg_buf_reserve (size) != 0)
 		return CS_ERR_LIBRARY;
+	buf = cpg_confchg_buf;
 
 	res = (struct res_lib_cpg_confchg_callback *)buf;
-	res->joined_list_entries = joined_list_entries;
-	res->left_list_entries = left_list_entries;
-	res->member_list_entries = count;
 	retgi = res->member_list;
-	res->header.size = size;
-	res->header.id = id;
-	res->header.error = CS_OK;
-	memcpy(&res->group_name, group_name, sizeof(mar_cpg_name_t));
 
-	for (iter = process_info_list_head.next; iter != &process_info_list_head; iter = iter->next) {
-		struct process_info *pi=list_entry (iter, struct process_info, list);
+	/*
+	 * Group members are sorted by nodeid and pid. Sort left list the same way,
+	 * so members which left can be filtered out in one pass over both lists.
+	 */
+	left_sorted = left_list;
+	if (left_list_entries > CPG_MEMBERS_MAX)
+		return CS_ERR_LIBRARY;
+	if (left_list_entries > 1) {
+		left_sorted = cpg_confchg_left_sorted;
+		memcpy (left_sorted, left_list, left_list_entries * sizeof(mar_cpg_address_t));
+		qsort (left_sorted, left_list_entries, sizeof(mar_cpg_address_t), cpg_address_cmp);
+	}
 
-		if (mar_name_compare (&pi->group, group_name) == 0) {
-			int i;
-			int founded = 0;
+	i = 0;
+	for (iter = pi_head->next; iter != pi_head; iter = iter->next) {
+		struct process_info *pi=list_entry (iter, struct process_info, group_list);
 
-			for (i = 0;i < left_list_entries; i++) {
-				if (left_list[i].nodeid == pi->nodeid && left_list[i].pid == pi->pid) {
-					founded++;
-				}
-			}
+		while (i < left_list_entries && (left_sorted[i].nodeid < pi->nodeid ||
+		    (left_sorted[i].nodeid == pi->nodeid && left_sorted[i].pid < pi->pid))) {
+			i++;
+		}
 
-			if (!founded) {
-				retgi->nodeid = pi->nodeid;
-				retgi->pid = pi->pid;
-				retgi++;
-			}
+		if (i < left_list_entries &&
+		    left_sorted[i].nodeid == pi->nodeid && left_sorted[i].pid == pi->pid) {
+			continue;
 		}
+
+		retgi->nodeid = pi->nodeid;
+		retgi->pid = pi->pid;
+		retgi++;
+		count++;
 	}
 
 	if (left_list_entries) {
@@ -752,37 +1198,50 @@ static int notify_lib_joinlist(
 		retgi += joined_list_entries;
 	}
 
+	size = sizeof(struct res_lib_cpg_confchg_callback) +
+		sizeof(mar_cpg_address_t) * (count + left_list_entries + joined_list_entries);
+	res->joined_list_entries = joined_list_entries;
+	res->left_list_entries = left_list_entries;
+	res->member_list_entries = count;
+	res->header.size = size;
+	res->header.id = id;
+	res->header.error = CS_OK;
+	memcpy(&res->group_name, group_name, sizeof(mar_cpg_name_t));
+
 	if (conn) {
 		api->ipc_dispatch_send (conn, buf, size);
 	} else {
-		for (iter = cpg_pd_list_head.next; iter != &cpg_pd_list_head; iter = iter->next) {
-			struct cpg_pd *cpd = list_entry (iter, struct cpg_pd, list);
-			if (mar_name_compare (&cpd->group_name, group_name) == 0) {
-				assert (joined_list_entries <= 1);
-				if (joined_list_entries) {
-					if (joined_list[0].pid == cpd->pid &&
-						joined_list[0].nodeid == api->totem_nodeid_get()) {
-						cpd->cpd_state = CPD_STATE_JOIN_COMPLETED;
-					}
+		for (iter = cpd_head->next; iter != cpd_head; iter = iter_next) {
+			struct cpg_pd *cpd = list_entry (iter, struct cpg_pd, group_list);
+			iter_next = iter->next;
+
+			assert (joined_list_entries <= 1);
+			if (joined_list_entries) {
+				if (joined_list[0].pid == cpd->pid &&
+					joined_list[0].nodeid == api->totem_nodeid_get()) {
+					cpd->cpd_state = CPD_STATE_JOIN_COMPLETED;
 				}
-				if (cpd->cpd_state == CPD_STATE_JOIN_COMPLETED ||
-					cpd->cpd_state == CPD_STATE_LEAVE_STARTED) {
+			}
+			if (cpd->cpd_state == CPD_STATE_JOIN_COMPLETED ||
+				cpd->cpd_state == CPD_STATE_LEAVE_STARTED) {
 
-					api->ipc_dispatch_send (cpd->conn, buf, size);
-					cpd->transition_counter++;
-				}
-				if (left_list_entries) {
-					if (left_list[0].pid == cpd->pid &&
-						left_list[0].nodeid == api->totem_nodeid_get() &&
-						left_list[0].reason == CONFCHG_CPG_REASON_LEAVE) {
-
-						cpd->pid = 0;
-						memset (&cpd->group_name, 0, sizeof(cpd->group_name));
-						cpd->cpd_state = CPD_STATE_UNJOINED;
-					}
+				api->ipc_dispatch_send (cpd->conn, buf, size);
+				cpd->transition_counter++;
+			}
+			if (left_list_entries) {
+				if (left_list[0].pid == cpd->pid &&
+					left_list[0].nodeid == api->totem_nodeid_get() &&
+					left_list[0].reason == CONFCHG_CPG_REASON_LEAVE) {
+
+					cpd->pid = 0;
+					memset (&cpd->group_name, 0, sizeof(cpd->group_name));
+					cpd->cpd_state = CPD_STATE_UNJOINED;
+					cpg_shm_detach (cpd);
+					cpg_group_cpd_del (cpd);
 				}
 			}
 		}
+		cpg_group_release (group);
 	}
 
 
@@ -930,8 +1389,7 @@ static void downlist_master_choose_and_send (void)
 			pcd->left_list[size].pid = left_pi->pid;
 			pcd->left_list[size].reason = CONFCHG_CPG_REASON_NODEDOWN;
 			pcd->left_list_entries++;
-			list_del (&left_pi->list);
-			free (left_pi);
+			process_info_del (left_pi);
 		}
 	}
 
@@ -1076,11 +1534,34 @@ static void joinlist_messages_delete (void)
 	list_init (&joinlist_messages_head);
 }
 
-static char *cpg_exec_init_fn (struct corosync_api_v1 *corosync_api)
+static void joinlist_compact_bufs_delete (void)
 {
-	list_init (&downlist_messages_head);
-	list_init (&joinlist_messages_head);
-	api = corosync_api;
+	struct joinlist_compact_buf *buf;
+	struct list_head *iter, *iter_next;
+
+	for (iter = joinlist_compact_send_head.next;
+		iter != &joinlist_compact_send_head;
+		iter = iter_next) {
+
+		iter_next = iter->next;
+
+		buf = list_entry(iter, struct joinlist_compact_buf, list);
+		list_del (&buf->list);
+		free (buf);
+	}
+}
+
+static char *cpg_exec_init_fn (struct corosync_api_v1 *corosync_api)
+{
+	int i;
+
+	list_init (&downlist_messages_head);
+	list_init (&joinlist_messages_head);
+	list_init (&joinlist_compact_send_head);
+	for (i = 0; i < GROUP_HASH_SIZE; i++) {
+		list_init (&cpg_group_hash[i]);
+	}
+	api = corosync_api;
 	return (NULL);
 }
 
@@ -1110,6 +1591,7 @@ static void cpg_pd_finalize (struct cpg_pd *cpd)
 	struct cpg_iteration_instance *cpii;
 
 	zcb_all_free(cpd);
+	cpg_shm_detach (cpd);
 	for (iter = cpd->iteration_instance_list_head.next;
 		iter != &cpd->iteration_instance_list_head;
 		iter = iter_next) {
@@ -1122,6 +1604,7 @@ static void cpg_pd_finalize (struct cpg_pd *cpd)
 	}
 
 	list_del (&cpd->list);
+	cpg_group_release (cpg_group_cpd_del (cpd));
 }
 
 static int cpg_lib_exit_fn (void *conn)
@@ -1163,6 +1646,44 @@ static int cpg_node_joinleave_send (unsigned int pid, const mar_cpg_name_t *grou
 }
 
 /* Can byteswap join & leave messages */
+static size_t downlist_trailer_offset (uint32_t left_nodes)
+{
+	size_t offset;
+
+	offset = offsetof (struct req_exec_cpg_downlist, nodeids) + left_nodes * sizeof (mar_uint32_t);
+
+	return ((offset + 7) & ~((size_t)7));
+}
+
+static size_t cpg_varint_put (uint8_t *buf, uint32_t value)
+{
+	size_t len = 0;
+
+	while (value >= 0x80) {
+		buf[len++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	buf[len++] = value;
+
+	return (len);
+}
+
+static int cpg_varint_get (const uint8_t **pos, const uint8_t *end, uint32_t *value)
+{
+	uint32_t res = 0;
+	unsigned int shift;
+
+	for (shift = 0; shift < 35 && *pos < end; shift += 7) {
+		res |= (uint32_t)(**pos & 0x7f) << shift;
+		if ((*(*pos)++ & 0x80) == 0) {
+			*value = res;
+			return (0);
+		}
+	}
+
+	return (-1);
+}
+
 static void exec_cpg_procjoin_endian_convert (void *msg)
 {
 	struct req_exec_cpg_procjoin *req_exec_cpg_procjoin = msg;
@@ -1196,12 +1717,36 @@ static void exec_cpg_downlist_endian_convert (void *msg)
 	struct req_exec_cpg_downlist *req_exec_cpg_downlist = msg;
 	unsigned int i;
 
+	struct req_exec_cpg_downlist_trailer *trailer;
+	size_t trailer_offset;
+
+	req_exec_cpg_downlist->header.size = swab32(req_exec_cpg_downlist->header.size);
 	req_exec_cpg_downlist->left_nodes = swab32(req_exec_cpg_downlist->left_nodes);
 	req_exec_cpg_downlist->old_members = swab32(req_exec_cpg_downlist->old_members);
 
-	for (i = 0; i < req_exec_cpg_downlist->left_nodes; i++) {
+	for (i = 0; i < req_exec_cpg_downlist->left_nodes && i < PROCESSOR_COUNT_MAX; i++) {
 		req_exec_cpg_downlist->nodeids[i] = swab32(req_exec_cpg_downlist->nodeids[i]);
 	}
+
+	trailer_offset = downlist_trailer_offset (req_exec_cpg_downlist->left_nodes);
+	if (req_exec_cpg_downlist->left_nodes <= PROCESSOR_COUNT_MAX &&
+	    req_exec_cpg_downlist->header.size == trailer_offset + sizeof (*trailer)) {
+		trailer = (struct req_exec_cpg_downlist_trailer *)((char *)msg + trailer_offset);
+		trailer->magic = swab32(trailer->magic);
+		trailer->sync_version = swab32(trailer->sync_version);
+	}
+}
+
+static void exec_cpg_joinlist_compact_endian_convert (void *msg)
+{
+	struct req_exec_cpg_joinlist_compact *req_exec_cpg_joinlist = msg;
+
+	/*
+	 * Data are encoded byte by byte, only header needs conversion
+	 */
+	req_exec_cpg_joinlist->header.size = swab32(req_exec_cpg_joinlist->header.size);
+	req_exec_cpg_joinlist->version = swab32(req_exec_cpg_joinlist->version);
+	req_exec_cpg_joinlist->groups = swab32(req_exec_cpg_joinlist->groups);
 }
 
 
@@ -1231,13 +1776,17 @@ static void exec_cpg_partial_mcast_endian_convert (void *msg)
 
 static struct process_info *process_info_find(const mar_cpg_name_t *group_name, uint32_t pid, unsigned int nodeid) {
 	struct list_head *iter;
+	struct cpg_group *group;
 
-	for (iter = process_info_list_head.next; iter != &process_info_list_head; ) {
-		struct process_info *pi = list_entry (iter, struct process_info, list);
-		iter = iter->next;
+	group = cpg_group_find (group_name);
+	if (group == NULL) {
+		return NULL;
+	}
+
+	for (iter = group->pi_head.next; iter != &group->pi_head; iter = iter->next) {
+		struct process_info *pi = list_entry (iter, struct process_info, group_list);
 
-		if (pi->pid == pid && pi->nodeid == nodeid &&
-			mar_name_compare (&pi->group, group_name) == 0) {
+		if (pi->pid == pid && pi->nodeid == nodeid) {
 				return pi;
 		}
 	}
@@ -1245,6 +1794,49 @@ static struct process_info *process_info_find(const mar_cpg_name_t *group_name,
 	return NULL;
 }
 
+/*
+ * Insert list entry before first entry with higher nodeid and pid, so
+ * synchronization works properly
+ */
+static void process_info_list_insert(struct list_head *head, struct list_head *entry,
+	const struct process_info *pi, int group_list)
+{
+	struct list_head *list;
+	struct list_head *list_to_add = head;
+	struct process_info *pi_entry;
+
+	for (list = head->next; list != head; list = list->next) {
+		if (group_list) {
+			pi_entry = list_entry(list, struct process_info, group_list);
+		} else {
+			pi_entry = list_entry(list, struct process_info, list);
+		}
+		if (pi_entry->nodeid > pi->nodeid ||
+			(pi_entry->nodeid == pi->nodeid && pi_entry->pid > pi->pid)) {
+
+			break;
+		}
+		list_to_add = list;
+	}
+	list_add (entry, list_to_add);
+}
+
+static void process_info_del(struct process_info *pi)
+{
+	struct cpg_group *group;
+
+	group = cpg_group_find (&pi->group);
+	if (group != NULL) {
+		list_del (&pi->group_list);
+		group->pi_entries--;
+		cpg_group_node_del (group, pi->nodeid);
+	}
+	list_del (&pi->list);
+	free (pi);
+
+	cpg_group_release (group);
+}
+
 static void do_proc_join(
 	const mar_cpg_name_t *name,
 	uint32_t pid,
@@ -1252,39 +1844,32 @@ static void do_proc_join(
 	int reason)
 {
 	struct process_info *pi;
-	struct process_info *pi_entry;
+	struct cpg_group *group;
 	mar_cpg_address_t notify_info;
-	struct list_head *list;
-	struct list_head *list_to_add = NULL;
 
 	if (process_info_find (name, pid, nodeid) != NULL) {
 		return ;
  	}
 	pi = malloc (sizeof (struct process_info));
-	if (!pi) {
+	group = cpg_group_get (name);
+	if (!pi || !group || cpg_group_node_add (group, nodeid) != 0) {
 		log_printf(LOGSYS_LEVEL_WARNING, "Unable to allocate process_info struct");
+		free (pi);
+		cpg_group_release (group);
 		return;
 	}
 	pi->nodeid = nodeid;
 	pi->pid = pid;
 	memcpy(&pi->group, name, sizeof(*name));
 	list_init(&pi->list);
+	list_init(&pi->group_list);
 
 	/*
 	 * Insert new process in sorted order so synchronization works properly
 	 */
-	list_to_add = &process_info_list_head;
-	for (list = process_info_list_head.next; list != &process_info_list_head; list = list->next) {
-
-		pi_entry = list_entry(list, struct process_info, list);
-		if (pi_entry->nodeid > pi->nodeid ||
-			(pi_entry->nodeid == pi->nodeid && pi_entry->pid > pi->pid)) {
-
-			break;
-		}
-		list_to_add = list;
-	}
-	list_add (&pi->list, list_to_add);
+	process_info_list_insert (&process_info_list_head, &pi->list, pi, 0);
+	process_info_list_insert (&group->pi_head, &pi->group_list, pi, 1);
+	group->pi_entries++;
 
 	notify_info.pid = pi->pid;
 	notify_info.nodeid = nodeid;
@@ -1303,7 +1888,6 @@ static void do_proc_leave(
 	int reason)
 {
 	struct process_info *pi;
-	struct list_head *iter;
 	mar_cpg_address_t notify_info;
 
 	notify_info.pid = pid;
@@ -1315,15 +1899,9 @@ static void do_proc_leave(
 		1, &notify_info,
 		MESSAGE_RES_CPG_CONFCHG_CALLBACK);
 
-	for (iter = process_info_list_head.next; iter != &process_info_list_head; ) {
-		pi = list_entry(iter, struct process_info, list);
-		iter = iter->next;
-
-		if (pi->pid == pid && pi->nodeid == nodeid &&
-			mar_name_compare (&pi->group, name)==0) {
-			list_del (&pi->list);
-			free (pi);
-		}
+	pi = process_info_find (name, pid, nodeid);
+	if (pi != NULL) {
+		process_info_del (pi);
 	}
 }
 
@@ -1340,6 +1918,8 @@ static void message_handler_req_exec_cpg_downlist(
 	unsigned int nodeid)
 {
 	const struct req_exec_cpg_downlist *req_exec_cpg_downlist = message;
+	const struct req_exec_cpg_downlist_trailer *trailer;
+	size_t trailer_offset;
 	int i;
 	struct list_head *iter;
 	struct downlist_msg *stored_msg;
@@ -1351,8 +1931,27 @@ static void message_handler_req_exec_cpg_downlist(
 		return;
 	}
 
+	if (req_exec_cpg_downlist->left_nodes > PROCESSOR_COUNT_MAX) {
+		log_printf (LOGSYS_LEVEL_WARNING, "downlist with invalid left_list: %d received",
+			req_exec_cpg_downlist->left_nodes);
+		return;
+	}
+
 	stored_msg = malloc (sizeof (struct downlist_msg));
 	stored_msg->sender_nodeid = nodeid;
+
+	/*
+	 * Older nodes send full message without trailer
+	 */
+	stored_msg->sync_version = 0;
+	trailer_offset = downlist_trailer_offset (req_exec_cpg_downlist->left_nodes);
+	if (req_exec_cpg_downlist->header.size == trailer_offset + sizeof (*trailer)) {
+		trailer = (const struct req_exec_cpg_downlist_trailer *)((const char *)message + trailer_offset);
+		if (trailer->magic == CPG_SYNC_TRAILER_MAGIC) {
+			stored_msg->sync_version = trailer->sync_version;
+		}
+	}
+
 	stored_msg->old_members = req_exec_cpg_downlist->old_members;
 	stored_msg->left_nodes = req_exec_cpg_downlist->left_nodes;
 	memcpy (stored_msg->nodeids, req_exec_cpg_downlist->nodeids,
@@ -1438,14 +2037,84 @@ static void message_handler_req_exec_cpg_joinlist (
 	}
 }
 
-static void message_handler_req_exec_cpg_mcast (
+static void message_handler_req_exec_cpg_joinlist_compact (
 	const void *message,
 	unsigned int nodeid)
 {
-	const struct req_exec_cpg_mcast *req_exec_cpg_mcast = message;
+	const struct req_exec_cpg_joinlist_compact *req_exec_cpg_joinlist = message;
+	const uint8_t *pos = req_exec_cpg_joinlist->data;
+	const uint8_t *end = (const uint8_t *)message + req_exec_cpg_joinlist->header.size;
+	struct joinlist_msg *stored_msg;
+	mar_cpg_name_t group_name;
+	uint32_t name_len;
+	uint32_t count;
+	uint32_t delta;
+	uint32_t pid;
+	uint32_t i, j;
+
+	log_printf(LOGSYS_LEVEL_DEBUG, "got compact joinlist message from node 0x%x",
+		nodeid);
+
+	if (req_exec_cpg_joinlist->version != CPG_SYNC_VERSION_COMPACT ||
+	    req_exec_cpg_joinlist->header.size < sizeof (*req_exec_cpg_joinlist)) {
+		log_printf(LOGSYS_LEVEL_WARNING, "Unsupported joinlist version %u from node 0x%x",
+			req_exec_cpg_joinlist->version, nodeid);
+		return ;
+	}
+
+	for (i = 0; i < req_exec_cpg_joinlist->groups; i++) {
+		if (pos >= end) {
+			goto invalid_msg;
+		}
+		name_len = *pos++;
+		if (name_len > CPG_MAX_NAME_LENGTH || pos + name_len > end) {
+			goto invalid_msg;
+		}
+		memset (&group_name, 0, sizeof (group_name));
+		group_name.length = name_len;
+		memcpy (group_name.value, pos, name_len);
+		pos += name_len;
+
+		if (cpg_varint_get (&pos, end, &count) != 0) {
+			goto invalid_msg;
+		}
+
+		pid = 0;
+		for (j = 0; j < count; j++) {
+			if (cpg_varint_get (&pos, end, &delta) != 0) {
+				goto invalid_msg;
+			}
+			pid += delta;
+
+			stored_msg = malloc (sizeof (struct joinlist_msg));
+			memset(stored_msg, 0, sizeof (struct joinlist_msg));
+			stored_msg->sender_nodeid = nodeid;
+			stored_msg->pid = pid;
+			memcpy(&stored_msg->group_name, &group_name, sizeof(mar_cpg_name_t));
+			list_init (&stored_msg->list);
+			list_add (&stored_msg->list, &joinlist_messages_head);
+		}
+	}
+
+	return ;
+
+invalid_msg:
+	log_printf(LOGSYS_LEVEL_WARNING, "Invalid compact joinlist message from node 0x%x", nodeid);
+}
+
+/*
+ * Deliver message to all local members of the group
+ */
+static void cpg_mcast_deliver (
+	const mar_cpg_name_t *group_name,
+	uint32_t pid,
+	unsigned int nodeid,
+	const void *msg,
+	int msglen)
+{
 	struct res_lib_cpg_deliver_callback res_lib_cpg_mcast;
-	int msglen = req_exec_cpg_mcast->msglen;
-	struct list_head *iter, *pi_iter;
+	struct list_head *iter;
+	struct cpg_group *group;
 	struct cpg_pd *cpd;
 	struct iovec iovec[2];
 	int known_node = 0;
@@ -1453,37 +2122,34 @@ static void message_handler_req_exec_cpg_mcast (
 	res_lib_cpg_mcast.header.id = MESSAGE_RES_CPG_DELIVER_CALLBACK;
 	res_lib_cpg_mcast.header.size = sizeof(res_lib_cpg_mcast) + msglen;
 	res_lib_cpg_mcast.msglen = msglen;
-	res_lib_cpg_mcast.pid = req_exec_cpg_mcast->pid;
+	res_lib_cpg_mcast.pid = pid;
 	res_lib_cpg_mcast.nodeid = nodeid;
 
-	memcpy(&res_lib_cpg_mcast.group_name, &req_exec_cpg_mcast->group_name,
+	memcpy(&res_lib_cpg_mcast.group_name, group_name,
 		sizeof(mar_cpg_name_t));
 	iovec[0].iov_base = (void *)&res_lib_cpg_mcast;
 	iovec[0].iov_len = sizeof (res_lib_cpg_mcast);
 
-	iovec[1].iov_base = (char*)message+sizeof(*req_exec_cpg_mcast);
+	iovec[1].iov_base = (void *)msg;
 	iovec[1].iov_len = msglen;
 
-	for (iter = cpg_pd_list_head.next; iter != &cpg_pd_list_head; ) {
-		cpd = list_entry(iter, struct cpg_pd, list);
+	cpg_shm_deliver_token++;
+
+	group = cpg_group_find (group_name);
+	if (group == NULL) {
+		cpg_shm_arenas_gc ();
+		return ;
+	}
+
+	for (iter = group->cpd_head.next; iter != &group->cpd_head; ) {
+		cpd = list_entry(iter, struct cpg_pd, group_list);
 		iter = iter->next;
 
-		if ((cpd->cpd_state == CPD_STATE_LEAVE_STARTED || cpd->cpd_state == CPD_STATE_JOIN_COMPLETED)
-			&& (mar_name_compare (&cpd->group_name, &req_exec_cpg_mcast->group_name) == 0)) {
+		if (cpd->cpd_state == CPD_STATE_LEAVE_STARTED || cpd->cpd_state == CPD_STATE_JOIN_COMPLETED) {
 
 			if (!known_node) {
 				/* Try to find, if we know the node */
-				for (pi_iter = process_info_list_head.next;
-					pi_iter != &process_info_list_head; pi_iter = pi_iter->next) {
-
-					struct process_info *pi = list_entry (pi_iter, struct process_info, list);
-
-					if (pi->nodeid == nodeid &&
-						mar_name_compare (&pi->group, &req_exec_cpg_mcast->group_name) == 0) {
-						known_node = 1;
-						break;
-					}
-				}
+				known_node = (cpg_group_node_find (group, nodeid) != NULL);
 			}
 
 			if (!known_node) {
@@ -1491,9 +2157,82 @@ static void message_handler_req_exec_cpg_mcast (
 				return ;
 			}
 
+			if (cpg_shm_deliver (cpd, &res_lib_cpg_mcast, iovec[1].iov_base) == 0) {
+				continue;
+			}
+
 			api->ipc_dispatch_iov_send (cpd->conn, iovec, 2);
 		}
 	}
+
+	cpg_shm_arenas_gc ();
+}
+
+/*
+ * Own message sent through totem was delivered. Once none is outstanding,
+ * FIFO messages of the sender may be delivered locally again without breaking
+ * their order.
+ */
+static void cpg_mcast_in_flight_dec (
+	const mar_cpg_name_t *group_name,
+	uint32_t pid,
+	const mar_message_source_t *source)
+{
+	struct list_head *iter;
+	struct cpg_group *group;
+	struct cpg_pd *cpd;
+
+	if (!api->ipc_source_is_local (source)) {
+		return ;
+	}
+
+	group = cpg_group_find (group_name);
+	if (group == NULL) {
+		return ;
+	}
+
+	for (iter = group->cpd_head.next; iter != &group->cpd_head; iter = iter->next) {
+		cpd = list_entry(iter, struct cpg_pd, group_list);
+
+		if (cpd->conn == source->conn && cpd->pid == pid) {
+			if (cpd->mcast_in_flight > 0) {
+				cpd->mcast_in_flight--;
+			}
+			return ;
+		}
+	}
+}
+
+static void message_handler_req_exec_cpg_mcast (
+	const void *message,
+	unsigned int nodeid)
+{
+	const struct req_exec_cpg_mcast *req_exec_cpg_mcast = message;
+
+	cpg_mcast_in_flight_dec (&req_exec_cpg_mcast->group_name,
+		req_exec_cpg_mcast->pid, &req_exec_cpg_mcast->source);
+
+	cpg_mcast_deliver (&req_exec_cpg_mcast->group_name, req_exec_cpg_mcast->pid,
+		nodeid, (const char *)message + sizeof(*req_exec_cpg_mcast),
+		req_exec_cpg_mcast->msglen);
+}
+
+static void message_handler_req_exec_cpg_mcast_fifo_local (
+	const void *message,
+	unsigned int nodeid)
+{
+	const struct req_exec_cpg_mcast *req_exec_cpg_mcast = message;
+
+	if (api->ipc_source_is_local (&req_exec_cpg_mcast->source)) {
+		/*
+		 * Already delivered to local members when it was sent
+		 */
+		return ;
+	}
+
+	cpg_mcast_deliver (&req_exec_cpg_mcast->group_name, req_exec_cpg_mcast->pid,
+		nodeid, (const char *)message + sizeof(*req_exec_cpg_mcast),
+		req_exec_cpg_mcast->msglen);
 }
 
 static void message_handler_req_exec_cpg_partial_mcast (
@@ -1503,13 +2242,17 @@ static void message_handler_req_exec_cpg_partial_mcast (
 	const struct req_exec_cpg_partial_mcast *req_exec_cpg_mcast = message;
 	struct res_lib_cpg_partial_deliver_callback res_lib_cpg_mcast;
 	int msglen = req_exec_cpg_mcast->fraglen;
-	struct list_head *iter, *pi_iter;
+	struct list_head *iter;
+	struct cpg_group *group;
 	struct cpg_pd *cpd;
 	struct iovec iovec[2];
 	int known_node = 0;
 
 	log_printf(LOGSYS_LEVEL_DEBUG, "Got fragmented message from node %d, size = %d bytes\n", nodeid, msglen);
 
+	cpg_mcast_in_flight_dec (&req_exec_cpg_mcast->group_name,
+		req_exec_cpg_mcast->pid, &req_exec_cpg_mcast->source);
+
 	res_lib_cpg_mcast.header.id = MESSAGE_RES_CPG_PARTIAL_DELIVER_CALLBACK;
 	res_lib_cpg_mcast.header.size = sizeof(res_lib_cpg_mcast) + msglen;
 	res_lib_cpg_mcast.fraglen = msglen;
@@ -1526,26 +2269,20 @@ static void message_handler_req_exec_cpg_partial_mcast (
 	iovec[1].iov_base = (char*)message+sizeof(*req_exec_cpg_mcast);
 	iovec[1].iov_len = msglen;
 
-	for (iter = cpg_pd_list_head.next; iter != &cpg_pd_list_head; ) {
-		cpd = list_entry(iter, struct cpg_pd, list);
+	group = cpg_group_find (&req_exec_cpg_mcast->group_name);
+	if (group == NULL) {
+		return ;
+	}
+
+	for (iter = group->cpd_head.next; iter != &group->cpd_head; ) {
+		cpd = list_entry(iter, struct cpg_pd, group_list);
 		iter = iter->next;
 
-		if ((cpd->cpd_state == CPD_STATE_LEAVE_STARTED || cpd->cpd_state == CPD_STATE_JOIN_COMPLETED)
-		    && (mar_name_compare (&cpd->group_name, &req_exec_cpg_mcast->group_name) == 0)) {
+		if (cpd->cpd_state == CPD_STATE_LEAVE_STARTED || cpd->cpd_state == CPD_STATE_JOIN_COMPLETED) {
 
 			if (!known_node) {
 				/* Try to find, if we know the node */
-				for (pi_iter = process_info_list_head.next;
-				     pi_iter != &process_info_list_head; pi_iter = pi_iter->next) {
-
-					struct process_info *pi = list_entry (pi_iter, struct process_info, list);
-
-					if (pi->nodeid == nodeid &&
-					    mar_name_compare (&pi->group, &req_exec_cpg_mcast->group_name) == 0) {
-						known_node = 1;
-						break;
-					}
-				}
+				known_node = (cpg_group_node_find (group, nodeid) != NULL);
 			}
 
 			if (!known_node) {
@@ -1561,20 +2298,32 @@ static void message_handler_req_exec_cpg_partial_mcast (
 
 static int cpg_exec_send_downlist(void)
 {
-	struct iovec iov;
+	struct iovec iov[2];
+	struct req_exec_cpg_downlist_trailer trailer;
+	size_t trailer_offset;
+
+	/*
+	 * Only used part of nodeids is sent, followed by trailer
+	 */
+	trailer_offset = downlist_trailer_offset (g_req_exec_cpg_downlist.left_nodes);
+	memset (&trailer, 0, sizeof (trailer));
+	trailer.magic = CPG_SYNC_TRAILER_MAGIC;
+	trailer.sync_version = CPG_SYNC_VERSION;
 
 	g_req_exec_cpg_downlist.header.id = SERVICE_ID_MAKE(CPG_SERVICE, MESSAGE_REQ_EXEC_CPG_DOWNLIST);
-	g_req_exec_cpg_downlist.header.size = sizeof(struct req_exec_cpg_downlist);
+	g_req_exec_cpg_downlist.header.size = trailer_offset + sizeof (trailer);
 
 	g_req_exec_cpg_downlist.old_members = my_old_member_list_entries;
 
-	iov.iov_base = (void *)&g_req_exec_cpg_downlist;
-	iov.iov_len = g_req_exec_cpg_downlist.header.size;
+	iov[0].iov_base = (void *)&g_req_exec_cpg_downlist;
+	iov[0].iov_len = trailer_offset;
+	iov[1].iov_base = (void *)&trailer;
+	iov[1].iov_len = sizeof (trailer);
 
-	return (api->totem_mcast (&iov, 1, TOTEM_AGREED));
+	return (api->totem_mcast (iov, 2, TOTEM_AGREED));
 }
 
-static int cpg_exec_send_joinlist(void)
+static int cpg_exec_send_joinlist_old(void)
 {
 	int count = 0;
 	struct list_head *iter;
@@ -1620,74 +2369,282 @@ static int cpg_exec_send_joinlist(void)
 	req_exec_cpg_iovec.iov_base = buf;
 	req_exec_cpg_iovec.iov_len = res->size;
 
+	sync_joinlist_msgs = 1;
+	sync_joinlist_bytes = res->size;
+
 	return (api->totem_mcast (&req_exec_cpg_iovec, 1, TOTEM_AGREED));
 }
 
-static int cpg_lib_init_fn (void *conn)
+/*
+ * Max size of group entry with one pid
+ */
+#define CPG_JOINLIST_COMPACT_ENTRY_MIN (1 + CPG_MAX_NAME_LENGTH + 5 + 5)
+
+static struct joinlist_compact_buf *joinlist_compact_buf_new (void)
 {
-	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
-	memset (cpd, 0, sizeof(struct cpg_pd));
-	cpd->conn = conn;
-	list_add (&cpd->list, &cpg_pd_list_head);
+	struct joinlist_compact_buf *buf;
+	struct req_exec_cpg_joinlist_compact *req;
 
-	list_init (&cpd->iteration_instance_list_head);
-	list_init (&cpd->zcb_mapped_list_head);
+	buf = malloc (sizeof (struct joinlist_compact_buf) + CPG_JOINLIST_COMPACT_MSG_MAX);
+	if (buf == NULL) {
+		return (NULL);
+	}
 
-	api->ipc_refcnt_inc (conn);
-	log_printf(LOGSYS_LEVEL_DEBUG, "lib_init_fn: conn=%p, cpd=%p", conn, cpd);
-	return (0);
+	req = (struct req_exec_cpg_joinlist_compact *)buf->data;
+	memset (req, 0, sizeof (*req));
+	req->header.id = SERVICE_ID_MAKE(CPG_SERVICE, MESSAGE_REQ_EXEC_CPG_JOINLIST_COMPACT);
+	req->version = CPG_SYNC_VERSION_COMPACT;
+	buf->size = sizeof (*req);
+
+	list_init (&buf->list);
+	list_add_tail (&buf->list, &joinlist_compact_send_head);
+
+	return (buf);
 }
 
-/* Join message from the library */
-static void message_handler_req_lib_cpg_join (void *conn, const void *message)
+/*
+ * Encode local processes of all groups into as few messages as possible
+ */
+static int joinlist_compact_build (void)
 {
-	const struct req_lib_cpg_join *req_lib_cpg_join = message;
-	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
-	struct res_lib_cpg_join res_lib_cpg_join;
-	cs_error_t error = CS_OK;
-	struct list_head *iter;
+	unsigned int local_nodeid = api->totem_nodeid_get ();
+	struct joinlist_compact_buf *buf = NULL;
+	struct req_exec_cpg_joinlist_compact *req = NULL;
+	struct list_head *iter, *pi_iter, *n_iter;
+	struct cpg_group *group;
+	struct process_info *pi;
+	uint8_t *pos;
+	uint32_t prev_pid;
+	size_t n_fit;
+	size_t n;
+	int i;
 
-	/* Test, if we don't have same pid and group name joined */
-	for (iter = cpg_pd_list_head.next; iter != &cpg_pd_list_head; iter = iter->next) {
-		struct cpg_pd *cpd_item = list_entry (iter, struct cpg_pd, list);
+	for (i = 0; i < GROUP_HASH_SIZE; i++) {
+		for (iter = cpg_group_hash[i].next; iter != &cpg_group_hash[i]; iter = iter->next) {
+			group = list_entry (iter, struct cpg_group, list);
 
-		if (cpd_item->pid == req_lib_cpg_join->pid &&
-			mar_name_compare(&req_lib_cpg_join->group_name, &cpd_item->group_name) == 0) {
+			/*
+			 * Local processes are stored together, sorted by pid
+			 */
+			for (pi_iter = group->pi_head.next; pi_iter != &group->pi_head; pi_iter = pi_iter->next) {
+				pi = list_entry (pi_iter, struct process_info, group_list);
+				if (pi->nodeid == local_nodeid) {
+					break;
+				}
+			}
 
-			/* We have same pid and group name joined -> return error */
-			error = CS_ERR_EXIST;
-			goto response_send;
-		}
-	}
+			while (pi_iter != &group->pi_head &&
+			    list_entry (pi_iter, struct process_info, group_list)->nodeid == local_nodeid) {
+				if (buf == NULL ||
+				    buf->size + CPG_JOINLIST_COMPACT_ENTRY_MIN > CPG_JOINLIST_COMPACT_MSG_MAX) {
+					buf = joinlist_compact_buf_new ();
+					if (buf == NULL) {
+						return (-1);
+					}
+					req = (struct req_exec_cpg_joinlist_compact *)buf->data;
+				}
 
-	/*
-	 * Same check must be done in process info list, because there may be not yet delivered
-	 * leave of client.
-	 */
-	for (iter = process_info_list_head.next; iter != &process_info_list_head; iter = iter->next) {
-		struct process_info *pi = list_entry (iter, struct process_info, list);
+				/*
+				 * Count pids which fit into this message
+				 */
+				n_fit = (CPG_JOINLIST_COMPACT_MSG_MAX - buf->size -
+				    (1 + CPG_MAX_NAME_LENGTH + 5)) / 5;
+				n = 0;
+				for (n_iter = pi_iter; n_iter != &group->pi_head && n < n_fit; n_iter = n_iter->next) {
+					if (list_entry (n_iter, struct process_info, group_list)->nodeid != local_nodeid) {
+						break;
+					}
+					n++;
+				}
+
+				pos = (uint8_t *)buf->data + buf->size;
+				*pos++ = group->name.length;
+				memcpy (pos, group->name.value, group->name.length);
+				pos += group->name.length;
+				pos += cpg_varint_put (pos, n);
+
+				prev_pid = 0;
+				while (n > 0) {
+					pi = list_entry (pi_iter, struct process_info, group_list);
+					pos += cpg_varint_put (pos, pi->pid - prev_pid);
+					prev_pid = pi->pid;
+					pi_iter = pi_iter->next;
+					n--;
+				}
 
-		if (pi->nodeid == api->totem_nodeid_get () && pi->pid == req_lib_cpg_join->pid &&
-		    mar_name_compare(&req_lib_cpg_join->group_name, &pi->group) == 0) {
-			/* We have same pid and group name joined -> return error */
-			error = CS_ERR_TRY_AGAIN;
-			goto response_send;
+				buf->size = pos - (uint8_t *)buf->data;
+				req->groups++;
+			}
 		}
 	}
 
-	if (req_lib_cpg_join->group_name.length > CPG_MAX_NAME_LENGTH) {
-		error = CS_ERR_NAME_TOO_LONG;
-		goto response_send;
+	for (iter = joinlist_compact_send_head.next; iter != &joinlist_compact_send_head; iter = iter->next) {
+		buf = list_entry (iter, struct joinlist_compact_buf, list);
+		memset (buf->data + buf->size, 0, ((buf->size + 7) & ~((size_t)7)) - buf->size);
+		buf->size = (buf->size + 7) & ~((size_t)7);
+		req = (struct req_exec_cpg_joinlist_compact *)buf->data;
+		req->header.size = buf->size;
 	}
 
-	switch (cpd->cpd_state) {
-	case CPD_STATE_UNJOINED:
-		error = CS_OK;
+	return (0);
+}
+
+static int cpg_exec_send_joinlist_compact(void)
+{
+	struct joinlist_compact_buf *buf;
+	struct iovec iov;
+
+	if (!joinlist_built) {
+		if (joinlist_compact_build () != 0) {
+			log_printf(LOGSYS_LEVEL_WARNING, "Unable to allocate joinlist buffer");
+			joinlist_compact_bufs_delete ();
+			return (-1);
+		}
+		joinlist_built = 1;
+	}
+
+	/*
+	 * Messages already sent are freed, so retry continues with first unsent one
+	 */
+	while (!list_empty (&joinlist_compact_send_head)) {
+		buf = list_entry (joinlist_compact_send_head.next, struct joinlist_compact_buf, list);
+
+		iov.iov_base = buf->data;
+		iov.iov_len = buf->size;
+		if (api->totem_mcast (&iov, 1, TOTEM_AGREED) != 0) {
+			return (-1);
+		}
+
+		sync_joinlist_msgs++;
+		sync_joinlist_bytes += buf->size;
+
+		list_del (&buf->list);
+		free (buf);
+	}
+
+	return (0);
+}
+
+/*
+ * Lowest sync version announced by members. Member without downlist counts
+ * as one not knowing any.
+ */
+static uint32_t cpg_sync_version_min (void)
+{
+	struct list_head *iter;
+	struct downlist_msg *stored_msg;
+	uint32_t res = CPG_SYNC_VERSION;
+	int i;
+	int found;
+
+	for (i = 0; i < my_member_list_entries; i++) {
+		found = 0;
+		for (iter = downlist_messages_head.next;
+			iter != &downlist_messages_head;
+			iter = iter->next) {
+
+			stored_msg = list_entry(iter, struct downlist_msg, list);
+			if (my_member_list[i] == stored_msg->sender_nodeid) {
+				found = 1;
+				if (stored_msg->sync_version < res) {
+					res = stored_msg->sync_version;
+				}
+				break;
+			}
+		}
+		if (!found) {
+			return (0);
+		}
+	}
+
+	return (res);
+}
+
+static int cpg_exec_send_joinlist(void)
+{
+	/*
+	 * Compact joinlist is used only if all members understand it
+	 */
+	if (cpg_sync_version_min () >= CPG_SYNC_VERSION_COMPACT) {
+		return (cpg_exec_send_joinlist_compact ());
+	}
+
+	return (cpg_exec_send_joinlist_old ());
+}
+
+static int cpg_lib_init_fn (void *conn)
+{
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	memset (cpd, 0, sizeof(struct cpg_pd));
+	cpd->conn = conn;
+	list_add (&cpd->list, &cpg_pd_list_head);
+	list_init (&cpd->group_list);
+
+	list_init (&cpd->iteration_instance_list_head);
+	list_init (&cpd->zcb_mapped_list_head);
+
+	api->ipc_refcnt_inc (conn);
+	log_printf(LOGSYS_LEVEL_DEBUG, "lib_init_fn: conn=%p, cpd=%p", conn, cpd);
+	return (0);
+}
+
+/* Join message from the library */
+static void message_handler_req_lib_cpg_join (void *conn, const void *message)
+{
+	const struct req_lib_cpg_join *req_lib_cpg_join = message;
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	struct res_lib_cpg_join res_lib_cpg_join;
+	cs_error_t error = CS_OK;
+	struct list_head *iter;
+	struct cpg_group *group;
+
+	if (req_lib_cpg_join->group_name.length > CPG_MAX_NAME_LENGTH) {
+		error = CS_ERR_NAME_TOO_LONG;
+		goto response_send;
+	}
+
+	group = cpg_group_find (&req_lib_cpg_join->group_name);
+
+	/* Test, if we don't have same pid and group name joined */
+	if (group != NULL) {
+		for (iter = group->cpd_head.next; iter != &group->cpd_head; iter = iter->next) {
+			struct cpg_pd *cpd_item = list_entry (iter, struct cpg_pd, group_list);
+
+			if (cpd_item->pid == req_lib_cpg_join->pid) {
+				/* We have same pid and group name joined -> return error */
+				error = CS_ERR_EXIST;
+				goto response_send;
+			}
+		}
+	}
+
+	/*
+	 * Same check must be done in process info list, because there may be not yet delivered
+	 * leave of client.
+	 */
+	if (process_info_find (&req_lib_cpg_join->group_name, req_lib_cpg_join->pid,
+	    api->totem_nodeid_get ()) != NULL) {
+		/* We have same pid and group name joined -> return error */
+		error = CS_ERR_TRY_AGAIN;
+		goto response_send;
+	}
+
+	switch (cpd->cpd_state) {
+	case CPD_STATE_UNJOINED:
+		error = CS_OK;
 		cpd->cpd_state = CPD_STATE_JOIN_STARTED;
 		cpd->pid = req_lib_cpg_join->pid;
 		cpd->flags = req_lib_cpg_join->flags;
+		cpd->mcast_in_flight = 0;
 		memcpy (&cpd->group_name, &req_lib_cpg_join->group_name,
 			sizeof (cpd->group_name));
+		if (cpg_group_cpd_add (cpd) != 0) {
+			error = CS_ERR_NO_MEMORY;
+			cpd->cpd_state = CPD_STATE_UNJOINED;
+			cpd->pid = 0;
+			memset (&cpd->group_name, 0, sizeof (cpd->group_name));
+			break;
+		}
 
 		cpg_node_joinleave_send (req_lib_cpg_join->pid,
 			&req_lib_cpg_join->group_name,
@@ -1765,6 +2722,7 @@ static void message_handler_req_lib_cpg_finalize (
 	 */
 	list_del (&cpd->list);
 	list_init (&cpd->list);
+	cpg_group_release (cpg_group_cpd_del (cpd));
 
 	res_lib_cpg_finalize.header.size = sizeof (res_lib_cpg_finalize);
 	res_lib_cpg_finalize.header.id = MESSAGE_RES_CPG_FINALIZE;
@@ -1899,6 +2857,401 @@ static inline int zcb_all_free (
 	return (0);
 }
 
+static struct cpg_shm_arena *cpg_shm_arena_create (
+	const mar_cpg_name_t *group_name,
+	uid_t uid)
+{
+	struct cpg_shm_arena *arena;
+	int32_t fd;
+	void *addr;
+	char *buffer;
+	size_t written;
+	size_t page_size;
+	long int sysconf_page_size;
+	mode_t old_umask;
+	int32_t i;
+
+	arena = malloc (sizeof (struct cpg_shm_arena));
+	if (arena == NULL) {
+		return (NULL);
+	}
+	memset (arena, 0, sizeof (struct cpg_shm_arena));
+
+	snprintf (arena->path, sizeof (arena->path), "/dev/shm/corosync-cpg-shm-XXXXXX");
+	old_umask = umask (CPG_SHM_UMASK);
+	fd = mkstemp (arena->path);
+	(void)umask (old_umask);
+	if (fd == -1) {
+		snprintf (arena->path, sizeof (arena->path),
+			LOCALSTATEDIR "/run/corosync-cpg-shm-XXXXXX");
+		old_umask = umask (CPG_SHM_UMASK);
+		fd = mkstemp (arena->path);
+		(void)umask (old_umask);
+		if (fd == -1) {
+			goto error_free;
+		}
+	}
+
+	if (ftruncate (fd, CPG_SHM_ARENA_SIZE) == -1) {
+		goto error_close_unlink;
+	}
+
+	/*
+	 * Fill the file, so running out of space in tmpfs can't end by SIGBUS
+	 * when message is stored later
+	 */
+	sysconf_page_size = sysconf (_SC_PAGESIZE);
+	if (sysconf_page_size <= 0) {
+		goto error_close_unlink;
+	}
+	page_size = sysconf_page_size;
+	buffer = malloc (page_size);
+	if (buffer == NULL) {
+		goto error_close_unlink;
+	}
+	memset (buffer, 0, page_size);
+	for (i = 0; i < (CPG_SHM_ARENA_SIZE / page_size); i++) {
+retry_write:
+		written = write (fd, buffer, page_size);
+		if (written == -1 && errno == EINTR) {
+			goto retry_write;
+		}
+		if (written != page_size) {
+			free (buffer);
+			goto error_close_unlink;
+		}
+	}
+	free (buffer);
+
+	/*
+	 * Only members running under uid are able to map the arena
+	 */
+	if (fchown (fd, uid, -1) == -1) {
+		log_printf (LOGSYS_LEVEL_WARNING, "Can't change owner of %s: %s",
+			arena->path, strerror (errno));
+		goto error_close_unlink;
+	}
+
+	addr = mmap (NULL, CPG_SHM_ARENA_SIZE, PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		goto error_close_unlink;
+	}
+	close (fd);
+
+	memcpy (&arena->group_name, group_name, sizeof (mar_cpg_name_t));
+	arena->uid = uid;
+	arena->id = cpg_shm_arena_id_next++;
+	arena->addr = addr;
+	arena->size = CPG_SHM_ARENA_SIZE;
+	arena->seq_next = 1;
+	arena->seq_tail = 1;
+	list_init (&arena->list);
+	list_add (&arena->list, &cpg_shm_arena_list_head);
+
+	log_printf (LOGSYS_LEVEL_DEBUG, "Created shared delivery arena %s for group %s, uid %u",
+		arena->path, cpg_print_group_name (group_name), (unsigned int)uid);
+
+	return (arena);
+
+error_close_unlink:
+	close (fd);
+	unlink (arena->path);
+error_free:
+	free (arena);
+	return (NULL);
+}
+
+static void cpg_shm_arena_destroy (struct cpg_shm_arena *arena)
+{
+	log_printf (LOGSYS_LEVEL_DEBUG, "Destroying shared delivery arena %s", arena->path);
+
+	list_del (&arena->list);
+	munmap (arena->addr, arena->size);
+	unlink (arena->path);
+	free (arena);
+}
+
+static struct cpg_shm_arena *cpg_shm_arena_get (
+	const mar_cpg_name_t *group_name,
+	uid_t uid)
+{
+	struct list_head *iter;
+	struct cpg_shm_arena *arena;
+
+	for (iter = cpg_shm_arena_list_head.next; iter != &cpg_shm_arena_list_head; iter = iter->next) {
+		arena = list_entry (iter, struct cpg_shm_arena, list);
+
+		if (arena->uid == uid && mar_name_compare (&arena->group_name, group_name) == 0) {
+			return (arena);
+		}
+	}
+
+	return (cpg_shm_arena_create (group_name, uid));
+}
+
+/*
+ * Data are stored as a ring in order of seq. data_tail is offset of the
+ * oldest slot still in use, so free space is [head, size) + [0, tail) or
+ * [head, tail) when ring is wrapped.
+ */
+static int cpg_shm_arena_alloc (
+	struct cpg_shm_arena *arena,
+	size_t len,
+	uint64_t *seq)
+{
+	struct cpg_shm_slot *slot;
+	size_t aligned_len = (len + 7) & ~((size_t)7);
+	size_t offset;
+	int empty = (arena->seq_tail == arena->seq_next);
+
+	if (arena->seq_next - arena->seq_tail >= CPG_SHM_SLOTS_MAX) {
+		return (-1);
+	}
+
+	if (empty) {
+		arena->data_head = 0;
+		arena->data_tail = 0;
+	}
+
+	if (empty || arena->data_head > arena->data_tail) {
+		if (arena->size - arena->data_head >= aligned_len) {
+			offset = arena->data_head;
+		} else if (arena->data_tail >= aligned_len) {
+			offset = 0;
+		} else {
+			return (-1);
+		}
+	} else {
+		if (arena->data_tail - arena->data_head >= aligned_len) {
+			offset = arena->data_head;
+		} else {
+			return (-1);
+		}
+	}
+
+	arena->data_head = offset + aligned_len;
+
+	*seq = arena->seq_next++;
+	slot = &arena->slots[*seq % CPG_SHM_SLOTS_MAX];
+	slot->offset = offset;
+	slot->len = len;
+	slot->refs = 0;
+
+	return (0);
+}
+
+static void cpg_shm_arena_gc (struct cpg_shm_arena *arena)
+{
+	while (arena->seq_tail != arena->seq_next &&
+	    arena->slots[arena->seq_tail % CPG_SHM_SLOTS_MAX].refs == 0) {
+		arena->seq_tail++;
+	}
+
+	if (arena->seq_tail != arena->seq_next) {
+		arena->data_tail = arena->slots[arena->seq_tail % CPG_SHM_SLOTS_MAX].offset;
+	}
+}
+
+static void cpg_shm_arenas_gc (void)
+{
+	struct list_head *iter;
+	struct cpg_shm_arena *arena;
+
+	for (iter = cpg_shm_arena_list_head.next; iter != &cpg_shm_arena_list_head; iter = iter->next) {
+		arena = list_entry (iter, struct cpg_shm_arena, list);
+
+		if (arena->alloc_token == cpg_shm_deliver_token) {
+			cpg_shm_arena_gc (arena);
+		}
+	}
+}
+
+/*
+ * Release shared deliveries of cpd up to and including seq
+ */
+static void cpg_shm_release (struct cpg_pd *cpd, uint64_t seq)
+{
+	struct cpg_shm_arena *arena = cpd->shm_arena;
+
+	while (cpd->shm_seq_first != cpd->shm_seq_next && cpd->shm_seq_first <= seq) {
+		arena->slots[cpd->shm_seq_first % CPG_SHM_SLOTS_MAX].refs--;
+		cpd->shm_seq_first++;
+	}
+
+	cpg_shm_arena_gc (arena);
+}
+
+static void cpg_shm_detach (struct cpg_pd *cpd)
+{
+	struct cpg_shm_arena *arena = cpd->shm_arena;
+
+	if (arena == NULL) {
+		return ;
+	}
+
+	cpg_shm_release (cpd, UINT64_MAX);
+
+	cpd->shm_arena = NULL;
+	cpd->shm_active = 0;
+	cpd->shm_seq_first = 0;
+	cpd->shm_seq_next = 0;
+
+	arena->attached--;
+	if (arena->attached == 0) {
+		cpg_shm_arena_destroy (arena);
+	}
+}
+
+/*
+ * Try to deliver message to cpd using shared arena. Message is stored in
+ * the arena by first member which gets it, other members only take reference.
+ * Returns 0 on success or -1 when message must be delivered by copy.
+ */
+static int cpg_shm_deliver (
+	struct cpg_pd *cpd,
+	const struct res_lib_cpg_deliver_callback *res,
+	const void *msg)
+{
+	struct cpg_shm_arena *arena = cpd->shm_arena;
+	struct res_lib_cpg_shm_deliver_callback res_lib_cpg_shm_deliver;
+	struct cpg_shm_slot *slot;
+	uint64_t seq;
+
+	if (arena == NULL || !cpd->shm_active || res->msglen < CPG_SHM_DELIVER_MIN_SIZE) {
+		return (-1);
+	}
+
+	if (arena->alloc_token != cpg_shm_deliver_token) {
+		arena->alloc_token = cpg_shm_deliver_token;
+		arena->alloc_seq = 0;
+
+		if (cpg_shm_arena_alloc (arena, res->msglen, &seq) == 0) {
+			slot = &arena->slots[seq % CPG_SHM_SLOTS_MAX];
+			memcpy (arena->addr + slot->offset, msg, res->msglen);
+			arena->alloc_seq = seq;
+		}
+	}
+
+	if (arena->alloc_seq == 0) {
+		return (-1);
+	}
+
+	/*
+	 * cpd holds continuous range of slots, so library can release them
+	 * by sending only last seq
+	 */
+	if (cpd->shm_seq_first == cpd->shm_seq_next) {
+		cpd->shm_seq_first = cpd->shm_seq_next = arena->alloc_seq;
+	}
+	if (cpd->shm_seq_next != arena->alloc_seq) {
+		return (-1);
+	}
+
+	slot = &arena->slots[arena->alloc_seq % CPG_SHM_SLOTS_MAX];
+
+	res_lib_cpg_shm_deliver.header.id = MESSAGE_RES_CPG_SHM_DELIVER_CALLBACK;
+	res_lib_cpg_shm_deliver.header.size = sizeof (res_lib_cpg_shm_deliver);
+	res_lib_cpg_shm_deliver.header.error = CS_OK;
+	memcpy (&res_lib_cpg_shm_deliver.group_name, &res->group_name,
+		sizeof (mar_cpg_name_t));
+	res_lib_cpg_shm_deliver.msglen = res->msglen;
+	res_lib_cpg_shm_deliver.nodeid = res->nodeid;
+	res_lib_cpg_shm_deliver.pid = res->pid;
+	res_lib_cpg_shm_deliver.arena_id = arena->id;
+	res_lib_cpg_shm_deliver.offset = slot->offset;
+	res_lib_cpg_shm_deliver.seq = arena->alloc_seq;
+
+	slot->refs++;
+	cpd->shm_seq_next++;
+
+	api->ipc_dispatch_send (cpd->conn, &res_lib_cpg_shm_deliver,
+		sizeof (res_lib_cpg_shm_deliver));
+
+	return (0);
+}
+
+static void message_handler_req_lib_cpg_shm_attach (
+	void *conn,
+	const void *message)
+{
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	struct res_lib_cpg_shm_attach res_lib_cpg_shm_attach;
+	struct cpg_shm_arena *arena;
+	cs_error_t error = CS_OK;
+	uid_t euid;
+	gid_t egid;
+
+	memset (&res_lib_cpg_shm_attach, 0, sizeof (res_lib_cpg_shm_attach));
+
+	if (!(cpd->flags & CPG_MODEL_V1_DELIVER_SHARED)) {
+		error = CS_ERR_INVALID_PARAM;
+		goto response_send;
+	}
+
+	if (cpd->cpd_state != CPD_STATE_JOIN_STARTED &&
+	    cpd->cpd_state != CPD_STATE_JOIN_COMPLETED) {
+		error = CS_ERR_NOT_EXIST;
+		goto response_send;
+	}
+
+	if (cpd->shm_arena != NULL) {
+		error = CS_ERR_EXIST;
+		goto response_send;
+	}
+
+	/*
+	 * Arena is owned by uid of the client, never trust uid sent by client
+	 */
+	if (api->ipc_credentials_get (conn, &euid, &egid) != 0) {
+		error = CS_ERR_ACCESS;
+		goto response_send;
+	}
+
+	arena = cpg_shm_arena_get (&cpd->group_name, euid);
+	if (arena == NULL) {
+		error = CS_ERR_NO_RESOURCES;
+		goto response_send;
+	}
+
+	arena->attached++;
+	cpd->shm_arena = arena;
+
+	res_lib_cpg_shm_attach.arena_id = arena->id;
+	res_lib_cpg_shm_attach.map_size = arena->size;
+	memcpy (res_lib_cpg_shm_attach.path, arena->path, sizeof (arena->path));
+
+response_send:
+	res_lib_cpg_shm_attach.header.size = sizeof (res_lib_cpg_shm_attach);
+	res_lib_cpg_shm_attach.header.id = MESSAGE_RES_CPG_SHM_ATTACH;
+	res_lib_cpg_shm_attach.header.error = error;
+
+	api->ipc_response_send (conn, &res_lib_cpg_shm_attach,
+		sizeof (res_lib_cpg_shm_attach));
+}
+
+/*
+ * No response is sent (same as for mcast)
+ */
+static void message_handler_req_lib_cpg_shm_release (
+	void *conn,
+	const void *message)
+{
+	const struct req_lib_cpg_shm_release *req_lib_cpg_shm_release = message;
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+
+	if (cpd->shm_arena == NULL || cpd->shm_arena->id != req_lib_cpg_shm_release->arena_id) {
+		return ;
+	}
+
+	/*
+	 * First release tells that library has the arena mapped
+	 */
+	cpd->shm_active = 1;
+
+	cpg_shm_release (cpd, req_lib_cpg_shm_release->seq);
+}
+
 union u {
 	uint64_t server_addr;
 	void *server_ptr;
@@ -1969,22 +3322,26 @@ static void message_handler_req_lib_cpg_zc_free (
 		res_header.size);
 }
 
-/* Fragmented mcast message from the library */
-static void message_handler_req_lib_cpg_partial_mcast (void *conn, const void *message)
+/*
+ * Send one fragment of large message to the group. Used by both plain and
+ * pipelined fragmented mcast.
+ */
+static cs_error_t cpg_partial_mcast_send (
+	void *conn,
+	struct cpg_pd *cpd,
+	uint32_t msglen,
+	uint32_t fraglen,
+	uint32_t type,
+	const void *fragment)
 {
-	const struct req_lib_cpg_partial_mcast *req_lib_cpg_mcast = message;
-	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
 	mar_cpg_name_t group_name = cpd->group_name;
-
 	struct iovec req_exec_cpg_iovec[2];
 	struct req_exec_cpg_partial_mcast req_exec_cpg_mcast;
-	struct res_lib_cpg_partial_send res_lib_cpg_partial_send;
-	int msglen = req_lib_cpg_mcast->fraglen;
 	int result;
 	cs_error_t error = CS_ERR_NOT_EXIST;
 
 	log_printf(LOGSYS_LEVEL_TRACE, "got fragmented mcast request on %p", conn);
-	log_printf(LOGSYS_LEVEL_DEBUG, "Sending fragmented message size = %d bytes\n", msglen);
+	log_printf(LOGSYS_LEVEL_DEBUG, "Sending fragmented message size = %d bytes\n", fraglen);
 
 	switch (cpd->cpd_state) {
 	case CPD_STATE_UNJOINED:
@@ -2001,10 +3358,7 @@ static void message_handler_req_lib_cpg_partial_mcast (void *conn, const void *m
 		break;
 	}
 
-	res_lib_cpg_partial_send.header.size = sizeof(res_lib_cpg_partial_send);
-	res_lib_cpg_partial_send.header.id = MESSAGE_RES_CPG_PARTIAL_SEND;
-
-	if (req_lib_cpg_mcast->type == LIBCPG_PARTIAL_FIRST) {
+	if (type == LIBCPG_PARTIAL_FIRST) {
 		cpd->initial_transition_counter = cpd->transition_counter;
 	}
 	if (cpd->transition_counter != cpd->initial_transition_counter) {
@@ -2012,44 +3366,220 @@ static void message_handler_req_lib_cpg_partial_mcast (void *conn, const void *m
 	}
 
 	if (error == CS_OK) {
-		req_exec_cpg_mcast.header.size = sizeof(req_exec_cpg_mcast) + msglen;
+		req_exec_cpg_mcast.header.size = sizeof(req_exec_cpg_mcast) + fraglen;
 		req_exec_cpg_mcast.header.id = SERVICE_ID_MAKE(CPG_SERVICE,
 							       MESSAGE_REQ_EXEC_CPG_PARTIAL_MCAST);
 		req_exec_cpg_mcast.pid = cpd->pid;
-		req_exec_cpg_mcast.msglen = req_lib_cpg_mcast->msglen;
-		req_exec_cpg_mcast.type = req_lib_cpg_mcast->type;
-		req_exec_cpg_mcast.fraglen = req_lib_cpg_mcast->fraglen;
+		req_exec_cpg_mcast.msglen = msglen;
+		req_exec_cpg_mcast.type = type;
+		req_exec_cpg_mcast.fraglen = fraglen;
 		api->ipc_source_set (&req_exec_cpg_mcast.source, conn);
 		memcpy(&req_exec_cpg_mcast.group_name, &group_name,
 		       sizeof(mar_cpg_name_t));
 
 		req_exec_cpg_iovec[0].iov_base = (char *)&req_exec_cpg_mcast;
 		req_exec_cpg_iovec[0].iov_len = sizeof(req_exec_cpg_mcast);
-		req_exec_cpg_iovec[1].iov_base = (char *)&req_lib_cpg_mcast->message;
-		req_exec_cpg_iovec[1].iov_len = msglen;
+		req_exec_cpg_iovec[1].iov_base = (char *)fragment;
+		req_exec_cpg_iovec[1].iov_len = fraglen;
 
 		result = api->totem_mcast (req_exec_cpg_iovec, 2, TOTEM_AGREED);
 		assert(result == 0);
+		cpd->mcast_in_flight++;
 	} else {
 		log_printf(LOGSYS_LEVEL_ERROR, "*** %p can't mcast to group %s state:%d, error:%d",
 			   conn, group_name.value, cpd->cpd_state, error);
 	}
 
-	res_lib_cpg_partial_send.header.error = error;
+	return (error);
+}
+
+/* Fragmented mcast message from the library */
+static void message_handler_req_lib_cpg_partial_mcast (void *conn, const void *message)
+{
+	const struct req_lib_cpg_partial_mcast *req_lib_cpg_mcast = message;
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	struct res_lib_cpg_partial_send res_lib_cpg_partial_send;
+
+	res_lib_cpg_partial_send.header.size = sizeof(res_lib_cpg_partial_send);
+	res_lib_cpg_partial_send.header.id = MESSAGE_RES_CPG_PARTIAL_SEND;
+	res_lib_cpg_partial_send.header.error = cpg_partial_mcast_send (conn, cpd,
+		req_lib_cpg_mcast->msglen, req_lib_cpg_mcast->fraglen,
+		req_lib_cpg_mcast->type, req_lib_cpg_mcast->message);
+
 	api->ipc_response_send (conn, &res_lib_cpg_partial_send,
 				sizeof (res_lib_cpg_partial_send));
 }
 
+/*
+ * Fragment of large message sent by library without waiting for result of
+ * previous one. Every fragment gets response which gives library credit to
+ * send another one. When fragment is refused (flow control in ipc glue or
+ * here), all following fragments already in flight are refused too, because
+ * their seq doesn't match, and library resends them in order.
+ */
+static void message_handler_req_lib_cpg_partial_mcast_pipelined (void *conn, const void *message)
+{
+	const struct req_lib_cpg_partial_mcast_pipelined *req_lib_cpg_mcast = message;
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	struct res_lib_cpg_partial_send_credit res_lib_cpg_partial_send_credit;
+	cs_error_t error;
+
+	if (req_lib_cpg_mcast->type == LIBCPG_PARTIAL_FIRST && req_lib_cpg_mcast->seq == 0) {
+		cpd->partial_msgid = req_lib_cpg_mcast->msgid;
+		cpd->partial_seq_next = 0;
+	}
+
+	if (req_lib_cpg_mcast->msgid != cpd->partial_msgid ||
+	    req_lib_cpg_mcast->seq != cpd->partial_seq_next) {
+		error = CS_ERR_TRY_AGAIN;
+	} else {
+		error = cpg_partial_mcast_send (conn, cpd,
+			req_lib_cpg_mcast->msglen, req_lib_cpg_mcast->fraglen,
+			req_lib_cpg_mcast->type, req_lib_cpg_mcast->message);
+		if (error == CS_OK) {
+			cpd->partial_seq_next++;
+		}
+	}
+
+	res_lib_cpg_partial_send_credit.header.size = sizeof(res_lib_cpg_partial_send_credit);
+	res_lib_cpg_partial_send_credit.header.id = MESSAGE_RES_CPG_PARTIAL_SEND_CREDIT;
+	res_lib_cpg_partial_send_credit.header.error = error;
+	res_lib_cpg_partial_send_credit.seq = req_lib_cpg_mcast->seq;
+
+	api->ipc_response_send (conn, &res_lib_cpg_partial_send_credit,
+				sizeof (res_lib_cpg_partial_send_credit));
+}
+
+/*
+ * Library has messages waiting because of flow control. Tell it when
+ * sending is possible again.
+ */
+static void message_handler_req_lib_cpg_send_ready (void *conn, const void *message)
+{
+	struct res_lib_cpg_send_ready_callback res_lib_cpg_send_ready_callback;
+
+	res_lib_cpg_send_ready_callback.header.size = sizeof(res_lib_cpg_send_ready_callback);
+	res_lib_cpg_send_ready_callback.header.id = MESSAGE_RES_CPG_SEND_READY_CALLBACK;
+	res_lib_cpg_send_ready_callback.header.error = CS_OK;
+
+	api->ipc_dispatch_send_when_ready (conn, &res_lib_cpg_send_ready_callback,
+		sizeof (res_lib_cpg_send_ready_callback));
+}
+
+/*
+ * Library has no fragment in flight and its fragments are refused. Credit
+ * is sent as soon as fragments are accepted again.
+ */
+static void message_handler_req_lib_cpg_partial_send_wait (void *conn, const void *message)
+{
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	struct res_lib_cpg_partial_send_credit res_lib_cpg_partial_send_credit;
+
+	res_lib_cpg_partial_send_credit.header.size = sizeof(res_lib_cpg_partial_send_credit);
+	res_lib_cpg_partial_send_credit.header.id = MESSAGE_RES_CPG_PARTIAL_SEND_CREDIT;
+	res_lib_cpg_partial_send_credit.header.error = CS_OK;
+	res_lib_cpg_partial_send_credit.seq = cpd->partial_seq_next;
+
+	api->ipc_response_send_when_ready (conn, &res_lib_cpg_partial_send_credit,
+		sizeof (res_lib_cpg_partial_send_credit));
+}
+
+/*
+ * Every local member of the group accepts FIFO messages delivered locally.
+ * Members still joining would not get the message at all, because the totem
+ * copy is skipped for local members.
+ */
+static int cpg_group_local_fifo_all (const mar_cpg_name_t *group_name)
+{
+	struct list_head *iter;
+	struct cpg_group *group;
+	struct cpg_pd *cpd;
+
+	group = cpg_group_find (group_name);
+	if (group == NULL) {
+		return (0);
+	}
+
+	for (iter = group->cpd_head.next; iter != &group->cpd_head; iter = iter->next) {
+		cpd = list_entry(iter, struct cpg_pd, group_list);
+
+		if (cpd->cpd_state == CPD_STATE_JOIN_STARTED) {
+			return (0);
+		}
+
+		if ((cpd->cpd_state == CPD_STATE_LEAVE_STARTED ||
+		    cpd->cpd_state == CPD_STATE_JOIN_COMPLETED) &&
+		    !(cpd->flags & CPG_MODEL_V1_DELIVER_LOCAL_FIFO)) {
+			return (0);
+		}
+	}
+
+	return (1);
+}
+
+/*
+ * FIFO message can be delivered to local members right away only if no
+ * earlier message of the same sender is still on its way through totem,
+ * all local members asked for it and all nodes know to skip local members
+ * when it comes back.
+ */
+static int cpg_mcast_fifo_local_allowed (const struct cpg_pd *cpd, uint32_t guarantee)
+{
+	return (guarantee == CPG_TYPE_FIFO &&
+	    (cpd->flags & CPG_MODEL_V1_DELIVER_LOCAL_FIFO) &&
+	    cpd->cpd_state == CPD_STATE_JOIN_COMPLETED &&
+	    cpd->mcast_in_flight == 0 &&
+	    cpg_cluster_sync_version >= CPG_SYNC_VERSION_FIFO_LOCAL &&
+	    cpg_group_local_fifo_all (&cpd->group_name));
+}
+
+static int cpg_mcast_send (
+	void *conn,
+	struct cpg_pd *cpd,
+	uint32_t guarantee,
+	const void *msg,
+	int msglen)
+{
+	struct iovec req_exec_cpg_iovec[2];
+	struct req_exec_cpg_mcast req_exec_cpg_mcast;
+	int fifo_local = cpg_mcast_fifo_local_allowed (cpd, guarantee);
+	int result;
+
+	req_exec_cpg_mcast.header.size = sizeof(req_exec_cpg_mcast) + msglen;
+	req_exec_cpg_mcast.header.id = SERVICE_ID_MAKE(CPG_SERVICE,
+		fifo_local ? MESSAGE_REQ_EXEC_CPG_MCAST_FIFO_LOCAL : MESSAGE_REQ_EXEC_CPG_MCAST);
+	req_exec_cpg_mcast.pid = cpd->pid;
+	req_exec_cpg_mcast.msglen = msglen;
+	api->ipc_source_set (&req_exec_cpg_mcast.source, conn);
+	memcpy(&req_exec_cpg_mcast.group_name, &cpd->group_name,
+		sizeof(mar_cpg_name_t));
+
+	req_exec_cpg_iovec[0].iov_base = (char *)&req_exec_cpg_mcast;
+	req_exec_cpg_iovec[0].iov_len = sizeof(req_exec_cpg_mcast);
+	req_exec_cpg_iovec[1].iov_base = (char *)msg;
+	req_exec_cpg_iovec[1].iov_len = msglen;
+
+	result = api->totem_mcast (req_exec_cpg_iovec, 2, TOTEM_AGREED);
+	if (result != 0) {
+		return (result);
+	}
+
+	if (fifo_local) {
+		cpg_mcast_deliver (&req_exec_cpg_mcast.group_name, cpd->pid,
+			api->totem_nodeid_get (), msg, msglen);
+	} else {
+		cpd->mcast_in_flight++;
+	}
+
+	return (0);
+}
+
 /* Mcast message from the library */
 static void message_handler_req_lib_cpg_mcast (void *conn, const void *message)
 {
 	const struct req_lib_cpg_mcast *req_lib_cpg_mcast = message;
 	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
 	mar_cpg_name_t group_name = cpd->group_name;
-
-	struct iovec req_exec_cpg_iovec[2];
-	struct req_exec_cpg_mcast req_exec_cpg_mcast;
-	int msglen = req_lib_cpg_mcast->msglen;
 	int result;
 	cs_error_t error = CS_ERR_NOT_EXIST;
 
@@ -2071,21 +3601,8 @@ static void message_handler_req_lib_cpg_mcast (void *conn, const void *message)
 	}
 
 	if (error == CS_OK) {
-		req_exec_cpg_mcast.header.size = sizeof(req_exec_cpg_mcast) + msglen;
-		req_exec_cpg_mcast.header.id = SERVICE_ID_MAKE(CPG_SERVICE,
-			MESSAGE_REQ_EXEC_CPG_MCAST);
-		req_exec_cpg_mcast.pid = cpd->pid;
-		req_exec_cpg_mcast.msglen = msglen;
-		api->ipc_source_set (&req_exec_cpg_mcast.source, conn);
-		memcpy(&req_exec_cpg_mcast.group_name, &group_name,
-			sizeof(mar_cpg_name_t));
-
-		req_exec_cpg_iovec[0].iov_base = (char *)&req_exec_cpg_mcast;
-		req_exec_cpg_iovec[0].iov_len = sizeof(req_exec_cpg_mcast);
-		req_exec_cpg_iovec[1].iov_base = (char *)&req_lib_cpg_mcast->message;
-		req_exec_cpg_iovec[1].iov_len = msglen;
-
-		result = api->totem_mcast (req_exec_cpg_iovec, 2, TOTEM_AGREED);
+		result = cpg_mcast_send (conn, cpd, req_lib_cpg_mcast->guarantee,
+			&req_lib_cpg_mcast->message, req_lib_cpg_mcast->msglen);
 		assert(result == 0);
 	} else {
 		log_printf(LOGSYS_LEVEL_ERROR, "*** %p can't mcast to group %s state:%d, error:%d",
@@ -2101,8 +3618,6 @@ static void message_handler_req_lib_cpg_zc_execute (
 	struct qb_ipc_request_header *header;
 	struct res_lib_cpg_mcast res_lib_cpg_mcast;
 	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
-	struct iovec req_exec_cpg_iovec[2];
-	struct req_exec_cpg_mcast req_exec_cpg_mcast;
 	struct req_lib_cpg_mcast *req_lib_cpg_mcast;
 	int result;
 	cs_error_t error = CS_ERR_NOT_EXIST;
@@ -2130,21 +3645,9 @@ static void message_handler_req_lib_cpg_zc_execute (
 	res_lib_cpg_mcast.header.size = sizeof(res_lib_cpg_mcast);
 	res_lib_cpg_mcast.header.id = MESSAGE_RES_CPG_MCAST;
 	if (error == CS_OK) {
-		req_exec_cpg_mcast.header.size = sizeof(req_exec_cpg_mcast) + req_lib_cpg_mcast->msglen;
-		req_exec_cpg_mcast.header.id = SERVICE_ID_MAKE(CPG_SERVICE,
-			MESSAGE_REQ_EXEC_CPG_MCAST);
-		req_exec_cpg_mcast.pid = cpd->pid;
-		req_exec_cpg_mcast.msglen = req_lib_cpg_mcast->msglen;
-		api->ipc_source_set (&req_exec_cpg_mcast.source, conn);
-		memcpy(&req_exec_cpg_mcast.group_name, &cpd->group_name,
-			sizeof(mar_cpg_name_t));
-
-		req_exec_cpg_iovec[0].iov_base = (char *)&req_exec_cpg_mcast;
-		req_exec_cpg_iovec[0].iov_len = sizeof(req_exec_cpg_mcast);
-		req_exec_cpg_iovec[1].iov_base = (char *)header + sizeof(struct req_lib_cpg_mcast);
-		req_exec_cpg_iovec[1].iov_len = req_exec_cpg_mcast.msglen;
-
-		result = api->totem_mcast (req_exec_cpg_iovec, 2, TOTEM_AGREED);
+		result = cpg_mcast_send (conn, cpd, req_lib_cpg_mcast->guarantee,
+			(char *)header + sizeof(struct req_lib_cpg_mcast),
+			req_lib_cpg_mcast->msglen);
 		if (result == 0) {
 			res_lib_cpg_mcast.header.error = CS_OK;
 		} else {
@@ -2166,6 +3669,7 @@ static void message_handler_req_lib_cpg_membership (void *conn,
 		(struct req_lib_cpg_membership_get *)message;
 	struct res_lib_cpg_membership_get res_lib_cpg_membership_get;
 	struct list_head *iter;
+	struct cpg_group *group;
 	int member_count = 0;
 
 	res_lib_cpg_membership_get.header.id = MESSAGE_RES_CPG_MEMBERSHIP;
@@ -2173,11 +3677,11 @@ static void message_handler_req_lib_cpg_membership (void *conn,
 	res_lib_cpg_membership_get.header.size =
 		sizeof (struct res_lib_cpg_membership_get);
 
-	for (iter = process_info_list_head.next;
-		iter != &process_info_list_head; iter = iter->next) {
+	group = cpg_group_find (&req_lib_cpg_membership_get->group_name);
+	if (group != NULL) {
+		for (iter = group->pi_head.next; iter != &group->pi_head; iter = iter->next) {
+			struct process_info *pi = list_entry (iter, struct process_info, group_list);
 
-		struct process_info *pi = list_entry (iter, struct process_info, list);
-		if (mar_name_compare (&pi->group, &req_lib_cpg_membership_get->group_name) == 0) {
 			res_lib_cpg_membership_get.member_list[member_count].nodeid = pi->nodeid;
 			res_lib_cpg_membership_get.member_list[member_count].pid = pi->pid;
 			member_count += 1;
@@ -35,6 +35,7 @@
 #include <config.h>
 
 #include <string.h>
+#include <stddef.h>
 #include <stdio.h>
 
 #include <corosync/corotypes.h>
@@ -45,8 +46,59 @@
 
 #define ICMAP_MAX_VALUE_LEN	(16*1024)
 
+/*
+ * Items and interned key names are allocated from arena. Arena is set of chunks
+ * split into blocks of size classes (multiple of ICMAP_ARENA_ALIGN). Freed blocks
+ * are kept on per class free list and reused by next allocation of same class, so
+ * constantly changing runtime keys don't fragment heap. Bigger blocks are
+ * allocated directly by malloc.
+ */
+#define ICMAP_ARENA_CHUNK_SIZE		(64 * 1024)
+#define ICMAP_ARENA_ALIGN		16
+#define ICMAP_ARENA_MAX_BLOCK_SIZE	512
+#define ICMAP_ARENA_CLASSES		(ICMAP_ARENA_MAX_BLOCK_SIZE / ICMAP_ARENA_ALIGN)
+
+/*
+ * Initial size of hash table with interned key names
+ */
+#define ICMAP_KEYS_HASH_SIZE		4096
+
+struct icmap_arena_chunk {
+	struct icmap_arena_chunk *next;
+	char data[] __attribute__((aligned(ICMAP_ARENA_ALIGN)));
+};
+
+struct icmap_arena_free_block {
+	struct icmap_arena_free_block *next;
+};
+
+struct icmap_arena {
+	struct icmap_arena_free_block *free_list[ICMAP_ARENA_CLASSES];
+	struct icmap_arena_chunk *chunks;
+	char *chunk_pos;
+	char *chunk_end;
+	size_t arena_size;
+	size_t arena_used;
+	size_t large_size;
+};
+
+static struct icmap_arena icmap_arena;
+
+/*
+ * Interned key name. Same key name is shared by items of all maps.
+ */
+struct icmap_key {
+	unsigned int refcount;
+	char name[];
+};
+
+static qb_map_t *icmap_keys = NULL;
+static size_t icmap_keys_size = 0;
+static size_t icmap_items = 0;
+
 struct icmap_item {
 	char *key_name;
+	struct icmap_counter *counter;
 	icmap_value_types_t type;
 	size_t value_len;
 	char value[];
@@ -62,8 +114,32 @@ struct icmap_track {
 	char *key_name;
 	int32_t track_type;
 	icmap_notify_fn_t notify_fn;
+	icmap_notify_batch_fn_t batch_notify_fn;
 	void *user_data;
 	struct list_head list;
+	/*
+	 * Only for batch tracks. Pending changes are stored in map (key name -> struct
+	 * icmap_track_batch_change) so repeated change of key updates existing entry.
+	 */
+	qb_map_t *batch_pending;
+	int batch_queued;
+	struct list_head batch_list;
+};
+
+struct icmap_track_batch_change {
+	int32_t event;
+	char *key_name;
+	struct icmap_notify_value new_value;
+	struct icmap_notify_value old_value;
+};
+
+/*
+ * Counter points directly to item. When item is replaced (icmap_set) counter is moved
+ * to new item, when item is deleted, counter is detached.
+ */
+struct icmap_counter {
+	struct icmap_item *item;
+	int refcount;
 };
 
 struct icmap_ro_access_item {
@@ -74,6 +150,10 @@ struct icmap_ro_access_item {
 
 DECLARE_LIST_INIT(icmap_ro_access_item_list_head);
 DECLARE_LIST_INIT(icmap_track_list_head);
+DECLARE_LIST_INIT(icmap_track_batch_list_head);
+
+static icmap_track_batch_sched_fn_t icmap_track_batch_sched_fn = NULL;
+static int icmap_track_batch_scheduled = 0;
 
 /*
  * Static functions declarations
@@ -136,6 +216,11 @@ static cs_error_t icmap_get_ref_r(
 	size_t *value_len,
 	icmap_value_types_t *type);
 
+/*
+ * Add step to integer value of item in place. Returns CS_ERR_INVALID_PARAM for non integer types.
+ */
+static cs_error_t icmap_item_adjust_int(struct icmap_item *item, int32_t step);
+
 /*
  * Function implementation
  */
@@ -185,18 +270,206 @@ static int32_t icmap_qbtt_to_tt(int32_t track_type)
 	return (res);
 }
 
+static void *icmap_arena_alloc(size_t size)
+{
+	struct icmap_arena_chunk *chunk;
+	struct icmap_arena_free_block *block;
+	size_t block_class;
+	size_t block_size;
+
+	if (size > ICMAP_ARENA_MAX_BLOCK_SIZE) {
+		block = malloc(size);
+		if (block != NULL) {
+			icmap_arena.large_size += size;
+		}
+
+		return (block);
+	}
+
+	block_class = (size + ICMAP_ARENA_ALIGN - 1) / ICMAP_ARENA_ALIGN - 1;
+	block_size = (block_class + 1) * ICMAP_ARENA_ALIGN;
+
+	if (icmap_arena.free_list[block_class] != NULL) {
+		block = icmap_arena.free_list[block_class];
+		icmap_arena.free_list[block_class] = block->next;
+		icmap_arena.arena_used += block_size;
+
+		return (block);
+	}
+
+	if (icmap_arena.chunk_end - icmap_arena.chunk_pos < block_size) {
+		chunk = malloc(ICMAP_ARENA_CHUNK_SIZE);
+		if (chunk == NULL) {
+			return (NULL);
+		}
+		chunk->next = icmap_arena.chunks;
+		icmap_arena.chunks = chunk;
+		icmap_arena.chunk_pos = chunk->data;
+		icmap_arena.chunk_end = (char *)chunk + ICMAP_ARENA_CHUNK_SIZE;
+		icmap_arena.arena_size += ICMAP_ARENA_CHUNK_SIZE;
+	}
+
+	block = (struct icmap_arena_free_block *)icmap_arena.chunk_pos;
+	icmap_arena.chunk_pos += block_size;
+	icmap_arena.arena_used += block_size;
+
+	return (block);
+}
+
+/*
+ * size must be same as passed to icmap_arena_alloc
+ */
+static void icmap_arena_free(void *ptr, size_t size)
+{
+	struct icmap_arena_free_block *block = (struct icmap_arena_free_block *)ptr;
+	size_t block_class;
+
+	if (size > ICMAP_ARENA_MAX_BLOCK_SIZE) {
+		icmap_arena.large_size -= size;
+		free(ptr);
+
+		return ;
+	}
+
+	block_class = (size + ICMAP_ARENA_ALIGN - 1) / ICMAP_ARENA_ALIGN - 1;
+
+	block->next = icmap_arena.free_list[block_class];
+	icmap_arena.free_list[block_class] = block;
+	icmap_arena.arena_used -= (block_class + 1) * ICMAP_ARENA_ALIGN;
+}
+
+/*
+ * Return interned copy of key_name (or NULL when out of memory). Every successful
+ * call must be paired with icmap_key_release.
+ */
+static char *icmap_key_intern(const char *key_name)
+{
+	struct icmap_key *key;
+	size_t key_size;
+
+	if (icmap_keys == NULL) {
+		icmap_keys = qb_hashtable_create(ICMAP_KEYS_HASH_SIZE);
+		if (icmap_keys == NULL) {
+			return (NULL);
+		}
+	}
+
+	key = qb_map_get(icmap_keys, key_name);
+	if (key != NULL) {
+		key->refcount++;
+
+		return (key->name);
+	}
+
+	key_size = sizeof(*key) + strlen(key_name) + 1;
+	key = icmap_arena_alloc(key_size);
+	if (key == NULL) {
+		return (NULL);
+	}
+
+	key->refcount = 1;
+	memcpy(key->name, key_name, strlen(key_name) + 1);
+	qb_map_put(icmap_keys, key->name, key);
+	icmap_keys_size += key_size;
+
+	return (key->name);
+}
+
+static void icmap_key_release(char *key_name)
+{
+	struct icmap_key *key;
+	size_t key_size;
+
+	key = (struct icmap_key *)(key_name - offsetof(struct icmap_key, name));
+
+	if (--key->refcount > 0) {
+		return ;
+	}
+
+	key_size = sizeof(*key) + strlen(key->name) + 1;
+	qb_map_rm(icmap_keys, key->name);
+	icmap_keys_size -= key_size;
+	icmap_arena_free(key, key_size);
+}
+
+static void icmap_item_free(struct icmap_item *item)
+{
+
+	if (item->key_name != NULL) {
+		icmap_key_release(item->key_name);
+	}
+	icmap_arena_free(item, sizeof(*item) + item->value_len);
+	icmap_items--;
+}
+
+/*
+ * Returns non zero if modification of key_name in map is tracked, so item can't
+ * be updated in place (tracker needs old value).
+ */
+static int icmap_key_modify_tracked(const icmap_map_t map, const char *key_name)
+{
+	struct list_head *iter;
+	struct icmap_track *icmap_track;
+
+	if (map != icmap_global_map) {
+		return (0);
+	}
+
+	for (iter = icmap_track_list_head.next; iter != &icmap_track_list_head; iter = iter->next) {
+		icmap_track = list_entry(iter, struct icmap_track, list);
+
+		if (!(icmap_track->track_type & ICMAP_TRACK_MODIFY)) {
+			continue;
+		}
+
+		if (icmap_track->key_name == NULL) {
+			return (1);
+		}
+
+		if (icmap_track->track_type & ICMAP_TRACK_PREFIX) {
+			if (strncmp(key_name, icmap_track->key_name, strlen(icmap_track->key_name)) == 0) {
+				return (1);
+			}
+		} else if (strcmp(key_name, icmap_track->key_name) == 0) {
+			return (1);
+		}
+	}
+
+	return (0);
+}
+
+void icmap_mem_stats_get(struct icmap_mem_stats *stats)
+{
+
+	memset(stats, 0, sizeof(*stats));
+
+	stats->arena_size = icmap_arena.arena_size;
+	stats->arena_used = icmap_arena.arena_used;
+	stats->large_size = icmap_arena.large_size;
+	stats->items = icmap_items;
+	stats->keys = (icmap_keys != NULL ? qb_map_count_get(icmap_keys) : 0);
+	stats->keys_size = icmap_keys_size;
+}
+
 static void icmap_map_free_cb(uint32_t event,
 		char* key, void* old_value,
 		void* value, void* user_data)
 {
 	struct icmap_item *item = (struct icmap_item *)old_value;
+	struct icmap_item *new_item = (struct icmap_item *)value;
 
 	/*
 	 * value == old_value -> fast_adjust_int was used, don't free data
 	 */
 	if (item != NULL && value != old_value) {
-		free(item->key_name);
-		free(item);
+		if (item->counter != NULL) {
+			item->counter->item = new_item;
+			if (new_item != NULL) {
+				new_item->counter = item->counter;
+			}
+		}
+
+		icmap_item_free(item);
 	}
 }
 
@@ -466,17 +739,36 @@ cs_error_t icmap_set_r(
 		new_value_len = icmap_get_valuetype_len(type);
 	}
 
+	if (item != NULL && item->value_len == new_value_len &&
+	    !icmap_key_modify_tracked(map, item->key_name)) {
+		/*
+		 * Nobody needs old value -> update in place. Item (and counter bound to it)
+		 * stays same.
+		 */
+		item->type = type;
+		memcpy(item->value, value, new_value_len);
+
+		if (item->type == ICMAP_VALUETYPE_STRING) {
+			((char *)item->value)[new_value_len - 1] = 0;
+		}
+
+		return (CS_OK);
+	}
+
 	new_item_size = sizeof(struct icmap_item) + new_value_len;
-	new_item = malloc(new_item_size);
+	new_item = icmap_arena_alloc(new_item_size);
 	if (new_item == NULL) {
 		return (CS_ERR_NO_MEMORY);
 	}
 	memset(new_item, 0, new_item_size);
+	new_item->type = type;
+	new_item->value_len = new_value_len;
+	icmap_items++;
 
 	if (item == NULL) {
-		new_item->key_name = strdup(key_name);
+		new_item->key_name = icmap_key_intern(key_name);
 		if (new_item->key_name == NULL) {
-			free(new_item);
+			icmap_item_free(new_item);
 			return (CS_ERR_NO_MEMORY);
 		}
 	} else {
@@ -484,9 +776,6 @@ cs_error_t icmap_set_r(
 		item->key_name = NULL;
 	}
 
-	new_item->type = type;
-	new_item->value_len = new_value_len;
-
 	memcpy(new_item->value, value, new_value_len);
 
 	if (new_item->type == ICMAP_VALUETYPE_STRING) {
@@ -1009,6 +1298,19 @@ cs_error_t icmap_fast_adjust_int_r(
 		return (CS_ERR_NOT_EXIST);
 	}
 
+	err = icmap_item_adjust_int(item, step);
+
+	if (err == CS_OK) {
+		qb_map_put(map->qb_map, item->key_name, item);
+	}
+
+	return (err);
+}
+
+static cs_error_t icmap_item_adjust_int(struct icmap_item *item, int32_t step)
+{
+	cs_error_t err = CS_OK;
+
 	switch (item->type) {
 	case ICMAP_VALUETYPE_INT8:
 	case ICMAP_VALUETYPE_UINT8:
@@ -1034,10 +1336,6 @@ cs_error_t icmap_fast_adjust_int_r(
 		break;
 	}
 
-	if (err == CS_OK) {
-		qb_map_put(map->qb_map, item->key_name, item);
-	}
-
 	return (err);
 }
 
@@ -1089,6 +1387,74 @@ cs_error_t icmap_fast_dec(const char *key_name)
 	return (icmap_fast_dec_r(icmap_global_map, key_name));
 }
 
+cs_error_t icmap_counter_ref_r(const icmap_map_t map, const char *key_name, icmap_counter_t *counter)
+{
+	struct icmap_item *item;
+
+	if (key_name == NULL || counter == NULL) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	item = qb_map_get(map->qb_map, key_name);
+	if (item == NULL) {
+		return (CS_ERR_NOT_EXIST);
+	}
+
+	if (icmap_get_valuetype_len(item->type) == 0 ||
+	    item->type == ICMAP_VALUETYPE_FLOAT || item->type == ICMAP_VALUETYPE_DOUBLE) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	if (item->counter == NULL) {
+		item->counter = malloc(sizeof(*item->counter));
+		if (item->counter == NULL) {
+			return (CS_ERR_NO_MEMORY);
+		}
+		item->counter->item = item;
+		item->counter->refcount = 0;
+	}
+
+	item->counter->refcount++;
+	*counter = item->counter;
+
+	return (CS_OK);
+}
+
+cs_error_t icmap_counter_ref(const char *key_name, icmap_counter_t *counter)
+{
+	return (icmap_counter_ref_r(icmap_global_map, key_name, counter));
+}
+
+void icmap_counter_unref(icmap_counter_t counter)
+{
+	if (counter == NULL) {
+		return ;
+	}
+
+	if (--counter->refcount > 0) {
+		return ;
+	}
+
+	if (counter->item != NULL) {
+		counter->item->counter = NULL;
+	}
+
+	free(counter);
+}
+
+cs_error_t icmap_counter_add(icmap_counter_t counter, int32_t step)
+{
+	if (counter == NULL) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	if (counter->item == NULL) {
+		return (CS_ERR_NOT_EXIST);
+	}
+
+	return (icmap_item_adjust_int(counter->item, step));
+}
+
 icmap_iter_t icmap_iter_init_r(const icmap_map_t map, const char *prefix)
 {
 	return (qb_map_pref_iter_create(map->qb_map, prefix));
@@ -1126,6 +1492,218 @@ void icmap_iter_finalize(icmap_iter_t iter)
 	qb_map_iter_free(iter);
 }
 
+static int icmap_notify_value_copy(struct icmap_notify_value *dst, const struct icmap_notify_value *src)
+{
+	void *data;
+
+	*dst = *src;
+	if (src->len == 0 || src->data == NULL) {
+		dst->data = NULL;
+
+		return (0);
+	}
+
+	data = malloc(src->len);
+	if (data == NULL) {
+		return (-1);
+	}
+	memcpy(data, src->data, src->len);
+	dst->data = data;
+
+	return (0);
+}
+
+static void icmap_track_batch_change_free(struct icmap_track_batch_change *change)
+{
+
+	free((void *)change->new_value.data);
+	free((void *)change->old_value.data);
+	free(change->key_name);
+	free(change);
+}
+
+static void icmap_track_batch_pending_free(qb_map_t *pending)
+{
+	qb_map_iter_t *iter;
+	struct icmap_track_batch_change *change;
+
+	iter = qb_map_iter_create(pending);
+	while (qb_map_iter_next(iter, (void **)&change) != NULL) {
+		icmap_track_batch_change_free(change);
+	}
+	qb_map_iter_free(iter);
+
+	qb_map_destroy(pending);
+}
+
+/*
+ * Store change into track pending map. If key was already changed in this batch, events
+ * are coalesced so old_value is value before first change and new_value is value after
+ * last change.
+ */
+static void icmap_track_batch_queue(icmap_track_t icmap_track,
+		int32_t event,
+		const char *key,
+		const struct icmap_notify_value *new_val,
+		const struct icmap_notify_value *old_val)
+{
+	struct icmap_track_batch_change *change;
+	struct icmap_notify_value new_copy;
+
+	if (icmap_track->batch_pending == NULL) {
+		icmap_track->batch_pending = qb_skiplist_create();
+		if (icmap_track->batch_pending == NULL) {
+			return ;
+		}
+	}
+
+	if (icmap_notify_value_copy(&new_copy, new_val) != 0) {
+		return ;
+	}
+
+	change = qb_map_get(icmap_track->batch_pending, key);
+	if (change == NULL) {
+		change = malloc(sizeof(*change));
+		if (change == NULL) {
+			free((void *)new_copy.data);
+			return ;
+		}
+		memset(change, 0, sizeof(*change));
+
+		change->key_name = strdup(key);
+		if (change->key_name == NULL ||
+		    icmap_notify_value_copy(&change->old_value, old_val) != 0) {
+			change->new_value = new_copy;
+			icmap_track_batch_change_free(change);
+			return ;
+		}
+		change->event = event;
+		change->new_value = new_copy;
+
+		qb_map_put(icmap_track->batch_pending, change->key_name, change);
+	} else {
+		free((void *)change->new_value.data);
+		change->new_value = new_copy;
+
+		if (change->event == ICMAP_TRACK_ADD && event == ICMAP_TRACK_DELETE) {
+			/*
+			 * Key created and deleted in same batch -> nothing to report
+			 */
+			qb_map_rm(icmap_track->batch_pending, key);
+			icmap_track_batch_change_free(change);
+		} else if (change->event == ICMAP_TRACK_DELETE && event == ICMAP_TRACK_ADD) {
+			change->event = ICMAP_TRACK_MODIFY;
+		} else if (change->event != ICMAP_TRACK_ADD) {
+			change->event = event;
+		}
+	}
+
+	if (!icmap_track->batch_queued) {
+		icmap_track->batch_queued = 1;
+		list_add_tail(&icmap_track->batch_list, &icmap_track_batch_list_head);
+	}
+
+	if (!icmap_track_batch_scheduled && icmap_track_batch_sched_fn != NULL) {
+		icmap_track_batch_scheduled = 1;
+		icmap_track_batch_sched_fn();
+	}
+}
+
+static void icmap_track_batch_deliver(icmap_notify_batch_fn_t notify_fn, void *user_data,
+		qb_map_t *pending)
+{
+	qb_map_iter_t *iter;
+	struct icmap_track_batch_change *change;
+	struct icmap_notify_batch_entry *entries;
+	size_t no_entries;
+	size_t i;
+
+	no_entries = qb_map_count_get(pending);
+	if (no_entries > 0) {
+		entries = malloc(sizeof(*entries) * no_entries);
+		if (entries != NULL) {
+			i = 0;
+			iter = qb_map_iter_create(pending);
+			while (i < no_entries && qb_map_iter_next(iter, (void **)&change) != NULL) {
+				entries[i].event = change->event;
+				entries[i].key_name = change->key_name;
+				entries[i].new_value = change->new_value;
+				entries[i].old_value = change->old_value;
+				i++;
+			}
+			qb_map_iter_free(iter);
+
+			notify_fn(entries, i, user_data);
+			free(entries);
+		}
+	}
+
+	icmap_track_batch_pending_free(pending);
+}
+
+void icmap_track_batch_flush(void)
+{
+	struct list_head tracks;
+	icmap_track_t icmap_track;
+	qb_map_t *pending;
+
+	icmap_track_batch_scheduled = 0;
+
+	if (list_empty(&icmap_track_batch_list_head)) {
+		return ;
+	}
+
+	/*
+	 * Move pending tracks to local list, so changes made by callbacks are
+	 * delivered in next batch.
+	 */
+	list_init(&tracks);
+	list_splice(&icmap_track_batch_list_head, &tracks);
+	list_init(&icmap_track_batch_list_head);
+
+	while (!list_empty(&tracks)) {
+		icmap_track = list_entry(tracks.next, struct icmap_track, batch_list);
+		list_del(&icmap_track->batch_list);
+		icmap_track->batch_queued = 0;
+
+		pending = icmap_track->batch_pending;
+		icmap_track->batch_pending = NULL;
+
+		if (pending != NULL) {
+			/*
+			 * Callback may delete icmap_track, so don't touch it after call
+			 */
+			icmap_track_batch_deliver(icmap_track->batch_notify_fn, icmap_track->user_data,
+			    pending);
+		}
+	}
+}
+
+void icmap_track_batch_discard(icmap_track_t icmap_track)
+{
+
+	if (icmap_track->batch_queued) {
+		list_del(&icmap_track->batch_list);
+		icmap_track->batch_queued = 0;
+	}
+	if (icmap_track->batch_pending != NULL) {
+		icmap_track_batch_pending_free(icmap_track->batch_pending);
+		icmap_track->batch_pending = NULL;
+	}
+}
+
+void icmap_track_batch_sched_set(icmap_track_batch_sched_fn_t sched_fn)
+{
+
+	icmap_track_batch_sched_fn = sched_fn;
+
+	if (sched_fn != NULL && !icmap_track_batch_scheduled &&
+	    !list_empty(&icmap_track_batch_list_head)) {
+		icmap_track_batch_scheduled = 1;
+		sched_fn();
+	}
+}
+
 static void icmap_notify_fn(uint32_t event, char *key, void *old_value, void *value, void *user_data)
 {
 	icmap_track_t icmap_track = (icmap_track_t)user_data;
@@ -1157,6 +1735,12 @@ static void icmap_notify_fn(uint32_t event, char *key, void *old_value, void *va
 		memset(&old_val, 0, sizeof(old_val));
 	}
 
+	if (icmap_track->batch_notify_fn != NULL) {
+		icmap_track_batch_queue(icmap_track, icmap_qbtt_to_tt(event), key, &new_val, &old_val);
+
+		return ;
+	}
+
 	icmap_track->notify_fn(icmap_qbtt_to_tt(event),
 			key,
 			new_val,
@@ -1164,16 +1748,17 @@ static void icmap_notify_fn(uint32_t event, char *key, void *old_value, void *va
 			icmap_track->user_data);
 }
 
-cs_error_t icmap_track_add(
+static cs_error_t icmap_track_add_common(
 	const char *key_name,
 	int32_t track_type,
 	icmap_notify_fn_t notify_fn,
+	icmap_notify_batch_fn_t batch_notify_fn,
 	void *user_data,
 	icmap_track_t *icmap_track)
 {
 	int32_t err;
 
-	if (notify_fn == NULL || icmap_track == NULL) {
+	if ((notify_fn == NULL && batch_notify_fn == NULL) || icmap_track == NULL) {
 		return (CS_ERR_INVALID_PARAM);
 	}
 
@@ -1193,7 +1778,9 @@ cs_error_t icmap_track_add(
 
 	(*icmap_track)->track_type = track_type;
 	(*icmap_track)->notify_fn = notify_fn;
+	(*icmap_track)->batch_notify_fn = batch_notify_fn;
 	(*icmap_track)->user_data = user_data;
+	list_init(&(*icmap_track)->batch_list);
 
 	if ((err = qb_map_notify_add(icmap_global_map->qb_map, (*icmap_track)->key_name, icmap_notify_fn,
 					icmap_tt_to_qbtt(track_type), *icmap_track)) != 0) {
@@ -1209,6 +1796,36 @@ cs_error_t icmap_track_add(
 	return (CS_OK);
 }
 
+cs_error_t icmap_track_add(
+	const char *key_name,
+	int32_t track_type,
+	icmap_notify_fn_t notify_fn,
+	void *user_data,
+	icmap_track_t *icmap_track)
+{
+
+	if (notify_fn == NULL) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	return (icmap_track_add_common(key_name, track_type, notify_fn, NULL, user_data, icmap_track));
+}
+
+cs_error_t icmap_track_add_batch(
+	const char *key_name,
+	int32_t track_type,
+	icmap_notify_batch_fn_t notify_fn,
+	void *user_data,
+	icmap_track_t *icmap_track)
+{
+
+	if (notify_fn == NULL) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	return (icmap_track_add_common(key_name, track_type, NULL, notify_fn, user_data, icmap_track));
+}
+
 cs_error_t icmap_track_delete(icmap_track_t icmap_track)
 {
 	int32_t err;
@@ -1219,6 +1836,12 @@ cs_error_t icmap_track_delete(icmap_track_t icmap_track)
 	}
 
 	list_del(&icmap_track->list);
+	if (icmap_track->batch_queued) {
+		list_del(&icmap_track->batch_list);
+	}
+	if (icmap_track->batch_pending != NULL) {
+		icmap_track_batch_pending_free(icmap_track->batch_pending);
+	}
 	free(icmap_track->key_name);
 	free(icmap_track);
 
@@ -40,8 +40,13 @@
 #include <assert.h>
 #include <sys/uio.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include <qb/qbdefs.h>
+#include <qb/qbatomic.h>
 #include <qb/qblist.h>
 #include <qb/qbutil.h>
 #include <qb/qbloop.h>
@@ -53,6 +58,9 @@
 #include <corosync/totem/totempg.h>
 #include <corosync/logsys.h>
 #include <corosync/icmap.h>
+#include <corosync/list.h>
+#include <corosync/cpg.h>
+#include <corosync/ipc_cpg.h>
 
 #include "sync.h"
 #include "timer.h"
@@ -60,6 +68,7 @@
 #include "util.h"
 #include "apidef.h"
 #include "service.h"
+#include "stats_shm.h"
 
 LOGSYS_DECLARE_SUBSYS ("MAIN");
 
@@ -72,20 +81,174 @@ static int32_t ipc_allow_connections = 0; /* boolean */
 
 #define CS_IPCS_MAPPER_SERV_NAME		256
 
+struct cs_ipcs_thread;
+
 struct cs_ipcs_mapper {
 	int32_t id;
 	qb_ipcs_service_t *inst;
 	char name[CS_IPCS_MAPPER_SERV_NAME];
+	struct cs_ipcs_thread *thread; /* NULL when service runs in main loop */
 };
 
-struct outq_item {
-	void *msg;
-	size_t mlen;
+/*
+ * Messages which can't be sent to the client right away are stored back to
+ * back in a per connection byte ring, each one prefixed by its length.
+ * Ring is allocated on first use, grows by doubling and is limited to
+ * CS_IPCS_OUTQ_MAX_SIZE bytes. When it drains, it's halved (down to
+ * CS_IPCS_OUTQ_INITIAL_SIZE) as long as content takes at most a quarter of
+ * the smaller ring, so it doesn't keep its peak size forever.
+ */
+#define CS_IPCS_OUTQ_INITIAL_SIZE	(64 * 1024)
+#define CS_IPCS_OUTQ_MAX_SIZE		(64 * 1024 * 1024)
+
+/*
+ * Fair queueing of requests (used when totem queue is not empty). At the
+ * start of every round, free space of totem queue is split between
+ * connections by their weights and every connection gets its share as
+ * credits (at least one). Request of connection without credits is deferred
+ * until next round, which starts when no other connection active in current
+ * round has credits left or after CS_IPCS_FC_ROUND_TIMEOUT.
+ *
+ * When deferred requests of connection exceed CS_IPCS_FC_PENDING_MAX bytes,
+ * synchronous requests are refused with CS_ERR_TRY_AGAIN and reading of
+ * requests of that connection (other connections of the service are not
+ * affected) is stopped until it drains below CS_IPCS_FC_PENDING_LOW, so
+ * asynchronous requests are never dropped.
+ */
+#define CS_IPCS_FC_WEIGHT_DEFAULT	1
+#define CS_IPCS_FC_WEIGHT_MAX		1000
+#define CS_IPCS_FC_ROUND_TIMEOUT	(1 * QB_TIME_NS_IN_MSEC)
+#define CS_IPCS_FC_PENDING_MAX		(4 * 1024 * 1024)
+#define CS_IPCS_FC_PENDING_LOW		(CS_IPCS_FC_PENDING_MAX / 2)
+
+struct cs_ipcs_fc_pending {
 	struct list_head list;
+	size_t len;
+	char data[] __attribute__((aligned(8)));
+};
+
+struct cs_ipcs_outq {
+	char *buf;
+	size_t size;
+	size_t head;
+	size_t used;
+	uint32_t msgs;
+	size_t used_hw;
+	uint32_t msgs_hw;
+};
+
+/*
+ * IPC threads (qb.ipc_threads). When configured, every libqb IPC service is
+ * run by one of the IPC threads, each with its own qb_loop. Accepting
+ * connections, reading requests and sending responses and events is then
+ * done outside of the main thread, so busy clients can't delay totem.
+ * Service code (lib_init_fn, lib handlers, lib_exit_fn) and icmap are still
+ * used only by the main thread.
+ *
+ * IPC thread and main thread talk through two lock-free single producer /
+ * single consumer queues. Consumer is woken up by a byte written to a pipe,
+ * but only when it was not notified already.
+ *
+ * When requests waiting for the main thread exceed CS_IPCS_THREAD_REQ_MAX
+ * bytes, IPC thread stops reading requests of its services until the main
+ * thread handles them down to CS_IPCS_THREAD_REQ_LOW bytes.
+ */
+#define CS_IPCS_THREADS_MAX		16
+#define CS_IPCS_THREAD_REQ_MAX		(16 * 1024 * 1024)
+#define CS_IPCS_THREAD_REQ_LOW		(CS_IPCS_THREAD_REQ_MAX / 4)
+
+/*
+ * Maximum number of messages from one IPC thread handled by the main thread
+ * before it returns to the main loop
+ */
+#define CS_IPCS_THREAD_DISPATCH_MAX	64
+
+enum cs_ipcs_tmsg_type {
+	/* IPC thread -> main thread */
+	CS_IPCS_TMSG_CREATED,
+	CS_IPCS_TMSG_REQUEST,
+	CS_IPCS_TMSG_CLOSED,
+	CS_IPCS_TMSG_STATS,
+	/* main thread -> IPC thread */
+	CS_IPCS_TMSG_RESPONSE,
+	CS_IPCS_TMSG_EVENT,
+	CS_IPCS_TMSG_DISCONNECT,
+	CS_IPCS_TMSG_UNREF,
+	CS_IPCS_TMSG_RATE_LIMIT,
+	CS_IPCS_TMSG_STATS_REQUEST,
+	CS_IPCS_TMSG_CALL,
+	CS_IPCS_TMSG_RESUME,
+	CS_IPCS_TMSG_STOP,
+	CS_IPCS_TMSG_BLOCK,
+	CS_IPCS_TMSG_UNBLOCK,
+};
+
+struct cs_ipcs_tcall {
+	int32_t (*fn) (void *arg);
+	void *arg;
+	int32_t result;
+	int32_t done;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+struct cs_ipcs_tmsg {
+	struct cs_ipcs_tmsg *next;
+	enum cs_ipcs_tmsg_type type;
+	qb_ipcs_connection_t *conn;
+	qb_ipcs_service_t *inst;
+	enum qb_ipcs_rate_limit rate_limit;
+	struct cs_ipcs_tcall *call;
+	struct qb_ipcs_connection_stats stats;
+	uint32_t queued;
+	uint32_t queue_size_max;
+	uint64_t queue_bytes;
+	uint64_t queue_bytes_max;
+	size_t len;
+	char data[] __attribute__((aligned(8)));
+};
+
+struct cs_ipcs_tqueue {
+	struct cs_ipcs_tmsg *head;	/* Consumer side, last consumed message */
+	struct cs_ipcs_tmsg *tail;	/* Producer side */
+	volatile int32_t notify_pending;
+	int32_t notify_fd[2];
+};
+
+struct cs_ipcs_thread {
+	pthread_t thread;
+	qb_loop_t *loop;
+	struct cs_ipcs_tqueue to_thread;
+	struct cs_ipcs_tqueue to_main;
+	volatile int32_t req_bytes; /* Size of requests in to_main */
+	int32_t paused; /* Used only by IPC thread */
+	enum qb_ipcs_rate_limit rate_limit[SERVICES_COUNT_MAX]; /* Used only by IPC thread */
+	struct list_head poll_list_head; /* Used only by IPC thread */
+};
+
+static struct cs_ipcs_thread *ipc_threads = NULL;
+static uint32_t ipc_threads_count = 0;
+static uint32_t ipc_threads_next = 0;
+static pthread_key_t ipc_thread_key;
+
+/*
+ * Copy of uidgid.* keys, so connection_accept called by IPC thread
+ * doesn't have to touch icmap
+ */
+struct cs_ipcs_uidgid {
+	uint32_t id;
+	int32_t is_gid;
 };
 
+static struct cs_ipcs_uidgid *ipc_uidgid = NULL;
+static size_t ipc_uidgid_entries = 0;
+static pthread_mutex_t ipc_uidgid_mutex = PTHREAD_MUTEX_INITIALIZER;
+static icmap_track_t ipc_uidgid_track = NULL;
+
 static struct cs_ipcs_mapper ipcs_mapper[SERVICES_COUNT_MAX];
 
+static icmap_track_t ipc_fc_weight_track = NULL;
+
 static int32_t cs_ipcs_job_add(enum qb_loop_priority p,	void *data, qb_loop_job_dispatch_fn fn);
 static int32_t cs_ipcs_dispatch_add(enum qb_loop_priority p, int32_t fd, int32_t events,
 	void *data, qb_ipcs_dispatch_fn_t fn);
@@ -93,6 +256,12 @@ static int32_t cs_ipcs_dispatch_mod(enum qb_loop_priority p, int32_t fd, int32_t
 	void *data, qb_ipcs_dispatch_fn_t fn);
 static int32_t cs_ipcs_dispatch_del(int32_t fd);
 static void outq_flush (void *data);
+static qb_loop_t *cs_ipcs_loop_get (void);
+static struct cs_ipcs_thread *cs_ipcs_conn_thread (qb_ipcs_connection_t *c);
+static int cs_ipcs_tmsg_post (struct cs_ipcs_tqueue *q, enum cs_ipcs_tmsg_type type,
+	qb_ipcs_connection_t *c, const struct iovec *iov, unsigned int iov_len);
+static void cs_ipcs_thread_pause(struct cs_ipcs_thread *t, int32_t pause);
+static void cs_ipcs_conn_read_block(qb_ipcs_connection_t *c, int32_t blocked);
 
 
 static struct qb_ipcs_poll_handlers corosync_poll_funcs = {
@@ -157,15 +326,391 @@ void cs_ipc_allow_connections(int32_t allow)
 	ipc_allow_connections = allow;
 }
 
+static int cs_ipcs_uidgid_allowed(uid_t euid, gid_t egid)
+{
+	size_t i;
+	int allowed = 0;
+
+	pthread_mutex_lock(&ipc_uidgid_mutex);
+	for (i = 0; i < ipc_uidgid_entries; i++) {
+		if ((!ipc_uidgid[i].is_gid && ipc_uidgid[i].id == euid) ||
+		    (ipc_uidgid[i].is_gid && ipc_uidgid[i].id == egid)) {
+			allowed = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ipc_uidgid_mutex);
+
+	return allowed;
+}
+
+static void cs_ipcs_uidgid_refresh(void)
+{
+	icmap_iter_t iter;
+	const char *key_name;
+	struct cs_ipcs_uidgid *entries = NULL;
+	struct cs_ipcs_uidgid *new_entries;
+	size_t count = 0;
+	uint32_t id;
+	int32_t is_gid;
+	uint8_t u8;
+
+	iter = icmap_iter_init("uidgid.");
+	while ((key_name = icmap_iter_next(iter, NULL, NULL)) != NULL) {
+		if (icmap_get_uint8(key_name, &u8) != CS_OK || u8 != 1) {
+			continue;
+		}
+
+		if (sscanf(key_name, "uidgid.uid.%u", &id) == 1) {
+			is_gid = 0;
+		} else if (sscanf(key_name, "uidgid.gid.%u", &id) == 1) {
+			is_gid = 1;
+		} else {
+			continue;
+		}
+
+		new_entries = realloc(entries, (count + 1) * sizeof(struct cs_ipcs_uidgid));
+		if (new_entries == NULL) {
+			log_printf(LOGSYS_LEVEL_ERROR, "Unable to store uidgid %s", key_name);
+			break;
+		}
+		entries = new_entries;
+		entries[count].id = id;
+		entries[count].is_gid = is_gid;
+		count++;
+	}
+	icmap_iter_finalize(iter);
+
+	pthread_mutex_lock(&ipc_uidgid_mutex);
+	free(ipc_uidgid);
+	ipc_uidgid = entries;
+	ipc_uidgid_entries = count;
+	pthread_mutex_unlock(&ipc_uidgid_mutex);
+}
+
+static void cs_ipcs_uidgid_changed(
+	int32_t event,
+	const char *key_name,
+	struct icmap_notify_value new_val,
+	struct icmap_notify_value old_val,
+	void *user_data)
+{
+	cs_ipcs_uidgid_refresh();
+}
+
+/*
+ * Simple lock-free single producer / single consumer queue. Queue always
+ * contains at least one (already consumed) message, so producer and consumer
+ * never touch the same pointer except of the next field of last message.
+ */
+static int32_t cs_ipcs_tqueue_init(struct cs_ipcs_tqueue *q)
+{
+	int32_t i;
+
+	q->head = calloc(1, sizeof(struct cs_ipcs_tmsg));
+	if (q->head == NULL) {
+		return -ENOMEM;
+	}
+	q->tail = q->head;
+	q->notify_pending = 0;
+
+	if (pipe(q->notify_fd) != 0) {
+		free(q->head);
+		return -errno;
+	}
+	for (i = 0; i < 2; i++) {
+		(void)fcntl(q->notify_fd[i], F_SETFL, O_NONBLOCK);
+		(void)fcntl(q->notify_fd[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	return 0;
+}
+
+static void cs_ipcs_tqueue_notify(struct cs_ipcs_tqueue *q)
+{
+	char c = 0;
+
+	if (qb_atomic_int_compare_and_exchange(&q->notify_pending, 0, 1)) {
+		/*
+		 * EAGAIN means pipe is full, so consumer is going to be woken anyway
+		 */
+		(void)write(q->notify_fd[1], &c, 1);
+	}
+}
+
+static void cs_ipcs_tqueue_notify_clear(struct cs_ipcs_tqueue *q)
+{
+	char buf[64];
+
+	while (read(q->notify_fd[0], buf, sizeof(buf)) > 0) {
+		;
+	}
+	/*
+	 * Must be cleared before queue is drained, otherwise message pushed
+	 * meanwhile may stay unnoticed
+	 */
+	qb_atomic_int_set(&q->notify_pending, 0);
+}
+
+static void cs_ipcs_tqueue_push(struct cs_ipcs_tqueue *q, struct cs_ipcs_tmsg *msg)
+{
+	msg->next = NULL;
+	qb_atomic_pointer_set((volatile void **)&q->tail->next, msg);
+	q->tail = msg;
+
+	cs_ipcs_tqueue_notify(q);
+}
+
+/*
+ * Returned message is valid until next call of cs_ipcs_tqueue_pop
+ */
+static struct cs_ipcs_tmsg *cs_ipcs_tqueue_pop(struct cs_ipcs_tqueue *q)
+{
+	struct cs_ipcs_tmsg *next;
+
+	next = qb_atomic_pointer_get((volatile void **)&q->head->next);
+	if (next == NULL) {
+		return NULL;
+	}
+
+	free(q->head);
+	q->head = next;
+
+	return next;
+}
+
+static int cs_ipcs_tqueue_is_empty(struct cs_ipcs_tqueue *q)
+{
+	return (qb_atomic_pointer_get((volatile void **)&q->head->next) == NULL);
+}
+
+/*
+ * Free queue and all messages in it. Neither side may use it anymore.
+ */
+static void cs_ipcs_tqueue_fini(struct cs_ipcs_tqueue *q)
+{
+	while (cs_ipcs_tqueue_pop(q) != NULL) {
+		;
+	}
+	free(q->head);
+	q->head = q->tail = NULL;
+
+	close(q->notify_fd[0]);
+	close(q->notify_fd[1]);
+}
+
+static struct cs_ipcs_tmsg *cs_ipcs_tmsg_alloc(enum cs_ipcs_tmsg_type type,
+	qb_ipcs_connection_t *c,
+	const struct iovec *iov,
+	unsigned int iov_len)
+{
+	struct cs_ipcs_tmsg *msg;
+	size_t len = 0;
+	size_t pos = 0;
+	unsigned int i;
+
+	for (i = 0; i < iov_len; i++) {
+		len += iov[i].iov_len;
+	}
+
+	msg = malloc(sizeof(struct cs_ipcs_tmsg) + len);
+	if (msg == NULL) {
+		log_printf(LOGSYS_LEVEL_ERROR, "Unable to allocate IPC thread message");
+		return NULL;
+	}
+	memset(msg, 0, sizeof(struct cs_ipcs_tmsg));
+	msg->type = type;
+	msg->conn = c;
+	msg->len = len;
+
+	for (i = 0; i < iov_len; i++) {
+		memcpy(msg->data + pos, iov[i].iov_base, iov[i].iov_len);
+		pos += iov[i].iov_len;
+	}
+
+	return msg;
+}
+
+static int cs_ipcs_tmsg_post(struct cs_ipcs_tqueue *q, enum cs_ipcs_tmsg_type type,
+	qb_ipcs_connection_t *c, const struct iovec *iov, unsigned int iov_len)
+{
+	struct cs_ipcs_tmsg *msg;
+
+	msg = cs_ipcs_tmsg_alloc(type, c, iov, iov_len);
+	if (msg == NULL) {
+		return -ENOMEM;
+	}
+	cs_ipcs_tqueue_push(q, msg);
+
+	return 0;
+}
+
+/*
+ * Run fn in IPC thread and wait for the result
+ */
+static int32_t cs_ipcs_thread_call(struct cs_ipcs_thread *t, int32_t (*fn) (void *arg), void *arg)
+{
+	struct cs_ipcs_tcall call;
+	struct cs_ipcs_tmsg *msg;
+
+	msg = cs_ipcs_tmsg_alloc(CS_IPCS_TMSG_CALL, NULL, NULL, 0);
+	if (msg == NULL) {
+		return -ENOMEM;
+	}
+
+	call.fn = fn;
+	call.arg = arg;
+	call.result = 0;
+	call.done = 0;
+	pthread_mutex_init(&call.mutex, NULL);
+	pthread_cond_init(&call.cond, NULL);
+	msg->call = &call;
+
+	cs_ipcs_tqueue_push(&t->to_thread, msg);
+
+	pthread_mutex_lock(&call.mutex);
+	while (!call.done) {
+		pthread_cond_wait(&call.cond, &call.mutex);
+	}
+	pthread_mutex_unlock(&call.mutex);
+
+	pthread_cond_destroy(&call.cond);
+	pthread_mutex_destroy(&call.mutex);
+
+	return call.result;
+}
+
+static void cs_ipcs_thread_call_complete(struct cs_ipcs_tcall *call, int32_t result)
+{
+	pthread_mutex_lock(&call->mutex);
+	call->result = result;
+	call->done = 1;
+	pthread_cond_signal(&call->cond);
+	pthread_mutex_unlock(&call->mutex);
+}
+
+static struct cs_ipcs_thread *cs_ipcs_conn_thread(qb_ipcs_connection_t *c)
+{
+	if (ipc_threads_count == 0) {
+		return NULL;
+	}
+
+	return ipcs_mapper[qb_ipcs_service_id_get(c)].thread;
+}
+
+static qb_loop_t *cs_ipcs_loop_get(void)
+{
+	struct cs_ipcs_thread *t = NULL;
+
+	if (ipc_threads_count > 0) {
+		t = pthread_getspecific(ipc_thread_key);
+	}
+
+	return (t != NULL ? t->loop : cs_poll_handle_get());
+}
+
+static void cs_ipcs_disconnect(qb_ipcs_connection_t *c)
+{
+	struct cs_ipcs_thread *t = cs_ipcs_conn_thread(c);
+
+	if (t == NULL) {
+		qb_ipcs_disconnect(c);
+	} else {
+		cs_ipcs_tmsg_post(&t->to_thread, CS_IPCS_TMSG_DISCONNECT, c, NULL, 0);
+	}
+}
+
+static int32_t cs_ipcs_service_destroy_fn(void *arg)
+{
+	qb_ipcs_destroy((qb_ipcs_service_t *)arg);
+	return 0;
+}
+
+static void cs_ipcs_main_dispatch_msgs(struct cs_ipcs_thread *t, uint32_t max);
+
 int32_t cs_ipcs_service_destroy(int32_t service_id)
 {
+	struct cs_ipcs_thread *t = ipcs_mapper[service_id].thread;
+
 	if (ipcs_mapper[service_id].inst) {
-		qb_ipcs_destroy(ipcs_mapper[service_id].inst);
+		if (t == NULL) {
+			qb_ipcs_destroy(ipcs_mapper[service_id].inst);
+		} else {
+			cs_ipcs_thread_call(t, cs_ipcs_service_destroy_fn,
+				ipcs_mapper[service_id].inst);
+			/*
+			 * Finish closed connections right now, same as without IPC threads
+			 */
+			cs_ipcs_main_dispatch_msgs(t, 0);
+		}
 		ipcs_mapper[service_id].inst = NULL;
 	}
 	return 0;
 }
 
+/*
+ * Credentials of accepted connections waiting for connection_created.
+ * Accept may be called by IPC thread.
+ */
+struct cs_ipcs_cred {
+	struct list_head list;
+	qb_ipcs_connection_t *c;
+	uid_t euid;
+	gid_t egid;
+};
+
+static DECLARE_LIST_INIT(ipc_cred_head);
+static pthread_mutex_t ipc_cred_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int cs_ipcs_cred_store(qb_ipcs_connection_t *c, uid_t euid, gid_t egid)
+{
+	struct cs_ipcs_cred *cred;
+
+	cred = malloc(sizeof(*cred));
+	if (cred == NULL) {
+		return -1;
+	}
+	cred->c = c;
+	cred->euid = euid;
+	cred->egid = egid;
+
+	pthread_mutex_lock(&ipc_cred_mutex);
+	list_add_tail(&cred->list, &ipc_cred_head);
+	pthread_mutex_unlock(&ipc_cred_mutex);
+
+	return 0;
+}
+
+/*
+ * Returns 0 and removes stored credentials of connection, -1 if there are none
+ */
+static int cs_ipcs_cred_take(qb_ipcs_connection_t *c, uid_t *euid, gid_t *egid)
+{
+	struct list_head *iter;
+	struct cs_ipcs_cred *cred;
+	int res = -1;
+
+	pthread_mutex_lock(&ipc_cred_mutex);
+	for (iter = ipc_cred_head.next; iter != &ipc_cred_head; iter = iter->next) {
+		cred = list_entry(iter, struct cs_ipcs_cred, list);
+		if (cred->c == c) {
+			if (euid != NULL) {
+				*euid = cred->euid;
+			}
+			if (egid != NULL) {
+				*egid = cred->egid;
+			}
+			list_del(&cred->list);
+			free(cred);
+			res = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ipc_cred_mutex);
+
+	return res;
+}
+
 static int32_t cs_ipcs_connection_accept (qb_ipcs_connection_t *c, uid_t euid, gid_t egid)
 {
 	int32_t service = qb_ipcs_service_id_get(c);
@@ -187,20 +732,32 @@ static int32_t cs_ipcs_connection_accept (qb_ipcs_connection_t *c, uid_t euid, g
 	}
 
 	if (euid == 0 || egid == 0) {
-		return 0;
+		goto accepted;
 	}
 
-	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "uidgid.uid.%u", euid);
-	if (icmap_get_uint8(key_name, &u8) == CS_OK && u8 == 1)
-		return 0;
+	if (ipc_threads_count > 0) {
+		if (cs_ipcs_uidgid_allowed(euid, egid)) {
+			goto accepted;
+		}
+	} else {
+		snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "uidgid.uid.%u", euid);
+		if (icmap_get_uint8(key_name, &u8) == CS_OK && u8 == 1)
+			goto accepted;
 
-	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "uidgid.gid.%u", egid);
-	if (icmap_get_uint8(key_name, &u8) == CS_OK && u8 == 1)
-		return 0;
+		snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "uidgid.gid.%u", egid);
+		if (icmap_get_uint8(key_name, &u8) == CS_OK && u8 == 1)
+			goto accepted;
+	}
 
 	log_printf(LOGSYS_LEVEL_ERROR, "Denied connection attempt from %d:%d", euid, egid);
 
 	return -EACCES;
+
+accepted:
+	if (cs_ipcs_cred_store(c, euid, egid) != 0) {
+		return -ENOMEM;
+	}
+	return 0;
 }
 
 static char * pid_to_name (pid_t pid, char *out_name, size_t name_len)
@@ -249,86 +806,170 @@ static char * pid_to_name (pid_t pid, char *out_name, size_t name_len)
 
 struct cs_ipcs_conn_context {
 	char *icmap_path;
-	struct list_head outq_head;
+	struct cs_ipcs_outq outq;
 	int32_t queuing;
 	uint32_t queued;
 	uint64_t invalid_request;
 	uint64_t overload;
 	uint32_t sent;
+	uint32_t client_pid;
+	uid_t euid; /* Peer credentials checked by connection_accept */
+	gid_t egid;
+	int32_t cred_valid;
+	char proc_name[32];
+	int32_t proc_name_set;
+	int32_t closed; /* Used only by IPC thread */
+	int32_t main_refs; /* Used only by main thread */
+	qb_ipcs_connection_t *conn;
+	struct list_head send_ready_list;
+	void *send_ready_msg; /* Event sent when flow control is turned off */
+	size_t send_ready_msg_len;
+	void *response_ready_msg; /* Response sent when flow control is turned off */
+	size_t response_ready_msg_len;
+	struct list_head fc_list; /* Fair queueing, used only by main thread */
+	struct list_head fc_pending_head;
+	size_t fc_pending_bytes;
+	uint32_t fc_round;
+	uint32_t fc_weight; /* Cached, updated by ipc_fc_weight_track */
+	int32_t fc_credits;
+	int32_t fc_blocked; /* Pending requests over CS_IPCS_FC_PENDING_MAX, reading stopped */
+	uint64_t fc_deferred;
+	int32_t stats_slot; /* Slot in statistics segment, used only by main thread */
 	char data[1];
 };
 
-static void cs_ipcs_connection_created(qb_ipcs_connection_t *c)
+static DECLARE_LIST_INIT(ipc_fc_conn_list_head);
+static uint32_t ipc_fc_round = 1;
+static int32_t ipc_fc_round_avail = 0; /* Free totem queue space at start of round */
+static uint64_t ipc_fc_weight_total = 0; /* Sum of weights of ipc_fc_conn_list_head */
+static qb_loop_timer_handle ipc_fc_round_timer;
+
+static uint32_t cs_ipcs_fc_weight_get(struct cs_ipcs_conn_context *cnx)
 {
-	int32_t service = 0;
-	struct cs_ipcs_conn_context *context;
-	char proc_name[32];
-	struct qb_ipcs_connection_stats stats;
-	int32_t size = sizeof(struct cs_ipcs_conn_context);
 	char key_name[ICMAP_KEYNAME_MAXLEN];
-	int set_client_pid = 0;
-	int set_proc_name = 0;
+	uint32_t weight;
+	char *str;
 
-	log_printf(LOG_DEBUG, "connection created");
+	if (!cnx->proc_name_set) {
+		return CS_IPCS_FC_WEIGHT_DEFAULT;
+	}
 
-	service = qb_ipcs_service_id_get(c);
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "qb.ipc_weight.%s", cnx->proc_name);
+	icmap_convert_name_to_valid_name(key_name);
 
-	size += corosync_service[service]->private_data_size;
-	context = calloc(1, size);
-	if (context == NULL) {
-		qb_ipcs_disconnect(c);
-		return;
+	if (icmap_get_uint32(key_name, &weight) != CS_OK) {
+		/*
+		 * Key may be created by cmapctl as string
+		 */
+		if (icmap_get_string(key_name, &str) != CS_OK) {
+			return CS_IPCS_FC_WEIGHT_DEFAULT;
+		}
+		weight = strtoul(str, NULL, 10);
+		free(str);
 	}
 
-	list_init(&context->outq_head);
-	context->queuing = QB_FALSE;
-	context->queued = 0;
-	context->sent = 0;
+	if (weight == 0) {
+		weight = CS_IPCS_FC_WEIGHT_DEFAULT;
+	}
+	if (weight > CS_IPCS_FC_WEIGHT_MAX) {
+		weight = CS_IPCS_FC_WEIGHT_MAX;
+	}
 
-	qb_ipcs_context_set(c, context);
+	return weight;
+}
 
-	if (corosync_service[service]->lib_init_fn(c) != 0) {
-		log_printf(LOG_ERR, "lib_init_fn failed, disconnecting");
-		qb_ipcs_disconnect(c);
-		return;
+static void cs_ipcs_fc_weight_changed(
+	int32_t event,
+	const char *key_name,
+	struct icmap_notify_value new_val,
+	struct icmap_notify_value old_val,
+	void *user_data)
+{
+	struct list_head *iter;
+	struct cs_ipcs_conn_context *cnx;
+	uint32_t weight;
+
+	for (iter = ipc_fc_conn_list_head.next; iter != &ipc_fc_conn_list_head; iter = iter->next) {
+		cnx = list_entry(iter, struct cs_ipcs_conn_context, fc_list);
+
+		weight = cs_ipcs_fc_weight_get(cnx);
+		ipc_fc_weight_total -= cnx->fc_weight;
+		ipc_fc_weight_total += weight;
+		cnx->fc_weight = weight;
 	}
-	icmap_inc("runtime.connections.active");
+}
 
-	qb_ipcs_connection_stats_get(c, &stats, QB_FALSE);
+static void cs_ipcs_fc_blocked_set(struct cs_ipcs_conn_context *cnx, int32_t blocked)
+{
+	struct cs_ipcs_thread *t = cs_ipcs_conn_thread(cnx->conn);
 
-	if (stats.client_pid > 0) {
-		if (pid_to_name (stats.client_pid, proc_name, sizeof(proc_name))) {
-			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "runtime.connections.%s:%u:%p",
-					proc_name, stats.client_pid, c);
-			set_proc_name = 1;
-		} else {
-			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "runtime.connections.%u:%p",
-					stats.client_pid, c);
-		}
-		set_client_pid = 1;
+	if (cnx->fc_blocked == blocked) {
+		return ;
+	}
+
+	cnx->fc_blocked = blocked;
+	if (t == NULL) {
+		cs_ipcs_conn_read_block(cnx->conn, blocked);
 	} else {
-		snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "runtime.connections.%p", c);
+		cs_ipcs_tmsg_post(&t->to_thread, blocked ? CS_IPCS_TMSG_BLOCK : CS_IPCS_TMSG_UNBLOCK,
+			cnx->conn, NULL, 0);
 	}
+}
 
-	icmap_convert_name_to_valid_name(key_name);
+static void cs_ipcs_fc_conn_fini(struct cs_ipcs_conn_context *cnx)
+{
+	struct list_head *iter, *iter_next;
+
+	if (!list_empty(&cnx->fc_list)) {
+		ipc_fc_weight_total -= cnx->fc_weight;
+	}
+	list_del(&cnx->fc_list);
+	list_init(&cnx->fc_list);
+	/*
+	 * Connection is closing, there is nothing to read any longer
+	 */
+	cnx->fc_blocked = QB_FALSE;
+
+	for (iter = cnx->fc_pending_head.next; iter != &cnx->fc_pending_head; iter = iter_next) {
+		iter_next = iter->next;
+
+		list_del(iter);
+		free(list_entry(iter, struct cs_ipcs_fc_pending, list));
+	}
+	cnx->fc_pending_bytes = 0;
+}
+
+/*
+ * Main thread part of connection creation
+ */
+static void cs_ipcs_connection_init(qb_ipcs_connection_t *c)
+{
+	int32_t service = qb_ipcs_service_id_get(c);
+	struct cs_ipcs_conn_context *context = qb_ipcs_context_get(c);
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+
+	if (corosync_service[service]->lib_init_fn(c) != 0) {
+		log_printf(LOG_ERR, "lib_init_fn failed, disconnecting");
+		cs_ipcs_disconnect(c);
+		return;
+	}
+	icmap_inc("runtime.connections.active");
+	context->fc_weight = cs_ipcs_fc_weight_get(context);
+	list_add_tail(&context->fc_list, &ipc_fc_conn_list_head);
+	ipc_fc_weight_total += context->fc_weight;
 
-	context->icmap_path = strdup(key_name);
 	if (context->icmap_path == NULL) {
-		qb_ipcs_disconnect(c);
+		cs_ipcs_disconnect(c);
 		return;
 	}
 
-	if (set_proc_name) {
+	if (context->proc_name_set) {
 		snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.name", context->icmap_path);
-		icmap_set_string(key_name, proc_name);
+		icmap_set_string(key_name, context->proc_name);
 	}
 
 	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.client_pid", context->icmap_path);
-	if (set_client_pid) {
-		icmap_set_uint32(key_name, stats.client_pid);
-	} else {
-		icmap_set_uint32(key_name, 0);
-	}
+	icmap_set_uint32(key_name, context->client_pid);
 
 	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.service_id", context->icmap_path);
 	icmap_set_uint32(key_name, service);
@@ -357,21 +998,144 @@ static void cs_ipcs_connection_created(qb_ipcs_connection_t *c)
 	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.queue_size", context->icmap_path);
 	icmap_set_uint32(key_name, 0);
 
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.queue_size_max", context->icmap_path);
+	icmap_set_uint32(key_name, 0);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.queue_bytes", context->icmap_path);
+	icmap_set_uint64(key_name, 0);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.queue_bytes_max", context->icmap_path);
+	icmap_set_uint64(key_name, 0);
+
 	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.invalid_request", context->icmap_path);
 	icmap_set_uint64(key_name, 0);
 
 	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.overload", context->icmap_path);
 	icmap_set_uint64(key_name, 0);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.fc_weight", context->icmap_path);
+	icmap_set_uint32(key_name, context->fc_weight);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.fc_deferred", context->icmap_path);
+	icmap_set_uint64(key_name, 0);
+
+	context->stats_slot = stats_shm_connection_alloc(
+	    context->icmap_path + strlen("runtime.connections."),
+	    context->client_pid, service);
+}
+
+static void cs_ipcs_connection_created(qb_ipcs_connection_t *c)
+{
+	int32_t service = 0;
+	struct cs_ipcs_conn_context *context;
+	struct qb_ipcs_connection_stats stats;
+	int32_t size = sizeof(struct cs_ipcs_conn_context);
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+	struct cs_ipcs_thread *t;
+
+	log_printf(LOG_DEBUG, "connection created");
+
+	service = qb_ipcs_service_id_get(c);
+
+	size += corosync_service[service]->private_data_size;
+	context = calloc(1, size);
+	if (context == NULL) {
+		qb_ipcs_disconnect(c);
+		return;
+	}
+
+	context->queuing = QB_FALSE;
+	context->queued = 0;
+	context->sent = 0;
+	context->stats_slot = -1;
+	list_init(&context->send_ready_list);
+	context->conn = c;
+	list_init(&context->fc_list);
+	list_init(&context->fc_pending_head);
+	context->cred_valid = (cs_ipcs_cred_take(c, &context->euid, &context->egid) == 0);
+
+	qb_ipcs_context_set(c, context);
+
+	qb_ipcs_connection_stats_get(c, &stats, QB_FALSE);
+
+	if (stats.client_pid > 0) {
+		if (pid_to_name (stats.client_pid, context->proc_name, sizeof(context->proc_name))) {
+			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "runtime.connections.%s:%u:%p",
+					context->proc_name, stats.client_pid, c);
+			context->proc_name_set = 1;
+		} else {
+			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "runtime.connections.%u:%p",
+					stats.client_pid, c);
+		}
+		context->client_pid = stats.client_pid;
+	} else {
+		snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "runtime.connections.%p", c);
+	}
+
+	icmap_convert_name_to_valid_name(key_name);
+
+	context->icmap_path = strdup(key_name);
+
+	t = cs_ipcs_conn_thread(c);
+	if (t == NULL) {
+		cs_ipcs_connection_init(c);
+		return;
+	}
+
+	/*
+	 * Connection is kept alive until main thread releases all its references
+	 */
+	context->main_refs = 1;
+	qb_ipcs_connection_ref(c);
+	cs_ipcs_tmsg_post(&t->to_main, CS_IPCS_TMSG_CREATED, c, NULL, 0);
 }
 
 void cs_ipc_refcnt_inc(void *conn)
 {
-	qb_ipcs_connection_ref(conn);
+	struct cs_ipcs_conn_context *cnx;
+
+	if (cs_ipcs_conn_thread(conn) == NULL) {
+		qb_ipcs_connection_ref(conn);
+		return;
+	}
+
+	cnx = qb_ipcs_context_get(conn);
+	cnx->main_refs++;
 }
 
 void cs_ipc_refcnt_dec(void *conn)
 {
-	qb_ipcs_connection_unref(conn);
+	struct cs_ipcs_thread *t = cs_ipcs_conn_thread(conn);
+	struct cs_ipcs_conn_context *cnx;
+
+	if (t == NULL) {
+		qb_ipcs_connection_unref(conn);
+		return;
+	}
+
+	cnx = qb_ipcs_context_get(conn);
+	cnx->main_refs--;
+	if (cnx->main_refs == 0) {
+		/*
+		 * Last reference must be dropped by IPC thread, because it may
+		 * destroy the connection
+		 */
+		cs_ipcs_tmsg_post(&t->to_thread, CS_IPCS_TMSG_UNREF, conn, NULL, 0);
+	}
+}
+
+int cs_ipcs_credentials_get(void *conn, uid_t *euid, gid_t *egid)
+{
+	struct cs_ipcs_conn_context *cnx;
+
+	cnx = qb_ipcs_context_get(conn);
+	if (cnx == NULL || !cnx->cred_valid) {
+		return -1;
+	}
+	*euid = cnx->euid;
+	*egid = cnx->egid;
+
+	return 0;
 }
 
 void *cs_ipcs_private_data_get(void *conn)
@@ -384,28 +1148,26 @@ void *cs_ipcs_private_data_get(void *conn)
 static void cs_ipcs_connection_destroyed (qb_ipcs_connection_t *c)
 {
 	struct cs_ipcs_conn_context *context;
-	struct list_head *list, *list_next;
-	struct outq_item *outq_item;
 
 	log_printf(LOG_DEBUG, "%s() ", __func__);
 
+	/*
+	 * Connection may be destroyed between accept and created
+	 */
+	(void)cs_ipcs_cred_take(c, NULL, NULL);
+
 	context = qb_ipcs_context_get(c);
 	if (context) {
-		for (list = context->outq_head.next;
-			list != &context->outq_head; list = list_next) {
-
-			list_next = list->next;
-			outq_item = list_entry (list, struct outq_item, list);
-
-			list_del (list);
-			free (outq_item->msg);
-			free (outq_item);
-		}
+		free(context->icmap_path);
+		free(context->outq.buf);
 		free(context);
 	}
 }
 
-static int32_t cs_ipcs_connection_closed (qb_ipcs_connection_t *c)
+/*
+ * Main thread part of connection close
+ */
+static int32_t cs_ipcs_connection_fini(qb_ipcs_connection_t *c)
 {
 	int32_t res = 0;
 	int32_t service = qb_ipcs_service_id_get(c);
@@ -414,23 +1176,34 @@ static int32_t cs_ipcs_connection_closed (qb_ipcs_connection_t *c)
 	const char *key_name;
 	struct cs_ipcs_conn_context *cnx;
 
-	log_printf(LOG_DEBUG, "%s() ", __func__);
 	res = corosync_service[service]->lib_exit_fn(c);
 	if (res != 0) {
 		return res;
 	}
 
-	qb_loop_job_del(cs_poll_handle_get(), QB_LOOP_HIGH, c, outq_flush);
-
 	cnx = qb_ipcs_context_get(c);
 
-	snprintf(prefix, ICMAP_KEYNAME_MAXLEN, "%s.", cnx->icmap_path);
-	iter = icmap_iter_init(prefix);
-	while ((key_name = icmap_iter_next(iter, NULL, NULL)) != NULL) {
-		icmap_delete(key_name);
+	if (cnx->send_ready_msg != NULL || cnx->response_ready_msg != NULL) {
+		list_del(&cnx->send_ready_list);
+		free(cnx->send_ready_msg);
+		cnx->send_ready_msg = NULL;
+		free(cnx->response_ready_msg);
+		cnx->response_ready_msg = NULL;
+	}
+
+	cs_ipcs_fc_conn_fini(cnx);
+
+	stats_shm_connection_free(cnx->stats_slot);
+	cnx->stats_slot = -1;
+
+	if (cnx->icmap_path != NULL) {
+		snprintf(prefix, ICMAP_KEYNAME_MAXLEN, "%s.", cnx->icmap_path);
+		iter = icmap_iter_init(prefix);
+		while ((key_name = icmap_iter_next(iter, NULL, NULL)) != NULL) {
+			icmap_delete(key_name);
+		}
+		icmap_iter_finalize(iter);
 	}
-	icmap_iter_finalize(iter);
-	free(cnx->icmap_path);
 
 	icmap_inc("runtime.connections.closed");
 	icmap_dec("runtime.connections.active");
@@ -438,11 +1211,64 @@ static int32_t cs_ipcs_connection_closed (qb_ipcs_connection_t *c)
 	return 0;
 }
 
+static void cs_ipcs_connection_closed_main(void *data)
+{
+	qb_ipcs_connection_t *c = data;
+
+	if (cs_ipcs_connection_fini(c) != 0) {
+		/*
+		 * Service is not ready to let the connection go, try later
+		 */
+		qb_loop_job_add(cs_poll_handle_get(), QB_LOOP_LOW, c, cs_ipcs_connection_closed_main);
+		return;
+	}
+
+	cs_ipc_refcnt_dec(c);
+}
+
+static int32_t cs_ipcs_connection_closed (qb_ipcs_connection_t *c)
+{
+	int32_t res = 0;
+	struct cs_ipcs_conn_context *cnx;
+	struct cs_ipcs_thread *t;
+
+	log_printf(LOG_DEBUG, "%s() ", __func__);
+
+	cnx = qb_ipcs_context_get(c);
+	if (cnx == NULL) {
+		return 0;
+	}
+
+	t = cs_ipcs_conn_thread(c);
+	if (t == NULL) {
+		res = cs_ipcs_connection_fini(c);
+		if (res != 0) {
+			return res;
+		}
+		qb_loop_job_del(cs_poll_handle_get(), QB_LOOP_HIGH, c, outq_flush);
+
+		return 0;
+	}
+
+	qb_loop_job_del(t->loop, QB_LOOP_HIGH, c, outq_flush);
+	cnx->closed = QB_TRUE;
+	cs_ipcs_tmsg_post(&t->to_main, CS_IPCS_TMSG_CLOSED, c, NULL, 0);
+
+	return 0;
+}
+
 int cs_ipcs_response_iov_send (void *conn,
 	const struct iovec *iov,
 	unsigned int iov_len)
 {
-	int32_t rc = qb_ipcs_response_sendv(conn, iov, iov_len);
+	struct cs_ipcs_thread *t = cs_ipcs_conn_thread(conn);
+	int32_t rc;
+
+	if (t != NULL) {
+		return cs_ipcs_tmsg_post(&t->to_thread, CS_IPCS_TMSG_RESPONSE, conn, iov, iov_len);
+	}
+
+	rc = qb_ipcs_response_sendv(conn, iov, iov_len);
 	if (rc >= 0) {
 		return 0;
 	}
@@ -451,69 +1277,184 @@ int cs_ipcs_response_iov_send (void *conn,
 
 int cs_ipcs_response_send(void *conn, const void *msg, size_t mlen)
 {
-	int32_t rc = qb_ipcs_response_send(conn, msg, mlen);
+	struct iovec iov;
+	int32_t rc;
+
+	if (cs_ipcs_conn_thread(conn) != NULL) {
+		iov.iov_base = (void *)msg;
+		iov.iov_len = mlen;
+		return cs_ipcs_response_iov_send(conn, &iov, 1);
+	}
+
+	rc = qb_ipcs_response_send(conn, msg, mlen);
 	if (rc >= 0) {
 		return 0;
 	}
 	return rc;
 }
 
+/*
+ * Copy len bytes to the ring starting at offset pos (relative to head)
+ */
+static void outq_write (struct cs_ipcs_outq *outq, size_t pos, const void *data, size_t len)
+{
+	size_t start = (outq->head + pos) % outq->size;
+	size_t first = QB_MIN(len, outq->size - start);
+
+	memcpy (outq->buf + start, data, first);
+	memcpy (outq->buf, (const char *)data + first, len - first);
+}
+
+static void outq_read (const struct cs_ipcs_outq *outq, size_t pos, void *data, size_t len)
+{
+	size_t start = (outq->head + pos) % outq->size;
+	size_t first = QB_MIN(len, outq->size - start);
+
+	memcpy (data, outq->buf + start, first);
+	memcpy ((char *)data + first, outq->buf, len - first);
+}
+
+/*
+ * Make sure there is room for another needed bytes. Content is linearized
+ * when ring has to grow, so head is always 0 after reallocation.
+ */
+static int outq_reserve (struct cs_ipcs_outq *outq, size_t needed)
+{
+	size_t new_size;
+	char *new_buf;
+
+	if (outq->size - outq->used >= needed) {
+		return (0);
+	}
+
+	new_size = (outq->size == 0 ? CS_IPCS_OUTQ_INITIAL_SIZE : outq->size);
+	while (new_size - outq->used < needed) {
+		new_size *= 2;
+	}
+
+	if (new_size > CS_IPCS_OUTQ_MAX_SIZE) {
+		return (-ENOBUFS);
+	}
+
+	new_buf = malloc (new_size);
+	if (new_buf == NULL) {
+		return (-ENOMEM);
+	}
+
+	if (outq->used > 0) {
+		outq_read (outq, 0, new_buf, outq->used);
+	}
+	free (outq->buf);
+
+	outq->buf = new_buf;
+	outq->size = new_size;
+	outq->head = 0;
+
+	return (0);
+}
+
+/*
+ * Give memory back after burst
+ */
+static void outq_shrink (struct cs_ipcs_outq *outq)
+{
+	size_t new_size;
+	char *new_buf;
+
+	new_size = outq->size;
+	while (new_size / 2 >= CS_IPCS_OUTQ_INITIAL_SIZE && outq->used <= new_size / 8) {
+		new_size /= 2;
+	}
+
+	if (new_size == outq->size) {
+		return ;
+	}
+
+	new_buf = malloc (new_size);
+	if (new_buf == NULL) {
+		return ;
+	}
+
+	if (outq->used > 0) {
+		outq_read (outq, 0, new_buf, outq->used);
+	}
+	free (outq->buf);
+
+	outq->buf = new_buf;
+	outq->size = new_size;
+	outq->head = 0;
+}
+
 static void outq_flush (void *data)
 {
 	qb_ipcs_connection_t *conn = data;
-	struct list_head *list, *list_next;
-	struct outq_item *outq_item;
+	uint32_t mlen;
+	size_t start;
+	struct iovec iov[2];
+	int32_t iov_len;
 	int32_t rc;
 	struct cs_ipcs_conn_context *context = qb_ipcs_context_get(conn);
+	struct cs_ipcs_outq *outq = &context->outq;
+
+	while (outq->msgs > 0) {
+		outq_read (outq, 0, &mlen, sizeof (mlen));
+
+		/*
+		 * Message may wrap around the end of the ring. It is then
+		 * passed to libqb as two iovecs, so no extra copy is needed.
+		 */
+		start = (outq->head + sizeof (mlen)) % outq->size;
+		iov[0].iov_base = outq->buf + start;
+		iov[0].iov_len = QB_MIN(mlen, outq->size - start);
+		iov[1].iov_base = outq->buf;
+		iov[1].iov_len = mlen - iov[0].iov_len;
+		iov_len = (iov[1].iov_len > 0 ? 2 : 1);
 
-	for (list = context->outq_head.next;
-		list != &context->outq_head; list = list_next) {
-
-		list_next = list->next;
-		outq_item = list_entry (list, struct outq_item, list);
-
-		rc = qb_ipcs_event_send(conn, outq_item->msg, outq_item->mlen);
+		rc = qb_ipcs_event_sendv(conn, iov, iov_len);
 		if (rc < 0 && rc != -EAGAIN) {
 			errno = -rc;
-			qb_perror(LOG_ERR, "qb_ipcs_event_send");
+			qb_perror(LOG_ERR, "qb_ipcs_event_sendv");
 			return;
 		} else if (rc == -EAGAIN) {
 			break;
 		}
-		assert(rc == outq_item->mlen);
+		assert(rc == mlen);
 		context->sent++;
 		context->queued--;
 
-		list_del (list);
-		free (outq_item->msg);
-		free (outq_item);
+		outq->head = (outq->head + sizeof (mlen) + mlen) % outq->size;
+		outq->used -= sizeof (mlen) + mlen;
+		outq->msgs--;
 	}
-	if (list_empty (&context->outq_head)) {
+	if (outq->msgs == 0) {
 		context->queuing = QB_FALSE;
 		log_printf(LOGSYS_LEVEL_INFO, "Q empty, queued:%d sent:%d.",
 			context->queued, context->sent);
 		context->queued = 0;
 		context->sent = 0;
+		outq->head = 0;
 	} else {
-		qb_loop_job_add(cs_poll_handle_get(), QB_LOOP_HIGH, conn, outq_flush);
+		qb_loop_job_add(cs_ipcs_loop_get(), QB_LOOP_HIGH, conn, outq_flush);
 	}
+
+	outq_shrink (outq);
 }
 
 static void msg_send_or_queue(qb_ipcs_connection_t *conn, const struct iovec *iov, uint32_t iov_len)
 {
 	int32_t rc = 0;
 	int32_t i;
-	int32_t bytes_msg = 0;
-	struct outq_item *outq_item;
-	char *write_buf = 0;
+	uint32_t bytes_msg = 0;
+	size_t pos;
 	struct cs_ipcs_conn_context *context = qb_ipcs_context_get(conn);
+	struct cs_ipcs_outq *outq = &context->outq;
 
 	for (i = 0; i < iov_len; i++) {
 		bytes_msg += iov[i].iov_len;
 	}
 
 	if (!context->queuing) {
-		assert(list_empty (&context->outq_head));
+		assert(outq->msgs == 0);
 		rc = qb_ipcs_event_sendv(conn, iov, iov_len);
 		if (rc == bytes_msg) {
 			context->sent++;
@@ -523,32 +1464,38 @@ static void msg_send_or_queue(qb_ipcs_connection_t *conn, const struct iovec *io
 			context->queued = 0;
 			context->sent = 0;
 			context->queuing = QB_TRUE;
-			qb_loop_job_add(cs_poll_handle_get(), QB_LOOP_HIGH, conn, outq_flush);
+			qb_loop_job_add(cs_ipcs_loop_get(), QB_LOOP_HIGH, conn, outq_flush);
 		} else {
-			log_printf(LOGSYS_LEVEL_ERROR, "event_send retuned %d, expected %d!", rc, bytes_msg);
+			log_printf(LOGSYS_LEVEL_ERROR, "event_send retuned %d, expected %u!", rc, bytes_msg);
 			return;
 		}
 	}
-	outq_item = malloc (sizeof (struct outq_item));
-	if (outq_item == NULL) {
-		qb_ipcs_disconnect(conn);
-		return;
-	}
-	outq_item->msg = malloc (bytes_msg);
-	if (outq_item->msg == NULL) {
-		free (outq_item);
+
+	rc = outq_reserve (outq, sizeof (bytes_msg) + bytes_msg);
+	if (rc != 0) {
+		log_printf(LOGSYS_LEVEL_ERROR,
+			"Unable to queue message for %s (%u messages, %zu bytes queued): %s",
+			context->icmap_path, outq->msgs, outq->used, strerror(-rc));
 		qb_ipcs_disconnect(conn);
 		return;
 	}
 
-	write_buf = outq_item->msg;
+	pos = outq->used;
+	outq_write (outq, pos, &bytes_msg, sizeof (bytes_msg));
+	pos += sizeof (bytes_msg);
 	for (i = 0; i < iov_len; i++) {
-		memcpy (write_buf, iov[i].iov_base, iov[i].iov_len);
-		write_buf += iov[i].iov_len;
+		outq_write (outq, pos, iov[i].iov_base, iov[i].iov_len);
+		pos += iov[i].iov_len;
+	}
+	outq->used = pos;
+	outq->msgs++;
+
+	if (outq->used > outq->used_hw) {
+		outq->used_hw = outq->used;
+	}
+	if (outq->msgs > outq->msgs_hw) {
+		outq->msgs_hw = outq->msgs;
 	}
-	outq_item->mlen = bytes_msg;
-	list_init (&outq_item->list);
-	list_add_tail (&outq_item->list, &context->outq_head);
 	context->queued++;
 }
 
@@ -557,20 +1504,67 @@ int cs_ipcs_dispatch_send(void *conn, const void *msg, size_t mlen)
 	struct iovec iov;
 	iov.iov_base = (void *)msg;
 	iov.iov_len = mlen;
-	msg_send_or_queue (conn, &iov, 1);
-	return 0;
+	return cs_ipcs_dispatch_iov_send (conn, &iov, 1);
 }
 
 int cs_ipcs_dispatch_iov_send (void *conn,
 	const struct iovec *iov,
 	unsigned int iov_len)
 {
+	struct cs_ipcs_thread *t = cs_ipcs_conn_thread(conn);
+
+	if (t != NULL) {
+		return cs_ipcs_tmsg_post(&t->to_thread, CS_IPCS_TMSG_EVENT, conn, iov, iov_len);
+	}
+
 	msg_send_or_queue(conn, iov, iov_len);
 	return 0;
 }
 
-static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
-		void *data, size_t size)
+static int32_t cs_ipcs_msg_is_async(int32_t service, const struct qb_ipc_request_header *request_pt)
+{
+	return (service == CPG_SERVICE &&
+	    (request_pt->id == MESSAGE_REQ_CPG_MCAST || request_pt->id == MESSAGE_REQ_CPG_SHM_RELEASE ||
+	     request_pt->id == MESSAGE_REQ_CPG_SEND_READY));
+}
+
+/*
+ * Reject request because of overload
+ */
+static void cs_ipcs_msg_overload(qb_ipcs_connection_t *c,
+	const struct qb_ipc_request_header *request_pt,
+	int32_t err)
+{
+	struct qb_ipc_response_header response;
+	int32_t service = qb_ipcs_service_id_get(c);
+	struct cs_ipcs_conn_context *cnx;
+
+	cnx = qb_ipcs_context_get(c);
+	if (cnx) {
+		cnx->overload++;
+	}
+	if (!cs_ipcs_msg_is_async(service, request_pt)) {
+		/*
+		 * Overload, tell library to retry
+		 */
+		response.size = sizeof (response);
+		response.id = 0;
+		response.error = CS_ERR_TRY_AGAIN;
+		cs_ipcs_response_send (c,
+			&response,
+			sizeof (response));
+	} else {
+		log_printf(LOGSYS_LEVEL_WARNING,
+			"*** %s() (%d:%d) %s!",
+			__func__, service, request_pt->id,
+			strerror(-err));
+	}
+}
+
+/*
+ * Handle request from client. Always called by main thread.
+ */
+static int32_t cs_ipcs_msg_handle(qb_ipcs_connection_t *c, void *data)
 {
 	struct qb_ipc_response_header response;
 	struct qb_ipc_request_header *request_pt = (struct qb_ipc_request_header *)data;
@@ -586,7 +1580,7 @@ static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
 			request_pt,
 			&sending_allowed_private_data);
 
-	is_async_call = (service == CPG_SERVICE && request_pt->id == 2);
+	is_async_call = cs_ipcs_msg_is_async(service, request_pt);
 
 	/*
 	 * This happens when the message contains some kind of invalid
@@ -606,32 +1600,13 @@ static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
 			log_printf(LOGSYS_LEVEL_INFO, "*** %s() invalid message! size:%d error:%d",
 				__func__, response.size, response.error);
 		} else {
-			qb_ipcs_response_send (c,
+			cs_ipcs_response_send (c,
 				&response,
 				sizeof (response));
 		}
 		res = -EINVAL;
 	} else if (send_ok < 0) {
-		cnx = qb_ipcs_context_get(c);
-		if (cnx) {
-			cnx->overload++;
-		}
-		if (!is_async_call) {
-			/*
-			 * Overload, tell library to retry
-			 */
-			response.size = sizeof (response);
-			response.id = 0;
-			response.error = CS_ERR_TRY_AGAIN;
-			qb_ipcs_response_send (c,
-				&response,
-				sizeof (response));
-		} else {
-			log_printf(LOGSYS_LEVEL_WARNING,
-				"*** %s() (%d:%d - %d) %s!",
-				__func__, service, request_pt->id,
-				is_async_call, strerror(-send_ok));
-		}
+		cs_ipcs_msg_overload(c, request_pt, send_ok);
 		res = -ENOBUFS;
 	}
 
@@ -643,27 +1618,440 @@ static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
 	return res;
 }
 
+/*
+ * Fair queueing, so a single busy client cannot take whole totem queue
+ */
+static int32_t ipc_fc_round_timer_armed = 0; /* boolean */
+
+static void cs_ipcs_fc_pending_drain(void);
+
+static int32_t cs_ipcs_fc_credit_required(qb_ipcs_connection_t *c, const void *data)
+{
+	const struct qb_ipc_request_header *request_pt = data;
+	int32_t service = qb_ipcs_service_id_get(c);
+
+	if (ipc_fc_totem_queue_level == TOTEM_Q_LEVEL_LOW) {
+		return QB_FALSE;
+	}
+
+	if (request_pt->id < 0 || request_pt->id >= corosync_service[service]->lib_engine_count) {
+		/*
+		 * Invalid request is refused by cs_ipcs_msg_handle
+		 */
+		return QB_FALSE;
+	}
+
+	return (corosync_service[service]->lib_engine[request_pt->id].flow_control ==
+	    CS_LIB_FLOW_CONTROL_REQUIRED);
+}
+
+static void cs_ipcs_fc_round_next(void)
+{
+	ipc_fc_round++;
+	ipc_fc_round_avail = totempg_queue_avail_get();
+}
+
+/*
+ * Share of free totem queue space of connection with given weight
+ */
+static int32_t cs_ipcs_fc_credits_get(uint32_t weight)
+{
+	uint64_t credits;
+
+	if (ipc_fc_round_avail <= 0 || ipc_fc_weight_total == 0) {
+		return 1;
+	}
+
+	credits = ((uint64_t)ipc_fc_round_avail * weight) / ipc_fc_weight_total;
+	if (credits < 1) {
+		credits = 1;
+	}
+
+	return (int32_t)credits;
+}
+
+static int32_t cs_ipcs_fc_credit_take(struct cs_ipcs_conn_context *cnx)
+{
+	if (cnx->fc_round != ipc_fc_round) {
+		cnx->fc_round = ipc_fc_round;
+		cnx->fc_credits = cs_ipcs_fc_credits_get(cnx->fc_weight);
+	}
+
+	if (cnx->fc_credits <= 0) {
+		return QB_FALSE;
+	}
+
+	cnx->fc_credits--;
+	return QB_TRUE;
+}
+
+/*
+ * Start new round if no connection active in current round has credits left
+ */
+static int32_t cs_ipcs_fc_round_advance(void)
+{
+	struct list_head *iter;
+	struct cs_ipcs_conn_context *cnx;
+
+	for (iter = ipc_fc_conn_list_head.next; iter != &ipc_fc_conn_list_head; iter = iter->next) {
+		cnx = list_entry(iter, struct cs_ipcs_conn_context, fc_list);
+
+		if (cnx->fc_round == ipc_fc_round && cnx->fc_credits > 0) {
+			return QB_FALSE;
+		}
+	}
+
+	cs_ipcs_fc_round_next();
+	return QB_TRUE;
+}
+
+static void cs_ipcs_fc_round_timer_fn(void *data)
+{
+	ipc_fc_round_timer_armed = QB_FALSE;
+
+	/*
+	 * Connections which didn't use their credits are not waited for any longer
+	 */
+	cs_ipcs_fc_round_next();
+	cs_ipcs_fc_pending_drain();
+}
+
+static void cs_ipcs_fc_round_timer_arm(void)
+{
+	if (ipc_fc_round_timer_armed) {
+		return ;
+	}
+
+	if (qb_loop_timer_add(cs_poll_handle_get(), QB_LOOP_MED, CS_IPCS_FC_ROUND_TIMEOUT,
+	    NULL, cs_ipcs_fc_round_timer_fn, &ipc_fc_round_timer) == 0) {
+		ipc_fc_round_timer_armed = QB_TRUE;
+	}
+}
+
+static int32_t cs_ipcs_fc_defer(qb_ipcs_connection_t *c, struct cs_ipcs_conn_context *cnx,
+	const void *data, size_t size)
+{
+	struct cs_ipcs_fc_pending *pending;
+
+	if (cnx->fc_pending_bytes + size > CS_IPCS_FC_PENDING_MAX &&
+	    !cs_ipcs_msg_is_async(qb_ipcs_service_id_get(c), data)) {
+		/*
+		 * Not acknowledged yet, library retries
+		 */
+		cs_ipcs_msg_overload(c, data, -ENOBUFS);
+		return -ENOBUFS;
+	}
+
+	pending = malloc(sizeof(*pending) + size);
+	if (pending == NULL) {
+		cs_ipcs_msg_overload(c, data, -ENOMEM);
+		return -ENOMEM;
+	}
+
+	pending->len = size;
+	memcpy(pending->data, data, size);
+	list_init(&pending->list);
+	list_add_tail(&pending->list, &cnx->fc_pending_head);
+	cnx->fc_pending_bytes += size;
+	cnx->fc_deferred++;
+
+	if (cnx->fc_pending_bytes > CS_IPCS_FC_PENDING_MAX) {
+		/*
+		 * Asynchronous request can't be refused, stop reading this
+		 * connection until it drains
+		 */
+		cs_ipcs_fc_blocked_set(cnx, QB_TRUE);
+	}
+
+	return 0;
+}
+
+/*
+ * Handle deferred requests of connection which still has credits.
+ * Returns number of handled requests.
+ */
+static uint32_t cs_ipcs_fc_conn_drain(struct cs_ipcs_conn_context *cnx)
+{
+	qb_ipcs_connection_t *c = cnx->conn;
+	struct cs_ipcs_fc_pending *pending;
+	uint32_t handled = 0;
+
+	while (!list_empty(&cnx->fc_pending_head) && !list_empty(&cnx->fc_list)) {
+		pending = list_entry(cnx->fc_pending_head.next, struct cs_ipcs_fc_pending, list);
+
+		if (cs_ipcs_fc_credit_required(c, pending->data) && !cs_ipcs_fc_credit_take(cnx)) {
+			break;
+		}
+
+		list_del(&pending->list);
+		cnx->fc_pending_bytes -= pending->len;
+		if (cnx->fc_pending_bytes <= CS_IPCS_FC_PENDING_LOW) {
+			cs_ipcs_fc_blocked_set(cnx, QB_FALSE);
+		}
+		(void)cs_ipcs_msg_handle(c, pending->data);
+		free(pending);
+		handled++;
+	}
+
+	return handled;
+}
+
+static void cs_ipcs_fc_pending_drain(void)
+{
+	struct list_head *iter;
+	struct cs_ipcs_conn_context *cnx;
+	qb_ipcs_connection_t *c;
+	uint32_t handled;
+	int32_t pending_left;
+	int32_t removed;
+
+	if (ipc_fc_totem_queue_level == TOTEM_Q_LEVEL_CRITICAL) {
+		/*
+		 * Drained again when level drops
+		 */
+		return ;
+	}
+
+	do {
+		handled = 0;
+		pending_left = QB_FALSE;
+
+		for (iter = ipc_fc_conn_list_head.next; iter != &ipc_fc_conn_list_head; iter = iter->next) {
+			cnx = list_entry(iter, struct cs_ipcs_conn_context, fc_list);
+			if (list_empty(&cnx->fc_pending_head)) {
+				continue;
+			}
+
+			/*
+			 * Handler may close the connection, keep it alive until
+			 * we know whether it's still on the list
+			 */
+			c = cnx->conn;
+			cs_ipc_refcnt_inc(c);
+			handled += cs_ipcs_fc_conn_drain(cnx);
+			removed = list_empty(&cnx->fc_list);
+			if (!removed && !list_empty(&cnx->fc_pending_head)) {
+				pending_left = QB_TRUE;
+			}
+			cs_ipc_refcnt_dec(c);
+
+			if (removed) {
+				/*
+				 * List changed under us, start over
+				 */
+				pending_left = QB_TRUE;
+				break;
+			}
+		}
+
+		if (pending_left && handled == 0 && !cs_ipcs_fc_round_advance()) {
+			cs_ipcs_fc_round_timer_arm();
+			return ;
+		}
+	} while (pending_left && ipc_fc_totem_queue_level != TOTEM_Q_LEVEL_CRITICAL);
+}
+
+/*
+ * Handle request with respect to fair queueing. Always called by main thread.
+ */
+static int32_t cs_ipcs_msg_fc_handle(qb_ipcs_connection_t *c, void *data, size_t size)
+{
+	struct cs_ipcs_conn_context *cnx = qb_ipcs_context_get(c);
+	int32_t res;
+
+	if (cnx == NULL) {
+		return cs_ipcs_msg_handle(c, data);
+	}
+
+	if (!list_empty(&cnx->fc_pending_head)) {
+		/*
+		 * Keep order of requests of one connection
+		 */
+		res = cs_ipcs_fc_defer(c, cnx, data, size);
+		cs_ipcs_fc_pending_drain();
+		return res;
+	}
+
+	if (!cs_ipcs_fc_credit_required(c, data) || cs_ipcs_fc_credit_take(cnx)) {
+		return cs_ipcs_msg_handle(c, data);
+	}
+
+	if (cs_ipcs_fc_round_advance() && cs_ipcs_fc_credit_take(cnx)) {
+		return cs_ipcs_msg_handle(c, data);
+	}
+
+	res = cs_ipcs_fc_defer(c, cnx, data, size);
+	cs_ipcs_fc_round_timer_arm();
+	return res;
+}
+
+static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
+		void *data, size_t size)
+{
+	struct cs_ipcs_thread *t = cs_ipcs_conn_thread(c);
+	struct iovec iov;
+
+	if (t == NULL) {
+		return cs_ipcs_msg_fc_handle(c, data, size);
+	}
+
+	/*
+	 * Request is handled by main thread. Data is only valid during this
+	 * callback, so it must be copied.
+	 */
+	iov.iov_base = data;
+	iov.iov_len = size;
+	if (cs_ipcs_tmsg_post(&t->to_main, CS_IPCS_TMSG_REQUEST, c, &iov, 1) != 0) {
+		return -ENOMEM;
+	}
+
+	if (qb_atomic_int_exchange_and_add(&t->req_bytes, size) + (int32_t)size >
+	    CS_IPCS_THREAD_REQ_MAX && !t->paused) {
+		cs_ipcs_thread_pause(t, QB_TRUE);
+	}
+
+	return 0;
+}
+
 
 static int32_t cs_ipcs_job_add(enum qb_loop_priority p,	void *data, qb_loop_job_dispatch_fn fn)
 {
-	return qb_loop_job_add(cs_poll_handle_get(), p, data, fn);
+	return qb_loop_job_add(cs_ipcs_loop_get(), p, data, fn);
+}
+
+/*
+ * Poll entries registered by libqb in one loop. libqb knows only service
+ * wide rate limit, so reading of single connection is stopped by taking
+ * POLLIN away from fds registered with the connection as data.
+ */
+struct cs_ipcs_poll_entry {
+	struct list_head list;
+	int32_t fd;
+	enum qb_loop_priority p;
+	int32_t events;
+	void *data;
+	qb_ipcs_dispatch_fn_t fn;
+	int32_t blocked;
+};
+
+static DECLARE_LIST_INIT(ipc_poll_list_head); /* Used only by main thread */
+
+static struct list_head *cs_ipcs_poll_list_get(void)
+{
+	struct cs_ipcs_thread *t = NULL;
+
+	if (ipc_threads_count > 0) {
+		t = pthread_getspecific(ipc_thread_key);
+	}
+
+	return (t != NULL ? &t->poll_list_head : &ipc_poll_list_head);
+}
+
+static struct cs_ipcs_poll_entry *cs_ipcs_poll_entry_find(int32_t fd)
+{
+	struct list_head *head = cs_ipcs_poll_list_get();
+	struct list_head *iter;
+	struct cs_ipcs_poll_entry *entry;
+
+	for (iter = head->next; iter != head; iter = iter->next) {
+		entry = list_entry(iter, struct cs_ipcs_poll_entry, list);
+		if (entry->fd == fd) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static int32_t cs_ipcs_poll_entry_events(const struct cs_ipcs_poll_entry *entry)
+{
+	if (entry->blocked) {
+		return (entry->events & ~(POLLIN | POLLPRI));
+	}
+
+	return entry->events;
 }
 
 static int32_t cs_ipcs_dispatch_add(enum qb_loop_priority p, int32_t fd, int32_t events,
 	void *data, qb_ipcs_dispatch_fn_t fn)
 {
-	return qb_loop_poll_add(cs_poll_handle_get(), p, fd, events, data, fn);
+	struct cs_ipcs_poll_entry *entry;
+	int32_t res;
+
+	entry = malloc(sizeof(*entry));
+	if (entry == NULL) {
+		return -ENOMEM;
+	}
+
+	res = qb_loop_poll_add(cs_ipcs_loop_get(), p, fd, events, data, fn);
+	if (res != 0) {
+		free(entry);
+		return res;
+	}
+
+	entry->fd = fd;
+	entry->p = p;
+	entry->events = events;
+	entry->data = data;
+	entry->fn = fn;
+	entry->blocked = QB_FALSE;
+	list_init(&entry->list);
+	list_add_tail(&entry->list, cs_ipcs_poll_list_get());
+
+	return 0;
 }
 
 static int32_t cs_ipcs_dispatch_mod(enum qb_loop_priority p, int32_t fd, int32_t events,
 	void *data, qb_ipcs_dispatch_fn_t fn)
 {
-	return qb_loop_poll_mod(cs_poll_handle_get(), p, fd, events, data, fn);
+	struct cs_ipcs_poll_entry *entry = cs_ipcs_poll_entry_find(fd);
+
+	if (entry == NULL) {
+		return qb_loop_poll_mod(cs_ipcs_loop_get(), p, fd, events, data, fn);
+	}
+
+	entry->p = p;
+	entry->events = events;
+	entry->data = data;
+	entry->fn = fn;
+
+	return qb_loop_poll_mod(cs_ipcs_loop_get(), p, fd, cs_ipcs_poll_entry_events(entry),
+		data, fn);
 }
 
 static int32_t cs_ipcs_dispatch_del(int32_t fd)
 {
-	return qb_loop_poll_del(cs_poll_handle_get(), fd);
+	struct cs_ipcs_poll_entry *entry = cs_ipcs_poll_entry_find(fd);
+
+	if (entry != NULL) {
+		list_del(&entry->list);
+		free(entry);
+	}
+
+	return qb_loop_poll_del(cs_ipcs_loop_get(), fd);
+}
+
+/*
+ * Stop or resume reading of requests of one connection. Called by thread
+ * owning the connection. POLLHUP is still reported, so disconnect is
+ * noticed even when connection is blocked.
+ */
+static void cs_ipcs_conn_read_block(qb_ipcs_connection_t *c, int32_t blocked)
+{
+	struct list_head *head = cs_ipcs_poll_list_get();
+	struct list_head *iter;
+	struct cs_ipcs_poll_entry *entry;
+
+	for (iter = head->next; iter != head; iter = iter->next) {
+		entry = list_entry(iter, struct cs_ipcs_poll_entry, list);
+		if (entry->data != c || entry->blocked == blocked) {
+			continue;
+		}
+
+		entry->blocked = blocked;
+		(void)qb_loop_poll_mod(cs_ipcs_loop_get(), entry->p, entry->fd,
+			cs_ipcs_poll_entry_events(entry), entry->data, entry->fn);
+	}
 }
 
 static void cs_ipcs_low_fds_event(int32_t not_enough, int32_t fds_available)
@@ -684,50 +2072,191 @@ int32_t cs_ipcs_q_level_get(void)
 	return ipc_fc_totem_queue_level;
 }
 
-static qb_loop_timer_handle ipcs_check_for_flow_control_timer;
-static void cs_ipcs_check_for_flow_control(void)
+static void cs_ipcs_rate_limit(int32_t service, enum qb_ipcs_rate_limit rl)
+{
+	struct cs_ipcs_thread *t = ipcs_mapper[service].thread;
+	struct cs_ipcs_tmsg *msg;
+
+	if (t == NULL) {
+		qb_ipcs_request_rate_limit(ipcs_mapper[service].inst, rl);
+		return;
+	}
+
+	msg = cs_ipcs_tmsg_alloc(CS_IPCS_TMSG_RATE_LIMIT, NULL, NULL, 0);
+	if (msg == NULL) {
+		return ;
+	}
+	msg->inst = ipcs_mapper[service].inst;
+	msg->rate_limit = rl;
+	cs_ipcs_tqueue_push(&t->to_thread, msg);
+}
+
+static int32_t cs_ipcs_fc_enabled_get(int32_t service)
 {
-	int32_t i;
 	int32_t fc_enabled;
 
-	for (i = 0; i < SERVICES_COUNT_MAX; i++) {
-		if (corosync_service[i] == NULL || ipcs_mapper[i].inst == NULL) {
-			continue;
-		}
-		fc_enabled = QB_IPCS_RATE_OFF;
-		if (ipc_fc_is_quorate == 1 ||
-			corosync_service[i]->allow_inquorate == CS_LIB_ALLOW_INQUORATE) {
+	fc_enabled = QB_IPCS_RATE_OFF;
+	if (ipc_fc_is_quorate == 1 ||
+		corosync_service[service]->allow_inquorate == CS_LIB_ALLOW_INQUORATE) {
+		/*
+		 * we are quorate
+		 * now check flow control
+		 */
+		if (ipc_fc_totem_queue_level != TOTEM_Q_LEVEL_CRITICAL &&
+		    ipc_fc_sync_in_process == 0) {
+			fc_enabled = QB_FALSE;
+		} else if (ipc_fc_totem_queue_level != TOTEM_Q_LEVEL_CRITICAL &&
+		    service == VOTEQUORUM_SERVICE) {
 			/*
-			 * we are quorate
-			 * now check flow control
+			 * Allow message processing for votequorum service even
+			 * in sync phase
 			 */
-			if (ipc_fc_totem_queue_level != TOTEM_Q_LEVEL_CRITICAL &&
-			    ipc_fc_sync_in_process == 0) {
-				fc_enabled = QB_FALSE;
-			} else if (ipc_fc_totem_queue_level != TOTEM_Q_LEVEL_CRITICAL &&
-			    i == VOTEQUORUM_SERVICE) {
-				/*
-				 * Allow message processing for votequorum service even
-				 * in sync phase
-				 */
-				fc_enabled = QB_FALSE;
-			} else {
-				fc_enabled = QB_IPCS_RATE_OFF_2;
-			}
+			fc_enabled = QB_FALSE;
+		} else {
+			fc_enabled = QB_IPCS_RATE_OFF_2;
+		}
+	}
+
+	return fc_enabled;
+}
+
+/*
+ * Connections waiting for end of flow control of their service
+ */
+static DECLARE_LIST_INIT(ipc_send_ready_list_head);
+
+/*
+ * Remember msg to be sent when flow control of the service is turned off.
+ * Only last message of each kind is remembered for each connection.
+ */
+static int cs_ipcs_ready_msg_store(struct cs_ipcs_conn_context *cnx,
+	void **ready_msg, size_t *ready_msg_len,
+	const void *msg, size_t mlen)
+{
+	void *new_msg;
+
+	new_msg = malloc(mlen);
+	if (new_msg == NULL) {
+		return -ENOMEM;
+	}
+	memcpy(new_msg, msg, mlen);
+
+	if (cnx->send_ready_msg == NULL && cnx->response_ready_msg == NULL) {
+		list_add_tail(&cnx->send_ready_list, &ipc_send_ready_list_head);
+	}
+	free(*ready_msg);
+	*ready_msg = new_msg;
+	*ready_msg_len = mlen;
+
+	return 0;
+}
+
+/*
+ * Send msg to the client as soon as flow control of the service is turned
+ * off (right away if it is off already)
+ */
+int cs_ipcs_dispatch_send_when_ready(void *conn, const void *msg, size_t mlen)
+{
+	struct cs_ipcs_conn_context *cnx = qb_ipcs_context_get(conn);
+
+	if (!cs_ipcs_fc_enabled_get(qb_ipcs_service_id_get(conn))) {
+		return cs_ipcs_dispatch_send(conn, msg, mlen);
+	}
+
+	return cs_ipcs_ready_msg_store(cnx, &cnx->send_ready_msg, &cnx->send_ready_msg_len,
+		msg, mlen);
+}
+
+/*
+ * Same as cs_ipcs_dispatch_send_when_ready, but msg is sent as response
+ */
+int cs_ipcs_response_send_when_ready(void *conn, const void *msg, size_t mlen)
+{
+	struct cs_ipcs_conn_context *cnx = qb_ipcs_context_get(conn);
+
+	if (!cs_ipcs_fc_enabled_get(qb_ipcs_service_id_get(conn))) {
+		return cs_ipcs_response_send(conn, msg, mlen);
+	}
+
+	return cs_ipcs_ready_msg_store(cnx, &cnx->response_ready_msg, &cnx->response_ready_msg_len,
+		msg, mlen);
+}
+
+static void cs_ipcs_send_ready_notify(int32_t service)
+{
+	struct list_head *iter, *iter_next;
+	struct cs_ipcs_conn_context *cnx;
+	qb_ipcs_connection_t *conn;
+
+	for (iter = ipc_send_ready_list_head.next; iter != &ipc_send_ready_list_head;
+	    iter = iter_next) {
+		iter_next = iter->next;
+		cnx = list_entry(iter, struct cs_ipcs_conn_context, send_ready_list);
+		conn = cnx->conn;
+		if (qb_ipcs_service_id_get(conn) != service) {
+			continue;
 		}
-		if (fc_enabled) {
-			qb_ipcs_request_rate_limit(ipcs_mapper[i].inst, fc_enabled);
 
-			qb_loop_timer_add(cs_poll_handle_get(), QB_LOOP_MED, 1*QB_TIME_NS_IN_MSEC,
-			       NULL, corosync_recheck_the_q_level, &ipcs_check_for_flow_control_timer);
-		} else if (ipc_fc_totem_queue_level == TOTEM_Q_LEVEL_LOW) {
-			qb_ipcs_request_rate_limit(ipcs_mapper[i].inst, QB_IPCS_RATE_FAST);
-		} else if (ipc_fc_totem_queue_level == TOTEM_Q_LEVEL_GOOD) {
-			qb_ipcs_request_rate_limit(ipcs_mapper[i].inst, QB_IPCS_RATE_NORMAL);
-		} else if (ipc_fc_totem_queue_level == TOTEM_Q_LEVEL_HIGH) {
-			qb_ipcs_request_rate_limit(ipcs_mapper[i].inst, QB_IPCS_RATE_SLOW);
+		list_del(&cnx->send_ready_list);
+		if (cnx->response_ready_msg != NULL) {
+			cs_ipcs_response_send(conn, cnx->response_ready_msg, cnx->response_ready_msg_len);
+			free(cnx->response_ready_msg);
+			cnx->response_ready_msg = NULL;
+		}
+		if (cnx->send_ready_msg != NULL) {
+			cs_ipcs_dispatch_send(conn, cnx->send_ready_msg, cnx->send_ready_msg_len);
+			free(cnx->send_ready_msg);
+			cnx->send_ready_msg = NULL;
+		}
+	}
+}
+
+/*
+ * Set rate limit of service. Returns true if flow control is enabled.
+ */
+static int32_t cs_ipcs_service_flow_control_set(int32_t service)
+{
+	int32_t fc_enabled;
+
+	if (corosync_service[service] == NULL || ipcs_mapper[service].inst == NULL) {
+		return QB_FALSE;
+	}
+
+	fc_enabled = cs_ipcs_fc_enabled_get(service);
+	if (!fc_enabled) {
+		cs_ipcs_send_ready_notify(service);
+	}
+	if (fc_enabled) {
+		cs_ipcs_rate_limit(service, fc_enabled);
+	} else if (ipc_fc_totem_queue_level == TOTEM_Q_LEVEL_LOW) {
+		cs_ipcs_rate_limit(service, QB_IPCS_RATE_FAST);
+	} else if (ipc_fc_totem_queue_level == TOTEM_Q_LEVEL_GOOD) {
+		cs_ipcs_rate_limit(service, QB_IPCS_RATE_NORMAL);
+	} else if (ipc_fc_totem_queue_level == TOTEM_Q_LEVEL_HIGH) {
+		cs_ipcs_rate_limit(service, QB_IPCS_RATE_SLOW);
+	}
+
+	return (fc_enabled != 0);
+}
+
+static qb_loop_timer_handle ipcs_check_for_flow_control_timer;
+static void cs_ipcs_check_for_flow_control(void)
+{
+	int32_t i;
+	int32_t recheck = QB_FALSE;
+
+	for (i = 0; i < SERVICES_COUNT_MAX; i++) {
+		if (cs_ipcs_service_flow_control_set(i)) {
+			recheck = QB_TRUE;
 		}
 	}
+
+	if (recheck) {
+		qb_loop_timer_add(cs_poll_handle_get(), QB_LOOP_MED, 1*QB_TIME_NS_IN_MSEC,
+		       NULL, corosync_recheck_the_q_level, &ipcs_check_for_flow_control_timer);
+	}
+
+	cs_ipcs_fc_pending_drain();
 }
 
 static void cs_ipcs_fc_quorum_changed(int quorate, void *context)
@@ -748,6 +2277,91 @@ void cs_ipcs_sync_state_changed(int32_t sync_in_process)
 	cs_ipcs_check_for_flow_control();
 }
 
+static void cs_ipcs_conn_stats_store(struct cs_ipcs_conn_context *cnx,
+	const struct qb_ipcs_connection_stats *stats,
+	uint32_t queued,
+	uint32_t queue_size_max,
+	uint64_t queue_bytes,
+	uint64_t queue_bytes_max)
+{
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+	struct cmap_stats_connection *shm_conn;
+
+	if (cnx->icmap_path == NULL) {
+		return ;
+	}
+
+	if (stats_shm != NULL && cnx->stats_slot >= 0) {
+		shm_conn = &stats_shm->connections[cnx->stats_slot];
+
+		stats_shm_write_begin();
+		shm_conn->requests = stats->requests;
+		shm_conn->responses = stats->responses;
+		shm_conn->dispatched = stats->events;
+		shm_conn->send_retries = stats->send_retries;
+		shm_conn->recv_retries = stats->recv_retries;
+		shm_conn->flow_control = stats->flow_control_state;
+		shm_conn->flow_control_count = stats->flow_control_count;
+		shm_conn->queue_size = queued;
+		shm_conn->queue_size_max = queue_size_max;
+		shm_conn->queue_bytes = queue_bytes;
+		shm_conn->queue_bytes_max = queue_bytes_max;
+		shm_conn->invalid_request = cnx->invalid_request;
+		shm_conn->overload = cnx->overload;
+		shm_conn->fc_weight = cnx->fc_weight;
+		shm_conn->fc_deferred = cnx->fc_deferred;
+		stats_shm_write_end();
+	}
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.client_pid", cnx->icmap_path);
+	icmap_set_uint32(key_name, stats->client_pid);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.requests", cnx->icmap_path);
+	icmap_set_uint64(key_name, stats->requests);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.responses", cnx->icmap_path);
+	icmap_set_uint64(key_name, stats->responses);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.dispatched", cnx->icmap_path);
+	icmap_set_uint64(key_name, stats->events);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.send_retries", cnx->icmap_path);
+	icmap_set_uint64(key_name, stats->send_retries);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.recv_retries", cnx->icmap_path);
+	icmap_set_uint64(key_name, stats->recv_retries);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.flow_control", cnx->icmap_path);
+	icmap_set_uint32(key_name, stats->flow_control_state);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.flow_control_count", cnx->icmap_path);
+	icmap_set_uint64(key_name, stats->flow_control_count);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.queue_size", cnx->icmap_path);
+	icmap_set_uint32(key_name, queued);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.queue_size_max", cnx->icmap_path);
+	icmap_set_uint32(key_name, queue_size_max);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.queue_bytes", cnx->icmap_path);
+	icmap_set_uint64(key_name, queue_bytes);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.queue_bytes_max", cnx->icmap_path);
+	icmap_set_uint64(key_name, queue_bytes_max);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.invalid_request", cnx->icmap_path);
+	icmap_set_uint64(key_name, cnx->invalid_request);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.overload", cnx->icmap_path);
+	icmap_set_uint64(key_name, cnx->overload);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.fc_weight", cnx->icmap_path);
+	icmap_set_uint32(key_name, cnx->fc_weight);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.fc_deferred", cnx->icmap_path);
+	icmap_set_uint64(key_name, cnx->fc_deferred);
+}
+
 void cs_ipcs_stats_update(void)
 {
 	int32_t i;
@@ -755,10 +2369,18 @@ void cs_ipcs_stats_update(void)
 	struct qb_ipcs_connection_stats stats;
 	qb_ipcs_connection_t *c, *prev;
 	struct cs_ipcs_conn_context *cnx;
-	char key_name[ICMAP_KEYNAME_MAXLEN];
+
+	/*
+	 * Statistics of services run by IPC threads are collected by these
+	 * threads and stored later by cs_ipcs_main_dispatch
+	 */
+	for (i = 0; i < ipc_threads_count; i++) {
+		cs_ipcs_tmsg_post(&ipc_threads[i].to_thread, CS_IPCS_TMSG_STATS_REQUEST, NULL, NULL, 0);
+	}
 
 	for (i = 0; i < SERVICES_COUNT_MAX; i++) {
-		if (corosync_service[i] == NULL || ipcs_mapper[i].inst == NULL) {
+		if (corosync_service[i] == NULL || ipcs_mapper[i].inst == NULL ||
+		    ipcs_mapper[i].thread != NULL) {
 			continue;
 		}
 		qb_ipcs_stats_get(ipcs_mapper[i].inst, &srv_stats, QB_FALSE);
@@ -772,42 +2394,334 @@ void cs_ipcs_stats_update(void)
 
 			qb_ipcs_connection_stats_get(c, &stats, QB_FALSE);
 
-			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.client_pid", cnx->icmap_path);
-			icmap_set_uint32(key_name, stats.client_pid);
+			cs_ipcs_conn_stats_store(cnx, &stats, cnx->queued, cnx->outq.msgs_hw,
+				cnx->outq.used, cnx->outq.used_hw);
+		}
+	}
+}
 
-			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.requests", cnx->icmap_path);
-			icmap_set_uint64(key_name, stats.requests);
+/*
+ * Called by IPC thread to stop or resume reading requests of its services.
+ * Rate limit requested by main thread is applied again on resume.
+ */
+static void cs_ipcs_thread_pause(struct cs_ipcs_thread *t, int32_t pause)
+{
+	int32_t i;
 
-			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.responses", cnx->icmap_path);
-			icmap_set_uint64(key_name, stats.responses);
+	if (!pause && qb_atomic_int_get(&t->req_bytes) > CS_IPCS_THREAD_REQ_LOW) {
+		/*
+		 * Main thread sends another resume when it gets below
+		 */
+		return ;
+	}
 
-			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.dispatched", cnx->icmap_path);
-			icmap_set_uint64(key_name, stats.events);
+	t->paused = pause;
 
-			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.send_retries", cnx->icmap_path);
-			icmap_set_uint64(key_name, stats.send_retries);
+	for (i = 0; i < SERVICES_COUNT_MAX; i++) {
+		if (ipcs_mapper[i].thread != t || ipcs_mapper[i].inst == NULL) {
+			continue;
+		}
+		qb_ipcs_request_rate_limit(ipcs_mapper[i].inst,
+			pause ? QB_IPCS_RATE_OFF : t->rate_limit[i]);
+	}
 
-			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.recv_retries", cnx->icmap_path);
-			icmap_set_uint64(key_name, stats.recv_retries);
+	if (pause && qb_atomic_int_get(&t->req_bytes) <= CS_IPCS_THREAD_REQ_LOW) {
+		/*
+		 * Main thread got below low water before pause was set, so its
+		 * resume may have been already ignored
+		 */
+		cs_ipcs_thread_pause(t, QB_FALSE);
+	}
+}
 
-			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.flow_control", cnx->icmap_path);
-			icmap_set_uint32(key_name, stats.flow_control_state);
+static void cs_ipcs_thread_rate_limit(struct cs_ipcs_thread *t, qb_ipcs_service_t *inst,
+	enum qb_ipcs_rate_limit rl)
+{
+	int32_t i;
 
-			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.flow_control_count", cnx->icmap_path);
-			icmap_set_uint64(key_name, stats.flow_control_count);
+	for (i = 0; i < SERVICES_COUNT_MAX; i++) {
+		if (ipcs_mapper[i].inst == inst) {
+			t->rate_limit[i] = rl;
+			break;
+		}
+	}
 
-			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.queue_size", cnx->icmap_path);
-			icmap_set_uint32(key_name, cnx->queued);
+	if (!t->paused) {
+		qb_ipcs_request_rate_limit(inst, rl);
+	}
+}
 
-			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.invalid_request", cnx->icmap_path);
-			icmap_set_uint64(key_name, cnx->invalid_request);
+/*
+ * Called by IPC thread to snapshot statistics of all its connections
+ */
+static void cs_ipcs_thread_stats_collect(struct cs_ipcs_thread *t)
+{
+	int32_t i;
+	qb_ipcs_connection_t *c, *prev;
+	struct cs_ipcs_conn_context *cnx;
+	struct cs_ipcs_tmsg *msg;
 
-			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.overload", cnx->icmap_path);
-			icmap_set_uint64(key_name, cnx->overload);
+	for (i = 0; i < SERVICES_COUNT_MAX; i++) {
+		if (ipcs_mapper[i].thread != t || ipcs_mapper[i].inst == NULL) {
+			continue;
+		}
+
+		for (c = qb_ipcs_connection_first_get(ipcs_mapper[i].inst);
+			 c;
+			 prev = c, c = qb_ipcs_connection_next_get(ipcs_mapper[i].inst, prev), qb_ipcs_connection_unref(prev)) {
+
+			cnx = qb_ipcs_context_get(c);
+			if (cnx == NULL || cnx->closed) continue;
+
+			msg = cs_ipcs_tmsg_alloc(CS_IPCS_TMSG_STATS, c, NULL, 0);
+			if (msg == NULL) {
+				continue;
+			}
+			qb_ipcs_connection_stats_get(c, &msg->stats, QB_FALSE);
+			msg->queued = cnx->queued;
+			msg->queue_size_max = cnx->outq.msgs_hw;
+			msg->queue_bytes = cnx->outq.used;
+			msg->queue_bytes_max = cnx->outq.used_hw;
+			cs_ipcs_tqueue_push(&t->to_main, msg);
 		}
 	}
 }
 
+/*
+ * IPC thread side of the queues
+ */
+static int32_t cs_ipcs_thread_dispatch(int32_t fd, int32_t revents, void *data)
+{
+	struct cs_ipcs_thread *t = data;
+	struct cs_ipcs_tmsg *msg;
+	struct cs_ipcs_conn_context *cnx;
+	struct iovec iov;
+
+	cs_ipcs_tqueue_notify_clear(&t->to_thread);
+
+	while ((msg = cs_ipcs_tqueue_pop(&t->to_thread)) != NULL) {
+		switch (msg->type) {
+		case CS_IPCS_TMSG_RESPONSE:
+		case CS_IPCS_TMSG_EVENT:
+			cnx = qb_ipcs_context_get(msg->conn);
+			if (cnx->closed) {
+				break;
+			}
+			iov.iov_base = msg->data;
+			iov.iov_len = msg->len;
+			if (msg->type == CS_IPCS_TMSG_RESPONSE) {
+				(void)qb_ipcs_response_sendv(msg->conn, &iov, 1);
+			} else {
+				msg_send_or_queue(msg->conn, &iov, 1);
+			}
+			break;
+		case CS_IPCS_TMSG_DISCONNECT:
+			cnx = qb_ipcs_context_get(msg->conn);
+			if (!cnx->closed) {
+				qb_ipcs_disconnect(msg->conn);
+			}
+			break;
+		case CS_IPCS_TMSG_UNREF:
+			qb_ipcs_connection_unref(msg->conn);
+			break;
+		case CS_IPCS_TMSG_RATE_LIMIT:
+			cs_ipcs_thread_rate_limit(t, msg->inst, msg->rate_limit);
+			break;
+		case CS_IPCS_TMSG_STATS_REQUEST:
+			cs_ipcs_thread_stats_collect(t);
+			break;
+		case CS_IPCS_TMSG_CALL:
+			cs_ipcs_thread_call_complete(msg->call, msg->call->fn(msg->call->arg));
+			break;
+		case CS_IPCS_TMSG_RESUME:
+			if (t->paused) {
+				cs_ipcs_thread_pause(t, QB_FALSE);
+			}
+			break;
+		case CS_IPCS_TMSG_STOP:
+			qb_loop_stop(t->loop);
+			break;
+		case CS_IPCS_TMSG_BLOCK:
+		case CS_IPCS_TMSG_UNBLOCK:
+			cnx = qb_ipcs_context_get(msg->conn);
+			if (!cnx->closed) {
+				cs_ipcs_conn_read_block(msg->conn, msg->type == CS_IPCS_TMSG_BLOCK);
+			}
+			break;
+		default:
+			log_printf(LOGSYS_LEVEL_ERROR, "Unexpected IPC thread message %d", msg->type);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Main thread side of the queues. At most max (0 = unlimited) messages are
+ * handled in one run, so totem is not starved by busy clients.
+ */
+static void cs_ipcs_main_dispatch_msgs(struct cs_ipcs_thread *t, uint32_t max)
+{
+	struct cs_ipcs_tmsg *msg;
+	struct cs_ipcs_conn_context *cnx;
+	uint32_t handled = 0;
+	int32_t req_bytes;
+
+	while ((max == 0 || handled < max) &&
+	    (msg = cs_ipcs_tqueue_pop(&t->to_main)) != NULL) {
+		switch (msg->type) {
+		case CS_IPCS_TMSG_CREATED:
+			cs_ipcs_connection_init(msg->conn);
+			break;
+		case CS_IPCS_TMSG_REQUEST:
+			req_bytes = qb_atomic_int_exchange_and_add(&t->req_bytes, -(int32_t)msg->len);
+			if (req_bytes > CS_IPCS_THREAD_REQ_LOW &&
+			    req_bytes - (int32_t)msg->len <= CS_IPCS_THREAD_REQ_LOW) {
+				cs_ipcs_tmsg_post(&t->to_thread, CS_IPCS_TMSG_RESUME, NULL, NULL, 0);
+			}
+			(void)cs_ipcs_msg_fc_handle(msg->conn, msg->data, msg->len);
+			break;
+		case CS_IPCS_TMSG_CLOSED:
+			cs_ipcs_connection_closed_main(msg->conn);
+			break;
+		case CS_IPCS_TMSG_STATS:
+			cnx = qb_ipcs_context_get(msg->conn);
+			cs_ipcs_conn_stats_store(cnx, &msg->stats, msg->queued, msg->queue_size_max,
+				msg->queue_bytes, msg->queue_bytes_max);
+			break;
+		default:
+			log_printf(LOGSYS_LEVEL_ERROR, "Unexpected IPC thread message %d", msg->type);
+			break;
+		}
+		handled++;
+	}
+}
+
+static int32_t cs_ipcs_main_dispatch(int32_t fd, int32_t revents, void *data)
+{
+	struct cs_ipcs_thread *t = data;
+
+	cs_ipcs_tqueue_notify_clear(&t->to_main);
+
+	cs_ipcs_main_dispatch_msgs(t, CS_IPCS_THREAD_DISPATCH_MAX);
+
+	if (!cs_ipcs_tqueue_is_empty(&t->to_main)) {
+		/*
+		 * Let the main loop run, rest of messages is handled in next
+		 * iteration
+		 */
+		cs_ipcs_tqueue_notify(&t->to_main);
+	}
+
+	return 0;
+}
+
+static void *cs_ipcs_thread_run(void *data)
+{
+	struct cs_ipcs_thread *t = data;
+
+	pthread_setspecific(ipc_thread_key, t);
+	qb_loop_run(t->loop);
+
+	return NULL;
+}
+
+/*
+ * Stop IPC threads and free their queues. Services must be already destroyed.
+ */
+static void cs_ipcs_threads_fini(void)
+{
+	uint32_t i;
+	struct cs_ipcs_thread *t;
+
+	for (i = 0; i < ipc_threads_count; i++) {
+		t = &ipc_threads[i];
+
+		cs_ipcs_tmsg_post(&t->to_thread, CS_IPCS_TMSG_STOP, NULL, NULL, 0);
+		pthread_join(t->thread, NULL);
+
+		qb_loop_poll_del(cs_poll_handle_get(), t->to_main.notify_fd[0]);
+		cs_ipcs_tqueue_fini(&t->to_thread);
+		cs_ipcs_tqueue_fini(&t->to_main);
+		qb_loop_destroy(t->loop);
+	}
+
+	free(ipc_threads);
+	ipc_threads = NULL;
+	ipc_threads_count = 0;
+}
+
+static void cs_ipcs_threads_init(void)
+{
+	uint32_t threads = 0;
+	uint32_t i;
+	int32_t j;
+	struct cs_ipcs_thread *t;
+
+	if (icmap_get_uint32("qb.ipc_threads", &threads) != CS_OK || threads == 0) {
+		return ;
+	}
+
+	if (threads > CS_IPCS_THREADS_MAX) {
+		log_printf(LOGSYS_LEVEL_WARNING, "qb.ipc_threads %u is too big, using %u",
+			threads, CS_IPCS_THREADS_MAX);
+		threads = CS_IPCS_THREADS_MAX;
+	}
+
+	if (pthread_key_create(&ipc_thread_key, NULL) != 0) {
+		log_printf(LOGSYS_LEVEL_ERROR, "Can't create IPC thread key, IPC threads disabled");
+		return ;
+	}
+
+	ipc_threads = calloc(threads, sizeof(struct cs_ipcs_thread));
+	if (ipc_threads == NULL) {
+		log_printf(LOGSYS_LEVEL_ERROR, "Can't allocate IPC threads, IPC threads disabled");
+		return ;
+	}
+
+	for (i = 0; i < threads; i++) {
+		t = &ipc_threads[i];
+
+		for (j = 0; j < SERVICES_COUNT_MAX; j++) {
+			t->rate_limit[j] = QB_IPCS_RATE_NORMAL;
+		}
+		list_init(&t->poll_list_head);
+
+		t->loop = qb_loop_create();
+		if (t->loop == NULL ||
+		    cs_ipcs_tqueue_init(&t->to_thread) != 0 ||
+		    cs_ipcs_tqueue_init(&t->to_main) != 0) {
+			log_printf(LOGSYS_LEVEL_ERROR, "Can't initialize IPC thread %u", i);
+			break;
+		}
+
+		qb_loop_poll_add(t->loop, QB_LOOP_HIGH, t->to_thread.notify_fd[0], POLLIN,
+			t, cs_ipcs_thread_dispatch);
+		qb_loop_poll_low_fds_event_set(t->loop, cs_ipcs_low_fds_event);
+		qb_loop_poll_add(cs_poll_handle_get(), QB_LOOP_MED, t->to_main.notify_fd[0], POLLIN,
+			t, cs_ipcs_main_dispatch);
+
+		if (pthread_create(&t->thread, NULL, cs_ipcs_thread_run, t) != 0) {
+			log_printf(LOGSYS_LEVEL_ERROR, "Can't start IPC thread %u", i);
+			qb_loop_poll_del(cs_poll_handle_get(), t->to_main.notify_fd[0]);
+			break;
+		}
+		ipc_threads_count++;
+	}
+
+	log_printf(LOGSYS_LEVEL_NOTICE, "Using %u IPC thread(s)", ipc_threads_count);
+}
+
+static int32_t cs_ipcs_service_run(void *data)
+{
+	qb_ipcs_service_t *inst = data;
+
+	qb_ipcs_poll_handlers_set(inst, &corosync_poll_funcs);
+
+	return qb_ipcs_run(inst);
+}
+
 static enum qb_ipc_type cs_get_ipc_type (void)
 {
 	char *str;
@@ -848,6 +2762,7 @@ static enum qb_ipc_type cs_get_ipc_type (void)
 const char *cs_ipcs_service_init(struct corosync_service_engine *service)
 {
 	const char *serv_short_name;
+	int32_t res;
 
 	serv_short_name = cs_ipcs_serv_short_name(service->id);
 
@@ -875,9 +2790,20 @@ const char *cs_ipcs_service_init(struct corosync_service_engine *service)
 		cs_get_ipc_type(),
 		&corosync_service_funcs);
 	assert(ipcs_mapper[service->id].inst);
-	qb_ipcs_poll_handlers_set(ipcs_mapper[service->id].inst,
-		&corosync_poll_funcs);
-	if (qb_ipcs_run(ipcs_mapper[service->id].inst) != 0) {
+
+	if (ipc_threads == NULL) {
+		cs_ipcs_threads_init();
+	}
+
+	if (ipc_threads_count > 0) {
+		ipcs_mapper[service->id].thread = &ipc_threads[ipc_threads_next];
+		ipc_threads_next = (ipc_threads_next + 1) % ipc_threads_count;
+		res = cs_ipcs_thread_call(ipcs_mapper[service->id].thread,
+			cs_ipcs_service_run, ipcs_mapper[service->id].inst);
+	} else {
+		res = cs_ipcs_service_run(ipcs_mapper[service->id].inst);
+	}
+	if (res != 0) {
 		log_printf (LOGSYS_LEVEL_ERROR, "Can't initialize IPC");
 		return "qb_ipcs_run error";
 	}
@@ -896,5 +2822,34 @@ void cs_ipcs_init(void)
 
 	icmap_set_uint64("runtime.connections.active", 0);
 	icmap_set_uint64("runtime.connections.closed", 0);
+
+	icmap_track_add("qb.ipc_weight.",
+		ICMAP_TRACK_ADD | ICMAP_TRACK_DELETE | ICMAP_TRACK_MODIFY | ICMAP_TRACK_PREFIX,
+		cs_ipcs_fc_weight_changed,
+		NULL,
+		&ipc_fc_weight_track);
+
+	if (ipc_threads_count > 0) {
+		cs_ipcs_uidgid_refresh();
+		icmap_track_add("uidgid.",
+			ICMAP_TRACK_ADD | ICMAP_TRACK_DELETE | ICMAP_TRACK_MODIFY | ICMAP_TRACK_PREFIX,
+			cs_ipcs_uidgid_changed,
+			NULL,
+			&ipc_uidgid_track);
+	}
+}
+
+void cs_ipcs_fini(void)
+{
+	if (ipc_uidgid_track != NULL) {
+		icmap_track_delete(ipc_uidgid_track);
+		ipc_uidgid_track = NULL;
+	}
+	if (ipc_fc_weight_track != NULL) {
+		icmap_track_delete(ipc_fc_weight_track);
+		ipc_fc_weight_track = NULL;
+	}
+
+	cs_ipcs_threads_fini();
 }
 
@@ -121,6 +121,7 @@
 #include "apidef.h"
 #include "service.h"
 #include "schedwrk.h"
+#include "stats_shm.h"
 
 #ifdef HAVE_SMALL_MEMORY_FOOTPRINT
 #define IPC_LOGSYS_SIZE			1024*64
@@ -223,6 +224,8 @@ static void corosync_blackbox_write_to_file (void)
 static void unlink_all_completed (void)
 {
 	api->timer_delete (corosync_stats_timer_handle);
+	cs_ipcs_fini ();
+	stats_shm_fini ();
 	qb_loop_stop (corosync_poll_handle);
 	icmap_fini();
 }
@@ -332,6 +335,7 @@ static int corosync_sync_callbacks_retrieve (
 	callbacks->sync_process = corosync_service[service_id]->sync_process;
 	callbacks->sync_activate = corosync_service[service_id]->sync_activate;
 	callbacks->sync_abort = corosync_service[service_id]->sync_abort;
+	callbacks->sync_mode = corosync_service[service_id]->sync_mode;
 	return (0);
 }
 
@@ -489,6 +493,95 @@ static void corosync_mlockall (void)
 }
 
 
+static void corosync_totem_stats_shm_update (const totempg_stats_t *stats,
+	uint32_t mtt_rx_token,
+	uint32_t avg_token_workload,
+	uint32_t avg_backlog_calc,
+	int token_count)
+{
+	const totemsrp_stats_t *srp = stats->mrp->srp;
+	struct cmap_stats_totem *totem;
+	int i;
+
+	if (stats_shm == NULL) {
+		return ;
+	}
+	totem = &stats_shm->totem;
+
+	stats_shm_write_begin ();
+
+	stats_shm->update_time = qb_util_nano_from_epoch_get ();
+
+	totem->msg_reserved = stats->msg_reserved;
+	totem->msg_queue_avail = stats->msg_queue_avail;
+	totem->orf_token_tx = srp->orf_token_tx;
+	totem->orf_token_rx = srp->orf_token_rx;
+	totem->memb_merge_detect_tx = srp->memb_merge_detect_tx;
+	totem->memb_merge_detect_rx = srp->memb_merge_detect_rx;
+	totem->memb_join_tx = srp->memb_join_tx;
+	totem->memb_join_rx = srp->memb_join_rx;
+	totem->mcast_tx = srp->mcast_tx;
+	totem->mcast_retx = srp->mcast_retx;
+	totem->mcast_rx = srp->mcast_rx;
+	totem->memb_commit_token_tx = srp->memb_commit_token_tx;
+	totem->memb_commit_token_rx = srp->memb_commit_token_rx;
+	totem->token_hold_cancel_tx = srp->token_hold_cancel_tx;
+	totem->token_hold_cancel_rx = srp->token_hold_cancel_rx;
+	totem->operational_entered = srp->operational_entered;
+	totem->operational_token_lost = srp->operational_token_lost;
+	totem->gather_entered = srp->gather_entered;
+	totem->gather_token_lost = srp->gather_token_lost;
+	totem->commit_entered = srp->commit_entered;
+	totem->commit_token_lost = srp->commit_token_lost;
+	totem->recovery_entered = srp->recovery_entered;
+	totem->recovery_token_lost = srp->recovery_token_lost;
+	totem->consensus_timeouts = srp->consensus_timeouts;
+	totem->rx_msg_dropped = srp->rx_msg_dropped;
+	totem->continuous_gather = srp->continuous_gather;
+	totem->continuous_sendmsg_failures = srp->continuous_sendmsg_failures;
+	totem->firewall_enabled_or_nic_failure =
+	    (srp->continuous_gather > MAX_NO_CONT_GATHER ||
+	     srp->continuous_sendmsg_failures > MAX_NO_CONT_SENDMSG_FAILURES) ? 1 : 0;
+
+	if (token_count) {
+		totem->mtt_rx_token = mtt_rx_token;
+		totem->avg_token_workload = avg_token_workload;
+		totem->avg_backlog_calc = avg_backlog_calc;
+	}
+
+	totem->interface_count = srp->rrp->interface_count;
+	if (totem->interface_count > CMAP_STATS_INTERFACE_MAX) {
+		totem->interface_count = CMAP_STATS_INTERFACE_MAX;
+	}
+	for (i = 0; i < totem->interface_count; i++) {
+		totem->faulty[i] = srp->rrp->faulty[i];
+	}
+
+	totem->earliest_token = srp->earliest_token;
+	totem->latest_token = srp->latest_token;
+	for (i = 0; i < TOTEM_TOKEN_STATS_MAX && i < CMAP_STATS_TOKEN_MAX; i++) {
+		totem->token[i].rx = srp->token[i].rx;
+		totem->token[i].tx = srp->token[i].tx;
+		totem->token[i].backlog_calc = srp->token[i].backlog_calc;
+	}
+
+	stats_shm_write_end ();
+}
+
+static void corosync_icmap_mem_stats_update (void)
+{
+	struct icmap_mem_stats stats;
+
+	icmap_mem_stats_get(&stats);
+
+	icmap_set_uint64("runtime.icmap.arena_size", stats.arena_size);
+	icmap_set_uint64("runtime.icmap.arena_used", stats.arena_used);
+	icmap_set_uint64("runtime.icmap.large_size", stats.large_size);
+	icmap_set_uint64("runtime.icmap.items", stats.items);
+	icmap_set_uint64("runtime.icmap.keys", stats.keys);
+	icmap_set_uint64("runtime.icmap.keys_size", stats.keys_size);
+}
+
 static void corosync_totem_stats_updater (void *data)
 {
 	totempg_stats_t * stats;
@@ -575,9 +668,16 @@ static void corosync_totem_stats_updater (void *data)
 		icmap_set_uint32("runtime.totem.pg.mrp.srp.mtt_rx_token", (total_mtt_rx_token / token_count));
 		icmap_set_uint32("runtime.totem.pg.mrp.srp.avg_token_workload", (total_token_holdtime / token_count));
 		icmap_set_uint32("runtime.totem.pg.mrp.srp.avg_backlog_calc", (total_backlog_calc / token_count));
+
+		corosync_totem_stats_shm_update (stats, total_mtt_rx_token / token_count,
+		    total_token_holdtime / token_count, total_backlog_calc / token_count, token_count);
+	} else {
+		corosync_totem_stats_shm_update (stats, 0, 0, 0, 0);
 	}
 
 	cs_ipcs_stats_update();
+	corosync_icmap_mem_stats_update();
+	schedwrk_stats_update();
 
 	api->timer_add_duration (1500 * MILLI_2_NANO_SECONDS, NULL,
 		corosync_totem_stats_updater,
@@ -629,7 +729,8 @@ static void deliver_fn (
 		return;
 	}
 
-	icmap_fast_inc(service_stats_rx[service][fn_id]);
+	icmap_counter_add(service_stats_rx[service][fn_id], 1);
+	stats_shm_service_rx(service, fn_id);
 
 	if (endian_conversion_required) {
 		assert(corosync_service[service]->exec_engine[fn_id].exec_endian_convert_fn != NULL);
@@ -654,7 +755,8 @@ int main_mcast (
 	fn_id = req->id & 0xffff;
 
 	if (corosync_service[service]) {
-		icmap_fast_inc(service_stats_tx[service][fn_id]);
+		icmap_counter_add(service_stats_tx[service][fn_id], 1);
+		stats_shm_service_tx(service, fn_id);
 	}
 
 	return (totempg_groups_mcast_joined (corosync_group_handle, iovec, iov_len, guarantee));
@@ -994,6 +1096,19 @@ static void corosync_fplay_control_init (void)
 			NULL, &track);
 }
 
+static void corosync_icmap_batch_flush_job (void *data)
+{
+	icmap_track_batch_flush();
+}
+
+/*
+ * Batched icmap notifications are delivered once per main loop iteration
+ */
+static void corosync_icmap_batch_sched (void)
+{
+	qb_loop_job_add(corosync_poll_handle, QB_LOOP_HIGH, NULL, corosync_icmap_batch_flush_job);
+}
+
 /*
  * Set RO flag for keys, which ether doesn't make sense to change by user (statistic)
  * or which when changed are not reflected by runtime (totem.crypto_cipher, ...).
@@ -1011,6 +1126,9 @@ static void set_icmap_ro_keys_flag (void)
 	icmap_set_ro_access("runtime.totem.", CS_TRUE, CS_TRUE);
 	icmap_set_ro_access("runtime.services.", CS_TRUE, CS_TRUE);
 	icmap_set_ro_access("runtime.config.", CS_TRUE, CS_TRUE);
+	icmap_set_ro_access("runtime.icmap.", CS_TRUE, CS_TRUE);
+	icmap_set_ro_access("runtime.sync.", CS_TRUE, CS_TRUE);
+	icmap_set_ro_access("runtime.schedwrk.", CS_TRUE, CS_TRUE);
 
 	/*
 	 * Set RO flag for constrete keys of configuration which can't be changed
@@ -1029,6 +1147,7 @@ static void set_icmap_ro_keys_flag (void)
 	icmap_set_ro_access("totem.nodeid", CS_FALSE, CS_TRUE);
 	icmap_set_ro_access("totem.clear_node_high_bit", CS_FALSE, CS_TRUE);
 	icmap_set_ro_access("qb.ipc_type", CS_FALSE, CS_TRUE);
+	icmap_set_ro_access("qb.ipc_threads", CS_FALSE, CS_TRUE);
 	icmap_set_ro_access("config.reload_in_progress", CS_FALSE, CS_TRUE);
 	icmap_set_ro_access("config.totemconfig_reload_in_progress", CS_FALSE, CS_TRUE);
 }
@@ -1037,6 +1156,8 @@ static void main_service_ready (void)
 {
 	int res;
 
+	stats_shm_init ();
+
 	/*
 	 * This must occur after totempg is initialized because "this_ip" must be set
 	 */
@@ -1146,6 +1267,7 @@ int main (int argc, char **argv, char **envp)
 	struct totem_config totem_config;
 	int res, ch;
 	int background, setprio, testonly;
+	int cache_build, cache_dump;
 	struct stat stat_out;
 	enum e_corosync_done flock_err;
 	uint64_t totem_config_warnings;
@@ -1156,8 +1278,10 @@ int main (int argc, char **argv, char **envp)
 	background = 1;
 	setprio = 1;
 	testonly = 0;
+	cache_build = 0;
+	cache_dump = 0;
 
-	while ((ch = getopt (argc, argv, "fprtv")) != EOF) {
+	while ((ch = getopt (argc, argv, "cCfprtv")) != EOF) {
 
 		switch (ch) {
 			case 'f':
@@ -1172,6 +1296,12 @@ int main (int argc, char **argv, char **envp)
 			case 't':
 				testonly = 1;
 				break;
+			case 'c':
+				cache_build = 1;
+				break;
+			case 'C':
+				cache_dump = 1;
+				break;
 			case 'v':
 				printf ("Corosync Cluster Engine, version '%s'\n", VERSION);
 				printf ("Copyright (c) 2006-2009 Red Hat, Inc.\n");
@@ -1185,6 +1315,8 @@ int main (int argc, char **argv, char **envp)
 					"        -f     : Start application in foreground.\n"\
 					"        -p     : Do not set process priority.\n"\
 					"        -t     : Test configuration and exit.\n"\
+					"        -c     : Build configuration cache and exit.\n"\
+					"        -C     : Display configuration cache and exit.\n"\
 					"        -r     : Set round robin realtime scheduling (default).\n"\
 					"        -v     : Display version and SVN revision of Corosync and exit.\n");
 				logsys_system_fini();
@@ -1192,6 +1324,22 @@ int main (int argc, char **argv, char **envp)
 		}
 	}
 
+	if (cache_build || cache_dump) {
+		if (cache_build) {
+			res = coroparse_cache_build(&error_string);
+		} else {
+			res = coroparse_cache_dump(stdout, &error_string);
+		}
+
+		if (res == -1) {
+			fprintf(stderr, "%s\n", error_string);
+		} else if (cache_build) {
+			printf("%s\n", error_string);
+		}
+		logsys_system_fini();
+		return (res == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
 	/*
 	 * Set round robin realtime scheduling with priority 99
 	 * Lock all memory to avoid page faults which may interrupt
@@ -1331,6 +1479,8 @@ int main (int argc, char **argv, char **envp)
 
 	corosync_poll_handle = qb_loop_create ();
 
+	icmap_track_batch_sched_set(corosync_icmap_batch_sched);
+
 	memset(&scheduler_pause_timeout_data, 0, sizeof(scheduler_pause_timeout_data));
 	scheduler_pause_timeout_data.totem_config = &totem_config;
 	timer_function_scheduler_timeout (&scheduler_pause_timeout_data);
@@ -94,6 +94,8 @@ extern void corosync_recheck_the_q_level(void *data);
 
 extern void cs_ipcs_init(void);
 
+extern void cs_ipcs_fini(void);
+
 extern const char *cs_ipcs_service_init(struct corosync_service_engine *service);
 
 extern void cs_ipcs_stats_update(void);
@@ -107,6 +109,10 @@ extern int cs_ipcs_dispatch_iov_send (void *conn,
 	const struct iovec *iov,
 	unsigned int iov_len);
 
+extern int cs_ipcs_dispatch_send_when_ready(void *conn, const void *msg, size_t mlen);
+
+extern int cs_ipcs_response_send_when_ready(void *conn, const void *msg, size_t mlen);
+
 extern int cs_ipcs_response_send(void *conn, const void *msg, size_t mlen);
 extern int cs_ipcs_response_iov_send (void *conn,
 	const struct iovec *iov,
@@ -116,6 +122,8 @@ extern void cs_ipcs_sync_state_changed(int32_t sync_in_process);
 
 extern void *cs_ipcs_private_data_get(void *conn);
 
+extern int cs_ipcs_credentials_get(void *conn, uid_t *euid, gid_t *egid);
+
 extern void cs_ipc_refcnt_inc(void *conn);
 
 extern void cs_ipc_refcnt_dec(void *conn);
@@ -124,4 +132,8 @@ extern void cs_ipc_allow_connections(int32_t allow);
 
 int coroparse_configparse (icmap_map_t config_map, const char **error_string);
 
+int coroparse_cache_build (const char **error_string);
+
+int coroparse_cache_dump (FILE *fp, const char **error_string);
+
 #endif /* MAIN_H_DEFINED */
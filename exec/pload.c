@@ -214,7 +214,7 @@ static int pload_send_message (const void *arg)
 		} else {
 			msgs_sent++;
 		}
-	} while (msgs_sent < msgs_wanted);
+	} while (msgs_sent < msgs_wanted && !api->schedwrk_budget_exhausted ());
 
 	if (msgs_sent == msgs_wanted) {
 		return (0);
@@ -316,10 +316,12 @@ static void message_handler_req_exec_pload_start (
 	msgs_wanted = req_exec_pload_start->msg_count;
 	msg_size = req_exec_pload_start->msg_size;
 
-	api->schedwrk_create (
+	api->schedwrk_create_prio (
 		&start_mcasting_handle,
 		pload_send_message,
-		&start_mcasting_handle);
+		&start_mcasting_handle,
+		"pload",
+		CS_SCHEDWRK_PRIO_LOW);
 }
 
 static void req_exec_pload_mcast_endian_convert (void *msg)
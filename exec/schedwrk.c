@@ -33,35 +33,150 @@
  */
 
 #include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+
 #include <corosync/totem/totempg.h>
 #include <corosync/hdb.h>
+#include <corosync/list.h>
+#include <corosync/icmap.h>
+#include <qb/qbutil.h>
+#include "quorum.h"
 #include "schedwrk.h"
 
+/*
+ * Default time in microseconds work items may run in one token callback.
+ * 0 means unlimited.
+ */
+#define SCHEDWRK_BUDGET_DEFAULT		1000
+
+#define SCHEDWRK_PRIO_COUNT		(CS_SCHEDWRK_PRIO_LOW + 1)
+
+/*
+ * Number of token rotations a priority queue can be skipped (because higher
+ * priorities used whole budget) before one of its items runs first
+ */
+#define SCHEDWRK_STARVATION_LIMIT	8
+
+#define SCHEDWRK_STATS_MAX		32
+
+#define SCHEDWRK_NAME_MAX		32
+
 static void (*serialize_lock) (void);
 static void (*serialize_unlock) (void);
 
 DECLARE_HDB_DATABASE (schedwrk_instance_database,NULL);
 
+struct schedwrk_stats {
+	char name[SCHEDWRK_NAME_MAX];
+	enum cs_schedwrk_priority priority;
+	uint32_t items;
+	uint64_t runs;
+	uint64_t run_time;
+	uint64_t max_run_time;
+	int changed;
+};
+
 struct schedwrk_instance {
 	int (*schedwrk_fn) (const void *);
 	const void *context;
-	void *callback_handle;
+	hdb_handle_t handle;
 	int lock;
+	int destroyed;
+	enum cs_schedwrk_priority priority;
+	struct schedwrk_stats *stats;
+	struct list_head list;
+};
+
+/*
+ * Initialized statically, work may be created before schedwrk_init
+ */
+static struct list_head schedwrk_queue[SCHEDWRK_PRIO_COUNT] = {
+	[CS_SCHEDWRK_PRIO_HIGH] = {
+		&schedwrk_queue[CS_SCHEDWRK_PRIO_HIGH], &schedwrk_queue[CS_SCHEDWRK_PRIO_HIGH] },
+	[CS_SCHEDWRK_PRIO_NORMAL] = {
+		&schedwrk_queue[CS_SCHEDWRK_PRIO_NORMAL], &schedwrk_queue[CS_SCHEDWRK_PRIO_NORMAL] },
+	[CS_SCHEDWRK_PRIO_LOW] = {
+		&schedwrk_queue[CS_SCHEDWRK_PRIO_LOW], &schedwrk_queue[CS_SCHEDWRK_PRIO_LOW] },
 };
 
-static int schedwrk_do (enum totem_callback_token_type type, const void *context)
+static unsigned int schedwrk_queue_skipped[SCHEDWRK_PRIO_COUNT];
+
+static struct schedwrk_stats schedwrk_stats[SCHEDWRK_STATS_MAX];
+
+static int schedwrk_stats_entries = 0;
+
+static void *schedwrk_callback_handle;
+
+static int schedwrk_dispatch_registered = 0;
+
+static uint32_t schedwrk_budget = SCHEDWRK_BUDGET_DEFAULT;
+
+/*
+ * Deadline of currently running dispatch, 0 when not dispatching
+ */
+static uint64_t schedwrk_deadline = 0;
+
+static uint64_t schedwrk_dispatches = 0;
+
+static uint64_t schedwrk_budget_exceeded = 0;
+
+static uint64_t schedwrk_max_dispatch_time = 0;
+
+static struct schedwrk_stats *schedwrk_stats_get (
+	const char *name,
+	enum cs_schedwrk_priority priority)
+{
+	struct schedwrk_stats *stats;
+	int i;
+
+	for (i = 0; i < schedwrk_stats_entries; i++) {
+		if (strcmp (schedwrk_stats[i].name, name) == 0) {
+			return (&schedwrk_stats[i]);
+		}
+	}
+
+	/*
+	 * Table full, account to last entry
+	 */
+	if (schedwrk_stats_entries == SCHEDWRK_STATS_MAX) {
+		return (&schedwrk_stats[SCHEDWRK_STATS_MAX - 1]);
+	}
+
+	stats = &schedwrk_stats[schedwrk_stats_entries++];
+	memset (stats, 0, sizeof (*stats));
+	snprintf (stats->name, sizeof (stats->name), "%s", name);
+	icmap_convert_name_to_valid_name (stats->name);
+	stats->priority = priority;
+	stats->changed = 1;
+
+	return (stats);
+}
+
+static int schedwrk_run_one (enum cs_schedwrk_priority priority)
 {
-	hdb_handle_t handle = *((hdb_handle_t *)context);
 	struct schedwrk_instance *instance;
+	hdb_handle_t handle;
+	uint64_t start_time;
+	uint64_t run_time;
 	int res;
 
+	instance = list_entry (schedwrk_queue[priority].next, struct schedwrk_instance, list);
+	handle = instance->handle;
+
 	res = hdb_handle_get (&schedwrk_instance_database,
 		handle,
 		(void *)&instance);
 	if (res != 0) {
-		goto error_exit;
+		return (-1);
 	}
 
+	list_del (&instance->list);
+	list_init (&instance->list);
+
+	start_time = qb_util_nano_current_get ();
+
 	if (instance->lock)
 		serialize_lock ();
 
@@ -70,33 +185,177 @@ static int schedwrk_do (enum totem_callback_token_type type, const void *context
 	if (instance->lock)
 		serialize_unlock ();
 
-	if (res == 0) {
-		hdb_handle_destroy (&schedwrk_instance_database, handle);
+	run_time = qb_util_nano_current_get () - start_time;
+	instance->stats->runs++;
+	instance->stats->run_time += run_time;
+	if (run_time > instance->stats->max_run_time) {
+		instance->stats->max_run_time = run_time;
 	}
-        hdb_handle_put (&schedwrk_instance_database, handle);
-	return (res);
+	instance->stats->changed = 1;
 
-error_exit:
-	return (-1);
+	if (instance->destroyed == 0) {
+		if (res == 0) {
+			schedwrk_destroy (handle);
+		} else {
+			/*
+			 * Not finished, continue after other work items of same priority
+			 */
+			list_add_tail (&instance->list, &schedwrk_queue[priority]);
+		}
+	}
+	(void)hdb_handle_put (&schedwrk_instance_database, handle);
+
+	return (0);
+}
+
+static int schedwrk_queue_length (enum cs_schedwrk_priority priority)
+{
+	struct list_head *list;
+	int length = 0;
+
+	for (list = schedwrk_queue[priority].next;
+		list != &schedwrk_queue[priority]; list = list->next) {
+
+		length++;
+	}
+
+	return (length);
+}
+
+static int schedwrk_dispatch (enum totem_callback_token_type type, const void *context)
+{
+	uint64_t start_time;
+	uint64_t dispatch_time;
+	int to_run[SCHEDWRK_PRIO_COUNT];
+	int ran[SCHEDWRK_PRIO_COUNT];
+	int ran_total = 0;
+	int exhausted = 0;
+	int prio;
+	int pending = 0;
+
+	start_time = qb_util_nano_current_get ();
+	schedwrk_deadline = start_time + (uint64_t)schedwrk_budget * QB_TIME_NS_IN_USEC;
+
+	/*
+	 * Every item runs at most once per token, items created by running
+	 * items wait for next token
+	 */
+	for (prio = 0; prio < SCHEDWRK_PRIO_COUNT; prio++) {
+		to_run[prio] = schedwrk_queue_length (prio);
+		ran[prio] = 0;
+	}
+
+	/*
+	 * Starving queues go first
+	 */
+	for (prio = 0; prio < SCHEDWRK_PRIO_COUNT; prio++) {
+		if (to_run[prio] > 0 && schedwrk_queue_skipped[prio] >= SCHEDWRK_STARVATION_LIMIT) {
+			if (schedwrk_run_one (prio) == 0) {
+				ran[prio]++;
+				ran_total++;
+			}
+			to_run[prio]--;
+		}
+	}
+
+	for (prio = 0; prio < SCHEDWRK_PRIO_COUNT && !exhausted; prio++) {
+		while (to_run[prio] > 0 && !list_empty (&schedwrk_queue[prio])) {
+			if (schedwrk_budget_exhausted () && ran_total > 0) {
+				schedwrk_budget_exceeded++;
+				exhausted = 1;
+				break;
+			}
+			if (schedwrk_run_one (prio) == 0) {
+				ran[prio]++;
+				ran_total++;
+			}
+			to_run[prio]--;
+		}
+	}
+
+	for (prio = 0; prio < SCHEDWRK_PRIO_COUNT; prio++) {
+		if (list_empty (&schedwrk_queue[prio])) {
+			schedwrk_queue_skipped[prio] = 0;
+			continue;
+		}
+		pending = 1;
+		if (ran[prio] == 0) {
+			schedwrk_queue_skipped[prio]++;
+		} else {
+			schedwrk_queue_skipped[prio] = 0;
+		}
+	}
+
+	schedwrk_deadline = 0;
+	schedwrk_dispatches++;
+	dispatch_time = qb_util_nano_current_get () - start_time;
+	if (dispatch_time > schedwrk_max_dispatch_time) {
+		schedwrk_max_dispatch_time = dispatch_time;
+	}
+
+	if (pending) {
+		/*
+		 * Keep callback registered for next token
+		 */
+		return (-1);
+	}
+
+	schedwrk_dispatch_registered = 0;
+	return (0);
+}
+
+static void schedwrk_budget_read (void)
+{
+	uint32_t budget;
+
+	if (icmap_get_uint32 ("totem.schedwrk_budget", &budget) == CS_OK) {
+		schedwrk_budget = budget;
+	} else {
+		schedwrk_budget = SCHEDWRK_BUDGET_DEFAULT;
+	}
+}
+
+static void schedwrk_budget_changed (
+	int32_t event,
+	const char *key_name,
+	struct icmap_notify_value new_val,
+	struct icmap_notify_value old_val,
+	void *user_data)
+{
+	schedwrk_budget_read ();
 }
 
 void schedwrk_init (
 	void (*serialize_lock_fn) (void),
 	void (*serialize_unlock_fn) (void))
 {
+	icmap_track_t track = NULL;
+
 	serialize_lock = serialize_lock_fn;
 	serialize_unlock = serialize_unlock_fn;
+
+	schedwrk_budget_read ();
+	icmap_track_add ("totem.schedwrk_budget",
+		ICMAP_TRACK_ADD | ICMAP_TRACK_DELETE | ICMAP_TRACK_MODIFY,
+		schedwrk_budget_changed,
+		NULL, &track);
 }
 
 static int schedwrk_internal_create (
 	hdb_handle_t *handle,
 	int (schedwrk_fn) (const void *),
 	const void *context,
-	int lock)
+	int lock,
+	const char *name,
+	enum cs_schedwrk_priority priority)
 {
 	struct schedwrk_instance *instance;
 	int res;
 
+	if (priority < CS_SCHEDWRK_PRIO_HIGH || priority > CS_SCHEDWRK_PRIO_LOW) {
+		goto error_exit;
+	}
+
 	res = hdb_handle_create (&schedwrk_instance_database,
 		sizeof (struct schedwrk_instance), handle);
 	if (res != 0) {
@@ -108,16 +367,28 @@ static int schedwrk_internal_create (
 		goto error_destroy;
 	}
 
-	totempg_callback_token_create (
-		&instance->callback_handle,
-		TOTEM_CALLBACK_TOKEN_SENT,
-		1,
-		schedwrk_do,
-		handle);
-
 	instance->schedwrk_fn = schedwrk_fn;
 	instance->context = context;
+	instance->handle = *handle;
 	instance->lock = lock;
+	instance->destroyed = 0;
+	instance->priority = priority;
+	instance->stats = schedwrk_stats_get (name, priority);
+	instance->stats->items++;
+	instance->stats->changed = 1;
+
+	list_init (&instance->list);
+	list_add_tail (&instance->list, &schedwrk_queue[priority]);
+
+	if (!schedwrk_dispatch_registered) {
+		schedwrk_dispatch_registered = 1;
+		totempg_callback_token_create (
+			&schedwrk_callback_handle,
+			TOTEM_CALLBACK_TOKEN_SENT,
+			1,
+			schedwrk_dispatch,
+			NULL);
+	}
 
         hdb_handle_put (&schedwrk_instance_database, *handle);
 
@@ -130,17 +401,13 @@ error_exit:
 	return (-1);
 }
 
-/*
- * handle pointer is internally used by totempg_callback_token_create. To make schedwrk work,
- * handle must be pointer to ether heap or .text or static memory (not stack) which is not
- * changed by caller.
- */
 int schedwrk_create (
 	hdb_handle_t *handle,
 	int (schedwrk_fn) (const void *),
 	const void *context)
 {
-	return schedwrk_internal_create (handle, schedwrk_fn, context, 1);
+	return schedwrk_internal_create (handle, schedwrk_fn, context, 1,
+		"default", CS_SCHEDWRK_PRIO_NORMAL);
 }
 
 int schedwrk_create_nolock (
@@ -148,10 +415,81 @@ int schedwrk_create_nolock (
 	int (schedwrk_fn) (const void *),
 	const void *context)
 {
-	return schedwrk_internal_create (handle, schedwrk_fn, context, 0);
+	return schedwrk_internal_create (handle, schedwrk_fn, context, 0,
+		"default", CS_SCHEDWRK_PRIO_NORMAL);
+}
+
+int schedwrk_create_prio (
+	hdb_handle_t *handle,
+	int (schedwrk_fn) (const void *),
+	const void *context,
+	const char *name,
+	enum cs_schedwrk_priority priority)
+{
+	return schedwrk_internal_create (handle, schedwrk_fn, context, 1,
+		name, priority);
 }
 
 void schedwrk_destroy (hdb_handle_t handle)
 {
+	struct schedwrk_instance *instance;
+
+	if (hdb_handle_get (&schedwrk_instance_database, handle,
+		(void *)&instance) != 0) {
+		return;
+	}
+
+	list_del (&instance->list);
+	list_init (&instance->list);
+	instance->destroyed = 1;
+	instance->stats->items--;
+	instance->stats->changed = 1;
+
+	(void)hdb_handle_put (&schedwrk_instance_database, handle);
 	hdb_handle_destroy (&schedwrk_instance_database, handle);
 }
+
+int schedwrk_budget_exhausted (void)
+{
+	if (schedwrk_deadline == 0 || schedwrk_budget == 0) {
+		return (0);
+	}
+
+	return (qb_util_nano_current_get () >= schedwrk_deadline);
+}
+
+void schedwrk_stats_update (void)
+{
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+	struct schedwrk_stats *stats;
+	int i;
+
+	icmap_set_uint32 ("runtime.schedwrk.budget", schedwrk_budget);
+	icmap_set_uint64 ("runtime.schedwrk.dispatches", schedwrk_dispatches);
+	icmap_set_uint64 ("runtime.schedwrk.budget_exceeded", schedwrk_budget_exceeded);
+	icmap_set_uint64 ("runtime.schedwrk.max_dispatch_time",
+		schedwrk_max_dispatch_time / QB_TIME_NS_IN_USEC);
+
+	for (i = 0; i < schedwrk_stats_entries; i++) {
+		stats = &schedwrk_stats[i];
+		if (!stats->changed) {
+			continue;
+		}
+		stats->changed = 0;
+
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "runtime.schedwrk.%s.priority", stats->name);
+		icmap_set_uint8 (key_name, stats->priority);
+
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "runtime.schedwrk.%s.items", stats->name);
+		icmap_set_uint32 (key_name, stats->items);
+
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "runtime.schedwrk.%s.runs", stats->name);
+		icmap_set_uint64 (key_name, stats->runs);
+
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "runtime.schedwrk.%s.run_time", stats->name);
+		icmap_set_uint64 (key_name, stats->run_time / QB_TIME_NS_IN_USEC);
+
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "runtime.schedwrk.%s.max_run_time", stats->name);
+		icmap_set_uint64 (key_name, stats->max_run_time / QB_TIME_NS_IN_USEC);
+	}
+}
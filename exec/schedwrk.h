@@ -34,6 +34,8 @@
 #ifndef SCHEDWRK_H_DEFINED
 #define SCHEDWRK_H_DEFINED
 
+#include <corosync/coroapi.h>
+
 extern void schedwrk_init (
         void (*serialize_lock_fn) (void),
         void (*serialize_unlock_fn) (void));
@@ -48,6 +50,17 @@ extern int schedwrk_create_nolock (
         int (schedwrk_fn) (const void *),
         const void *context);
 
+extern int schedwrk_create_prio (
+        hdb_handle_t *handle,
+        int (schedwrk_fn) (const void *),
+        const void *context,
+        const char *name,
+        enum cs_schedwrk_priority priority);
+
 extern void schedwrk_destroy (hdb_handle_t handle);
 
+extern int schedwrk_budget_exhausted (void);
+
+extern void schedwrk_stats_update (void);
+
 #endif /* SCHEDWRK_H_DEFINED */
@@ -51,6 +51,7 @@
 #include <corosync/totem/totemip.h>
 #include "main.h"
 #include "service.h"
+#include "stats_shm.h"
 
 #include <qb/qbipcs.h>
 #include <qb/qbloop.h>
@@ -109,8 +110,8 @@ struct seus_handler_data {
 
 struct corosync_service_engine *corosync_service[SERVICES_COUNT_MAX];
 
-const char *service_stats_rx[SERVICES_COUNT_MAX][SERVICE_HANDLER_MAXIMUM_COUNT];
-const char *service_stats_tx[SERVICES_COUNT_MAX][SERVICE_HANDLER_MAXIMUM_COUNT];
+icmap_counter_t service_stats_rx[SERVICES_COUNT_MAX][SERVICE_HANDLER_MAXIMUM_COUNT];
+icmap_counter_t service_stats_tx[SERVICES_COUNT_MAX][SERVICE_HANDLER_MAXIMUM_COUNT];
 
 static void (*service_unlink_all_complete) (void) = NULL;
 
@@ -160,14 +161,20 @@ char *corosync_service_link_and_init (
 	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "runtime.services.%s.service_id", name_sufix);
 	icmap_set_uint16(key_name, service_engine->id);
 
+	stats_shm_service_set(service_engine->id, name_sufix);
+
 	for (fn = 0; fn < service_engine->exec_engine_count; fn++) {
 		snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "runtime.services.%s.%d.tx", name_sufix, fn);
 		icmap_set_uint64(key_name, 0);
-		service_stats_tx[service_engine->id][fn] = strdup(key_name);
+		icmap_counter_unref(service_stats_tx[service_engine->id][fn]);
+		service_stats_tx[service_engine->id][fn] = NULL;
+		icmap_counter_ref(key_name, &service_stats_tx[service_engine->id][fn]);
 
 		snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "runtime.services.%s.%d.rx", name_sufix, fn);
 		icmap_set_uint64(key_name, 0);
-		service_stats_rx[service_engine->id][fn] = strdup(key_name);
+		icmap_counter_unref(service_stats_rx[service_engine->id][fn]);
+		service_stats_rx[service_engine->id][fn] = NULL;
+		icmap_counter_ref(key_name, &service_stats_rx[service_engine->id][fn]);
 	}
 
 	log_printf (LOGSYS_LEVEL_NOTICE,
@@ -322,6 +329,8 @@ static unsigned int service_unlink_and_exit (
 
 		cs_ipcs_service_destroy (service_id);
 
+		stats_shm_service_set(service_id, NULL);
+
 		snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "internal_configuration.service.%u.handle", service_id);
 		icmap_delete(key_name);
 		snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "internal_configuration.service.%u.name", service_id);
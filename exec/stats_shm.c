@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2015 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the Red Hat, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <qb/qbipc_common.h>
+
+#include <corosync/corotypes.h>
+#include <corosync/mar_gen.h>
+#include <corosync/ipc_cmap.h>
+#include <corosync/logsys.h>
+
+#include "stats_shm.h"
+
+LOGSYS_DECLARE_SUBSYS ("MAIN");
+
+struct cmap_stats *stats_shm = NULL;
+
+void stats_shm_init (void)
+{
+	int fd;
+	void *addr;
+
+	/*
+	 * Remove segment left by previous instance
+	 */
+	(void)shm_unlink (CMAP_STATS_SHM_NAME);
+
+	fd = shm_open (CMAP_STATS_SHM_NAME, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd == -1) {
+		LOGSYS_PERROR (errno, LOGSYS_LEVEL_WARNING, "Can't create statistics segment");
+		return ;
+	}
+
+	/*
+	 * Segment is readable by everybody regardless of umask
+	 */
+	if (fchmod (fd, 0644) == -1 ||
+	    ftruncate (fd, sizeof (struct cmap_stats)) == -1) {
+		LOGSYS_PERROR (errno, LOGSYS_LEVEL_WARNING, "Can't set up statistics segment");
+		goto error_unlink;
+	}
+
+	addr = mmap (NULL, sizeof (struct cmap_stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		LOGSYS_PERROR (errno, LOGSYS_LEVEL_WARNING, "Can't map statistics segment");
+		goto error_unlink;
+	}
+	close (fd);
+
+	stats_shm = addr;
+	memset (stats_shm, 0, sizeof (*stats_shm));
+	stats_shm->version = CMAP_STATS_VERSION;
+	stats_shm->size = sizeof (*stats_shm);
+	__sync_synchronize ();
+	stats_shm->magic = CMAP_STATS_MAGIC;
+
+	return ;
+
+error_unlink:
+	close (fd);
+	(void)shm_unlink (CMAP_STATS_SHM_NAME);
+}
+
+void stats_shm_fini (void)
+{
+	if (stats_shm == NULL) {
+		return ;
+	}
+
+	/*
+	 * Let readers which still have segment mapped know it's dead
+	 */
+	stats_shm->magic = 0;
+	__sync_synchronize ();
+
+	munmap (stats_shm, sizeof (*stats_shm));
+	stats_shm = NULL;
+	(void)shm_unlink (CMAP_STATS_SHM_NAME);
+}
+
+void stats_shm_write_begin (void)
+{
+	if (stats_shm == NULL) {
+		return ;
+	}
+
+	stats_shm->seq++;
+	__sync_synchronize ();
+}
+
+void stats_shm_write_end (void)
+{
+	if (stats_shm == NULL) {
+		return ;
+	}
+
+	__sync_synchronize ();
+	stats_shm->seq++;
+}
+
+void stats_shm_service_set (int32_t service_id, const char *name)
+{
+	struct cmap_stats_service *service;
+
+	if (stats_shm == NULL || service_id < 0 || service_id >= CMAP_STATS_SERVICES_MAX) {
+		return ;
+	}
+
+	service = &stats_shm->services[service_id];
+
+	stats_shm_write_begin ();
+	memset (service, 0, sizeof (*service));
+	if (name != NULL) {
+		strncpy (service->name, name, sizeof (service->name) - 1);
+	}
+	stats_shm_write_end ();
+}
+
+int32_t stats_shm_connection_alloc (const char *name, uint32_t client_pid, uint32_t service_id)
+{
+	struct cmap_stats_connection *conn;
+	int32_t i;
+
+	if (stats_shm == NULL) {
+		return (-1);
+	}
+
+	for (i = 0; i < CMAP_STATS_CONNECTIONS_MAX; i++) {
+		if (stats_shm->connections[i].name[0] == '\0') {
+			break;
+		}
+	}
+
+	if (i == CMAP_STATS_CONNECTIONS_MAX) {
+		return (-1);
+	}
+
+	conn = &stats_shm->connections[i];
+
+	stats_shm_write_begin ();
+	memset (conn, 0, sizeof (*conn));
+	strncpy (conn->name, name, sizeof (conn->name) - 1);
+	if (conn->name[0] == '\0') {
+		conn->name[0] = '?';
+	}
+	conn->client_pid = client_pid;
+	conn->service_id = service_id;
+	stats_shm_write_end ();
+
+	return (i);
+}
+
+void stats_shm_connection_free (int32_t slot)
+{
+	if (stats_shm == NULL || slot < 0 || slot >= CMAP_STATS_CONNECTIONS_MAX) {
+		return ;
+	}
+
+	stats_shm_write_begin ();
+	memset (&stats_shm->connections[slot], 0, sizeof (stats_shm->connections[slot]));
+	stats_shm_write_end ();
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2015 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the Red Hat, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef STATS_SHM_H_DEFINED
+#define STATS_SHM_H_DEFINED
+
+#include <corosync/cmap.h>
+
+/*
+ * Statistics segment mapped read-write by executive. NULL if segment
+ * couldn't be created. Only main thread writes it.
+ */
+extern struct cmap_stats *stats_shm;
+
+extern void stats_shm_init (void);
+
+extern void stats_shm_fini (void);
+
+/*
+ * Everything written between begin and end is seen by readers atomically
+ */
+extern void stats_shm_write_begin (void);
+
+extern void stats_shm_write_end (void);
+
+extern void stats_shm_service_set (int32_t service_id, const char *name);
+
+/*
+ * Returns index of free connection slot or -1
+ */
+extern int32_t stats_shm_connection_alloc (const char *name, uint32_t client_pid, uint32_t service_id);
+
+extern void stats_shm_connection_free (int32_t slot);
+
+/*
+ * Service counters are independent values, so they are updated without
+ * write_begin/end
+ */
+static inline void stats_shm_service_rx (int32_t service_id, int32_t fn_id)
+{
+	if (stats_shm != NULL && fn_id < CMAP_STATS_SERVICE_FN_MAX) {
+		stats_shm->services[service_id].rx[fn_id]++;
+	}
+}
+
+static inline void stats_shm_service_tx (int32_t service_id, int32_t fn_id)
+{
+	if (stats_shm != NULL && fn_id < CMAP_STATS_SERVICE_FN_MAX) {
+		stats_shm->services[service_id].tx[fn_id]++;
+	}
+}
+
+#endif /* STATS_SHM_H_DEFINED */
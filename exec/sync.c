@@ -43,6 +43,9 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
 #include <errno.h>
 #include <time.h>
 #include <unistd.h>
@@ -54,9 +57,11 @@
 #include <corosync/totem/totempg.h>
 #include <corosync/totem/totem.h>
 #include <corosync/logsys.h>
+#include <corosync/icmap.h>
 #include <qb/qbipc_common.h>
-#include "schedwrk.h"
+#include <qb/qbutil.h>
 #include "quorum.h"
+#include "schedwrk.h"
 #include "sync.h"
 #include "main.h"
 
@@ -69,6 +74,7 @@ LOGSYS_DECLARE_SUBSYS ("SYNC");
 enum sync_process_state {
 	INIT,
 	PROCESS,
+	BARRIER,
 	ACTIVATE
 };
 
@@ -90,7 +96,31 @@ struct service_entry {
 	int (*sync_process) (void);
 	void (*sync_activate) (void);
 	enum sync_process_state state;
+	enum cs_sync_mode sync_mode;
+	uint64_t start_time;
+	uint64_t process_time;
+	uint64_t activate_time;
 	char name[128];
+	char stats_name[64];
+};
+
+/*
+ * Timestamps (monotonic, ns) of one membership change and following
+ * synchronization. Totem ones are taken from totemsrp statistics.
+ */
+struct sync_history_entry {
+	uint64_t seq;
+	struct memb_ring_id ring_id;
+	uint32_t members;
+	uint64_t time;
+	uint64_t gather;
+	uint64_t commit;
+	uint64_t recovery;
+	uint64_t operational;
+	uint64_t memb_determine;
+	uint64_t servicelist_build;
+	uint64_t process;
+	uint64_t completed;
 };
 
 struct processor_entry {
@@ -108,8 +138,15 @@ struct req_exec_service_build_message {
 	struct memb_ring_id ring_id __attribute__((aligned(8)));
 	int service_list_entries __attribute__((aligned(8)));
 	int service_list[128] __attribute__((aligned(8)));
+	int service_list_mode[128] __attribute__((aligned(8)));
 };
 
+/*
+ * Size of service build message sent by nodes which don't know about sync modes
+ */
+#define SYNC_SERVICE_BUILD_MSG_V1_SIZE \
+	offsetof (struct req_exec_service_build_message, service_list_mode)
+
 struct req_exec_barrier_message {
 	struct qb_ipc_request_header header __attribute__((aligned(8)));
 	struct memb_ring_id ring_id __attribute__((aligned(8)));
@@ -129,6 +166,28 @@ static unsigned int my_memb_determine_list_entries = 0;
 
 static int my_processing_idx = 0;
 
+/*
+ * Services in <my_processing_idx, my_processing_end) form current sync stage
+ */
+static int my_processing_end = 0;
+
+static int my_stage_count = 0;
+
+static uint64_t my_sync_start_time;
+
+/*
+ * Number of membership changes kept in runtime.sync.history.
+ */
+#define SYNC_HISTORY_MAX 16
+
+static struct sync_history_entry my_history;
+
+static int my_history_active = 0;
+
+static uint64_t my_history_seq = 0;
+
+static uint64_t my_memb_determine_time = 0;
+
 static hdb_handle_t my_schedwrk_handle;
 
 static struct processor_entry my_processor_list[PROCESSOR_COUNT_MAX];
@@ -203,6 +262,172 @@ int sync_init (
 	return (0);
 }
 
+static void sync_service_stats_update (const struct service_entry *service)
+{
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+
+	if (service->stats_name[0] == '\0') {
+		return;
+	}
+
+	snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "runtime.sync.%s.duration",
+		service->stats_name);
+	icmap_set_uint64 (key_name,
+		(qb_util_nano_current_get () - service->start_time) / QB_TIME_NS_IN_USEC);
+
+	snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "runtime.sync.%s.stage",
+		service->stats_name);
+	icmap_set_uint32 (key_name, my_stage_count - 1);
+}
+
+static void sync_stats_update (void)
+{
+	uint64_t duration;
+
+	duration = (qb_util_nano_current_get () - my_sync_start_time) / QB_TIME_NS_IN_USEC;
+
+	icmap_set_uint64 ("runtime.sync.duration", duration);
+	icmap_set_uint32 ("runtime.sync.services", my_service_list_entries);
+	icmap_set_uint32 ("runtime.sync.stages", my_stage_count);
+
+	log_printf (LOGSYS_LEVEL_DEBUG,
+		"Synchronization of %d services in %d stages took %"PRIu64" us",
+		my_service_list_entries, my_stage_count, duration);
+}
+
+static void sync_history_time_set (const char *prefix, const char *key,
+	uint64_t base, uint64_t timestamp)
+{
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+
+	if (timestamp == 0 || timestamp < base) {
+		return;
+	}
+
+	snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "%s%s", prefix, key);
+	icmap_set_uint64 (key_name, (timestamp - base) / QB_TIME_NS_IN_USEC);
+}
+
+/*
+ * Store finished (or aborted) synchronization into runtime.sync.history.SEQ.
+ * All times are in microseconds from the start of the membership change.
+ */
+static void sync_history_store (int aborted)
+{
+	char prefix[ICMAP_KEYNAME_MAXLEN];
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+	const char *iter_key;
+	icmap_iter_t iter;
+	uint64_t base;
+	int i;
+
+	if (!my_history_active) {
+		return;
+	}
+	my_history_active = 0;
+	my_history.completed = qb_util_nano_current_get ();
+
+	/*
+	 * Start of membership change is first gather, unless totem didn't
+	 * record it for this ring
+	 */
+	base = my_history.gather;
+	if (base == 0 || base > my_history.servicelist_build) {
+		base = my_history.servicelist_build;
+	}
+
+	if (my_history.seq >= SYNC_HISTORY_MAX) {
+		snprintf (prefix, ICMAP_KEYNAME_MAXLEN, "runtime.sync.history.%"PRIu64".",
+			my_history.seq - SYNC_HISTORY_MAX);
+		iter = icmap_iter_init (prefix);
+		while ((iter_key = icmap_iter_next (iter, NULL, NULL)) != NULL) {
+			icmap_delete (iter_key);
+		}
+		icmap_iter_finalize (iter);
+	}
+
+	snprintf (prefix, ICMAP_KEYNAME_MAXLEN, "runtime.sync.history.%"PRIu64".",
+		my_history.seq);
+
+	snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "%sring_id.rep", prefix);
+	icmap_set_uint32 (key_name, my_history.ring_id.rep.nodeid);
+	snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "%sring_id.seq", prefix);
+	icmap_set_uint64 (key_name, my_history.ring_id.seq);
+	snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "%smembers", prefix);
+	icmap_set_uint32 (key_name, my_history.members);
+	snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "%stime", prefix);
+	icmap_set_uint64 (key_name, my_history.time);
+	snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "%saborted", prefix);
+	icmap_set_uint8 (key_name, aborted);
+	snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "%sstages", prefix);
+	icmap_set_uint32 (key_name, my_stage_count);
+
+	sync_history_time_set (prefix, "commit", base, my_history.commit);
+	sync_history_time_set (prefix, "recovery", base, my_history.recovery);
+	sync_history_time_set (prefix, "operational", base, my_history.operational);
+	sync_history_time_set (prefix, "memb_determine", base, my_history.memb_determine);
+	sync_history_time_set (prefix, "servicelist_build", base, my_history.servicelist_build);
+	sync_history_time_set (prefix, "process", base, my_history.process);
+	sync_history_time_set (prefix, "completed", base, my_history.completed);
+
+	for (i = 0; i < my_service_list_entries; i++) {
+		if (my_service_list[i].stats_name[0] == '\0') {
+			continue;
+		}
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "%sservice.%s.init", prefix,
+			my_service_list[i].stats_name);
+		sync_history_time_set (key_name, "", base, my_service_list[i].start_time);
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "%sservice.%s.process", prefix,
+			my_service_list[i].stats_name);
+		sync_history_time_set (key_name, "", base, my_service_list[i].process_time);
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "%sservice.%s.activate", prefix,
+			my_service_list[i].stats_name);
+		sync_history_time_set (key_name, "", base, my_service_list[i].activate_time);
+	}
+
+	icmap_set_uint64 ("runtime.sync.history.last", my_history.seq);
+
+	log_printf (LOGSYS_LEVEL_DEBUG,
+		"Membership change %"PRIu64" %s %"PRIu64" us after it started",
+		my_history.seq, (aborted ? "aborted" : "completed"),
+		(my_history.completed - base) / QB_TIME_NS_IN_USEC);
+}
+
+static void sync_history_start (
+	size_t member_list_entries,
+	const struct memb_ring_id *ring_id)
+{
+	totempg_stats_t *stats;
+
+	/*
+	 * Previous synchronization was interrupted without abort
+	 */
+	sync_history_store (1);
+
+	memset (&my_history, 0, sizeof (my_history));
+
+	my_history.seq = my_history_seq++;
+	memcpy (&my_history.ring_id, ring_id, sizeof (struct memb_ring_id));
+	my_history.members = member_list_entries;
+	my_history.time = qb_util_nano_from_epoch_get () / QB_TIME_NS_IN_MSEC;
+	my_history.servicelist_build = qb_util_nano_current_get ();
+
+	stats = totempg_get_stats ();
+	if (stats != NULL && stats->mrp != NULL && stats->mrp->srp != NULL) {
+		my_history.gather = stats->mrp->srp->memb_change_gather;
+		my_history.commit = stats->mrp->srp->memb_change_commit;
+		my_history.recovery = stats->mrp->srp->memb_change_recovery;
+		my_history.operational = stats->mrp->srp->memb_change_operational;
+	}
+
+	if (my_memb_determine_time != 0) {
+		my_history.memb_determine = my_memb_determine_time;
+		my_memb_determine_time = 0;
+	}
+
+	my_history_active = 1;
+}
+
 static void sync_barrier_handler (unsigned int nodeid, const void *msg)
 {
 	const struct req_exec_barrier_message *req_exec_barrier_message = msg;
@@ -226,16 +451,22 @@ static void sync_barrier_handler (unsigned int nodeid, const void *msg)
 		}
 	}
 	if (barrier_reached) {
-		log_printf (LOGSYS_LEVEL_DEBUG, "Committing synchronization for %s",
-			my_service_list[my_processing_idx].name);
-		my_service_list[my_processing_idx].state = ACTIVATE;
+		for (i = my_processing_idx; i < my_processing_end; i++) {
+			log_printf (LOGSYS_LEVEL_DEBUG, "Committing synchronization for %s",
+				my_service_list[i].name);
+			my_service_list[i].state = ACTIVATE;
 
-		if (my_sync_callbacks_retrieve(my_service_list[my_processing_idx].service_id, NULL) != -1) {
-			my_service_list[my_processing_idx].sync_activate ();
+			if (my_sync_callbacks_retrieve(my_service_list[i].service_id, NULL) != -1) {
+				my_service_list[i].sync_activate ();
+			}
+			my_service_list[i].activate_time = qb_util_nano_current_get ();
+			sync_service_stats_update (&my_service_list[i]);
 		}
 
-		my_processing_idx += 1;
+		my_processing_idx = my_processing_end;
 		if (my_service_list_entries == my_processing_idx) {
+			sync_stats_update ();
+			sync_history_store (0);
 			my_memb_determine_list_entries = 0;
 			sync_synchronization_completed ();
 		} else {
@@ -299,13 +530,15 @@ static void sync_memb_determine (unsigned int nodeid, const void *msg)
 	}
 }
 
-static void sync_service_build_handler (unsigned int nodeid, const void *msg)
+static void sync_service_build_handler (unsigned int nodeid, const void *msg,
+	unsigned int msg_len)
 {
 	const struct req_exec_service_build_message *req_exec_service_build_message = msg;
 	int i, j;
 	int barrier_reached = 1;
 	int found;
 	int qsort_trigger = 0;
+	int mode_known;
 
 	if (memcmp (&my_ring_id, &req_exec_service_build_message->ring_id,
 		sizeof (struct memb_ring_id)) != 0) {
@@ -325,6 +558,9 @@ static void sync_service_build_handler (unsigned int nodeid, const void *msg)
 		if (found == 0) {
 			my_service_list[my_service_list_entries].state =
 				INIT;
+			my_service_list[my_service_list_entries].sync_mode =
+				CS_SYNC_SERIAL;
+			my_service_list[my_service_list_entries].stats_name[0] = '\0';
 			my_service_list[my_service_list_entries].service_id =
 				req_exec_service_build_message->service_list[i];
 			sprintf (my_service_list[my_service_list_entries].name,
@@ -347,6 +583,27 @@ static void sync_service_build_handler (unsigned int nodeid, const void *msg)
 		qsort (my_service_list, my_service_list_entries,
 			sizeof (struct service_entry), service_entry_compare);
 	}
+
+	/*
+	 * Service can be synchronized in parallel only if all nodes agree
+	 * on it, otherwise nodes would disagree on number of barriers.
+	 * Nodes not sending sync modes don't know about parallel sync at all.
+	 */
+	mode_known = (msg_len >= sizeof (struct req_exec_service_build_message));
+	for (j = 0; j < my_service_list_entries; j++) {
+		found = 0;
+		for (i = 0; i < req_exec_service_build_message->service_list_entries; i++) {
+			if (req_exec_service_build_message->service_list[i] ==
+				my_service_list[j].service_id) {
+				found = 1;
+				break;
+			}
+		}
+		if (found == 0 || mode_known == 0 ||
+		    req_exec_service_build_message->service_list_mode[i] != CS_SYNC_PARALLEL) {
+			my_service_list[j].sync_mode = CS_SYNC_SERIAL;
+		}
+	}
 	for (i = 0; i < my_processor_list_entries; i++) {
 		if (my_processor_list[i].nodeid == nodeid) {
 			my_processor_list[i].received = 1;
@@ -375,7 +632,11 @@ static void sync_deliver_fn (
 			sync_barrier_handler (nodeid, msg);
 			break;
 		case MESSAGE_REQ_SYNC_SERVICE_BUILD:
-			sync_service_build_handler (nodeid, msg);
+			if (msg_len < SYNC_SERVICE_BUILD_MSG_V1_SIZE) {
+				log_printf (LOGSYS_LEVEL_DEBUG, "service build message too short - discarding");
+				break;
+			}
+			sync_service_build_handler (nodeid, msg, msg_len);
 			break;
 		case MESSAGE_REQ_SYNC_MEMB_DETERMINE:
 			sync_memb_determine (nodeid, msg);
@@ -454,16 +715,40 @@ static void sync_process_enter (void)
 	 */
 	if (my_service_list_entries == 0) {
 		my_state = SYNC_SERVICELIST_BUILD;
+		sync_history_store (0);
 		my_memb_determine_list_entries = 0;
 		sync_synchronization_completed ();
 		return;
 	}
+	if (my_processing_idx == 0) {
+		my_history.process = qb_util_nano_current_get ();
+	}
 	for (i = 0; i < my_processor_list_entries; i++) {
 		my_processor_list[i].received = 0;
 	}
-	schedwrk_create (&my_schedwrk_handle,
+
+	/*
+	 * Stage is either one serial service or all adjacent parallel services
+	 */
+	my_processing_end = my_processing_idx + 1;
+	if (my_service_list[my_processing_idx].sync_mode == CS_SYNC_PARALLEL) {
+		while (my_processing_end < my_service_list_entries &&
+		    my_service_list[my_processing_end].sync_mode == CS_SYNC_PARALLEL) {
+			my_processing_end++;
+		}
+	}
+	my_stage_count++;
+
+	if (my_processing_end - my_processing_idx > 1) {
+		log_printf (LOGSYS_LEVEL_DEBUG, "Synchronizing %d services in parallel",
+			my_processing_end - my_processing_idx);
+	}
+
+	schedwrk_create_prio (&my_schedwrk_handle,
 		schedwrk_processor,
-		NULL);
+		NULL,
+		"sync",
+		CS_SCHEDWRK_PRIO_HIGH);
 }
 
 static void sync_servicelist_build_enter (
@@ -475,6 +760,9 @@ static void sync_servicelist_build_enter (
 	int i;
 	int res;
 	struct sync_callbacks sync_callbacks;
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+	char *service_name;
+	char *name_sufix;
 
 	my_state = SYNC_SERVICELIST_BUILD;
 	for (i = 0; i < member_list_entries; i++) {
@@ -488,6 +776,9 @@ static void sync_servicelist_build_enter (
 	my_member_list_entries = member_list_entries;
 
 	my_processing_idx = 0;
+	my_processing_end = 0;
+	my_stage_count = 0;
+	my_sync_start_time = qb_util_nano_current_get ();
 
 	memset(my_service_list, 0, sizeof (struct service_entry) * SERVICES_COUNT_MAX);
 	my_service_list_entries = 0;
@@ -508,12 +799,34 @@ static void sync_servicelist_build_enter (
 		my_service_list[my_service_list_entries].sync_process = sync_callbacks.sync_process;
 		my_service_list[my_service_list_entries].sync_abort = sync_callbacks.sync_abort;
 		my_service_list[my_service_list_entries].sync_activate = sync_callbacks.sync_activate;
+		my_service_list[my_service_list_entries].sync_mode = sync_callbacks.sync_mode;
+
+		/*
+		 * Statistics use same short service name as runtime.services.
+		 */
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN,
+			"internal_configuration.service.%u.name", i);
+		if (icmap_get_string (key_name, &service_name) == CS_OK) {
+			name_sufix = strrchr (service_name, '_');
+			if (name_sufix) {
+				name_sufix++;
+			} else {
+				name_sufix = service_name;
+			}
+			snprintf (my_service_list[my_service_list_entries].stats_name,
+				sizeof (my_service_list[my_service_list_entries].stats_name),
+				"%s", name_sufix);
+			free (service_name);
+		}
 		my_service_list_entries += 1;
 	}
 
+	memset (&service_build, 0, sizeof (service_build));
 	for (i = 0; i < my_service_list_entries; i++) {
 		service_build.service_list[i] =
 			my_service_list[i].service_id;
+		service_build.service_list_mode[i] =
+			my_service_list[i].sync_mode;
 	}
 	service_build.service_list_entries = my_service_list_entries;
 
@@ -523,48 +836,69 @@ static void sync_servicelist_build_enter (
 static int schedwrk_processor (const void *context)
 {
 	int res = 0;
+	int pending = 0;
+	int i;
 
-	if (my_service_list[my_processing_idx].state == INIT) {
-		unsigned int old_trans_list[PROCESSOR_COUNT_MAX];
-		size_t old_trans_list_entries = 0;
-		int o, m;
-		my_service_list[my_processing_idx].state = PROCESS;
-
-		memcpy (old_trans_list, my_trans_list, my_trans_list_entries *
-			sizeof (unsigned int));
-		old_trans_list_entries = my_trans_list_entries;
-
-		my_trans_list_entries = 0;
-		for (o = 0; o < old_trans_list_entries; o++) {
-			for (m = 0; m < my_member_list_entries; m++) {
-				if (old_trans_list[o] == my_member_list[m]) {
-					my_trans_list[my_trans_list_entries] = my_member_list[m];
-					my_trans_list_entries++;
-					break;
+	for (i = my_processing_idx; i < my_processing_end; i++) {
+		/*
+		 * Rest of the stage continues on next token
+		 */
+		if (i > my_processing_idx && schedwrk_budget_exhausted ()) {
+			pending = 1;
+			break;
+		}
+		if (my_service_list[i].state == INIT) {
+			unsigned int old_trans_list[PROCESSOR_COUNT_MAX];
+			size_t old_trans_list_entries = 0;
+			int o, m;
+			my_service_list[i].state = PROCESS;
+			my_service_list[i].start_time = qb_util_nano_current_get ();
+
+			memcpy (old_trans_list, my_trans_list, my_trans_list_entries *
+				sizeof (unsigned int));
+			old_trans_list_entries = my_trans_list_entries;
+
+			my_trans_list_entries = 0;
+			for (o = 0; o < old_trans_list_entries; o++) {
+				for (m = 0; m < my_member_list_entries; m++) {
+					if (old_trans_list[o] == my_member_list[m]) {
+						my_trans_list[my_trans_list_entries] = my_member_list[m];
+						my_trans_list_entries++;
+						break;
+					}
 				}
 			}
-		}
 
-		if (my_sync_callbacks_retrieve(my_service_list[my_processing_idx].service_id, NULL) != -1) {
-			my_service_list[my_processing_idx].sync_init (my_trans_list,
-				my_trans_list_entries, my_member_list,
-				my_member_list_entries,
-				&my_ring_id);
-		}
-	}
-	if (my_service_list[my_processing_idx].state == PROCESS) {
-		my_service_list[my_processing_idx].state = PROCESS;
-		if (my_sync_callbacks_retrieve(my_service_list[my_processing_idx].service_id, NULL) != -1) {
-			res = my_service_list[my_processing_idx].sync_process ();
-		} else {
-			res = 0;
+			if (my_sync_callbacks_retrieve(my_service_list[i].service_id, NULL) != -1) {
+				my_service_list[i].sync_init (my_trans_list,
+					my_trans_list_entries, my_member_list,
+					my_member_list_entries,
+					&my_ring_id);
+			}
 		}
-		if (res == 0) {
-			sync_barrier_enter();
-		} else {
-			return (-1);
+		if (my_service_list[i].state == PROCESS) {
+			if (my_sync_callbacks_retrieve(my_service_list[i].service_id, NULL) != -1) {
+				res = my_service_list[i].sync_process ();
+			} else {
+				res = 0;
+			}
+			if (res == 0) {
+				my_service_list[i].state = BARRIER;
+				my_service_list[i].process_time = qb_util_nano_current_get ();
+			} else {
+				pending = 1;
+			}
 		}
 	}
+
+	/*
+	 * Single barrier commits whole stage once all its services are processed
+	 */
+	if (pending) {
+		return (-1);
+	}
+	sync_barrier_enter();
+
 	return (0);
 }
 
@@ -576,6 +910,8 @@ void sync_start (
 	ENTER();
 	memcpy (&my_ring_id, ring_id, sizeof (struct memb_ring_id));
 
+	sync_history_start (member_list_entries, ring_id);
+
 	if (my_memb_determine) {
 		my_memb_determine = 0;
 		sync_servicelist_build_enter (my_memb_determine_list,
@@ -599,14 +935,20 @@ void sync_save_transitional (
 
 void sync_abort (void)
 {
+	int i;
+
 	ENTER();
 	if (my_state == SYNC_PROCESS) {
 		schedwrk_destroy (my_schedwrk_handle);
-		if (my_sync_callbacks_retrieve(my_service_list[my_processing_idx].service_id, NULL) != -1) {
-			my_service_list[my_processing_idx].sync_abort ();
+		for (i = my_processing_idx; i < my_processing_end; i++) {
+			if (my_sync_callbacks_retrieve(my_service_list[i].service_id, NULL) != -1) {
+				my_service_list[i].sync_abort ();
+			}
 		}
 	}
 
+	sync_history_store (1);
+
 	/* this will cause any "old" barrier messages from causing
 	 * problems.
 	 */
@@ -618,6 +960,7 @@ void sync_memb_list_determine (const struct memb_ring_id *ring_id)
 	ENTER();
 	memcpy (&my_memb_determine_ring_id, ring_id,
 		sizeof (struct memb_ring_id));
+	my_memb_determine_time = qb_util_nano_current_get ();
 
 	memb_determine_message_transmit ();
 }
@@ -626,5 +969,6 @@ void sync_memb_list_abort (void)
 {
 	ENTER();
 	my_memb_determine_list_entries = 0;
+	my_memb_determine_time = 0;
 	memset (&my_memb_determine_ring_id, 0, sizeof (struct memb_ring_id));
 }
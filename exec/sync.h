@@ -35,6 +35,8 @@
 #ifndef SYNC_H_DEFINED
 #define SYNC_H_DEFINED
 
+#include <corosync/coroapi.h>
+
 struct sync_callbacks {
 	void (*sync_init) (
 		const unsigned int *trans_list,
@@ -45,6 +47,7 @@ struct sync_callbacks {
 	int (*sync_process) (void);
 	void (*sync_activate) (void);
 	void (*sync_abort) (void);
+	enum cs_sync_mode sync_mode;
 	const char *name;
 };
 
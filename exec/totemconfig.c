@@ -52,6 +52,7 @@
 #include <corosync/swab.h>
 #include <corosync/list.h>
 #include <qb/qbdefs.h>
+#include <qb/qbutil.h>
 #include <corosync/totem/totem.h>
 #include <corosync/config.h>
 #include <corosync/logsys.h>
@@ -481,7 +482,7 @@ static int get_cluster_mcast_addr (
 }
 
 static unsigned int generate_nodeid_for_duplicate_test(
-	struct totem_config *totem_config,
+	int clear_node_high_bit,
 	char *addr)
 {
 	unsigned int nodeid;
@@ -498,29 +499,142 @@ static unsigned int generate_nodeid_for_duplicate_test(
 	nodeid = swab32 (nodeid);
 #endif
 
-	if (totem_config->clear_node_high_bit) {
+	if (clear_node_high_bit) {
 		nodeid &= 0x7FFFFFFF;
 	}
 	return nodeid;
 }
 
-static int check_for_duplicate_nodeids(
-	struct totem_config *totem_config,
-	const char **error_string)
+/*
+ * In-memory model of nodelist. It's built once from icmap (see totem_nodelist_get)
+ * and shared by all passes working with nodelist, so every address is parsed only once
+ * and lookups by nodeid and ring0 address are hashed instead of iterating icmap.
+ * Model is invalidated by any change of nodelist.node. keys.
+ */
+#define TOTEM_NODELIST_HASH_SIZE		1024
+
+struct totem_nodelist_node {
+	unsigned int node_pos;
+	unsigned int nodeid;
+	int nodeid_valid;
+	int nodeid_autogenerated;
+	char *ring0_addr_str;
+	struct totem_ip_address ring_addr[INTERFACE_MAX];
+	int ring_addr_valid[INTERFACE_MAX];
+	int nodeid_next;
+	int addr_next;
+};
+
+struct totem_nodelist {
+	int valid;
+	int ip_version;
+	int clear_node_high_bit;
+	struct totem_nodelist_node *nodes;
+	unsigned int node_count;
+	unsigned int nodes_allocated;
+	int nodeid_hash[TOTEM_NODELIST_HASH_SIZE];
+	int addr_hash[TOTEM_NODELIST_HASH_SIZE];
+};
+
+static struct totem_nodelist totem_nodelist;
+
+static unsigned int totem_nodelist_nodeid_hash(unsigned int nodeid)
+{
+	return ((nodeid * 2654435761U) >> 22) & (TOTEM_NODELIST_HASH_SIZE - 1);
+}
+
+static unsigned int totem_nodelist_addr_hash(const struct totem_ip_address *addr)
+{
+	unsigned int hash;
+	size_t addr_len;
+	size_t i;
+
+	addr_len = (addr->family == AF_INET6 ? sizeof(struct in6_addr) : sizeof(struct in_addr));
+
+	hash = addr->family;
+	for (i = 0; i < addr_len; i++) {
+		hash = hash * 31 + addr->addr[i];
+	}
+
+	return (hash & (TOTEM_NODELIST_HASH_SIZE - 1));
+}
+
+static void totem_nodelist_invalidate(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < totem_nodelist.node_count; i++) {
+		free(totem_nodelist.nodes[i].ring0_addr_str);
+	}
+	free(totem_nodelist.nodes);
+
+	totem_nodelist.nodes = NULL;
+	totem_nodelist.node_count = 0;
+	totem_nodelist.nodes_allocated = 0;
+	totem_nodelist.valid = 0;
+}
+
+/*
+ * Return node with given position. If node_create is set and node doesn't exist yet, it's
+ * created.
+ */
+static struct totem_nodelist_node *totem_nodelist_node_get(unsigned int node_pos, int node_create)
+{
+	struct totem_nodelist_node *nodes;
+	struct totem_nodelist_node *node;
+	unsigned int i;
+
+	/*
+	 * Keys of one node are returned by icmap iterator together, so usually it's last one
+	 */
+	for (i = totem_nodelist.node_count; i > 0; i--) {
+		if (totem_nodelist.nodes[i - 1].node_pos == node_pos) {
+			return (&totem_nodelist.nodes[i - 1]);
+		}
+	}
+
+	if (!node_create) {
+		return (NULL);
+	}
+
+	if (totem_nodelist.node_count == totem_nodelist.nodes_allocated) {
+		nodes = realloc(totem_nodelist.nodes,
+		    sizeof(*nodes) * (totem_nodelist.nodes_allocated + PROCESSOR_COUNT_MAX));
+		if (nodes == NULL) {
+			return (NULL);
+		}
+		totem_nodelist.nodes = nodes;
+		totem_nodelist.nodes_allocated += PROCESSOR_COUNT_MAX;
+	}
+
+	node = &totem_nodelist.nodes[totem_nodelist.node_count++];
+	memset(node, 0, sizeof(*node));
+	node->node_pos = node_pos;
+
+	return (node);
+}
+
+static void totem_nodelist_build(int ip_version, int clear_node_high_bit)
 {
 	icmap_iter_t iter;
-	icmap_iter_t subiter;
 	const char *iter_key;
-	int res = 0;
-	int retval = 0;
 	char tmp_key[ICMAP_KEYNAME_MAXLEN];
-	char *ring0_addr=NULL;
-	char *ring0_addr1=NULL;
+	char tmp_key2[ICMAP_KEYNAME_MAXLEN];
+	struct totem_nodelist_node *node;
 	unsigned int node_pos;
-	unsigned int node_pos1;
-	unsigned int nodeid;
-	unsigned int nodeid1;
-	int autogenerated;
+	unsigned int ring_no;
+	char *node_addr_str;
+	unsigned int hash;
+	unsigned int i;
+	unsigned int node_count;
+	uint64_t start_time;
+	int res;
+
+	start_time = qb_util_nano_current_get();
+
+	totem_nodelist_invalidate();
+	totem_nodelist.ip_version = ip_version;
+	totem_nodelist.clear_node_high_bit = clear_node_high_bit;
 
 	iter = icmap_iter_init("nodelist.node.");
 	while ((iter_key = icmap_iter_next(iter, NULL, NULL)) != NULL) {
@@ -529,83 +643,175 @@ static int check_for_duplicate_nodeids(
 			continue;
 		}
 
-		if (strcmp(tmp_key, "ring0_addr") != 0) {
+		if (strcmp(tmp_key, "nodeid") == 0) {
+			node = totem_nodelist_node_get(node_pos, 1);
+			if (node != NULL && icmap_get_uint32(iter_key, &node->nodeid) == CS_OK) {
+				node->nodeid_valid = 1;
+			}
 			continue;
 		}
 
-		snprintf(tmp_key, ICMAP_KEYNAME_MAXLEN, "nodelist.node.%u.nodeid", node_pos);
-		autogenerated = 0;
-		if (icmap_get_uint32(tmp_key, &nodeid) != CS_OK) {
+		res = sscanf(tmp_key, "ring%u%s", &ring_no, tmp_key2);
+		if (res != 2 || strcmp(tmp_key2, "_addr") != 0 || ring_no >= INTERFACE_MAX) {
+			continue;
+		}
 
-			snprintf(tmp_key, ICMAP_KEYNAME_MAXLEN, "nodelist.node.%u.ring0_addr", node_pos);
-			if (icmap_get_string(tmp_key, &ring0_addr) != CS_OK) {
-				continue;
-			}
+		if (icmap_get_string(iter_key, &node_addr_str) != CS_OK) {
+			continue;
+		}
 
-			/* Generate nodeid so we can check that auto-generated nodeids don't clash either */
-			nodeid = generate_nodeid_for_duplicate_test(totem_config, ring0_addr);
-			if (nodeid == -1) {
-				continue;
-			}
-			autogenerated = 1;
+		node = totem_nodelist_node_get(node_pos, 1);
+		if (node == NULL) {
+			free(node_addr_str);
+			continue;
 		}
 
-		node_pos1 = 0;
-		subiter = icmap_iter_init("nodelist.node.");
-		while (((iter_key = icmap_iter_next(subiter, NULL, NULL)) != NULL) && (node_pos1 < node_pos)) {
-			res = sscanf(iter_key, "nodelist.node.%u.%s", &node_pos1, tmp_key);
-			if ((res != 2) || (node_pos1 >= node_pos)) {
-				continue;
-			}
+		if (totemip_parse(&node->ring_addr[ring_no], node_addr_str, ip_version) != -1) {
+			node->ring_addr_valid[ring_no] = 1;
+		}
 
-			if (strcmp(tmp_key, "ring0_addr") != 0) {
-				continue;
-			}
+		if (ring_no == 0) {
+			node->ring0_addr_str = node_addr_str;
+		} else {
+			free(node_addr_str);
+		}
+	}
+	icmap_iter_finalize(iter);
 
-			snprintf(tmp_key, ICMAP_KEYNAME_MAXLEN, "nodelist.node.%u.nodeid", node_pos1);
-			if (icmap_get_uint32(tmp_key, &nodeid1) != CS_OK) {
+	/*
+	 * Only nodes with ring0_addr are members of nodelist
+	 */
+	node_count = 0;
+	for (i = 0; i < totem_nodelist.node_count; i++) {
+		if (totem_nodelist.nodes[i].ring0_addr_str == NULL) {
+			continue;
+		}
+		totem_nodelist.nodes[node_count++] = totem_nodelist.nodes[i];
+	}
+	totem_nodelist.node_count = node_count;
 
-				snprintf(tmp_key, ICMAP_KEYNAME_MAXLEN, "nodelist.node.%u.ring0_addr", node_pos1);
-				if (icmap_get_string(tmp_key, &ring0_addr1) != CS_OK) {
-					continue;
-				}
-				nodeid1 = generate_nodeid_for_duplicate_test(totem_config, ring0_addr1);
-				if (nodeid1 == -1) {
-					continue;
-				}
+	for (i = 0; i < TOTEM_NODELIST_HASH_SIZE; i++) {
+		totem_nodelist.nodeid_hash[i] = -1;
+		totem_nodelist.addr_hash[i] = -1;
+	}
+
+	for (i = 0; i < totem_nodelist.node_count; i++) {
+		node = &totem_nodelist.nodes[i];
+
+		if (!node->nodeid_valid) {
+			/*
+			 * Generate nodeid so we can check that auto-generated nodeids don't clash either
+			 */
+			node->nodeid = generate_nodeid_for_duplicate_test(clear_node_high_bit,
+			    node->ring0_addr_str);
+			if (node->nodeid != -1) {
+				node->nodeid_valid = 1;
+				node->nodeid_autogenerated = 1;
 			}
+		}
+
+		if (node->nodeid_valid) {
+			hash = totem_nodelist_nodeid_hash(node->nodeid);
+			node->nodeid_next = totem_nodelist.nodeid_hash[hash];
+			totem_nodelist.nodeid_hash[hash] = i;
+		}
+
+		if (node->ring_addr_valid[0]) {
+			hash = totem_nodelist_addr_hash(&node->ring_addr[0]);
+			node->addr_next = totem_nodelist.addr_hash[hash];
+			totem_nodelist.addr_hash[hash] = i;
+		}
+	}
+
+	totem_nodelist.valid = 1;
+
+	log_printf(LOGSYS_LEVEL_DEBUG, "Nodelist with %u nodes loaded in %"PRIu64" us",
+	    totem_nodelist.node_count,
+	    (qb_util_nano_current_get() - start_time) / QB_TIME_NS_IN_USEC);
+}
+
+static struct totem_nodelist *totem_nodelist_get(int ip_version, int clear_node_high_bit)
+{
+
+	if (!totem_nodelist.valid || totem_nodelist.ip_version != ip_version ||
+	    totem_nodelist.clear_node_high_bit != clear_node_high_bit) {
+		totem_nodelist_build(ip_version, clear_node_high_bit);
+	}
+
+	return (&totem_nodelist);
+}
+
+/*
+ * Return index of first node (in nodelist order) with ring0 address addr or -1 if there
+ * is no such node. Hash chains are built by prepending, so they are in reverse nodelist
+ * order and whole chain has to be walked.
+ */
+static int totem_nodelist_find_addr(const struct totem_nodelist *nodelist,
+	const struct totem_ip_address *addr)
+{
+	int i;
+	int found = -1;
+
+	for (i = nodelist->addr_hash[totem_nodelist_addr_hash(addr)]; i != -1;
+	    i = nodelist->nodes[i].addr_next) {
+		if (totemip_equal(&nodelist->nodes[i].ring_addr[0], addr)) {
+			found = i;
+		}
+	}
+
+	return (found);
+}
+
+static int check_for_duplicate_nodeids(
+	struct totem_config *totem_config,
+	const char **error_string)
+{
+	struct totem_nodelist *nodelist;
+	struct totem_nodelist_node *node;
+	int retval = 0;
+	unsigned int i;
+	int j;
+
+	nodelist = totem_nodelist_get(totem_config->ip_version, totem_config->clear_node_high_bit);
 
-			if (nodeid == nodeid1) {
-				retval = -1;
-				snprintf (error_string_response, sizeof(error_string_response),
-					  "Nodeid %u%s%s%s appears twice in corosync.conf", nodeid,
-					  autogenerated?"(autogenerated from ":"",
-					  autogenerated?ring0_addr:"",
-					  autogenerated?")":"");
-				log_printf (LOGSYS_LEVEL_ERROR, error_string_response);
-				*error_string = error_string_response;
-				break;
+	for (i = 0; i < nodelist->node_count; i++) {
+		node = &nodelist->nodes[i];
+		if (!node->nodeid_valid) {
+			continue;
+		}
+
+		/*
+		 * Only nodes preceding node are reported, so every duplicity is reported once
+		 */
+		for (j = nodelist->nodeid_hash[totem_nodelist_nodeid_hash(node->nodeid)]; j != -1;
+		    j = nodelist->nodes[j].nodeid_next) {
+			if (j >= i || nodelist->nodes[j].nodeid != node->nodeid) {
+				continue;
 			}
+
+			retval = -1;
+			snprintf (error_string_response, sizeof(error_string_response),
+				  "Nodeid %u%s%s%s appears twice in corosync.conf", node->nodeid,
+				  node->nodeid_autogenerated?"(autogenerated from ":"",
+				  node->nodeid_autogenerated?node->ring0_addr_str:"",
+				  node->nodeid_autogenerated?")":"");
+			log_printf (LOGSYS_LEVEL_ERROR, error_string_response);
+			*error_string = error_string_response;
+			break;
 		}
-		icmap_iter_finalize(subiter);
 	}
-	icmap_iter_finalize(iter);
+
 	return retval;
 }
 
 
 static int find_local_node_in_nodelist(struct totem_config *totem_config)
 {
-	icmap_iter_t iter;
-	const char *iter_key;
+	struct totem_nodelist *nodelist;
 	int res = 0;
-	unsigned int node_pos;
-	int local_node_pos = -1;
+	int node_index;
 	struct totem_ip_address bind_addr;
 	int interface_up, interface_num;
-	char tmp_key[ICMAP_KEYNAME_MAXLEN];
-	char *node_addr_str;
-	struct totem_ip_address node_addr;
 
 	res = totemip_iface_check(&totem_config->interfaces[0].bindnet,
 		&bind_addr, &interface_up, &interface_num,
@@ -614,35 +820,14 @@ static int find_local_node_in_nodelist(struct totem_config *totem_config)
 		return (-1);
 	}
 
-	iter = icmap_iter_init("nodelist.node.");
-	while ((iter_key = icmap_iter_next(iter, NULL, NULL)) != NULL) {
-		res = sscanf(iter_key, "nodelist.node.%u.%s", &node_pos, tmp_key);
-		if (res != 2) {
-			continue;
-		}
-
-		if (strcmp(tmp_key, "ring0_addr") != 0) {
-			continue;
-		}
-
-		snprintf(tmp_key, ICMAP_KEYNAME_MAXLEN, "nodelist.node.%u.ring0_addr", node_pos);
-		if (icmap_get_string(tmp_key, &node_addr_str) != CS_OK) {
-			continue;
-		}
+	nodelist = totem_nodelist_get(totem_config->ip_version, totem_config->clear_node_high_bit);
 
-		res = totemip_parse (&node_addr, node_addr_str, totem_config->ip_version);
-		free(node_addr_str);
-		if (res == -1) {
-			continue ;
-		}
-
-		if (totemip_equal(&bind_addr, &node_addr)) {
-			local_node_pos = node_pos;
-		}
+	node_index = totem_nodelist_find_addr(nodelist, &bind_addr);
+	if (node_index == -1) {
+		return (-1);
 	}
-	icmap_iter_finalize(iter);
 
-	return (local_node_pos);
+	return (nodelist->nodes[node_index].node_pos);
 }
 
 /*
@@ -713,16 +898,12 @@ static void compute_interfaces_diff(int interface_count,
 
 static void put_nodelist_members_to_config(struct totem_config *totem_config, int reload)
 {
-	icmap_iter_t iter, iter2;
-	const char *iter_key, *iter_key2;
-	int res = 0;
-	unsigned int node_pos;
-	char tmp_key[ICMAP_KEYNAME_MAXLEN];
-	char tmp_key2[ICMAP_KEYNAME_MAXLEN];
-	char *node_addr_str;
+	struct totem_nodelist *nodelist;
+	struct totem_nodelist_node *node;
 	int member_count;
 	unsigned int ringnumber = 0;
-	int i, j;
+	unsigned int i;
+	int j;
 	struct totem_interface *orig_interfaces = NULL;
 	struct totem_interface *new_interfaces = NULL;
 
@@ -748,44 +929,30 @@ static void put_nodelist_members_to_config(struct totem_config *totem_config, in
 		totem_config->interfaces[i].member_count = 0;
 	}
 
-	iter = icmap_iter_init("nodelist.node.");
-	while ((iter_key = icmap_iter_next(iter, NULL, NULL)) != NULL) {
-		res = sscanf(iter_key, "nodelist.node.%u.%s", &node_pos, tmp_key);
-		if (res != 2) {
-			continue;
-		}
+	nodelist = totem_nodelist_get(totem_config->ip_version, totem_config->clear_node_high_bit);
 
-		if (strcmp(tmp_key, "ring0_addr") != 0) {
-			continue;
-		}
+	for (i = 0; i < nodelist->node_count; i++) {
+		node = &nodelist->nodes[i];
 
-		snprintf(tmp_key, ICMAP_KEYNAME_MAXLEN, "nodelist.node.%u.", node_pos);
-		iter2 = icmap_iter_init(tmp_key);
-		while ((iter_key2 = icmap_iter_next(iter2, NULL, NULL)) != NULL) {
-			res = sscanf(iter_key2, "nodelist.node.%u.ring%u%s", &node_pos, &ringnumber, tmp_key2);
-			if (res != 3 || strcmp(tmp_key2, "_addr") != 0) {
+		for (ringnumber = 0; ringnumber < INTERFACE_MAX; ringnumber++) {
+			if (!node->ring_addr_valid[ringnumber]) {
 				continue;
 			}
 
-			if (icmap_get_string(iter_key2, &node_addr_str) != CS_OK) {
+			member_count = totem_config->interfaces[ringnumber].member_count;
+			if (member_count >= PROCESSOR_COUNT_MAX) {
+				log_printf(LOGSYS_LEVEL_ERROR,
+				    "Too many members in nodelist for ring %u, ignoring node %u",
+				    ringnumber, node->node_pos);
 				continue;
 			}
 
-			member_count = totem_config->interfaces[ringnumber].member_count;
-
-			res = totemip_parse(&totem_config->interfaces[ringnumber].member_list[member_count],
-						node_addr_str, totem_config->ip_version);
-			if (res != -1) {
-				totem_config->interfaces[ringnumber].member_count++;
-			}
-			free(node_addr_str);
+			memcpy(&totem_config->interfaces[ringnumber].member_list[member_count],
+			    &node->ring_addr[ringnumber], sizeof(struct totem_ip_address));
+			totem_config->interfaces[ringnumber].member_count++;
 		}
-
-		icmap_iter_finalize(iter2);
 	}
 
-	icmap_iter_finalize(iter);
-
 	if (reload) {
 		memcpy(new_interfaces, totem_config->interfaces, sizeof (struct totem_interface) * INTERFACE_MAX);
 
@@ -796,19 +963,34 @@ static void put_nodelist_members_to_config(struct totem_config *totem_config, in
 	}
 }
 
-static void nodelist_dynamic_notify(
+static void nodelist_invalidate_notify(
 	int32_t event,
 	const char *key_name,
 	struct icmap_notify_value new_val,
 	struct icmap_notify_value old_val,
 	void *user_data)
 {
+
+	totem_nodelist_invalidate();
+}
+
+/*
+ * Batched nodelist track, pending changes are dropped after full reload
+ */
+static icmap_track_t nodelist_dynamic_track = NULL;
+
+static void nodelist_dynamic_notify(
+	const struct icmap_notify_batch_entry *entries,
+	size_t no_entries,
+	void *user_data)
+{
 	int res;
 	unsigned int ring_no;
 	unsigned int member_no;
 	char tmp_str[ICMAP_KEYNAME_MAXLEN];
 	uint8_t reloading;
 	struct totem_config *totem_config = (struct totem_config *)user_data;
+	size_t i;
 
 	/*
 	* If a full reload is in progress then don't do anything until it's done and
@@ -818,15 +1000,17 @@ static void nodelist_dynamic_notify(
 		return ;
 	}
 
-	res = sscanf(key_name, "nodelist.node.%u.ring%u%s", &member_no, &ring_no, tmp_str);
-	if (res != 3)
-		return ;
-
-	if (strcmp(tmp_str, "_addr") != 0) {
-		return;
+	/*
+	 * Changes are batched, so whole nodelist is applied only once even when
+	 * many nodes were added at once
+	 */
+	for (i = 0; i < no_entries; i++) {
+		res = sscanf(entries[i].key_name, "nodelist.node.%u.ring%u%s", &member_no, &ring_no, tmp_str);
+		if (res == 3 && strcmp(tmp_str, "_addr") == 0) {
+			put_nodelist_members_to_config(totem_config, 1);
+			break;
+		}
 	}
-
-	put_nodelist_members_to_config(totem_config, 1);
 }
 
 
@@ -850,8 +1034,11 @@ int totem_config_find_local_addr_in_nodelist(const char *ipaddr_key_prefix, unsi
 	const char *ipaddr_key;
 	int ip_version;
 	struct totem_ip_address node_addr;
+	struct totem_nodelist *nodelist;
 	char *node_addr_str;
 	int node_found = 0;
+	int node_index;
+	int first_index;
 	int res = 0;
 	char tmp_key[ICMAP_KEYNAME_MAXLEN];
 
@@ -861,6 +1048,34 @@ int totem_config_find_local_addr_in_nodelist(const char *ipaddr_key_prefix, unsi
 
 	ip_version = totem_config_get_ip_version();
 
+	if (ipaddr_key_prefix == NULL) {
+		/*
+		 * ring0_addr is indexed by nodelist model. When more nodes match local
+		 * addresses, first one in nodelist order is used, no matter which
+		 * interface it matched.
+		 */
+		nodelist = totem_nodelist_get(ip_version, totem_nodelist.clear_node_high_bit);
+
+		first_index = -1;
+		for (list = addrs.next; list != &addrs; list = list->next) {
+			if_addr = list_entry(list, struct totem_ip_if_address, list);
+
+			node_index = totem_nodelist_find_addr(nodelist, &if_addr->ip_addr);
+			if (node_index != -1 && (first_index == -1 || node_index < first_index)) {
+				first_index = node_index;
+			}
+		}
+
+		if (first_index != -1) {
+			*node_pos = nodelist->nodes[first_index].node_pos;
+			node_found = 1;
+		}
+
+		totemip_freeifaddrs(&addrs);
+
+		return (node_found);
+	}
+
 	iter = icmap_iter_init("nodelist.node.");
 
 	while ((iter_key = icmap_iter_next(iter, NULL, NULL)) != NULL) {
@@ -882,15 +1097,11 @@ int totem_config_find_local_addr_in_nodelist(const char *ipaddr_key_prefix, unsi
 		/*
 		 * ring0_addr found -> let's iterate thru ipaddr_key_prefix
 		 */
-		snprintf(tmp_key, sizeof(tmp_key), "nodelist.node.%u.%s", *node_pos,
-		    (ipaddr_key_prefix != NULL ? ipaddr_key_prefix : "ring0_addr"));
+		snprintf(tmp_key, sizeof(tmp_key), "nodelist.node.%u.%s", *node_pos, ipaddr_key_prefix);
 
 		iter2 = icmap_iter_init(tmp_key);
 		while ((iter_key2 = icmap_iter_next(iter2, NULL, NULL)) != NULL) {
-			/*
-			 * ring0_addr must be exact match, not prefix
-			 */
-			ipaddr_key = (ipaddr_key_prefix != NULL ? iter_key2 : tmp_key);
+			ipaddr_key = iter_key2;
 			if (icmap_get_string(ipaddr_key, &node_addr_str) != CS_OK) {
 				continue ;
 			}
@@ -1607,6 +1818,13 @@ static void totem_reload_notify(
 
 	/* Reload has completed */
 	if (*(uint8_t *)new_val.data == 0) {
+		/*
+		 * Nodelist changes made during reload are applied right now, so
+		 * batch must not apply them again
+		 */
+		if (nodelist_dynamic_track != NULL) {
+			icmap_track_batch_discard(nodelist_dynamic_track);
+		}
 		put_nodelist_members_to_config (totem_config, 1);
 		totem_volatile_config_read (totem_config, NULL);
 		log_printf(LOGSYS_LEVEL_DEBUG, "Configuration reloaded. Dumping actual totem config.");
@@ -1648,8 +1866,14 @@ static void add_totem_config_notification(struct totem_config *totem_config)
 		&icmap_track);
 
 	icmap_track_add("nodelist.node.",
+		ICMAP_TRACK_ADD | ICMAP_TRACK_DELETE | ICMAP_TRACK_MODIFY | ICMAP_TRACK_PREFIX,
+		nodelist_invalidate_notify,
+		NULL,
+		&icmap_track);
+
+	icmap_track_add_batch("nodelist.node.",
 		ICMAP_TRACK_ADD | ICMAP_TRACK_DELETE | ICMAP_TRACK_MODIFY | ICMAP_TRACK_PREFIX,
 		nodelist_dynamic_notify,
 		(void *)totem_config,
-		&icmap_track);
+		&nodelist_dynamic_track);
 }
@@ -1269,6 +1269,11 @@ static void check_q_level(
 	}
 }
 
+int totempg_queue_avail_get (void)
+{
+	return (totemmrp_avail() - totempg_reserved);
+}
+
 void totempg_check_q_level(
 	void *totempg_groups_instance)
 {
@@ -1893,6 +1893,11 @@ static void memb_state_operational_enter (struct totemsrp_instance *instance)
 
 	instance->originated_orf_token = 0;
 
+	/*
+	 * Set before configuration change is delivered, so sync can use it
+	 */
+	instance->stats.memb_change_operational = qb_util_nano_current_get ();
+
 	memb_consensus_reset (instance);
 
 	old_ring_state_reset (instance);
@@ -2176,6 +2181,9 @@ static void memb_state_gather_enter (
 
 	instance->memb_state = MEMB_STATE_GATHER;
 	instance->stats.gather_entered++;
+	if (instance->stats.memb_change_gather <= instance->stats.memb_change_operational) {
+		instance->stats.memb_change_gather = qb_util_nano_current_get ();
+	}
 
 	if (gather_from == TOTEMSRP_GSFROM_THE_CONSENSUS_TIMEOUT_EXPIRED) {
 		/*
@@ -2228,6 +2236,7 @@ static void memb_state_commit_enter (
 	reset_token_timeout (instance); // REVIEWED
 
 	instance->stats.commit_entered++;
+	instance->stats.memb_change_commit = qb_util_nano_current_get ();
 	instance->stats.continuous_gather = 0;
 
 	/*
@@ -2427,6 +2436,7 @@ originated:
 
 	instance->memb_state = MEMB_STATE_RECOVERY;
 	instance->stats.recovery_entered++;
+	instance->stats.memb_change_recovery = qb_util_nano_current_get ();
 	instance->stats.continuous_gather = 0;
 
 	return;
@@ -408,7 +408,8 @@ static struct corosync_service_engine votequorum_service_engine = {
 	.sync_init			= votequorum_sync_init,
 	.sync_process			= votequorum_sync_process,
 	.sync_activate			= votequorum_sync_activate,
-	.sync_abort			= votequorum_sync_abort
+	.sync_abort			= votequorum_sync_abort,
+	.sync_mode			= CS_SYNC_PARALLEL
 };
 
 struct corosync_service_engine *votequorum_get_service_engine_ver0 (void)
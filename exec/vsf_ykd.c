@@ -182,10 +182,12 @@ static int ykd_state_send_msg (const void *context)
 
 static void ykd_state_send (void)
 {
-	api->schedwrk_create (
+	api->schedwrk_create_prio (
 		&schedwrk_state_send_callback_handle,
                 ykd_state_send_msg,
-                NULL);
+                NULL,
+		"ykd",
+		CS_SCHEDWRK_PRIO_HIGH);
 }
 
 static int ykd_attempt_send_msg (const void *context)
@@ -207,10 +209,12 @@ static int ykd_attempt_send_msg (const void *context)
 
 static void ykd_attempt_send (void)
 {
-	api->schedwrk_create (
+	api->schedwrk_create_prio (
 		&schedwrk_attempt_send_callback_handle,
                 ykd_attempt_send_msg,
-                NULL);
+                NULL,
+		"ykd",
+		CS_SCHEDWRK_PRIO_HIGH);
 }
 
 static void compute (void)
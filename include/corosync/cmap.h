@@ -63,6 +63,11 @@ typedef uint64_t cmap_iter_handle_t;
  */
 typedef uint64_t cmap_track_handle_t;
 
+/*
+ * Handle for mapped statistics segment
+ */
+typedef uint64_t cmap_stats_handle_t;
+
 /*
  * Maximum length of key in cmap
  */
@@ -86,6 +91,14 @@ typedef uint64_t cmap_track_handle_t;
  */
 #define CMAP_TRACK_PREFIX	8
 
+/**
+ * Changes are coalesced by executive and delivered once per its main loop iteration
+ * in one IPC event. notify_fn is then called for every changed key, where old_value is value
+ * before first change and new_value is value after last change of key. Like
+ * CMAP_TRACK_PREFIX, this value is never returned inside of callback.
+ */
+#define CMAP_TRACK_BATCH	16
+
 /**
  * Possible types of value. Binary is raw data without trailing zero with given length
  */
@@ -114,6 +127,126 @@ struct cmap_notify_value {
 	const void *data;
 };
 
+/**
+ * Key and value used by multi-key operations (cmap_get_multi, cmap_set_multi and
+ * cmap_iter_next_page). Value returned by get operations points into buffer passed
+ * by caller and is aligned to 8 bytes relative to start of the buffer. error is
+ * result of operation for given key.
+ */
+struct cmap_key_value {
+	char key_name[CMAP_KEYNAME_MAXLEN + 1];
+	cmap_value_types_t type;
+	size_t value_len;
+	const void *value;
+	cs_error_t error;
+};
+
+/**
+ * Layout of statistics segment. It's shared memory mapped by any local reader
+ * (see cmap_stats_open) and updated in place by executive. Fields have same
+ * meaning as runtime.totem.pg.*, runtime.services.* and runtime.connections.*
+ * keys.
+ */
+#define CMAP_STATS_VERSION		1
+
+#define CMAP_STATS_INTERFACE_MAX	8
+#define CMAP_STATS_TOKEN_MAX		100
+#define CMAP_STATS_SERVICES_MAX		64
+#define CMAP_STATS_SERVICE_FN_MAX	64
+#define CMAP_STATS_CONNECTIONS_MAX	256
+#define CMAP_STATS_NAME_LEN		128
+
+struct cmap_stats_token {
+	uint32_t rx;
+	uint32_t tx;
+	int32_t backlog_calc;
+	uint32_t reserved;
+};
+
+struct cmap_stats_totem {
+	uint32_t msg_reserved;
+	uint32_t msg_queue_avail;
+	uint64_t orf_token_tx;
+	uint64_t orf_token_rx;
+	uint64_t memb_merge_detect_tx;
+	uint64_t memb_merge_detect_rx;
+	uint64_t memb_join_tx;
+	uint64_t memb_join_rx;
+	uint64_t mcast_tx;
+	uint64_t mcast_retx;
+	uint64_t mcast_rx;
+	uint64_t memb_commit_token_tx;
+	uint64_t memb_commit_token_rx;
+	uint64_t token_hold_cancel_tx;
+	uint64_t token_hold_cancel_rx;
+	uint64_t operational_entered;
+	uint64_t operational_token_lost;
+	uint64_t gather_entered;
+	uint64_t gather_token_lost;
+	uint64_t commit_entered;
+	uint64_t commit_token_lost;
+	uint64_t recovery_entered;
+	uint64_t recovery_token_lost;
+	uint64_t consensus_timeouts;
+	uint64_t rx_msg_dropped;
+	uint32_t continuous_gather;
+	uint32_t continuous_sendmsg_failures;
+	uint32_t firewall_enabled_or_nic_failure;
+	uint32_t mtt_rx_token;
+	uint32_t avg_token_workload;
+	uint32_t avg_backlog_calc;
+	uint32_t interface_count;
+	uint8_t faulty[CMAP_STATS_INTERFACE_MAX];
+	int32_t earliest_token;
+	int32_t latest_token;
+	struct cmap_stats_token token[CMAP_STATS_TOKEN_MAX];
+};
+
+/*
+ * Service slot is unused if name is empty
+ */
+struct cmap_stats_service {
+	char name[32];
+	uint64_t rx[CMAP_STATS_SERVICE_FN_MAX];
+	uint64_t tx[CMAP_STATS_SERVICE_FN_MAX];
+};
+
+/*
+ * Connection slot is unused if name is empty. name is part of
+ * runtime.connections.* key identifying connection.
+ */
+struct cmap_stats_connection {
+	char name[CMAP_STATS_NAME_LEN];
+	uint32_t client_pid;
+	uint32_t service_id;
+	uint64_t requests;
+	uint64_t responses;
+	uint64_t dispatched;
+	uint64_t send_retries;
+	uint64_t recv_retries;
+	uint32_t flow_control;
+	uint32_t queue_size;
+	uint32_t queue_size_max;
+	uint32_t fc_weight;
+	uint64_t flow_control_count;
+	uint64_t queue_bytes;
+	uint64_t queue_bytes_max;
+	uint64_t invalid_request;
+	uint64_t overload;
+	uint64_t fc_deferred;
+};
+
+struct cmap_stats {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t seq;
+	uint64_t update_time;
+	struct cmap_stats_totem totem;
+	struct cmap_stats_service services[CMAP_STATS_SERVICES_MAX];
+	struct cmap_stats_connection connections[CMAP_STATS_CONNECTIONS_MAX];
+};
+
 /**
  * Prototype for notify callback function. Even is one of CMAP_TRACK_* event, key_name is
  * changed key, new and old_value contains values or are zeroed (in other words, type is non
@@ -213,6 +346,22 @@ extern cs_error_t cmap_set_float(cmap_handle_t handle, const char *key_name, flo
 extern cs_error_t cmap_set_double(cmap_handle_t handle, const char *key_name, double value);
 extern cs_error_t cmap_set_string(cmap_handle_t handle, const char *key_name, const char *value);
 
+/**
+ * @brief Store values of multiple keys with minimal number of IPC round trips
+ *
+ * key_name, type, value and value_len of every item must be filled. Keys are
+ * stored in order of items.
+ *
+ * @param handle cmap handle
+ * @param items array of keys and values
+ * @param items_count number of items
+ * @return CS_OK if all keys were processed. Result for every key is in error of item.
+ */
+extern cs_error_t cmap_set_multi(
+	cmap_handle_t handle,
+	struct cmap_key_value *items,
+	size_t items_count);
+
 /**
  * Deletes key from cmap database
  * @param handle cmap handle
@@ -257,6 +406,28 @@ extern cs_error_t cmap_get_uint64(cmap_handle_t handle, const char *key_name, ui
 extern cs_error_t cmap_get_float(cmap_handle_t handle, const char *key_name, float *flt);
 extern cs_error_t cmap_get_double(cmap_handle_t handle, const char *key_name, double *dbl);
 
+/**
+ * @brief Retrieve values of multiple keys with minimal number of IPC round trips
+ *
+ * key_name of every item must be filled. Other fields are filled on return, with
+ * values stored in buf. If value doesn't fit into buf (or is too big to be
+ * transferred in batch), error of item is CS_ERR_NO_SPACE, type and value_len are
+ * filled and value is NULL, so cmap_get can be used for it.
+ *
+ * @param handle cmap handle
+ * @param items array of keys
+ * @param items_count number of items
+ * @param buf buffer for values
+ * @param buf_len length of buf
+ * @return CS_OK if all keys were processed. Result for every key is in error of item.
+ */
+extern cs_error_t cmap_get_multi(
+	cmap_handle_t handle,
+	struct cmap_key_value *items,
+	size_t items_count,
+	void *buf,
+	size_t buf_len);
+
 /**
  * @brief Shortcut for cmap_get for string type.
  *
@@ -313,6 +484,29 @@ extern cs_error_t cmap_iter_next(
 		size_t *value_len,
 		cmap_value_types_t *type);
 
+/**
+ * @brief Return next page of items in iterator iter, including values.
+ *
+ * Up to *items_count items are returned, with values stored in buf. Page ends
+ * earlier when buf is full. Item which value can't fit even into empty buf
+ * has error set to CS_ERR_NO_SPACE and value set to NULL.
+ *
+ * @param handle cmap handle
+ * @param iter_handle handle of iteration returned by cmap_iter_init
+ * @param items array for returned items
+ * @param items_count number of items in array on input, number of returned items on output
+ * @param buf buffer for values
+ * @param buf_len length of buf
+ * @return CS_ERR_NO_SECTIONS if there are no more items to iterate
+ */
+extern cs_error_t cmap_iter_next_page(
+	cmap_handle_t handle,
+	cmap_iter_handle_t iter_handle,
+	struct cmap_key_value *items,
+	size_t *items_count,
+	void *buf,
+	size_t buf_len);
+
 /**
  * @brief Finalize iterator
  * @param handle
@@ -350,6 +544,64 @@ extern cs_error_t cmap_track_add(
  */
 extern cs_error_t cmap_track_delete(cmap_handle_t handle, cmap_track_handle_t track_handle);
 
+/**
+ * @brief Enable client side cache of keys starting with prefix
+ *
+ * cmap_get (and all cmap_get_* functions) of keys with given prefix are then
+ * served locally. Cache is invalidated by tracking changes of prefix on separate
+ * connection, so value may lag behind executive only by notification delivery.
+ * Changes made by handle itself are visible immediately. Values bigger than
+ * 1024 bytes are not cached. Handle may be used by multiple threads. When
+ * tracking connection is lost, cache is emptied and reconnected by next
+ * cmap_get. Until reconnect succeeds, values are read from executive and
+ * every lookup is counted as a miss by cmap_cache_stats_get.
+ *
+ * @param handle cmap handle
+ * @param prefix prefix of cached keys. NULL or empty string caches all keys.
+ */
+extern cs_error_t cmap_cache_enable(cmap_handle_t handle, const char *prefix);
+
+/**
+ * Disable client side cache previously enabled by cmap_cache_enable
+ * @param handle cmap handle
+ */
+extern cs_error_t cmap_cache_disable(cmap_handle_t handle);
+
+/**
+ * Get number of cmap_get calls served by (hits) and missed (misses) client side cache
+ * @param handle cmap handle
+ * @param hits number of lookups served from cache
+ * @param misses number of lookups which had to contact executive
+ */
+extern cs_error_t cmap_cache_stats_get(cmap_handle_t handle, uint64_t *hits, uint64_t *misses);
+
+/**
+ * @brief Map statistics segment of running executive read-only
+ *
+ * Doesn't need cmap connection. Returns CS_ERR_VERSION if executive uses
+ * different layout of segment.
+ *
+ * @param handle handle of mapped segment
+ */
+extern cs_error_t cmap_stats_open(cmap_stats_handle_t *handle);
+
+/**
+ * @brief Copy consistent snapshot of statistics segment
+ *
+ * Returns CS_ERR_BAD_HANDLE if executive exited (segment must be reopened)
+ * and CS_ERR_TRY_AGAIN if consistent snapshot can't be taken.
+ *
+ * @param handle handle of mapped segment
+ * @param stats where to store snapshot
+ */
+extern cs_error_t cmap_stats_read(cmap_stats_handle_t handle, struct cmap_stats *stats);
+
+/**
+ * Unmap statistics segment mapped by cmap_stats_open
+ * @param handle handle of mapped segment
+ */
+extern cs_error_t cmap_stats_close(cmap_stats_handle_t handle);
+
 /** @} */
 
 #ifdef __cplusplus
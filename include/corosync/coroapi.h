@@ -37,6 +37,7 @@
 #include <config.h>
 
 #include <stdio.h>
+#include <sys/types.h>
 #ifdef HAVE_SYS_UIO_H
 #include <sys/uio.h>
 #endif
@@ -164,6 +165,30 @@ enum cs_lib_allow_inquorate {
 	CS_LIB_ALLOW_INQUORATE = 1
 };
 
+/**
+ * @brief The cs_sync_mode enum
+ *
+ * Services declaring CS_SYNC_PARALLEL have no ordering dependency on the
+ * services synchronized next to them. Adjacent parallel services are
+ * synchronized concurrently and committed by a single barrier.
+ */
+enum cs_sync_mode {
+	CS_SYNC_SERIAL = 0, /* default */
+	CS_SYNC_PARALLEL = 1
+};
+
+/**
+ * @brief The cs_schedwrk_priority enum
+ *
+ * Work items of higher priority run first on each token. Lower priorities
+ * run when time budget allows, but are never starved.
+ */
+enum cs_schedwrk_priority {
+	CS_SCHEDWRK_PRIO_HIGH = 0,
+	CS_SCHEDWRK_PRIO_NORMAL = 1, /* default */
+	CS_SCHEDWRK_PRIO_LOW = 2
+};
+
 #if !defined (COROSYNC_FLOW_CONTROL_STATE)
 /**
  * @brief The cs_flow_control_state enum
@@ -265,10 +290,20 @@ struct corosync_api_v1 {
 	int (*ipc_dispatch_iov_send) (void *conn,
 				      const struct iovec *iov, unsigned int iov_len);
 
+	int (*ipc_dispatch_send_when_ready) (void *conn, const void *msg, size_t mlen);
+
+	int (*ipc_response_send_when_ready) (void *conn, const void *msg, size_t mlen);
+
 	void (*ipc_refcnt_inc) (void *conn);
 
 	void (*ipc_refcnt_dec) (void *conn);
 
+	/*
+	 * Effective uid and gid of connected client, as checked when
+	 * connection was accepted
+	 */
+	int (*ipc_credentials_get) (void *conn, uid_t *euid, gid_t *egid);
+
 	/*
 	 * Totem APIs
 	 */
@@ -454,6 +489,18 @@ struct corosync_api_v1 {
 		qb_loop_t * handle,
 		int fd);
 
+	int (*schedwrk_create_prio) (
+		hdb_handle_t *handle,
+		int (schedwrk_fn) (const void *),
+		const void *context,
+		const char *name,
+		enum cs_schedwrk_priority priority);
+
+	/*
+	 * Long running work items should return -1 when this is true
+	 * to continue on next token
+	 */
+	int (*schedwrk_budget_exhausted) (void);
 };
 
 #define SERVICE_ID_MAKE(a,b) ( ((a)<<16) | (b) )
@@ -522,6 +569,7 @@ struct corosync_service_engine {
 	int (*sync_process) (void);
 	void (*sync_activate) (void);
 	void (*sync_abort) (void);
+	enum cs_sync_mode sync_mode;
 };
 
 #endif /* COROAPI_H_DEFINED */
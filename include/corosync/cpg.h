@@ -76,6 +76,15 @@ typedef enum {
 } cpg_flow_control_state_t;
 
 
+/**
+ * @brief The cpg_partial_type_t enum
+ */
+typedef enum {
+	CPG_PARTIAL_FIRST = 1,     /**< first fragment of a large message */
+	CPG_PARTIAL_CONTINUED = 2, /**< fragment in the middle of a large message */
+	CPG_PARTIAL_LAST = 3       /**< final fragment of a large message */
+} cpg_partial_type_t;
+
 /**
  * @brief The cpg_reason_t enum
  */
@@ -155,6 +164,58 @@ typedef void (*cpg_deliver_fn_t) (
 	void *msg,
 	size_t msg_len);
 
+/**
+ * @brief The cpg_partial_deliver_fn_t callback
+ *
+ * Called for every fragment of a message larger than the maximum atomic
+ * message size, in the order the fragments were agreed. Offset is position
+ * of fragment inside of the whole message of msg_len bytes. Fragment is
+ * valid only for the duration of the callback.
+ */
+typedef void (*cpg_partial_deliver_fn_t) (
+	cpg_handle_t handle,
+	const struct cpg_name *group_name,
+	uint32_t nodeid,
+	uint32_t pid,
+	cpg_partial_type_t type,
+	size_t msg_len,
+	size_t offset,
+	void *fragment,
+	size_t fragment_len);
+
+/**
+ * @brief One message passed to cpg_deliver_batch_fn_t
+ */
+struct cpg_deliver_msg {
+	struct cpg_name group_name;
+	uint32_t nodeid;
+	uint32_t pid;
+	void *msg;
+	size_t msg_len;
+};
+
+/**
+ * @brief The cpg_deliver_batch_fn_t callback
+ *
+ * Called with messages received in one dispatch run, in the order they were
+ * agreed. Messages are not copied out of the receive buffer and are valid
+ * only for the duration of the callback.
+ */
+typedef void (*cpg_deliver_batch_fn_t) (
+	cpg_handle_t handle,
+	struct cpg_deliver_msg *msgs,
+	size_t msg_count);
+
+/**
+ * @brief The cpg_send_ready_fn_t callback
+ *
+ * Called by cpg_dispatch after flow control of the executive was turned
+ * off and messages queued by cpg_mcast_joined_async were passed on, so
+ * there is room for more messages.
+ */
+typedef void (*cpg_send_ready_fn_t) (
+	cpg_handle_t handle);
+
 /**
  * @brief The cpg_confchg_fn_t callback
  */
@@ -190,6 +251,23 @@ typedef struct {
 } cpg_model_data_t;
 
 #define CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF 0x01
+/*
+ * Messages are delivered from a shared memory arena mapped read-only by all
+ * local members of the group instead of being copied to every connection.
+ * The msg passed to cpg_deliver_fn is then read-only and valid only until the
+ * callback returns, unless it is kept by cpg_zcb_deliver_hold. Small messages
+ * and messages arriving when the arena is full are still delivered by copy.
+ */
+#define CPG_MODEL_V1_DELIVER_SHARED 0x02
+/*
+ * Messages sent with CPG_TYPE_FIFO are delivered to members on the local node
+ * right away instead of after the round trip through totem. Other nodes get
+ * them as usual. Only order of messages from one sender is kept, so members
+ * may see such message before messages of other senders sent earlier.
+ * Used only when all local members of the group set this flag and all nodes
+ * in the cluster support it.
+ */
+#define CPG_MODEL_V1_DELIVER_LOCAL_FIFO 0x04
 
 /**
  * @brief The cpg_model_v1_data_t struct
@@ -280,6 +358,44 @@ cs_error_t cpg_context_set (
 	cpg_handle_t handle,
 	void *context);
 
+/**
+ * @brief Set callback for streaming delivery of large messages
+ *
+ * When set, messages larger than the maximum atomic message size are not
+ * reassembled by the library. Instead every fragment is passed to
+ * partial_deliver_fn as soon as it is dispatched, so memory needed to receive
+ * a message doesn't depend on its size. Passing NULL restores default
+ * behavior (full message is delivered by cpg_deliver_fn).
+ *
+ * @param handle
+ * @param partial_deliver_fn
+ * @return
+ */
+cs_error_t cpg_partial_deliver_callback_set (
+	cpg_handle_t handle,
+	cpg_partial_deliver_fn_t partial_deliver_fn);
+
+/**
+ * @brief Set callback for batched delivery of messages
+ *
+ * When set, cpg_dispatch with CS_DISPATCH_ALL or CS_DISPATCH_BLOCKING
+ * receives all messages which are waiting (up to a library limit) and
+ * passes them to deliver_batch_fn in one call instead of calling
+ * cpg_deliver_fn for each of them. Batch is ended by any other callback,
+ * so ordering with configuration changes is kept. Large (fragmented)
+ * messages are still passed to cpg_deliver_fn. Passing NULL restores
+ * default behavior. CS_ERR_NOT_SUPPORTED is returned when handle was
+ * initialized with CPG_MODEL_V1_DELIVER_SHARED, because shared deliveries
+ * can be kept by cpg_zcb_deliver_hold only from cpg_deliver_fn.
+ *
+ * @param handle
+ * @param deliver_batch_fn
+ * @return
+ */
+cs_error_t cpg_deliver_batch_callback_set (
+	cpg_handle_t handle,
+	cpg_deliver_batch_fn_t deliver_batch_fn);
+
 /**
  * @brief  Dispatch messages and configuration changes
  * @param handle
@@ -318,6 +434,10 @@ cs_error_t cpg_leave (
 /**
  * @brief Multicast to groups joined with cpg_join.
  *
+ * Messages still waiting in the send queue of cpg_mcast_joined_async are
+ * passed on first. If they can't be, CS_ERR_TRY_AGAIN is returned, so
+ * messages are never reordered.
+ *
  * @param handle
  * @param guarantee
  * @param iovec This iovec will be multicasted to all groups joined with
@@ -330,6 +450,52 @@ cs_error_t cpg_mcast_joined (
 	const struct iovec *iovec,
 	unsigned int iov_len);
 
+/**
+ * @brief Multicast to groups joined with cpg_join without waiting for
+ * flow control.
+ *
+ * When the executive doesn't accept messages right now, message is copied
+ * to the library send queue and CS_OK is returned. Queue is flushed by
+ * cpg_dispatch as soon as the executive signals (through cpg fd) that it
+ * accepts messages again. CS_ERR_TRY_AGAIN is returned only when the send
+ * queue is full. Message must not be larger than
+ * cpg_max_atomic_msgsize_get. Handle may be used by more threads at once.
+ * Messages still queued when cpg_finalize is called are dropped.
+ *
+ * @param handle
+ * @param guarantee
+ * @param iovec
+ * @param iov_len
+ * @return
+ */
+cs_error_t cpg_mcast_joined_async (
+	cpg_handle_t handle,
+	cpg_guarantee_t guarantee,
+	const struct iovec *iovec,
+	unsigned int iov_len);
+
+/**
+ * @brief Set callback called when send queue has room again
+ * @param handle
+ * @param send_ready_fn
+ * @return
+ */
+cs_error_t cpg_send_ready_callback_set (
+	cpg_handle_t handle,
+	cpg_send_ready_fn_t send_ready_fn);
+
+/**
+ * @brief Get number of messages and bytes waiting in the send queue
+ * @param handle
+ * @param msgs
+ * @param bytes
+ * @return
+ */
+cs_error_t cpg_send_queue_get (
+	cpg_handle_t handle,
+	uint32_t *msgs,
+	size_t *bytes);
+
 /**
  * @brief Get membership information from cpg
  * @param handle
@@ -385,6 +551,36 @@ cs_error_t cpg_zcb_free (
 	cpg_handle_t handle,
 	void *buffer);
 
+/**
+ * @brief Keep message delivered from shared arena after callback returns.
+ *
+ * May be called only from cpg_deliver_fn with the msg it was passed. With
+ * CPG_MODEL_V1_DELIVER_SHARED, msg then stays valid until
+ * cpg_zcb_deliver_release is called or the group is left. CS_ERR_NOT_EXIST
+ * is returned for messages delivered by copy, which must be copied by the
+ * application to be kept. Held messages block reuse of the arena, so they
+ * should be released promptly, otherwise following messages are delivered
+ * by copy.
+ * @param handle
+ * @param msg
+ * @return
+ */
+cs_error_t cpg_zcb_deliver_hold (
+	cpg_handle_t handle,
+	const void *msg);
+
+/**
+ * @brief Release message kept by cpg_zcb_deliver_hold
+ *
+ * May be called from any thread, also while cpg_dispatch runs in another one.
+ * @param handle
+ * @param msg
+ * @return
+ */
+cs_error_t cpg_zcb_deliver_release (
+	cpg_handle_t handle,
+	const void *msg);
+
 /**
  * @brief cpg_zcb_mcast_joined
  * @param handle
@@ -107,6 +107,47 @@ typedef void (*icmap_notify_fn_t) (
 	struct icmap_notify_value old_value,
 	void *user_data);
 
+/**
+ * One (coalesced) change passed to batch notify callback. Event is one of ICMAP_TRACK_*
+ * values, old_value is value of key before first change in batch and new_value is value
+ * after last change.
+ */
+struct icmap_notify_batch_entry {
+	int32_t event;
+	const char *key_name;
+	struct icmap_notify_value new_value;
+	struct icmap_notify_value old_value;
+};
+
+/**
+ * Prototype for batch notify callback function. Entries are sorted by key_name and every key
+ * is contained at most once. Entries (including key names and values) are valid only
+ * inside of callback.
+ */
+typedef void (*icmap_notify_batch_fn_t) (
+	const struct icmap_notify_batch_entry *entries,
+	size_t no_entries,
+	void *user_data);
+
+/**
+ * Prototype for function called when first batched change is queued. It should arrange
+ * call of icmap_track_batch_flush (usually in next main loop iteration).
+ */
+typedef void (*icmap_track_batch_sched_fn_t) (void);
+
+/**
+ * Memory used by items of all icmap maps (returned by icmap_mem_stats_get).
+ * Sizes are in bytes.
+ */
+struct icmap_mem_stats {
+	size_t arena_size;	/* Allocated arena chunks */
+	size_t arena_used;	/* Arena blocks used by items and key names */
+	size_t large_size;	/* Items too big for arena, allocated by malloc */
+	size_t items;		/* Number of items */
+	size_t keys;		/* Number of interned key names */
+	size_t keys_size;	/* Memory used by interned key names */
+};
+
 /**
  * @brief icmap type.
  *
@@ -127,6 +168,11 @@ typedef qb_map_iter_t *icmap_iter_t;
  */
 typedef struct icmap_track *icmap_track_t;
 
+/**
+ * @brief Counter type
+ */
+typedef struct icmap_counter *icmap_counter_t;
+
 /**
  * @brief Initialize global icmap
  * @return
@@ -439,6 +485,46 @@ extern cs_error_t icmap_fast_dec(const char *key_name);
  */
 extern cs_error_t icmap_fast_dec_r(const icmap_map_t map, const char *key_name);
 
+/**
+ * @brief Get counter handle of existing [u]int* key
+ *
+ * Counter handle allows to adjust value without looking up key. Handle stays
+ * valid when key is set again. When key is deleted, icmap_counter_add returns
+ * CS_ERR_NOT_EXIST. Multiple references of same key share one handle.
+ *
+ * @param key_name
+ * @param counter
+ * @return
+ */
+extern cs_error_t icmap_counter_ref(const char *key_name, icmap_counter_t *counter);
+
+/**
+ * @brief icmap_counter_ref_r
+ * @param map
+ * @param key_name
+ * @param counter
+ * @return
+ */
+extern cs_error_t icmap_counter_ref_r(const icmap_map_t map, const char *key_name, icmap_counter_t *counter);
+
+/**
+ * @brief Release counter handle obtained by icmap_counter_ref
+ * @param counter
+ */
+extern void icmap_counter_unref(icmap_counter_t counter);
+
+/**
+ * @brief Add step to value of counter
+ *
+ * Value is changed in place, so icmap_get and iterators return current value,
+ * but tracking callbacks are not called.
+ *
+ * @param counter
+ * @param step
+ * @return
+ */
+extern cs_error_t icmap_counter_add(icmap_counter_t counter, int32_t step);
+
 /**
  * @brief Initialize iterator with given prefix
  * @param prefix
@@ -508,6 +594,60 @@ extern void *icmap_track_get_user_data(icmap_track_t icmap_track);
  */
 extern cs_error_t icmap_track_delete(icmap_track_t icmap_track);
 
+/**
+ * @brief Get memory usage of icmap items
+ * @param stats
+ */
+extern void icmap_mem_stats_get(struct icmap_mem_stats *stats);
+
+/**
+ * @brief Add batched tracking function for given key_name.
+ *
+ * Works like icmap_track_add, but changes are not delivered synchronously. Instead they are
+ * accumulated (multiple changes of one key are coalesced into one entry) and
+ * delivered by icmap_track_batch_flush as one call of notify_fn.
+ * Track is removed by icmap_track_delete, pending changes are dropped.
+ *
+ * @param key_name
+ * @param track_type
+ * @param notify_fn
+ * @param user_data
+ * @param icmap_track
+ * @return
+ */
+extern cs_error_t icmap_track_add_batch(
+	const char *key_name,
+	int32_t track_type,
+	icmap_notify_batch_fn_t notify_fn,
+	void *user_data,
+	icmap_track_t *icmap_track);
+
+/**
+ * @brief Deliver all pending batched changes.
+ *
+ * Changes made by batch callbacks are not delivered in same call, but scheduled again.
+ */
+extern void icmap_track_batch_flush(void);
+
+/**
+ * @brief Drop changes of batched track which were not delivered yet
+ *
+ * Useful when owner of track already applied current state by other means.
+ *
+ * @param icmap_track
+ */
+extern void icmap_track_batch_discard(icmap_track_t icmap_track);
+
+/**
+ * @brief Set function used to schedule icmap_track_batch_flush
+ *
+ * Without scheduling function, pending changes are delivered only by explicit call of
+ * icmap_track_batch_flush.
+ *
+ * @param sched_fn
+ */
+extern void icmap_track_batch_sched_set(icmap_track_batch_sched_fn_t sched_fn);
+
 /**
  * @brief Set read-only access for given key (key_name) or prefix,
  * If prefix is set. ro_access can be !0, which means, that old information
@@ -52,6 +52,9 @@ enum req_cmap_types {
 	MESSAGE_REQ_CMAP_ITER_FINALIZE = 6,
 	MESSAGE_REQ_CMAP_TRACK_ADD = 7,
 	MESSAGE_REQ_CMAP_TRACK_DELETE = 8,
+	MESSAGE_REQ_CMAP_GET_MULTI = 9,
+	MESSAGE_REQ_CMAP_SET_MULTI = 10,
+	MESSAGE_REQ_CMAP_ITER_NEXT_PAGE = 11,
 };
 
 /**
@@ -68,8 +71,40 @@ enum res_cmap_types {
 	MESSAGE_RES_CMAP_TRACK_ADD = 7,
 	MESSAGE_RES_CMAP_TRACK_DELETE = 8,
 	MESSAGE_RES_CMAP_NOTIFY_CALLBACK = 9,
+	MESSAGE_RES_CMAP_GET_MULTI = 10,
+	MESSAGE_RES_CMAP_SET_MULTI = 11,
+	MESSAGE_RES_CMAP_ITER_NEXT_PAGE = 12,
+	MESSAGE_RES_CMAP_NOTIFY_BATCH_CALLBACK = 13,
 };
 
+/*
+ * Maximal size of multi-key request and response. It fits into IPC buffers
+ * of all platforms.
+ */
+#define CMAP_MULTI_MSG_MAX_SIZE		(60 * 1024)
+
+/*
+ * Name of POSIX shared memory with struct cmap_stats. Segment is valid
+ * only when magic matches, version and size are checked by reader. seq is
+ * odd while executive updates segment.
+ */
+#define CMAP_STATS_SHM_NAME		"/corosync-stats"
+#define CMAP_STATS_MAGIC		0x434d5354
+
+/*
+ * Size of cmap_multi_item carrying value of given length. Items follow each
+ * other, so the size is aligned to 8 bytes.
+ */
+#define CMAP_MULTI_ITEM_SIZE(value_len) \
+	(sizeof(struct cmap_multi_item) + (((value_len) + 7) & ~((size_t)7)))
+
+/*
+ * Size of cmap_notify_batch_item carrying new and old value of given lengths.
+ */
+#define CMAP_NOTIFY_BATCH_ITEM_SIZE(new_value_len, old_value_len) \
+	(sizeof(struct cmap_notify_batch_item) + \
+	(((new_value_len) + (old_value_len) + 7) & ~((size_t)7)))
+
 /**
  * @brief The req_lib_cmap_set struct
  */
@@ -221,6 +256,88 @@ struct res_lib_cmap_track_delete {
 	mar_uint64_t track_inst_handle __attribute__((aligned(8)));
 };
 
+/**
+ * @brief The cmap_multi_item struct
+ *
+ * One key of multi-key request or response. Value is present only if
+ * error is CS_OK.
+ */
+struct cmap_multi_item {
+	mar_name_t key_name __attribute__((aligned(8)));
+	mar_uint32_t error __attribute__((aligned(8)));
+	mar_uint8_t type __attribute__((aligned(8)));
+	mar_size_t value_len __attribute__((aligned(8)));
+	mar_uint8_t value[] __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The req_lib_cmap_get_multi struct
+ */
+struct req_lib_cmap_get_multi {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+	mar_uint32_t no_items __attribute__((aligned(8)));
+	mar_name_t key_names[] __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The res_lib_cmap_get_multi struct
+ *
+ * Keys are answered in order of request. When response would not fit into
+ * CMAP_MULTI_MSG_MAX_SIZE, only first no_items keys are answered.
+ */
+struct res_lib_cmap_get_multi {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_uint32_t no_items __attribute__((aligned(8)));
+	/*
+	 * Followed by no_items of cmap_multi_item
+	 */
+};
+
+/**
+ * @brief The req_lib_cmap_set_multi struct
+ */
+struct req_lib_cmap_set_multi {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+	mar_uint32_t no_items __attribute__((aligned(8)));
+	/*
+	 * Followed by no_items of cmap_multi_item
+	 */
+};
+
+/**
+ * @brief The res_lib_cmap_set_multi struct
+ */
+struct res_lib_cmap_set_multi {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_uint32_t no_items __attribute__((aligned(8)));
+	mar_uint32_t errors[] __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The req_lib_cmap_iter_next_page struct
+ *
+ * values_size is space for values the library has. Item which value
+ * doesn't fit is kept for next page, unless it would be alone in the page.
+ * Then it's returned without value with CS_ERR_NO_SPACE error.
+ */
+struct req_lib_cmap_iter_next_page {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+	mar_uint64_t iter_handle __attribute__((aligned(8)));
+	mar_uint32_t max_items __attribute__((aligned(8)));
+	mar_size_t values_size __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The res_lib_cmap_iter_next_page struct
+ */
+struct res_lib_cmap_iter_next_page {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_uint32_t no_items __attribute__((aligned(8)));
+	/*
+	 * Followed by no_items of cmap_multi_item
+	 */
+};
+
 /**
  * @brief The res_lib_cmap_notify_callback struct
  */
@@ -243,4 +360,35 @@ struct res_lib_cmap_notify_callback {
 	mar_uint8_t new_value[];
 };
 
+/**
+ * @brief The cmap_notify_batch_item struct
+ *
+ * Item of res_lib_cmap_notify_batch_callback. Like in
+ * res_lib_cmap_notify_callback, new value is followed by old value.
+ */
+struct cmap_notify_batch_item {
+	mar_name_t key_name __attribute__((aligned(8)));
+	mar_int32_t event __attribute__((aligned(8)));
+	mar_uint8_t new_value_type __attribute__((aligned(8)));
+	mar_uint8_t old_value_type __attribute__((aligned(8)));
+	mar_size_t new_value_len __attribute__((aligned(8)));
+	mar_size_t old_value_len __attribute__((aligned(8)));
+	mar_uint8_t new_value[] __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The res_lib_cmap_notify_batch_callback struct
+ *
+ * Sent for tracks added with CMAP_TRACK_BATCH. Batch not fitting into
+ * CMAP_MULTI_MSG_MAX_SIZE is split into more messages.
+ */
+struct res_lib_cmap_notify_batch_callback {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_uint64_t track_inst_handle __attribute__((aligned(8)));
+	mar_uint32_t no_items __attribute__((aligned(8)));
+	/*
+	 * Followed by no_items of cmap_notify_batch_item
+	 */
+};
+
 #endif /* IPC_CMAP_H_DEFINED */
@@ -59,6 +59,11 @@ enum req_cpg_types {
 	MESSAGE_REQ_CPG_ZC_FREE = 10,
 	MESSAGE_REQ_CPG_ZC_EXECUTE = 11,
 	MESSAGE_REQ_CPG_PARTIAL_MCAST = 12,
+	MESSAGE_REQ_CPG_SHM_ATTACH = 13,
+	MESSAGE_REQ_CPG_SHM_RELEASE = 14,
+	MESSAGE_REQ_CPG_PARTIAL_MCAST_PIPELINED = 15,
+	MESSAGE_REQ_CPG_SEND_READY = 16,
+	MESSAGE_REQ_CPG_PARTIAL_SEND_WAIT = 17,
 };
 
 /**
@@ -84,6 +89,10 @@ enum res_cpg_types {
 	MESSAGE_RES_CPG_ZC_EXECUTE = 16,
 	MESSAGE_RES_CPG_PARTIAL_DELIVER_CALLBACK = 17,
 	MESSAGE_RES_CPG_PARTIAL_SEND = 18,
+	MESSAGE_RES_CPG_SHM_ATTACH = 19,
+	MESSAGE_RES_CPG_SHM_DELIVER_CALLBACK = 20,
+	MESSAGE_RES_CPG_PARTIAL_SEND_CREDIT = 21,
+	MESSAGE_RES_CPG_SEND_READY_CALLBACK = 22,
 };
 
 /**
@@ -320,6 +329,61 @@ struct req_lib_cpg_partial_mcast {
 	mar_uint8_t message[] __attribute__((aligned(8)));
 };
 
+/**
+ * @brief The req_lib_cpg_partial_mcast_pipelined struct
+ *
+ * Fragment sent without waiting for the response of the previous one.
+ * Fragments of one message share msgid and carry consecutive seq numbers
+ * starting with 0, so the executive can drop fragments following the one
+ * it had to refuse.
+ */
+struct req_lib_cpg_partial_mcast_pipelined {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_uint32_t guarantee __attribute__((aligned(8)));
+	mar_uint32_t msglen __attribute__((aligned(8)));
+	mar_uint32_t fraglen __attribute__((aligned(8)));
+	mar_uint32_t type __attribute__((aligned(8)));
+	mar_uint32_t msgid __attribute__((aligned(8)));
+	mar_uint32_t seq __attribute__((aligned(8)));
+	mar_uint8_t message[] __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The res_lib_cpg_partial_send_credit struct
+ */
+struct res_lib_cpg_partial_send_credit {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_uint32_t seq __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The req_lib_cpg_partial_send_wait struct
+ *
+ * Sent by library with no fragment in flight when fragments are refused.
+ * MESSAGE_RES_CPG_PARTIAL_SEND_CREDIT is sent as soon as messages are
+ * accepted again.
+ */
+struct req_lib_cpg_partial_send_wait {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The req_lib_cpg_send_ready struct
+ *
+ * Request for MESSAGE_RES_CPG_SEND_READY_CALLBACK to be sent as soon as
+ * messages are accepted again. There is no response.
+ */
+struct req_lib_cpg_send_ready {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The res_lib_cpg_send_ready_callback struct
+ */
+struct res_lib_cpg_send_ready_callback {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+};
+
 /**
  * @brief The res_lib_cpg_mcast struct
  */
@@ -353,6 +417,23 @@ struct res_lib_cpg_partial_deliver_callback {
 	mar_uint8_t message[] __attribute__((aligned(8)));
 };
 
+/**
+ * @brief The res_lib_cpg_shm_deliver_callback struct
+ *
+ * Message body is not part of the callback, it is stored at offset
+ * of shared delivery arena identified by arena_id.
+ */
+struct res_lib_cpg_shm_deliver_callback {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_cpg_name_t group_name __attribute__((aligned(8)));
+	mar_uint32_t msglen __attribute__((aligned(8)));
+	mar_uint32_t nodeid __attribute__((aligned(8)));
+	mar_uint32_t pid __attribute__((aligned(8)));
+	mar_uint64_t arena_id __attribute__((aligned(8)));
+	mar_uint64_t offset __attribute__((aligned(8)));
+	mar_uint64_t seq __attribute__((aligned(8)));
+};
+
 /**
  * @brief The res_lib_cpg_flowcontrol_callback struct
  */
@@ -466,6 +547,38 @@ struct res_lib_cpg_iterationfinalize {
 	struct qb_ipc_response_header header __attribute__((aligned(8)));
 };
 
+/**
+ * @brief The req_lib_cpg_shm_attach struct
+ *
+ * Arena is always created for uid of the connection, as checked by the
+ * executive.
+ */
+struct req_lib_cpg_shm_attach {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The res_lib_cpg_shm_attach struct
+ */
+struct res_lib_cpg_shm_attach {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_uint64_t arena_id __attribute__((aligned(8)));
+	mar_uint64_t map_size __attribute__((aligned(8)));
+	char path[CPG_ZC_PATH_LEN] __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The req_lib_cpg_shm_release struct
+ *
+ * Releases all shared deliveries of arena up to and including seq.
+ * Seq 0 only tells that library has mapped the arena.
+ */
+struct req_lib_cpg_shm_release {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+	mar_uint64_t arena_id __attribute__((aligned(8)));
+	mar_uint64_t seq __attribute__((aligned(8)));
+};
+
 /**
  * @brief mar_req_coroipcc_zc_alloc_t struct
  */
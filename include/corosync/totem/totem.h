@@ -268,6 +268,15 @@ typedef struct {
 	uint32_t continuous_gather;
 	uint32_t continuous_sendmsg_failures;
 
+	/*
+	 * Monotonic timestamps (ns) of the last membership change. Gather is
+	 * first entry to gather state after operational, others are the last entry.
+	 */
+	uint64_t memb_change_gather;
+	uint64_t memb_change_commit;
+	uint64_t memb_change_recovery;
+	uint64_t memb_change_operational;
+
 	int earliest_token;
 	int latest_token;
 #define TOTEM_TOKEN_STATS_MAX 100
@@ -179,6 +179,11 @@ enum totem_q_level {
 
 void totempg_check_q_level(void *instance);
 
+/*
+ * Number of messages which can still be queued
+ */
+extern int totempg_queue_avail_get (void);
+
 typedef void (*totem_queue_level_changed_fn) (enum totem_q_level level);
 extern void totempg_queue_level_register_callback (totem_queue_level_changed_fn);
 
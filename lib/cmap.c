@@ -38,9 +38,14 @@
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <errno.h>
+#include <poll.h>
 
 #include <corosync/corotypes.h>
 #include <corosync/corodefs.h>
@@ -54,10 +59,65 @@
 #include "util.h"
 #include <stdio.h>
 
+/*
+ * Number of hash buckets and maximum number of entries of client side cache.
+ * When cache is full, it's flushed.
+ */
+#define CMAP_CACHE_HASH_SIZE		256
+#define CMAP_CACHE_MAX_ENTRIES		4096
+
+/*
+ * Maximum size of value stored in client side cache. Bigger values are read
+ * by regular get.
+ */
+#define CMAP_CACHE_VALUE_MAX_SIZE	1024
+
+struct cmap_cache_entry {
+	struct list_head list;
+	cs_error_t error;
+	cmap_value_types_t type;
+	size_t value_len;
+	char key_name[CMAP_KEYNAME_MAXLEN + 1];
+	char value[];
+};
+
+struct cmap_cache {
+	cmap_handle_t handle;
+	cmap_track_handle_t track_handle;
+	int fd;
+	int connected;
+	char prefix[CMAP_KEYNAME_MAXLEN + 1];
+	size_t prefix_len;
+	uint32_t no_entries;
+	uint64_t hits;
+	uint64_t misses;
+	struct list_head hash[CMAP_CACHE_HASH_SIZE];
+};
+
 struct cmap_inst {
 	int finalize;
 	qb_ipcc_connection_t *c;
 	const void *context;
+	/*
+	 * Protects cache pointer and content of cache
+	 */
+	pthread_mutex_t cache_mutex;
+	struct cmap_cache *cache;
+	/*
+	 * Incremented by every invalidation, so value read without cache_mutex
+	 * held is stored only when it can't be stale
+	 */
+	uint64_t cache_generation;
+};
+
+/*
+ * Number of attempts to read consistent statistics snapshot
+ */
+#define CMAP_STATS_READ_RETRIES		1000
+
+struct cmap_stats_inst {
+	const struct cmap_stats *stats;
+	size_t size;
 };
 
 struct cmap_track_inst {
@@ -69,8 +129,11 @@ struct cmap_track_inst {
 
 static void cmap_inst_free (void *inst);
 
+static void cmap_stats_inst_free (void *inst);
+
 DECLARE_HDB_DATABASE(cmap_handle_t_db, cmap_inst_free);
 DECLARE_HDB_DATABASE(cmap_track_handle_t_db,NULL);
+DECLARE_HDB_DATABASE(cmap_stats_handle_t_db, cmap_stats_inst_free);
 
 /*
  * Function prototypes
@@ -84,6 +147,17 @@ static cs_error_t cmap_get_int(
 
 static cs_error_t cmap_adjust_int(cmap_handle_t handle, const char *key_name, int32_t step);
 
+static void cmap_cache_free(struct cmap_cache *cache);
+
+static void cmap_cache_invalidate(struct cmap_inst *cmap_inst, const char *key_name);
+
+static cs_error_t cmap_cache_get(
+	struct cmap_inst *cmap_inst,
+	const char *key_name,
+	void *value,
+	size_t *value_len,
+	cmap_value_types_t *type);
+
 /*
  * Function implementations
  */
@@ -104,6 +178,9 @@ cs_error_t cmap_initialize (cmap_handle_t *handle)
 
 	error = CS_OK;
 	cmap_inst->finalize = 0;
+	pthread_mutex_init(&cmap_inst->cache_mutex, NULL);
+	cmap_inst->cache = NULL;
+	cmap_inst->cache_generation = 0;
 	cmap_inst->c = qb_ipcc_connect("cmap", IPC_REQUEST_SIZE);
 	if (cmap_inst->c == NULL) {
 		error = qb_to_cs_error(-errno);
@@ -126,6 +203,7 @@ static void cmap_inst_free (void *inst)
 {
 	struct cmap_inst *cmap_inst = (struct cmap_inst *)inst;
 	qb_ipcc_disconnect(cmap_inst->c);
+	pthread_mutex_destroy(&cmap_inst->cache_mutex);
 }
 
 cs_error_t cmap_finalize(cmap_handle_t handle)
@@ -146,6 +224,13 @@ cs_error_t cmap_finalize(cmap_handle_t handle)
 	}
 	cmap_inst->finalize = 1;
 
+	pthread_mutex_lock(&cmap_inst->cache_mutex);
+	if (cmap_inst->cache != NULL) {
+		cmap_cache_free(cmap_inst->cache);
+		cmap_inst->cache = NULL;
+	}
+	pthread_mutex_unlock(&cmap_inst->cache_mutex);
+
 	/*
 	 * Destroy all track instances for given connection
 	 */
@@ -195,9 +280,13 @@ cs_error_t cmap_dispatch (
 	struct qb_ipc_response_header *dispatch_data;
 	char dispatch_buf[IPC_DISPATCH_SIZE];
 	struct res_lib_cmap_notify_callback *res_lib_cmap_notify_callback;
+	struct res_lib_cmap_notify_batch_callback *res_lib_cmap_notify_batch_callback;
+	struct cmap_notify_batch_item *batch_item;
 	struct cmap_track_inst *cmap_track_inst;
 	struct cmap_notify_value old_val;
 	struct cmap_notify_value new_val;
+	const char *pos;
+	uint32_t i;
 
 	error = hdb_error_to_cs(hdb_handle_get (&cmap_handle_t_db, handle, (void *)&cmap_inst));
 	if (error != CS_OK) {
@@ -280,6 +369,46 @@ cs_error_t cmap_dispatch (
 
 			(void)hdb_handle_put(&cmap_track_handle_t_db, res_lib_cmap_notify_callback->track_inst_handle);
 			break;
+		case MESSAGE_RES_CMAP_NOTIFY_BATCH_CALLBACK:
+			res_lib_cmap_notify_batch_callback = (struct res_lib_cmap_notify_batch_callback *)dispatch_data;
+
+			error = hdb_error_to_cs(hdb_handle_get(&cmap_track_handle_t_db,
+					res_lib_cmap_notify_batch_callback->track_inst_handle,
+					(void *)&cmap_track_inst));
+			if (error == CS_ERR_BAD_HANDLE) {
+				/*
+				 * User deleted tracker -> ignore error
+				 */
+				 break;
+			}
+			if (error != CS_OK) {
+				goto error_put;
+			}
+
+			pos = (const char *)dispatch_data + sizeof(*res_lib_cmap_notify_batch_callback);
+			for (i = 0; i < res_lib_cmap_notify_batch_callback->no_items && !cmap_inst->finalize; i++) {
+				batch_item = (struct cmap_notify_batch_item *)pos;
+
+				new_val.type = batch_item->new_value_type;
+				old_val.type = batch_item->old_value_type;
+				new_val.len = batch_item->new_value_len;
+				old_val.len = batch_item->old_value_len;
+				new_val.data = batch_item->new_value;
+				old_val.data = (((const char *)batch_item->new_value) + new_val.len);
+
+				cmap_track_inst->notify_fn(handle,
+						cmap_track_inst->track_handle,
+						batch_item->event,
+						(char *)batch_item->key_name.value,
+						new_val,
+						old_val,
+						cmap_track_inst->user_data);
+
+				pos += CMAP_NOTIFY_BATCH_ITEM_SIZE(new_val.len, old_val.len);
+			}
+
+			(void)hdb_handle_put(&cmap_track_handle_t_db, res_lib_cmap_notify_batch_callback->track_inst_handle);
+			break;
 		default:
 			error = CS_ERR_LIBRARY;
 			goto error_put;
@@ -397,6 +526,8 @@ cs_error_t cmap_set (
 		error = res_lib_cmap_set.header.error;
 	}
 
+	cmap_cache_invalidate(cmap_inst, key_name);
+
 	(void)hdb_handle_put (&cmap_handle_t_db, handle);
 
 	return (error);
@@ -462,6 +593,143 @@ cs_error_t cmap_set_string(cmap_handle_t handle, const char *key_name, const cha
 	return (cmap_set(handle, key_name, value, strlen(value), CMAP_VALUETYPE_STRING));
 }
 
+static cs_error_t cmap_multi_items_check(const struct cmap_key_value *items, size_t items_count)
+{
+	size_t i;
+
+	if (items == NULL && items_count > 0) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	for (i = 0; i < items_count; i++) {
+		if (strnlen(items[i].key_name, sizeof(items[i].key_name)) >= CS_MAX_NAME_LENGTH) {
+			return (CS_ERR_NAME_TOO_LONG);
+		}
+	}
+
+	return (CS_OK);
+}
+
+cs_error_t cmap_set_multi(
+	cmap_handle_t handle,
+	struct cmap_key_value *items,
+	size_t items_count)
+{
+	cs_error_t error;
+	struct iovec iov;
+	struct cmap_inst *cmap_inst;
+	struct req_lib_cmap_set_multi *req_lib_cmap_set_multi;
+	struct res_lib_cmap_set_multi *res_lib_cmap_set_multi;
+	struct cmap_multi_item *item;
+	size_t item_size;
+	size_t req_items;
+	size_t done;
+	size_t pos;
+	size_t i;
+	ssize_t res;
+
+	error = cmap_multi_items_check(items, items_count);
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	for (i = 0; i < items_count; i++) {
+		if (items[i].value == NULL && items[i].value_len > 0) {
+			return (CS_ERR_INVALID_PARAM);
+		}
+	}
+
+	error = hdb_error_to_cs(hdb_handle_get (&cmap_handle_t_db, handle, (void *)&cmap_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	req_lib_cmap_set_multi = malloc(CMAP_MULTI_MSG_MAX_SIZE);
+	res_lib_cmap_set_multi = malloc(CMAP_MULTI_MSG_MAX_SIZE);
+	if (req_lib_cmap_set_multi == NULL || res_lib_cmap_set_multi == NULL) {
+		error = CS_ERR_NO_MEMORY;
+		goto error_free;
+	}
+
+	done = 0;
+	while (done < items_count) {
+		pos = sizeof(*req_lib_cmap_set_multi);
+		req_items = 0;
+
+		while (done + req_items < items_count) {
+			item_size = CMAP_MULTI_ITEM_SIZE(items[done + req_items].value_len);
+			if (item_size > CMAP_MULTI_MSG_MAX_SIZE - pos) {
+				break;
+			}
+
+			item = (struct cmap_multi_item *)((char *)req_lib_cmap_set_multi + pos);
+			memset(item, 0, item_size);
+			item->key_name.length = strlen(items[done + req_items].key_name);
+			memcpy(item->key_name.value, items[done + req_items].key_name, item->key_name.length);
+			item->type = items[done + req_items].type;
+			item->value_len = items[done + req_items].value_len;
+			if (item->value_len > 0) {
+				memcpy(item->value, items[done + req_items].value, item->value_len);
+			}
+
+			pos += item_size;
+			req_items++;
+		}
+
+		if (req_items == 0) {
+			/*
+			 * Value is too big to be sent in batch
+			 */
+			items[done].error = cmap_set(handle, items[done].key_name, items[done].value,
+			    items[done].value_len, items[done].type);
+			done++;
+			continue;
+		}
+
+		req_lib_cmap_set_multi->header.size = pos;
+		req_lib_cmap_set_multi->header.id = MESSAGE_REQ_CMAP_SET_MULTI;
+		req_lib_cmap_set_multi->no_items = req_items;
+
+		iov.iov_base = (char *)req_lib_cmap_set_multi;
+		iov.iov_len = pos;
+
+		res = qb_ipcc_sendv_recv(
+			cmap_inst->c,
+			&iov,
+			1,
+			res_lib_cmap_set_multi,
+			CMAP_MULTI_MSG_MAX_SIZE, CS_IPC_TIMEOUT_MS);
+		if (res < 0) {
+			error = qb_to_cs_error(res);
+			break;
+		}
+
+		error = res_lib_cmap_set_multi->header.error;
+		if (error != CS_OK) {
+			break;
+		}
+
+		if (res_lib_cmap_set_multi->no_items != req_items) {
+			error = CS_ERR_LIBRARY;
+			break;
+		}
+
+		for (i = 0; i < req_items; i++) {
+			items[done + i].error = res_lib_cmap_set_multi->errors[i];
+			cmap_cache_invalidate(cmap_inst, items[done + i].key_name);
+		}
+		done += req_items;
+	}
+
+error_free:
+	free(req_lib_cmap_set_multi);
+	free(res_lib_cmap_set_multi);
+
+	(void)hdb_handle_put (&cmap_handle_t_db, handle);
+
+	return (error);
+}
+
 cs_error_t cmap_delete(cmap_handle_t handle, const char *key_name)
 {
 	cs_error_t error;
@@ -503,41 +771,29 @@ cs_error_t cmap_delete(cmap_handle_t handle, const char *key_name)
 		error = res_lib_cmap_delete.header.error;
 	}
 
+	cmap_cache_invalidate(cmap_inst, key_name);
+
 	(void)hdb_handle_put (&cmap_handle_t_db, handle);
 
 	return (error);
 }
 
-cs_error_t cmap_get(
-		cmap_handle_t handle,
+/*
+ * cmap_get without cache. Instance must be held by caller.
+ */
+static cs_error_t cmap_get_uncached(
+		struct cmap_inst *cmap_inst,
 		const char *key_name,
 		void *value,
 		size_t *value_len,
 		cmap_value_types_t *type)
 {
 	cs_error_t error;
-	struct cmap_inst *cmap_inst;
 	struct iovec iov;
 	struct req_lib_cmap_get req_lib_cmap_get;
 	struct res_lib_cmap_get *res_lib_cmap_get;
 	size_t res_size;
 
-	if (key_name == NULL) {
-		return (CS_ERR_INVALID_PARAM);
-	}
-	if (strlen(key_name) >= CS_MAX_NAME_LENGTH) {
-		return (CS_ERR_NAME_TOO_LONG);
-	}
-
-	if (value != NULL && value_len == NULL) {
-		return (CS_ERR_INVALID_PARAM);
-	}
-
-	error = hdb_error_to_cs(hdb_handle_get (&cmap_handle_t_db, handle, (void *)&cmap_inst));
-	if (error != CS_OK) {
-		return (error);
-	}
-
 	memset(&req_lib_cmap_get, 0, sizeof(req_lib_cmap_get));
 	req_lib_cmap_get.header.size = sizeof(req_lib_cmap_get);
 	req_lib_cmap_get.header.id = MESSAGE_REQ_CMAP_GET;
@@ -588,6 +844,37 @@ cs_error_t cmap_get(
 
 	free(res_lib_cmap_get);
 
+	return (error);
+}
+
+cs_error_t cmap_get(
+		cmap_handle_t handle,
+		const char *key_name,
+		void *value,
+		size_t *value_len,
+		cmap_value_types_t *type)
+{
+	cs_error_t error;
+	struct cmap_inst *cmap_inst;
+
+	if (key_name == NULL) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+	if (strlen(key_name) >= CS_MAX_NAME_LENGTH) {
+		return (CS_ERR_NAME_TOO_LONG);
+	}
+
+	if (value != NULL && value_len == NULL) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	error = hdb_error_to_cs(hdb_handle_get (&cmap_handle_t_db, handle, (void *)&cmap_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	error = cmap_cache_get(cmap_inst, key_name, value, value_len, type);
+
 	(void)hdb_handle_put (&cmap_handle_t_db, handle);
 
 	return (error);
@@ -718,6 +1005,175 @@ return_error:
 	return (res);
 }
 
+/*
+ * Copy items of multi-key response to items of application. Values are
+ * stored to buf starting at *buf_used.
+ */
+static cs_error_t cmap_multi_items_copy(
+	const char *data,
+	size_t data_len,
+	uint32_t no_items,
+	struct cmap_key_value *items,
+	char *buf,
+	size_t buf_len,
+	size_t *buf_used)
+{
+	const struct cmap_multi_item *item;
+	size_t aligned_len;
+	size_t pos;
+	uint32_t i;
+
+	pos = 0;
+	for (i = 0; i < no_items; i++) {
+		item = (const struct cmap_multi_item *)(data + pos);
+
+		if (data_len - pos < sizeof(*item) || item->key_name.length > CMAP_KEYNAME_MAXLEN) {
+			return (CS_ERR_LIBRARY);
+		}
+
+		memcpy(items[i].key_name, item->key_name.value, item->key_name.length);
+		items[i].key_name[item->key_name.length] = '\0';
+		items[i].error = item->error;
+		items[i].type = item->type;
+		items[i].value_len = item->value_len;
+		items[i].value = NULL;
+
+		if (item->error != CS_OK) {
+			pos += sizeof(*item);
+			continue;
+		}
+
+		if (item->value_len > data_len - pos - sizeof(*item)) {
+			return (CS_ERR_LIBRARY);
+		}
+
+		aligned_len = (item->value_len + 7) & ~((size_t)7);
+		if (buf_len - *buf_used < aligned_len) {
+			items[i].error = CS_ERR_NO_SPACE;
+		} else {
+			memcpy(buf + *buf_used, item->value, item->value_len);
+			items[i].value = buf + *buf_used;
+			*buf_used += aligned_len;
+		}
+
+		pos += CMAP_MULTI_ITEM_SIZE(item->value_len);
+	}
+
+	return (CS_OK);
+}
+
+cs_error_t cmap_get_multi(
+	cmap_handle_t handle,
+	struct cmap_key_value *items,
+	size_t items_count,
+	void *buf,
+	size_t buf_len)
+{
+	cs_error_t error;
+	struct iovec iov;
+	struct cmap_inst *cmap_inst;
+	struct req_lib_cmap_get_multi *req_lib_cmap_get_multi;
+	struct res_lib_cmap_get_multi *res_lib_cmap_get_multi;
+	size_t max_req_items;
+	size_t req_items;
+	size_t buf_used;
+	size_t done;
+	size_t i;
+	ssize_t res;
+
+	error = cmap_multi_items_check(items, items_count);
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	if (buf == NULL) {
+		buf_len = 0;
+	}
+
+	error = hdb_error_to_cs(hdb_handle_get (&cmap_handle_t_db, handle, (void *)&cmap_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	req_lib_cmap_get_multi = malloc(CMAP_MULTI_MSG_MAX_SIZE);
+	res_lib_cmap_get_multi = malloc(CMAP_MULTI_MSG_MAX_SIZE);
+	if (req_lib_cmap_get_multi == NULL || res_lib_cmap_get_multi == NULL) {
+		error = CS_ERR_NO_MEMORY;
+		goto error_free;
+	}
+
+	max_req_items = (CMAP_MULTI_MSG_MAX_SIZE - sizeof(*req_lib_cmap_get_multi)) / sizeof(mar_name_t);
+	buf_used = 0;
+	done = 0;
+
+	while (done < items_count) {
+		req_items = items_count - done;
+		if (req_items > max_req_items) {
+			req_items = max_req_items;
+		}
+
+		memset(req_lib_cmap_get_multi, 0,
+		    sizeof(*req_lib_cmap_get_multi) + req_items * sizeof(mar_name_t));
+		req_lib_cmap_get_multi->header.size = sizeof(*req_lib_cmap_get_multi) +
+		    req_items * sizeof(mar_name_t);
+		req_lib_cmap_get_multi->header.id = MESSAGE_REQ_CMAP_GET_MULTI;
+		req_lib_cmap_get_multi->no_items = req_items;
+
+		for (i = 0; i < req_items; i++) {
+			req_lib_cmap_get_multi->key_names[i].length = strlen(items[done + i].key_name);
+			memcpy(req_lib_cmap_get_multi->key_names[i].value, items[done + i].key_name,
+			    req_lib_cmap_get_multi->key_names[i].length);
+		}
+
+		iov.iov_base = (char *)req_lib_cmap_get_multi;
+		iov.iov_len = req_lib_cmap_get_multi->header.size;
+
+		res = qb_ipcc_sendv_recv(
+			cmap_inst->c,
+			&iov,
+			1,
+			res_lib_cmap_get_multi,
+			CMAP_MULTI_MSG_MAX_SIZE, CS_IPC_TIMEOUT_MS);
+		if (res < 0) {
+			error = qb_to_cs_error(res);
+			break;
+		}
+
+		error = res_lib_cmap_get_multi->header.error;
+		if (error != CS_OK) {
+			break;
+		}
+
+		/*
+		 * Executive answers at least one key, rest is asked again
+		 */
+		if (res_lib_cmap_get_multi->no_items == 0 ||
+		    res_lib_cmap_get_multi->no_items > req_items ||
+		    res_lib_cmap_get_multi->header.size < sizeof(*res_lib_cmap_get_multi) ||
+		    res_lib_cmap_get_multi->header.size > CMAP_MULTI_MSG_MAX_SIZE) {
+			error = CS_ERR_LIBRARY;
+			break;
+		}
+
+		error = cmap_multi_items_copy((char *)res_lib_cmap_get_multi + sizeof(*res_lib_cmap_get_multi),
+		    res_lib_cmap_get_multi->header.size - sizeof(*res_lib_cmap_get_multi),
+		    res_lib_cmap_get_multi->no_items, items + done, buf, buf_len, &buf_used);
+		if (error != CS_OK) {
+			break;
+		}
+
+		done += res_lib_cmap_get_multi->no_items;
+	}
+
+error_free:
+	free(req_lib_cmap_get_multi);
+	free(res_lib_cmap_get_multi);
+
+	(void)hdb_handle_put (&cmap_handle_t_db, handle);
+
+	return (error);
+}
+
 static cs_error_t cmap_adjust_int(cmap_handle_t handle, const char *key_name, int32_t step)
 {
 	cs_error_t error;
@@ -761,6 +1217,8 @@ static cs_error_t cmap_adjust_int(cmap_handle_t handle, const char *key_name, in
 		error = res_lib_cmap_adjust_int.header.error;
 	}
 
+	cmap_cache_invalidate(cmap_inst, key_name);
+
 	(void)hdb_handle_put (&cmap_handle_t_db, handle);
 
 	return (error);
@@ -891,35 +1349,121 @@ cs_error_t cmap_iter_next(
 	return (error);
 }
 
-cs_error_t cmap_iter_finalize(
+cs_error_t cmap_iter_next_page(
 		cmap_handle_t handle,
-		cmap_iter_handle_t iter_handle)
+		cmap_iter_handle_t iter_handle,
+		struct cmap_key_value *items,
+		size_t *items_count,
+		void *buf,
+		size_t buf_len)
 {
 	cs_error_t error;
 	struct iovec iov;
 	struct cmap_inst *cmap_inst;
-	struct req_lib_cmap_iter_finalize req_lib_cmap_iter_finalize;
-	struct res_lib_cmap_iter_finalize res_lib_cmap_iter_finalize;
+	struct req_lib_cmap_iter_next_page req_lib_cmap_iter_next_page;
+	struct res_lib_cmap_iter_next_page *res_lib_cmap_iter_next_page;
+	size_t buf_used;
+	ssize_t res;
+
+	if (items == NULL || items_count == NULL || *items_count == 0) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	if (buf == NULL) {
+		buf_len = 0;
+	}
 
 	error = hdb_error_to_cs(hdb_handle_get (&cmap_handle_t_db, handle, (void *)&cmap_inst));
 	if (error != CS_OK) {
 		return (error);
 	}
 
-	memset(&req_lib_cmap_iter_finalize, 0, sizeof(req_lib_cmap_iter_finalize));
-	req_lib_cmap_iter_finalize.header.size = sizeof(req_lib_cmap_iter_finalize);
-	req_lib_cmap_iter_finalize.header.id = MESSAGE_REQ_CMAP_ITER_FINALIZE;
-	req_lib_cmap_iter_finalize.iter_handle = iter_handle;
+	res_lib_cmap_iter_next_page = malloc(CMAP_MULTI_MSG_MAX_SIZE);
+	if (res_lib_cmap_iter_next_page == NULL) {
+		error = CS_ERR_NO_MEMORY;
+		goto error_put;
+	}
 
-	iov.iov_base = (char *)&req_lib_cmap_iter_finalize;
-	iov.iov_len = sizeof(req_lib_cmap_iter_finalize);
+	memset(&req_lib_cmap_iter_next_page, 0, sizeof(req_lib_cmap_iter_next_page));
+	req_lib_cmap_iter_next_page.header.size = sizeof(req_lib_cmap_iter_next_page);
+	req_lib_cmap_iter_next_page.header.id = MESSAGE_REQ_CMAP_ITER_NEXT_PAGE;
+	req_lib_cmap_iter_next_page.iter_handle = iter_handle;
+	req_lib_cmap_iter_next_page.max_items = (*items_count > UINT32_MAX ? UINT32_MAX : *items_count);
+	req_lib_cmap_iter_next_page.values_size = buf_len;
 
-	error = qb_to_cs_error(qb_ipcc_sendv_recv(
+	iov.iov_base = (char *)&req_lib_cmap_iter_next_page;
+	iov.iov_len = sizeof(req_lib_cmap_iter_next_page);
+
+	res = qb_ipcc_sendv_recv(
 		cmap_inst->c,
 		&iov,
 		1,
-		&res_lib_cmap_iter_finalize,
-		sizeof (struct res_lib_cmap_iter_finalize), CS_IPC_TIMEOUT_MS));
+		res_lib_cmap_iter_next_page,
+		CMAP_MULTI_MSG_MAX_SIZE, CS_IPC_TIMEOUT_MS);
+	if (res < 0) {
+		error = qb_to_cs_error(res);
+	} else {
+		error = res_lib_cmap_iter_next_page->header.error;
+	}
+
+	if (error == CS_OK &&
+	    (res_lib_cmap_iter_next_page->no_items > *items_count ||
+	     res_lib_cmap_iter_next_page->header.size < sizeof(*res_lib_cmap_iter_next_page) ||
+	     res_lib_cmap_iter_next_page->header.size > CMAP_MULTI_MSG_MAX_SIZE)) {
+		error = CS_ERR_LIBRARY;
+	}
+
+	if (error == CS_OK) {
+		buf_used = 0;
+		error = cmap_multi_items_copy((char *)res_lib_cmap_iter_next_page +
+		    sizeof(*res_lib_cmap_iter_next_page),
+		    res_lib_cmap_iter_next_page->header.size - sizeof(*res_lib_cmap_iter_next_page),
+		    res_lib_cmap_iter_next_page->no_items, items, buf, buf_len, &buf_used);
+	}
+
+	if (error == CS_OK) {
+		*items_count = res_lib_cmap_iter_next_page->no_items;
+	} else {
+		*items_count = 0;
+	}
+
+	free(res_lib_cmap_iter_next_page);
+
+error_put:
+	(void)hdb_handle_put (&cmap_handle_t_db, handle);
+
+	return (error);
+}
+
+cs_error_t cmap_iter_finalize(
+		cmap_handle_t handle,
+		cmap_iter_handle_t iter_handle)
+{
+	cs_error_t error;
+	struct iovec iov;
+	struct cmap_inst *cmap_inst;
+	struct req_lib_cmap_iter_finalize req_lib_cmap_iter_finalize;
+	struct res_lib_cmap_iter_finalize res_lib_cmap_iter_finalize;
+
+	error = hdb_error_to_cs(hdb_handle_get (&cmap_handle_t_db, handle, (void *)&cmap_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	memset(&req_lib_cmap_iter_finalize, 0, sizeof(req_lib_cmap_iter_finalize));
+	req_lib_cmap_iter_finalize.header.size = sizeof(req_lib_cmap_iter_finalize);
+	req_lib_cmap_iter_finalize.header.id = MESSAGE_REQ_CMAP_ITER_FINALIZE;
+	req_lib_cmap_iter_finalize.iter_handle = iter_handle;
+
+	iov.iov_base = (char *)&req_lib_cmap_iter_finalize;
+	iov.iov_len = sizeof(req_lib_cmap_iter_finalize);
+
+	error = qb_to_cs_error(qb_ipcc_sendv_recv(
+		cmap_inst->c,
+		&iov,
+		1,
+		&res_lib_cmap_iter_finalize,
+		sizeof (struct res_lib_cmap_iter_finalize), CS_IPC_TIMEOUT_MS));
 
 	if (error == CS_OK) {
 		error = res_lib_cmap_iter_finalize.header.error;
@@ -1073,3 +1617,600 @@ error_put:
 
 	return (error);
 }
+
+/*
+ * Client side cache
+ */
+static uint32_t cmap_cache_hash(const char *key_name)
+{
+	uint32_t hash = 5381;
+
+	while (*key_name != '\0') {
+		hash = ((hash << 5) + hash) + (unsigned char)*key_name++;
+	}
+
+	return (hash % CMAP_CACHE_HASH_SIZE);
+}
+
+static void cmap_cache_flush(struct cmap_cache *cache)
+{
+	struct cmap_cache_entry *entry;
+	uint32_t i;
+
+	for (i = 0; i < CMAP_CACHE_HASH_SIZE; i++) {
+		while (!list_empty(&cache->hash[i])) {
+			entry = list_entry(cache->hash[i].next, struct cmap_cache_entry, list);
+			list_del(&entry->list);
+			free(entry);
+		}
+	}
+
+	cache->no_entries = 0;
+}
+
+static struct cmap_cache_entry *cmap_cache_lookup(struct cmap_cache *cache, const char *key_name)
+{
+	struct list_head *iter;
+	struct cmap_cache_entry *entry;
+	uint32_t hash = cmap_cache_hash(key_name);
+
+	for (iter = cache->hash[hash].next; iter != &cache->hash[hash]; iter = iter->next) {
+		entry = list_entry(iter, struct cmap_cache_entry, list);
+
+		if (strcmp(entry->key_name, key_name) == 0) {
+			return (entry);
+		}
+	}
+
+	return (NULL);
+}
+
+static void cmap_cache_remove(struct cmap_cache *cache, const char *key_name)
+{
+	struct cmap_cache_entry *entry;
+
+	entry = cmap_cache_lookup(cache, key_name);
+	if (entry != NULL) {
+		list_del(&entry->list);
+		free(entry);
+		cache->no_entries--;
+	}
+}
+
+static struct cmap_cache_entry *cmap_cache_insert(struct cmap_cache *cache, const struct cmap_key_value *item)
+{
+	struct cmap_cache_entry *entry;
+	size_t value_len;
+
+	value_len = (item->error == CS_OK ? item->value_len : 0);
+
+	entry = malloc(sizeof(*entry) + value_len);
+	if (entry == NULL) {
+		return (NULL);
+	}
+
+	if (cache->no_entries >= CMAP_CACHE_MAX_ENTRIES) {
+		cmap_cache_flush(cache);
+	}
+
+	strcpy(entry->key_name, item->key_name);
+	entry->error = item->error;
+	entry->type = item->type;
+	entry->value_len = value_len;
+	if (value_len > 0) {
+		memcpy(entry->value, item->value, value_len);
+	}
+
+	list_add(&entry->list, &cache->hash[cmap_cache_hash(entry->key_name)]);
+	cache->no_entries++;
+
+	return (entry);
+}
+
+/*
+ * Called only from cmap_dispatch of cache handle, so cache_mutex of instance
+ * using the cache is already locked
+ */
+static void cmap_cache_notify_fn(
+	cmap_handle_t cmap_handle,
+	cmap_track_handle_t cmap_track_handle,
+	int32_t event,
+	const char *key_name,
+	struct cmap_notify_value new_val,
+	struct cmap_notify_value old_val,
+	void *user_data)
+{
+	struct cmap_inst *cmap_inst = (struct cmap_inst *)user_data;
+
+	cmap_cache_remove(cmap_inst->cache, key_name);
+	cmap_inst->cache_generation++;
+}
+
+/*
+ * Drop key changed by own connection. Notification is delivered by different
+ * connection so it may arrive after next cmap_get.
+ */
+static void cmap_cache_invalidate(struct cmap_inst *cmap_inst, const char *key_name)
+{
+	pthread_mutex_lock(&cmap_inst->cache_mutex);
+	if (cmap_inst->cache != NULL) {
+		cmap_cache_remove(cmap_inst->cache, key_name);
+		cmap_inst->cache_generation++;
+	}
+	pthread_mutex_unlock(&cmap_inst->cache_mutex);
+}
+
+/*
+ * Open connection delivering invalidations. Notifications may have been
+ * missed while cache was not connected, so content is dropped.
+ * Called with cache_mutex locked.
+ */
+static cs_error_t cmap_cache_connect(struct cmap_inst *cmap_inst)
+{
+	struct cmap_cache *cache = cmap_inst->cache;
+	cs_error_t error;
+
+	cmap_cache_flush(cache);
+	cmap_inst->cache_generation++;
+
+	/*
+	 * Cache uses its own connection, so notifications can be processed
+	 * without interfering with dispatch of application
+	 */
+	error = cmap_initialize(&cache->handle);
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	error = cmap_fd_get(cache->handle, &cache->fd);
+	if (error != CS_OK) {
+		goto error_finalize;
+	}
+
+	error = cmap_track_add(cache->handle, cache->prefix,
+	    CMAP_TRACK_ADD | CMAP_TRACK_DELETE | CMAP_TRACK_MODIFY | CMAP_TRACK_PREFIX,
+	    cmap_cache_notify_fn, cmap_inst, &cache->track_handle);
+	if (error != CS_OK) {
+		goto error_finalize;
+	}
+
+	cache->connected = 1;
+
+	return (CS_OK);
+
+error_finalize:
+	(void)cmap_finalize(cache->handle);
+	return (error);
+}
+
+static void cmap_cache_disconnect(struct cmap_inst *cmap_inst)
+{
+	struct cmap_cache *cache = cmap_inst->cache;
+
+	if (cache->connected) {
+		(void)cmap_finalize(cache->handle);
+		cache->connected = 0;
+	}
+	cmap_cache_flush(cache);
+	cmap_inst->cache_generation++;
+}
+
+/*
+ * Process pending invalidations. Dispatch is called only when notification
+ * is waiting, so hit costs just one poll. When connection was lost, it's
+ * reestablished, because without it invalidations would be missed.
+ * Called with cache_mutex locked.
+ */
+static cs_error_t cmap_cache_sync(struct cmap_inst *cmap_inst)
+{
+	struct cmap_cache *cache = cmap_inst->cache;
+	struct pollfd pfd;
+
+	if (cache->connected) {
+		pfd.fd = cache->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, 0) == 0) {
+			return (CS_OK);
+		}
+
+		if (cmap_dispatch(cache->handle, CS_DISPATCH_ALL) == CS_OK) {
+			return (CS_OK);
+		}
+
+		cmap_cache_disconnect(cmap_inst);
+	}
+
+	return (cmap_cache_connect(cmap_inst));
+}
+
+static void cmap_cache_free(struct cmap_cache *cache)
+{
+
+	if (cache->connected) {
+		(void)cmap_finalize(cache->handle);
+	}
+	cmap_cache_flush(cache);
+	free(cache);
+}
+
+/*
+ * Copy cached value, same semantics as icmap_get
+ */
+static cs_error_t cmap_cache_entry_get(
+	const struct cmap_cache_entry *entry,
+	void *value,
+	size_t *value_len,
+	cmap_value_types_t *type)
+{
+
+	if (entry->error != CS_OK) {
+		return (entry->error);
+	}
+
+	if (value == NULL) {
+		if (value_len != NULL) {
+			*value_len = entry->value_len;
+		}
+	} else {
+		if (*value_len < entry->value_len) {
+			return (CS_ERR_INVALID_PARAM);
+		}
+
+		*value_len = entry->value_len;
+		memcpy(value, entry->value, entry->value_len);
+	}
+
+	if (type != NULL) {
+		*type = entry->type;
+	}
+
+	return (CS_OK);
+}
+
+/*
+ * Serve cmap_get, from cache when key is inside of cache prefix. Miss costs
+ * single regular get, which is done without cache_mutex held so other threads
+ * are not blocked by the round trip. Value is stored only when it was requested,
+ * fits into CMAP_CACHE_VALUE_MAX_SIZE and no invalidation was processed
+ * meanwhile. While cache can't reconnect, all lookups are counted as misses.
+ */
+static cs_error_t cmap_cache_get(
+	struct cmap_inst *cmap_inst,
+	const char *key_name,
+	void *value,
+	size_t *value_len,
+	cmap_value_types_t *type)
+{
+	struct cmap_cache *cache;
+	struct cmap_cache_entry *entry;
+	struct cmap_key_value item;
+	cmap_value_types_t item_type;
+	uint64_t generation;
+	cs_error_t error;
+
+	pthread_mutex_lock(&cmap_inst->cache_mutex);
+	cache = cmap_inst->cache;
+	if (cache == NULL || strncmp(key_name, cache->prefix, cache->prefix_len) != 0) {
+		pthread_mutex_unlock(&cmap_inst->cache_mutex);
+
+		return (cmap_get_uncached(cmap_inst, key_name, value, value_len, type));
+	}
+
+	if (cmap_cache_sync(cmap_inst) != CS_OK) {
+		cache->misses++;
+		pthread_mutex_unlock(&cmap_inst->cache_mutex);
+
+		return (cmap_get_uncached(cmap_inst, key_name, value, value_len, type));
+	}
+
+	entry = cmap_cache_lookup(cache, key_name);
+	if (entry != NULL) {
+		cache->hits++;
+		error = cmap_cache_entry_get(entry, value, value_len, type);
+		pthread_mutex_unlock(&cmap_inst->cache_mutex);
+
+		return (error);
+	}
+
+	cache->misses++;
+	generation = cmap_inst->cache_generation;
+	pthread_mutex_unlock(&cmap_inst->cache_mutex);
+
+	error = cmap_get_uncached(cmap_inst, key_name, value, value_len, &item_type);
+	if (type != NULL && error == CS_OK) {
+		*type = item_type;
+	}
+
+	if ((error == CS_OK && value != NULL && *value_len <= CMAP_CACHE_VALUE_MAX_SIZE) ||
+	    error == CS_ERR_NOT_EXIST) {
+		memset(&item, 0, sizeof(item));
+		strcpy(item.key_name, key_name);
+		item.error = error;
+		if (error == CS_OK) {
+			item.type = item_type;
+			item.value_len = *value_len;
+			item.value = value;
+		}
+
+		pthread_mutex_lock(&cmap_inst->cache_mutex);
+		/*
+		 * Invalidation which arrived during get may be still waiting
+		 */
+		if (cmap_inst->cache == cache && cmap_cache_sync(cmap_inst) == CS_OK &&
+		    cmap_inst->cache_generation == generation) {
+			(void)cmap_cache_insert(cache, &item);
+		}
+		pthread_mutex_unlock(&cmap_inst->cache_mutex);
+	}
+
+	return (error);
+}
+
+cs_error_t cmap_cache_enable(cmap_handle_t handle, const char *prefix)
+{
+	cs_error_t error;
+	struct cmap_inst *cmap_inst;
+	struct cmap_cache *cache;
+	uint32_t i;
+
+	if (prefix == NULL) {
+		prefix = "";
+	}
+
+	if (strlen(prefix) >= CS_MAX_NAME_LENGTH) {
+		return (CS_ERR_NAME_TOO_LONG);
+	}
+
+	error = hdb_error_to_cs(hdb_handle_get (&cmap_handle_t_db, handle, (void *)&cmap_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	pthread_mutex_lock(&cmap_inst->cache_mutex);
+	if (cmap_inst->cache != NULL) {
+		error = CS_ERR_EXIST;
+		goto error_put;
+	}
+
+	cache = malloc(sizeof(*cache));
+	if (cache == NULL) {
+		error = CS_ERR_NO_MEMORY;
+		goto error_put;
+	}
+
+	memset(cache, 0, sizeof(*cache));
+	strcpy(cache->prefix, prefix);
+	cache->prefix_len = strlen(prefix);
+	for (i = 0; i < CMAP_CACHE_HASH_SIZE; i++) {
+		list_init(&cache->hash[i]);
+	}
+
+	cmap_inst->cache = cache;
+	error = cmap_cache_connect(cmap_inst);
+	if (error != CS_OK) {
+		cmap_inst->cache = NULL;
+		goto error_free;
+	}
+	pthread_mutex_unlock(&cmap_inst->cache_mutex);
+
+	(void)hdb_handle_put (&cmap_handle_t_db, handle);
+
+	return (CS_OK);
+
+error_free:
+	free(cache);
+error_put:
+	pthread_mutex_unlock(&cmap_inst->cache_mutex);
+	(void)hdb_handle_put (&cmap_handle_t_db, handle);
+
+	return (error);
+}
+
+cs_error_t cmap_cache_disable(cmap_handle_t handle)
+{
+	cs_error_t error;
+	struct cmap_inst *cmap_inst;
+
+	error = hdb_error_to_cs(hdb_handle_get (&cmap_handle_t_db, handle, (void *)&cmap_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	pthread_mutex_lock(&cmap_inst->cache_mutex);
+	if (cmap_inst->cache == NULL) {
+		error = CS_ERR_NOT_EXIST;
+	} else {
+		cmap_cache_free(cmap_inst->cache);
+		cmap_inst->cache = NULL;
+		cmap_inst->cache_generation++;
+	}
+	pthread_mutex_unlock(&cmap_inst->cache_mutex);
+
+	(void)hdb_handle_put (&cmap_handle_t_db, handle);
+
+	return (error);
+}
+
+cs_error_t cmap_cache_stats_get(cmap_handle_t handle, uint64_t *hits, uint64_t *misses)
+{
+	cs_error_t error;
+	struct cmap_inst *cmap_inst;
+
+	if (hits == NULL || misses == NULL) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	error = hdb_error_to_cs(hdb_handle_get (&cmap_handle_t_db, handle, (void *)&cmap_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	pthread_mutex_lock(&cmap_inst->cache_mutex);
+	if (cmap_inst->cache == NULL) {
+		error = CS_ERR_NOT_EXIST;
+	} else {
+		*hits = cmap_inst->cache->hits;
+		*misses = cmap_inst->cache->misses;
+	}
+	pthread_mutex_unlock(&cmap_inst->cache_mutex);
+
+	(void)hdb_handle_put (&cmap_handle_t_db, handle);
+
+	return (error);
+}
+
+/*
+ * Statistics segment
+ */
+static void cmap_stats_inst_free (void *inst)
+{
+	struct cmap_stats_inst *cmap_stats_inst = (struct cmap_stats_inst *)inst;
+
+	if (cmap_stats_inst->stats != NULL) {
+		munmap((void *)cmap_stats_inst->stats, cmap_stats_inst->size);
+	}
+}
+
+cs_error_t cmap_stats_open(cmap_stats_handle_t *handle)
+{
+	cs_error_t error;
+	struct cmap_stats_inst *cmap_stats_inst;
+	const struct cmap_stats *stats;
+	struct stat st;
+	void *addr;
+	int fd;
+
+	if (handle == NULL) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	fd = shm_open(CMAP_STATS_SHM_NAME, O_RDONLY, 0);
+	if (fd == -1) {
+		return (errno == ENOENT ? CS_ERR_NOT_EXIST : qb_to_cs_error(-errno));
+	}
+
+	if (fstat(fd, &st) == -1) {
+		error = qb_to_cs_error(-errno);
+		close(fd);
+		return (error);
+	}
+
+	if (st.st_size < sizeof(struct cmap_stats)) {
+		close(fd);
+		return (CS_ERR_VERSION);
+	}
+
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		return (qb_to_cs_error(-errno));
+	}
+
+	stats = addr;
+	if (stats->magic != CMAP_STATS_MAGIC) {
+		/*
+		 * Executive is just creating or destroying segment
+		 */
+		error = CS_ERR_TRY_AGAIN;
+		goto error_unmap;
+	}
+
+	if (stats->version != CMAP_STATS_VERSION || stats->size != sizeof(struct cmap_stats)) {
+		error = CS_ERR_VERSION;
+		goto error_unmap;
+	}
+
+	error = hdb_error_to_cs(hdb_handle_create(&cmap_stats_handle_t_db, sizeof(*cmap_stats_inst), handle));
+	if (error != CS_OK) {
+		goto error_unmap;
+	}
+
+	error = hdb_error_to_cs(hdb_handle_get(&cmap_stats_handle_t_db, *handle, (void *)&cmap_stats_inst));
+	if (error != CS_OK) {
+		(void)hdb_handle_destroy(&cmap_stats_handle_t_db, *handle);
+		goto error_unmap;
+	}
+
+	cmap_stats_inst->stats = stats;
+	cmap_stats_inst->size = st.st_size;
+
+	(void)hdb_handle_put(&cmap_stats_handle_t_db, *handle);
+
+	return (CS_OK);
+
+error_unmap:
+	munmap(addr, st.st_size);
+
+	return (error);
+}
+
+cs_error_t cmap_stats_read(cmap_stats_handle_t handle, struct cmap_stats *stats)
+{
+	cs_error_t error;
+	struct cmap_stats_inst *cmap_stats_inst;
+	const volatile struct cmap_stats *shm;
+	uint32_t seq;
+	int i;
+
+	if (stats == NULL) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	error = hdb_error_to_cs(hdb_handle_get(&cmap_stats_handle_t_db, handle, (void *)&cmap_stats_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	shm = cmap_stats_inst->stats;
+	error = CS_ERR_TRY_AGAIN;
+
+	/*
+	 * Executive increases seq before and after update, so snapshot is
+	 * consistent if seq is even and not changed while copying
+	 */
+	for (i = 0; i < CMAP_STATS_READ_RETRIES; i++) {
+		seq = shm->seq;
+		__sync_synchronize();
+
+		if (shm->magic != CMAP_STATS_MAGIC) {
+			error = CS_ERR_BAD_HANDLE;
+			break;
+		}
+
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+
+		memcpy(stats, (const void *)shm, sizeof(*stats));
+		__sync_synchronize();
+
+		if (shm->seq == seq) {
+			error = CS_OK;
+			break;
+		}
+	}
+
+	(void)hdb_handle_put(&cmap_stats_handle_t_db, handle);
+
+	return (error);
+}
+
+cs_error_t cmap_stats_close(cmap_stats_handle_t handle)
+{
+	cs_error_t error;
+	struct cmap_stats_inst *cmap_stats_inst;
+
+	error = hdb_error_to_cs(hdb_handle_get(&cmap_stats_handle_t_db, handle, (void *)&cmap_stats_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	(void)hdb_handle_destroy(&cmap_stats_handle_t_db, handle);
+
+	(void)hdb_handle_put(&cmap_stats_handle_t_db, handle);
+
+	return (CS_OK);
+}
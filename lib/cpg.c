@@ -50,7 +50,9 @@
 #include <sys/uio.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include <qb/qbdefs.h>
 #include <qb/qbipcc.h>
@@ -70,18 +72,55 @@
 #endif
 
 /*
- * Maximum number of times to retry a send when transmitting
- * a large message fragment
+ * Maximum number of times to resend a large message fragment refused by
+ * the executive without any progress
  */
 #define MAX_RETRIES 100
 
+/*
+ * Number of fragments of large message sent to the executive without
+ * waiting for response. Fragments are sized so the whole window fits
+ * into the IPC request buffer. Response channel is given to other calls
+ * between windows.
+ */
+#define CPG_PARTIAL_WINDOW		4
+
+/*
+ * Limit of messages queued by cpg_mcast_joined_async
+ */
+#define CPG_SEND_QUEUE_MAX_BYTES	(8 * 1024 * 1024)
+
 /*
  * ZCB files have following umask (umask is same as used in libqb)
  */
 #define CPG_MEMORY_MAP_UMASK		077
 
+/*
+ * Number of consumed shared deliveries after which they are given back
+ * to the executive even when more messages are waiting
+ */
+#define CPG_SHM_RELEASE_BATCH		32
+
+/*
+ * Limits of one batch passed to cpg_deliver_batch_fn_t. Every receive needs
+ * IPC_DISPATCH_SIZE bytes of free buffer, so the buffer is a few times
+ * bigger to hold more than one message of maximal size.
+ */
+#define CPG_DELIVER_BATCH_MAX		256
+#define CPG_DELIVER_BATCH_BUF_SIZE	(4 * IPC_DISPATCH_SIZE)
+
 struct cpg_inst {
 	qb_ipcc_connection_t *c;
+	/*
+	 * Held while waiting for response, so responses of concurrent calls
+	 * (and credits of send_fragments) are not mixed up
+	 */
+	pthread_mutex_t response_mutex;
+	/*
+	 * Held by send_fragments for whole message, so fragments of two
+	 * large messages are not mixed up
+	 */
+	pthread_mutex_t send_mutex;
 	int finalize;
 	void *context;
 	union {
@@ -97,6 +136,77 @@ struct cpg_inst {
 					 * the cluster/group in the middle of a CPG message send
 					 * so we don't pass on a partial message to the client.
 					 */
+	cpg_partial_deliver_fn_t partial_deliver_fn;
+	struct list_head partial_stream_list_head;
+	/*
+	 * Protects shared delivery state below. Held list is changed by
+	 * cpg_zcb_deliver_release in application threads while cpg_dispatch
+	 * adds to it and releases deliveries.
+	 */
+	pthread_mutex_t shm_mutex;
+	struct list_head shm_map_list_head;
+	uint64_t shm_arena_id; /* Arena of currently joined group */
+	uint64_t shm_release_seq;
+	unsigned int shm_release_pending;
+	uint64_t shm_delivered_seq; /* Last shared delivery from current arena */
+	const void *shm_deliver_msg; /* Shared delivery passed to running callback */
+	uint64_t shm_deliver_seq;
+	struct list_head shm_held_list_head;
+	cpg_deliver_batch_fn_t deliver_batch_fn;
+	uint32_t partial_msgid;
+	cpg_send_ready_fn_t send_ready_fn;
+	/*
+	 * Protects send queue, which is filled by application threads and
+	 * flushed by cpg_dispatch
+	 */
+	pthread_mutex_t send_queue_mutex;
+	struct list_head send_queue_list_head;
+	uint32_t send_queue_msgs;
+	size_t send_queue_bytes;
+	int send_ready_requested;
+	char *deliver_batch_buf;
+	struct cpg_deliver_msg *deliver_batch_msgs;
+};
+
+/*
+ * Message waiting in send queue of cpg_mcast_joined_async. Data contains
+ * whole request including header.
+ */
+struct cpg_send_queued {
+	struct list_head list;
+	size_t len;
+	char data[];
+};
+
+/*
+ * Shared delivery arena mapped read-only (CPG_MODEL_V1_DELIVER_SHARED)
+ */
+struct cpg_shm_map {
+	uint64_t arena_id;
+	void *addr;
+	size_t size;
+	struct list_head list;
+};
+
+/*
+ * Shared delivery kept by application after callback returned
+ * (cpg_zcb_deliver_hold). List is ordered by seq.
+ */
+struct cpg_shm_held {
+	struct list_head list;
+	const void *msg;
+	uint64_t seq;
+};
+
+/*
+ * Position inside of large message received from one sender when
+ * fragments are passed to the application as they arrive
+ */
+struct cpg_partial_stream {
+	uint32_t nodeid;
+	uint32_t pid;
+	size_t offset;
+	struct list_head list;
 };
 static void cpg_inst_free (void *inst);
 
@@ -105,6 +215,7 @@ DECLARE_HDB_DATABASE(cpg_handle_t_db, cpg_inst_free);
 struct cpg_iteration_instance_t {
 	cpg_iteration_handle_t cpg_iteration_handle;
 	qb_ipcc_connection_t *conn;
+	pthread_mutex_t *response_mutex;
 	hdb_handle_t executive_iteration_handle;
 	struct list_head list;
 };
@@ -119,13 +230,20 @@ DECLARE_HDB_DATABASE(cpg_iteration_handle_t_db,NULL);
 static cs_error_t
 coroipcc_msg_send_reply_receive (
 	qb_ipcc_connection_t *c,
+	pthread_mutex_t *response_mutex,
 	const struct iovec *iov,
 	unsigned int iov_len,
 	void *res_msg,
 	size_t res_len)
 {
-	return qb_to_cs_error(qb_ipcc_sendv_recv(c, iov, iov_len, res_msg, res_len,
-				CS_IPC_TIMEOUT_MS));
+	int32_t res;
+
+	pthread_mutex_lock (response_mutex);
+	res = qb_ipcc_sendv_recv(c, iov, iov_len, res_msg, res_len,
+				CS_IPC_TIMEOUT_MS);
+	pthread_mutex_unlock (response_mutex);
+
+	return qb_to_cs_error(res);
 }
 
 static void cpg_iteration_instance_finalize (struct cpg_iteration_instance_t *cpg_iteration_instance)
@@ -134,10 +252,323 @@ static void cpg_iteration_instance_finalize (struct cpg_iteration_instance_t *cp
 	hdb_handle_destroy (&cpg_iteration_handle_t_db, cpg_iteration_instance->cpg_iteration_handle);
 }
 
+static struct cpg_partial_stream *cpg_partial_stream_find (
+	struct cpg_inst *cpg_inst,
+	uint32_t nodeid,
+	uint32_t pid)
+{
+	struct list_head *iter;
+	struct cpg_partial_stream *stream;
+
+	for (iter = cpg_inst->partial_stream_list_head.next;
+	    iter != &cpg_inst->partial_stream_list_head; iter = iter->next) {
+		stream = list_entry (iter, struct cpg_partial_stream, list);
+
+		if (stream->nodeid == nodeid && stream->pid == pid) {
+			return (stream);
+		}
+	}
+
+	return (NULL);
+}
+
+static void cpg_partial_stream_free (struct cpg_partial_stream *stream)
+{
+	list_del (&stream->list);
+	free (stream);
+}
+
+static void cpg_partial_streams_free (struct cpg_inst *cpg_inst)
+{
+	struct list_head *iter, *iter_next;
+
+	for (iter = cpg_inst->partial_stream_list_head.next;
+	    iter != &cpg_inst->partial_stream_list_head; iter = iter_next) {
+		iter_next = iter->next;
+
+		cpg_partial_stream_free (list_entry (iter, struct cpg_partial_stream, list));
+	}
+}
+
+static struct cpg_shm_map *cpg_shm_map_find (
+	struct cpg_inst *cpg_inst,
+	uint64_t arena_id)
+{
+	struct list_head *iter;
+	struct cpg_shm_map *shm_map;
+
+	for (iter = cpg_inst->shm_map_list_head.next;
+	    iter != &cpg_inst->shm_map_list_head; iter = iter->next) {
+		shm_map = list_entry (iter, struct cpg_shm_map, list);
+
+		if (shm_map->arena_id == arena_id) {
+			return (shm_map);
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * Unmap all arenas except keep (may be NULL)
+ */
+static void cpg_shm_maps_free (struct cpg_inst *cpg_inst, const struct cpg_shm_map *keep)
+{
+	struct list_head *iter, *iter_next;
+	struct cpg_shm_map *shm_map;
+
+	for (iter = cpg_inst->shm_map_list_head.next;
+	    iter != &cpg_inst->shm_map_list_head; iter = iter_next) {
+		iter_next = iter->next;
+
+		shm_map = list_entry (iter, struct cpg_shm_map, list);
+		if (shm_map == keep) {
+			continue;
+		}
+		list_del (&shm_map->list);
+		munmap (shm_map->addr, shm_map->size);
+		free (shm_map);
+	}
+}
+
+static void cpg_shm_held_free (struct cpg_inst *cpg_inst)
+{
+	struct list_head *iter, *iter_next;
+
+	for (iter = cpg_inst->shm_held_list_head.next;
+	    iter != &cpg_inst->shm_held_list_head; iter = iter_next) {
+		iter_next = iter->next;
+
+		list_del (iter);
+		free (list_entry (iter, struct cpg_shm_held, list));
+	}
+}
+
+/*
+ * Release is cumulative, so only deliveries older than the first one still
+ * held by application can be given back
+ */
+static void cpg_shm_release_seq_update (struct cpg_inst *cpg_inst)
+{
+	struct cpg_shm_held *held;
+
+	if (list_empty (&cpg_inst->shm_held_list_head)) {
+		cpg_inst->shm_release_seq = cpg_inst->shm_delivered_seq;
+	} else {
+		held = list_entry (cpg_inst->shm_held_list_head.next, struct cpg_shm_held, list);
+		cpg_inst->shm_release_seq = held->seq - 1;
+	}
+}
+
+/*
+ * Give shared deliveries up to seq back to the executive. Release is
+ * cumulative, so when it can't be sent now it is simply sent later.
+ *
+ * Must be called with shm_mutex held.
+ */
+static void cpg_shm_release_send (struct cpg_inst *cpg_inst)
+{
+	struct req_lib_cpg_shm_release req_lib_cpg_shm_release;
+	struct iovec iov;
+
+	req_lib_cpg_shm_release.header.size = sizeof (struct req_lib_cpg_shm_release);
+	req_lib_cpg_shm_release.header.id = MESSAGE_REQ_CPG_SHM_RELEASE;
+	req_lib_cpg_shm_release.arena_id = cpg_inst->shm_arena_id;
+	req_lib_cpg_shm_release.seq = cpg_inst->shm_release_seq;
+
+	iov.iov_base = (void *)&req_lib_cpg_shm_release;
+	iov.iov_len = sizeof (struct req_lib_cpg_shm_release);
+
+	if (qb_ipcc_sendv (cpg_inst->c, &iov, 1) >= 0) {
+		cpg_inst->shm_release_pending = 0;
+	}
+}
+
+static int cpg_shm_release_pending_get (struct cpg_inst *cpg_inst)
+{
+	int pending;
+
+	pthread_mutex_lock (&cpg_inst->shm_mutex);
+	pending = (cpg_inst->shm_release_pending != 0);
+	pthread_mutex_unlock (&cpg_inst->shm_mutex);
+
+	return (pending);
+}
+
+static void cpg_shm_release_flush (struct cpg_inst *cpg_inst)
+{
+	pthread_mutex_lock (&cpg_inst->shm_mutex);
+	if (cpg_inst->shm_release_pending) {
+		cpg_shm_release_send (cpg_inst);
+	}
+	pthread_mutex_unlock (&cpg_inst->shm_mutex);
+}
+
+/*
+ * Map shared delivery arena of just joined group. On any failure messages
+ * are just delivered by copy.
+ */
+static void cpg_shm_attach (struct cpg_inst *cpg_inst)
+{
+	struct req_lib_cpg_shm_attach req_lib_cpg_shm_attach;
+	struct res_lib_cpg_shm_attach res_lib_cpg_shm_attach;
+	struct cpg_shm_map *shm_map;
+	struct iovec iov;
+	cs_error_t error;
+	void *addr;
+	int fd;
+
+	req_lib_cpg_shm_attach.header.size = sizeof (struct req_lib_cpg_shm_attach);
+	req_lib_cpg_shm_attach.header.id = MESSAGE_REQ_CPG_SHM_ATTACH;
+
+	iov.iov_base = (void *)&req_lib_cpg_shm_attach;
+	iov.iov_len = sizeof (struct req_lib_cpg_shm_attach);
+
+	error = coroipcc_msg_send_reply_receive (cpg_inst->c, &cpg_inst->response_mutex, &iov, 1,
+		&res_lib_cpg_shm_attach, sizeof (struct res_lib_cpg_shm_attach));
+	if (error != CS_OK || res_lib_cpg_shm_attach.header.error != CS_OK) {
+		return ;
+	}
+
+	pthread_mutex_lock (&cpg_inst->shm_mutex);
+	shm_map = cpg_shm_map_find (cpg_inst, res_lib_cpg_shm_attach.arena_id);
+	if (shm_map == NULL) {
+		res_lib_cpg_shm_attach.path[CPG_ZC_PATH_LEN - 1] = '\0';
+
+		fd = open (res_lib_cpg_shm_attach.path, O_RDONLY);
+		if (fd == -1) {
+			goto error_unlock;
+		}
+		addr = mmap (NULL, res_lib_cpg_shm_attach.map_size, PROT_READ,
+			MAP_SHARED, fd, 0);
+		close (fd);
+		if (addr == MAP_FAILED) {
+			goto error_unlock;
+		}
+
+		shm_map = malloc (sizeof (struct cpg_shm_map));
+		if (shm_map == NULL) {
+			munmap (addr, res_lib_cpg_shm_attach.map_size);
+			goto error_unlock;
+		}
+		shm_map->arena_id = res_lib_cpg_shm_attach.arena_id;
+		shm_map->addr = addr;
+		shm_map->size = res_lib_cpg_shm_attach.map_size;
+		list_init (&shm_map->list);
+		list_add (&shm_map->list, &cpg_inst->shm_map_list_head);
+	}
+
+	/*
+	 * Release of seq 0 tells executive that arena is mapped. Deliveries
+	 * held from previous group were already released by executive on leave,
+	 * so arenas of previous groups are not needed anymore.
+	 */
+	cpg_shm_held_free (cpg_inst);
+	cpg_shm_maps_free (cpg_inst, shm_map);
+	cpg_inst->shm_arena_id = shm_map->arena_id;
+	cpg_inst->shm_delivered_seq = 0;
+	cpg_inst->shm_release_seq = 0;
+	cpg_inst->shm_release_pending = 1;
+	cpg_shm_release_send (cpg_inst);
+
+error_unlock:
+	pthread_mutex_unlock (&cpg_inst->shm_mutex);
+}
+
+static void cpg_send_queue_free (struct cpg_inst *cpg_inst)
+{
+	struct list_head *iter, *iter_next;
+
+	pthread_mutex_lock (&cpg_inst->send_queue_mutex);
+	for (iter = cpg_inst->send_queue_list_head.next;
+	    iter != &cpg_inst->send_queue_list_head; iter = iter_next) {
+		iter_next = iter->next;
+
+		list_del (iter);
+		free (list_entry (iter, struct cpg_send_queued, list));
+	}
+	cpg_inst->send_queue_msgs = 0;
+	cpg_inst->send_queue_bytes = 0;
+	pthread_mutex_unlock (&cpg_inst->send_queue_mutex);
+}
+
+/*
+ * Ask executive to send MESSAGE_RES_CPG_SEND_READY_CALLBACK when it accepts
+ * messages again. Request itself must not be refused by libqb flow control.
+ * Must be called with send_queue_mutex held.
+ */
+static void cpg_send_ready_request (struct cpg_inst *cpg_inst)
+{
+	struct req_lib_cpg_send_ready req_lib_cpg_send_ready;
+	struct iovec iov;
+
+	if (cpg_inst->send_ready_requested) {
+		return ;
+	}
+
+	req_lib_cpg_send_ready.header.size = sizeof (struct req_lib_cpg_send_ready);
+	req_lib_cpg_send_ready.header.id = MESSAGE_REQ_CPG_SEND_READY;
+
+	iov.iov_base = (void *)&req_lib_cpg_send_ready;
+	iov.iov_len = sizeof (struct req_lib_cpg_send_ready);
+
+	qb_ipcc_fc_enable_max_set(cpg_inst->c,  0);
+	if (qb_ipcc_sendv (cpg_inst->c, &iov, 1) >= 0) {
+		cpg_inst->send_ready_requested = 1;
+	}
+	qb_ipcc_fc_enable_max_set(cpg_inst->c,  1);
+}
+
+/*
+ * Pass queued messages to the executive, in order, until it refuses one.
+ * Must be called with send_queue_mutex held.
+ */
+static cs_error_t cpg_send_queue_flush (struct cpg_inst *cpg_inst)
+{
+	struct cpg_send_queued *queued;
+	struct iovec iov;
+	int32_t res = 0;
+
+	qb_ipcc_fc_enable_max_set(cpg_inst->c,  2);
+	while (!list_empty (&cpg_inst->send_queue_list_head)) {
+		queued = list_entry (cpg_inst->send_queue_list_head.next, struct cpg_send_queued, list);
+
+		iov.iov_base = queued->data;
+		iov.iov_len = queued->len;
+		res = qb_ipcc_sendv (cpg_inst->c, &iov, 1);
+		if (res < 0) {
+			break;
+		}
+
+		list_del (&queued->list);
+		cpg_inst->send_queue_msgs--;
+		cpg_inst->send_queue_bytes -= queued->len;
+		free (queued);
+	}
+	qb_ipcc_fc_enable_max_set(cpg_inst->c,  1);
+
+	if (res == -EAGAIN) {
+		cpg_send_ready_request (cpg_inst);
+		return (CS_OK);
+	}
+
+	return (qb_to_cs_error (res));
+}
+
 static void cpg_inst_free (void *inst)
 {
 	struct cpg_inst *cpg_inst = (struct cpg_inst *)inst;
 	qb_ipcc_disconnect(cpg_inst->c);
+	cpg_send_queue_free (cpg_inst);
+	cpg_partial_streams_free (cpg_inst);
+	cpg_shm_held_free (cpg_inst);
+	cpg_shm_maps_free (cpg_inst, NULL);
+	free (cpg_inst->deliver_batch_buf);
+	free (cpg_inst->deliver_batch_msgs);
+	pthread_mutex_destroy (&cpg_inst->response_mutex);
+	pthread_mutex_destroy (&cpg_inst->send_mutex);
+	pthread_mutex_destroy (&cpg_inst->send_queue_mutex);
+	pthread_mutex_destroy (&cpg_inst->shm_mutex);
 }
 
 static void cpg_inst_finalize (struct cpg_inst *cpg_inst, hdb_handle_t handle)
@@ -205,6 +636,11 @@ cs_error_t cpg_model_initialize (
 		goto error_destroy;
 	}
 
+	pthread_mutex_init (&cpg_inst->response_mutex, NULL);
+	pthread_mutex_init (&cpg_inst->send_mutex, NULL);
+	pthread_mutex_init (&cpg_inst->send_queue_mutex, NULL);
+	pthread_mutex_init (&cpg_inst->shm_mutex, NULL);
+
 	cpg_inst->c = qb_ipcc_connect ("cpg", IPC_REQUEST_SIZE);
 	if (cpg_inst->c == NULL) {
 		error = qb_to_cs_error(-errno);
@@ -215,7 +651,8 @@ cs_error_t cpg_model_initialize (
 		switch (model) {
 		case CPG_MODEL_V1:
 			memcpy (&cpg_inst->model_v1_data, model_data, sizeof (cpg_model_v1_data_t));
-			if ((cpg_inst->model_v1_data.flags & ~(CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF)) != 0) {
+			if ((cpg_inst->model_v1_data.flags & ~(CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF | CPG_MODEL_V1_DELIVER_SHARED |
+			    CPG_MODEL_V1_DELIVER_LOCAL_FIFO)) != 0) {
 				error = CS_ERR_INVALID_PARAM;
 
 				goto error_destroy;
@@ -230,6 +667,10 @@ cs_error_t cpg_model_initialize (
 	cpg_inst->context = context;
 
 	list_init(&cpg_inst->iteration_list_head);
+	list_init(&cpg_inst->partial_stream_list_head);
+	list_init(&cpg_inst->shm_map_list_head);
+	list_init(&cpg_inst->shm_held_list_head);
+	list_init(&cpg_inst->send_queue_list_head);
 
 	hdb_handle_put (&cpg_handle_t_db, *handle);
 
@@ -267,6 +708,11 @@ cs_error_t cpg_finalize (
 
 	cpg_inst->finalize = 1;
 
+	/*
+	 * Messages still queued by cpg_mcast_joined_async are not sent
+	 */
+	cpg_send_queue_free (cpg_inst);
+
 	/*
 	 * Send service request
 	 */
@@ -276,7 +722,7 @@ cs_error_t cpg_finalize (
 	iov.iov_base = (void *)&req_lib_cpg_finalize;
 	iov.iov_len = sizeof (struct req_lib_cpg_finalize);
 
-	error = coroipcc_msg_send_reply_receive (cpg_inst->c,
+	error = coroipcc_msg_send_reply_receive (cpg_inst->c, &cpg_inst->response_mutex,
 		&iov,
 		1,
 		&res_lib_cpg_finalize,
@@ -364,6 +810,184 @@ cs_error_t cpg_context_set (
 	return (CS_OK);
 }
 
+cs_error_t cpg_partial_deliver_callback_set (
+	cpg_handle_t handle,
+	cpg_partial_deliver_fn_t partial_deliver_fn)
+{
+	cs_error_t error;
+	struct cpg_inst *cpg_inst;
+
+	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	if (partial_deliver_fn == NULL) {
+		cpg_partial_streams_free (cpg_inst);
+	}
+	cpg_inst->partial_deliver_fn = partial_deliver_fn;
+
+	hdb_handle_put (&cpg_handle_t_db, handle);
+
+	return (CS_OK);
+}
+
+cs_error_t cpg_deliver_batch_callback_set (
+	cpg_handle_t handle,
+	cpg_deliver_batch_fn_t deliver_batch_fn)
+{
+	cs_error_t error;
+	struct cpg_inst *cpg_inst;
+
+	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	if (deliver_batch_fn != NULL && cpg_inst->model_data.model == CPG_MODEL_V1 &&
+	    (cpg_inst->model_v1_data.flags & CPG_MODEL_V1_DELIVER_SHARED)) {
+		/*
+		 * Shared deliveries can be kept by cpg_zcb_deliver_hold only
+		 * from cpg_deliver_fn, which batched delivery replaces
+		 */
+		error = CS_ERR_NOT_SUPPORTED;
+		goto error_put;
+	}
+
+	if (deliver_batch_fn != NULL && cpg_inst->deliver_batch_buf == NULL) {
+		cpg_inst->deliver_batch_buf = malloc (CPG_DELIVER_BATCH_BUF_SIZE);
+		cpg_inst->deliver_batch_msgs = malloc (CPG_DELIVER_BATCH_MAX *
+			sizeof (struct cpg_deliver_msg));
+		if (cpg_inst->deliver_batch_buf == NULL || cpg_inst->deliver_batch_msgs == NULL) {
+			free (cpg_inst->deliver_batch_buf);
+			free (cpg_inst->deliver_batch_msgs);
+			cpg_inst->deliver_batch_buf = NULL;
+			cpg_inst->deliver_batch_msgs = NULL;
+			error = CS_ERR_NO_MEMORY;
+			goto error_put;
+		}
+	}
+	cpg_inst->deliver_batch_fn = deliver_batch_fn;
+
+error_put:
+	hdb_handle_put (&cpg_handle_t_db, handle);
+
+	return (error);
+}
+
+static void cpg_deliver_batch_add (
+	struct cpg_deliver_msg *msg,
+	struct res_lib_cpg_deliver_callback *res_cpg_deliver_callback)
+{
+	marshall_from_mar_cpg_name_t (&msg->group_name,
+		&res_cpg_deliver_callback->group_name);
+	msg->nodeid = res_cpg_deliver_callback->nodeid;
+	msg->pid = res_cpg_deliver_callback->pid;
+	msg->msg = &res_cpg_deliver_callback->message;
+	msg->msg_len = res_cpg_deliver_callback->msglen;
+}
+
+/*
+ * Receive deliver callbacks following the first one (already received in
+ * dispatch buffer) directly into the batch buffer and pass all of them to
+ * the application at once. Event which is not a deliver callback ends the
+ * batch and is returned to the caller to be dispatched as usual.
+ */
+static struct qb_ipc_response_header *cpg_deliver_batch (
+	cpg_handle_t handle,
+	struct cpg_inst *cpg_inst,
+	cpg_deliver_batch_fn_t deliver_batch_fn,
+	struct res_lib_cpg_deliver_callback *first,
+	size_t max_msgs)
+{
+	struct cpg_deliver_msg *msgs = cpg_inst->deliver_batch_msgs;
+	struct qb_ipc_response_header *header;
+	struct qb_ipc_response_header *next_event = NULL;
+	size_t used = 0;
+	size_t count = 0;
+	ssize_t res;
+
+	cpg_deliver_batch_add (&msgs[count++], first);
+
+	while (count < max_msgs && count < CPG_DELIVER_BATCH_MAX &&
+	    CPG_DELIVER_BATCH_BUF_SIZE - used >= IPC_DISPATCH_SIZE) {
+		header = (struct qb_ipc_response_header *)(cpg_inst->deliver_batch_buf + used);
+		res = qb_ipcc_event_recv (cpg_inst->c, header, IPC_DISPATCH_SIZE, 0);
+		if (res <= 0) {
+			/*
+			 * Nothing more is waiting or error which is reported
+			 * by next receive in cpg_dispatch
+			 */
+			break;
+		}
+		used += QB_ROUNDUP (res, sizeof (uint64_t));
+
+		if (header->id != MESSAGE_RES_CPG_DELIVER_CALLBACK) {
+			next_event = header;
+			break;
+		}
+		cpg_deliver_batch_add (&msgs[count++],
+			(struct res_lib_cpg_deliver_callback *)header);
+	}
+
+	deliver_batch_fn (handle, msgs, count);
+
+	return (next_event);
+}
+
+/*
+ * Pass one fragment of large message directly to the application. Fragments
+ * of messages whose beginning was not seen (we joined in the middle of the
+ * send) are skipped, same as in the assembling code.
+ */
+static void cpg_partial_deliver_stream (
+	cpg_handle_t handle,
+	struct cpg_inst *cpg_inst,
+	cpg_partial_deliver_fn_t partial_deliver_fn,
+	const struct cpg_name *group_name,
+	struct res_lib_cpg_partial_deliver_callback *res)
+{
+	struct cpg_partial_stream *stream;
+	size_t offset;
+
+	stream = cpg_partial_stream_find (cpg_inst, res->nodeid, res->pid);
+
+	if (res->type == LIBCPG_PARTIAL_FIRST) {
+		if (stream == NULL) {
+			stream = malloc (sizeof (struct cpg_partial_stream));
+			if (stream == NULL) {
+				return ;
+			}
+			stream->nodeid = res->nodeid;
+			stream->pid = res->pid;
+			list_init (&stream->list);
+			list_add_tail (&stream->list, &cpg_inst->partial_stream_list_head);
+		}
+		stream->offset = 0;
+	}
+
+	if (stream == NULL) {
+		return ;
+	}
+
+	offset = stream->offset;
+	stream->offset += res->fraglen;
+
+	if (res->type == LIBCPG_PARTIAL_LAST) {
+		cpg_partial_stream_free (stream);
+	}
+
+	partial_deliver_fn (handle,
+		group_name,
+		res->nodeid,
+		res->pid,
+		res->type,
+		res->msglen,
+		offset,
+		res->message,
+		res->fraglen);
+}
+
 cs_error_t cpg_dispatch (
 	cpg_handle_t handle,
 	cs_dispatch_flags_t dispatch_types)
@@ -375,6 +999,7 @@ cs_error_t cpg_dispatch (
 	struct res_lib_cpg_confchg_callback *res_cpg_confchg_callback;
 	struct res_lib_cpg_deliver_callback *res_cpg_deliver_callback;
 	struct res_lib_cpg_partial_deliver_callback *res_cpg_partial_deliver_callback;
+	struct res_lib_cpg_shm_deliver_callback *res_cpg_shm_deliver_callback;
 	struct res_lib_cpg_totem_confchg_callback *res_cpg_totem_confchg_callback;
 	struct cpg_inst cpg_inst_copy;
 	struct qb_ipc_response_header *dispatch_data;
@@ -384,10 +1009,17 @@ cs_error_t cpg_dispatch (
 	struct cpg_name group_name;
 	mar_cpg_address_t *left_list_start;
 	mar_cpg_address_t *joined_list_start;
+	struct cpg_partial_stream *partial_stream;
+	struct cpg_shm_map *shm_map;
+	int shm_release_tried = 0;
+	int shm_release_pending;
+	void *shm_msg;
+	struct qb_ipc_response_header *pending_event = NULL;
 	unsigned int i;
 	struct cpg_ring_id ring_id;
 	uint32_t totem_member_list[CPG_MEMBERS_MAX];
 	int32_t errno_res;
+	size_t send_queue_bytes;
 	char dispatch_buf[IPC_DISPATCH_SIZE];
 
 	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
@@ -403,34 +1035,55 @@ cs_error_t cpg_dispatch (
 		timeout = 0;
 	}
 
-	dispatch_data = (struct qb_ipc_response_header *)dispatch_buf;
 	do {
-		errno_res = qb_ipcc_event_recv (
-			cpg_inst->c,
-			dispatch_buf,
-			IPC_DISPATCH_SIZE,
-			timeout);
-		error = qb_to_cs_error (errno_res);
-		if (error == CS_ERR_BAD_HANDLE) {
-			error = CS_OK;
-			goto error_put;
-		}
-		if (error == CS_ERR_TRY_AGAIN) {
-			if (dispatch_types == CS_DISPATCH_ONE_NONBLOCKING) {
+		if (pending_event != NULL) {
+			/*
+			 * Event which ended previous batch of delivered messages
+			 */
+			dispatch_data = pending_event;
+			pending_event = NULL;
+		} else {
+			dispatch_data = (struct qb_ipc_response_header *)dispatch_buf;
+			shm_release_pending = cpg_shm_release_pending_get (cpg_inst);
+			errno_res = qb_ipcc_event_recv (
+				cpg_inst->c,
+				dispatch_buf,
+				IPC_DISPATCH_SIZE,
+				(shm_release_pending && !shm_release_tried) ? 0 : timeout);
+			error = qb_to_cs_error (errno_res);
+			if (error == CS_ERR_BAD_HANDLE) {
+				error = CS_OK;
+				goto error_put;
+			}
+			if (error == CS_ERR_TRY_AGAIN && shm_release_pending && !shm_release_tried) {
 				/*
-				 * Don't mask error
+				 * Nothing more to dispatch now, so give consumed shared
+				 * deliveries back before waiting
 				 */
-				goto error_put;
+				cpg_shm_release_flush (cpg_inst);
+				shm_release_tried = 1;
+				if (timeout != 0) {
+					continue;
+				}
 			}
-			error = CS_OK;
-			if (dispatch_types == CS_DISPATCH_ALL) {
-				break; /* exit do while cont is 1 loop */
-			} else {
-				continue; /* next poll */
+			if (error == CS_ERR_TRY_AGAIN) {
+				if (dispatch_types == CS_DISPATCH_ONE_NONBLOCKING) {
+					/*
+					 * Don't mask error
+					 */
+					goto error_put;
+				}
+				error = CS_OK;
+				if (dispatch_types == CS_DISPATCH_ALL) {
+					break; /* exit do while cont is 1 loop */
+				} else {
+					continue; /* next poll */
+				}
 			}
-		}
-		if (error != CS_OK) {
-			goto error_put;
+			if (error != CS_OK) {
+				goto error_put;
+			}
+			shm_release_tried = 0;
 		}
 
 		/*
@@ -446,11 +1099,20 @@ cs_error_t cpg_dispatch (
 			 */
 			switch (dispatch_data->id) {
 			case MESSAGE_RES_CPG_DELIVER_CALLBACK:
-				if (cpg_inst_copy.model_v1_data.cpg_deliver_fn == NULL) {
+				res_cpg_deliver_callback = (struct res_lib_cpg_deliver_callback *)dispatch_data;
+
+				if (cpg_inst_copy.deliver_batch_fn != NULL) {
+					pending_event = cpg_deliver_batch (handle, cpg_inst,
+						cpg_inst_copy.deliver_batch_fn,
+						res_cpg_deliver_callback,
+						(dispatch_types == CS_DISPATCH_ALL ||
+						 dispatch_types == CS_DISPATCH_BLOCKING) ? CPG_DELIVER_BATCH_MAX : 1);
 					break;
 				}
 
-				res_cpg_deliver_callback = (struct res_lib_cpg_deliver_callback *)dispatch_data;
+				if (cpg_inst_copy.model_v1_data.cpg_deliver_fn == NULL) {
+					break;
+				}
 
 				marshall_from_mar_cpg_name_t (
 					&group_name,
@@ -471,6 +1133,14 @@ cs_error_t cpg_dispatch (
 					&group_name,
 					&res_cpg_partial_deliver_callback->group_name);
 
+				if (cpg_inst_copy.partial_deliver_fn != NULL) {
+					cpg_partial_deliver_stream (handle, cpg_inst,
+						cpg_inst_copy.partial_deliver_fn,
+						&group_name,
+						res_cpg_partial_deliver_callback);
+					break;
+				}
+
 				if (res_cpg_partial_deliver_callback->type == LIBCPG_PARTIAL_FIRST) {
 					/*
 					 * Allocate a buffer to contain a full message.
@@ -501,13 +1171,75 @@ cs_error_t cpg_dispatch (
 				}
 				break;
 
+			case MESSAGE_RES_CPG_SHM_DELIVER_CALLBACK:
+				res_cpg_shm_deliver_callback = (struct res_lib_cpg_shm_deliver_callback *)dispatch_data;
+
+				/*
+				 * shm_mutex is not held while callback runs, because
+				 * callback may call cpg_zcb_deliver_hold
+				 */
+				shm_msg = NULL;
+				pthread_mutex_lock (&cpg_inst->shm_mutex);
+				shm_map = cpg_shm_map_find (cpg_inst, res_cpg_shm_deliver_callback->arena_id);
+				if (cpg_inst_copy.model_v1_data.cpg_deliver_fn != NULL && shm_map != NULL &&
+				    res_cpg_shm_deliver_callback->offset <= shm_map->size &&
+				    res_cpg_shm_deliver_callback->msglen <=
+				    shm_map->size - res_cpg_shm_deliver_callback->offset) {
+					shm_msg = (char *)shm_map->addr + res_cpg_shm_deliver_callback->offset;
+
+					if (res_cpg_shm_deliver_callback->arena_id == cpg_inst->shm_arena_id) {
+						cpg_inst->shm_deliver_msg = shm_msg;
+						cpg_inst->shm_deliver_seq = res_cpg_shm_deliver_callback->seq;
+					}
+				}
+				pthread_mutex_unlock (&cpg_inst->shm_mutex);
+
+				if (shm_msg != NULL) {
+					marshall_from_mar_cpg_name_t (
+						&group_name,
+						&res_cpg_shm_deliver_callback->group_name);
+
+					cpg_inst_copy.model_v1_data.cpg_deliver_fn (handle,
+						&group_name,
+						res_cpg_shm_deliver_callback->nodeid,
+						res_cpg_shm_deliver_callback->pid,
+						shm_msg,
+						res_cpg_shm_deliver_callback->msglen);
+				}
+
+				pthread_mutex_lock (&cpg_inst->shm_mutex);
+				cpg_inst->shm_deliver_msg = NULL;
+				if (res_cpg_shm_deliver_callback->arena_id == cpg_inst->shm_arena_id) {
+					cpg_inst->shm_delivered_seq = res_cpg_shm_deliver_callback->seq;
+					cpg_shm_release_seq_update (cpg_inst);
+					cpg_inst->shm_release_pending++;
+					if (cpg_inst->shm_release_pending >= CPG_SHM_RELEASE_BATCH) {
+						cpg_shm_release_send (cpg_inst);
+					}
+				}
+				pthread_mutex_unlock (&cpg_inst->shm_mutex);
+				break;
+
 			case MESSAGE_RES_CPG_CONFCHG_CALLBACK:
+				res_cpg_confchg_callback = (struct res_lib_cpg_confchg_callback *)dispatch_data;
+
+				/*
+				 * Forget unfinished large messages of processes which left
+				 */
+				left_list_start = res_cpg_confchg_callback->member_list +
+					res_cpg_confchg_callback->member_list_entries;
+				for (i = 0; i < res_cpg_confchg_callback->left_list_entries; i++) {
+					partial_stream = cpg_partial_stream_find (cpg_inst,
+						left_list_start[i].nodeid, left_list_start[i].pid);
+					if (partial_stream != NULL) {
+						cpg_partial_stream_free (partial_stream);
+					}
+				}
+
 				if (cpg_inst_copy.model_v1_data.cpg_confchg_fn == NULL) {
 					break;
 				}
 
-				res_cpg_confchg_callback = (struct res_lib_cpg_confchg_callback *)dispatch_data;
-
 				for (i = 0; i < res_cpg_confchg_callback->member_list_entries; i++) {
 					marshall_from_mar_cpg_address_t (&member_list[i],
 						&res_cpg_confchg_callback->member_list[i]);
@@ -556,6 +1288,21 @@ cs_error_t cpg_dispatch (
 					res_cpg_totem_confchg_callback->member_list_entries,
 					totem_member_list);
 				break;
+			case MESSAGE_RES_CPG_SEND_READY_CALLBACK:
+				pthread_mutex_lock (&cpg_inst->send_queue_mutex);
+				cpg_inst->send_ready_requested = 0;
+				error = cpg_send_queue_flush (cpg_inst);
+				send_queue_bytes = cpg_inst->send_queue_bytes;
+				pthread_mutex_unlock (&cpg_inst->send_queue_mutex);
+				if (error != CS_OK) {
+					goto error_put;
+				}
+
+				if (cpg_inst_copy.send_ready_fn != NULL &&
+				    send_queue_bytes < CPG_SEND_QUEUE_MAX_BYTES) {
+					cpg_inst_copy.send_ready_fn (handle);
+				}
+				break;
 			default:
 				error = CS_ERR_LIBRARY;
 				goto error_put;
@@ -581,6 +1328,17 @@ cs_error_t cpg_dispatch (
 		}
 	} while (cont);
 
+	cpg_shm_release_flush (cpg_inst);
+
+	pthread_mutex_lock (&cpg_inst->send_queue_mutex);
+	if (!list_empty (&cpg_inst->send_queue_list_head) && !cpg_inst->send_ready_requested) {
+		/*
+		 * Previous send ready request couldn't be sent
+		 */
+		(void)cpg_send_queue_flush (cpg_inst);
+	}
+	pthread_mutex_unlock (&cpg_inst->send_queue_mutex);
+
 error_put:
 	hdb_handle_put (&cpg_handle_t_db, handle);
 	return (error);
@@ -624,7 +1382,7 @@ cs_error_t cpg_join (
 	iov[0].iov_len = sizeof (struct req_lib_cpg_join);
 
 	do {
-		error = coroipcc_msg_send_reply_receive (cpg_inst->c, iov, 1,
+		error = coroipcc_msg_send_reply_receive (cpg_inst->c, &cpg_inst->response_mutex, iov, 1,
 			&response, sizeof (struct res_lib_cpg_join));
 
 		if (error != CS_OK) {
@@ -634,6 +1392,10 @@ cs_error_t cpg_join (
 
 	error = response.header.error;
 
+	if (error == CS_OK && (req_lib_cpg_join.flags & CPG_MODEL_V1_DELIVER_SHARED)) {
+		cpg_shm_attach (cpg_inst);
+	}
+
 error_exit:
 	hdb_handle_put (&cpg_handle_t_db, handle);
 
@@ -669,7 +1431,7 @@ cs_error_t cpg_leave (
 	iov[0].iov_len = sizeof (struct req_lib_cpg_leave);
 
 	do {
-		error = coroipcc_msg_send_reply_receive (cpg_inst->c, iov, 1,
+		error = coroipcc_msg_send_reply_receive (cpg_inst->c, &cpg_inst->response_mutex, iov, 1,
 			&res_lib_cpg_leave, sizeof (struct res_lib_cpg_leave));
 
 		if (error != CS_OK) {
@@ -722,7 +1484,7 @@ cs_error_t cpg_membership_get (
 	iov.iov_base = (void *)&req_lib_cpg_membership_get;
 	iov.iov_len = sizeof (struct req_lib_cpg_membership_get);
 
-	error = coroipcc_msg_send_reply_receive (cpg_inst->c, &iov, 1,
+	error = coroipcc_msg_send_reply_receive (cpg_inst->c, &cpg_inst->response_mutex, &iov, 1,
 			&res_lib_cpg_membership_get, sizeof (res_lib_cpg_membership_get));
 
 	if (error != CS_OK) {
@@ -769,7 +1531,7 @@ cs_error_t cpg_local_get (
 	iov.iov_base = (void *)&req_lib_cpg_local_get;
 	iov.iov_len = sizeof (struct req_lib_cpg_local_get);
 
-	error = coroipcc_msg_send_reply_receive (cpg_inst->c, &iov, 1,
+	error = coroipcc_msg_send_reply_receive (cpg_inst->c, &cpg_inst->response_mutex, &iov, 1,
 		&res_lib_cpg_local_get, sizeof (res_lib_cpg_local_get));
 
 	if (error != CS_OK) {
@@ -923,6 +1685,7 @@ cs_error_t cpg_zcb_alloc (
 
 	error = coroipcc_msg_send_reply_receive (
 		cpg_inst->c,
+		&cpg_inst->response_mutex,
 		&iovec,
 		1,
 		&res_coroipcs_zc_alloc,
@@ -968,6 +1731,7 @@ cs_error_t cpg_zcb_free (
 
 	error = coroipcc_msg_send_reply_receive (
 		cpg_inst->c,
+		&cpg_inst->response_mutex,
 		&iovec,
 		1,
 		&res_coroipcs_zc_free,
@@ -990,6 +1754,94 @@ error_exit:
 	return (error);
 }
 
+cs_error_t cpg_zcb_deliver_hold (
+	cpg_handle_t handle,
+	const void *msg)
+{
+	cs_error_t error;
+	struct cpg_inst *cpg_inst;
+	struct cpg_shm_held *held;
+
+	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	pthread_mutex_lock (&cpg_inst->shm_mutex);
+	if (cpg_inst->shm_deliver_msg == NULL || cpg_inst->shm_deliver_msg != msg) {
+		error = CS_ERR_NOT_EXIST;
+		goto error_unlock;
+	}
+
+	held = malloc (sizeof (struct cpg_shm_held));
+	if (held == NULL) {
+		error = CS_ERR_NO_MEMORY;
+		goto error_unlock;
+	}
+
+	held->msg = msg;
+	held->seq = cpg_inst->shm_deliver_seq;
+	list_init (&held->list);
+	list_add_tail (&held->list, &cpg_inst->shm_held_list_head);
+
+	cpg_inst->shm_deliver_msg = NULL;
+
+error_unlock:
+	pthread_mutex_unlock (&cpg_inst->shm_mutex);
+	hdb_handle_put (&cpg_handle_t_db, handle);
+
+	return (error);
+}
+
+cs_error_t cpg_zcb_deliver_release (
+	cpg_handle_t handle,
+	const void *msg)
+{
+	cs_error_t error;
+	struct cpg_inst *cpg_inst;
+	struct cpg_shm_held *held;
+	struct list_head *iter;
+	int oldest;
+
+	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	error = CS_ERR_NOT_EXIST;
+
+	pthread_mutex_lock (&cpg_inst->shm_mutex);
+	for (iter = cpg_inst->shm_held_list_head.next;
+	    iter != &cpg_inst->shm_held_list_head; iter = iter->next) {
+		held = list_entry (iter, struct cpg_shm_held, list);
+
+		if (held->msg != msg) {
+			continue;
+		}
+
+		oldest = (iter == cpg_inst->shm_held_list_head.next);
+		list_del (&held->list);
+		free (held);
+		error = CS_OK;
+
+		/*
+		 * Only release of the oldest held delivery lets executive
+		 * reuse part of the arena
+		 */
+		if (oldest) {
+			cpg_shm_release_seq_update (cpg_inst);
+			cpg_inst->shm_release_pending++;
+			cpg_shm_release_send (cpg_inst);
+		}
+		break;
+	}
+	pthread_mutex_unlock (&cpg_inst->shm_mutex);
+
+	hdb_handle_put (&cpg_handle_t_db, handle);
+
+	return (error);
+}
+
 cs_error_t cpg_zcb_mcast_joined (
 	cpg_handle_t handle,
 	cpg_guarantee_t guarantee,
@@ -1033,6 +1885,7 @@ cs_error_t cpg_zcb_mcast_joined (
 
 	error = coroipcc_msg_send_reply_receive (
 		cpg_inst->c,
+		&cpg_inst->response_mutex,
 		&iovec,
 		1,
 		&res_lib_cpg_mcast,
@@ -1050,83 +1903,231 @@ error_exit:
 	return (error);
 }
 
-static cs_error_t send_fragments (
+/*
+ * Position of fragment inside of the iovec passed to cpg_mcast_joined
+ */
+struct cpg_partial_pos {
+	unsigned int i;
+	size_t iov_sent;
+	size_t sent;
+};
+
+/*
+ * Wait for response to the oldest fragment in flight
+ */
+static cs_error_t send_fragments_credit_recv (
 	struct cpg_inst *cpg_inst,
-	cpg_guarantee_t guarantee,
-	size_t msg_len,
+	struct res_lib_cpg_partial_send_credit *res)
+{
+	ssize_t rc;
+
+	rc = qb_ipcc_recv (cpg_inst->c, res, sizeof (*res), CS_IPC_TIMEOUT_MS);
+	if (rc < 0) {
+		return (qb_to_cs_error (rc));
+	}
+
+	return (res->header.error);
+}
+
+/*
+ * Nothing is in flight and fragments are refused. Wait on the response
+ * channel until executive accepts them again.
+ */
+static cs_error_t send_fragments_credit_wait (struct cpg_inst *cpg_inst)
+{
+	struct iovec iov;
+	struct req_lib_cpg_partial_send_wait req_lib_cpg_partial_send_wait;
+	struct res_lib_cpg_partial_send_credit res_lib_cpg_partial_send_credit;
+	int32_t rc;
+
+	req_lib_cpg_partial_send_wait.header.size = sizeof (struct req_lib_cpg_partial_send_wait);
+	req_lib_cpg_partial_send_wait.header.id = MESSAGE_REQ_CPG_PARTIAL_SEND_WAIT;
+
+	iov.iov_base = (void *)&req_lib_cpg_partial_send_wait;
+	iov.iov_len = sizeof (struct req_lib_cpg_partial_send_wait);
+
+	/*
+	 * Server side flow control is what we wait for, so don't let libqb
+	 * refuse the request because of it
+	 */
+	qb_ipcc_fc_enable_max_set(cpg_inst->c,  0);
+	rc = qb_ipcc_sendv (cpg_inst->c, &iov, 1);
+	qb_ipcc_fc_enable_max_set(cpg_inst->c,  2);
+	if (rc < 0) {
+		/*
+		 * Request buffer is full of requests of other threads
+		 */
+		return (qb_to_cs_error (rc));
+	}
+
+	return (send_fragments_credit_recv (cpg_inst, &res_lib_cpg_partial_send_credit));
+}
+
+/*
+ * Send one window of fragments starting at pos and collect all their
+ * credits. Must be called with response_mutex held.
+ */
+static cs_error_t send_fragments_window (
+	struct cpg_inst *cpg_inst,
+	struct req_lib_cpg_partial_mcast_pipelined *req_lib_cpg_mcast,
+	size_t frag_size,
 	const struct iovec *iovec,
-	unsigned int iov_len)
+	struct cpg_partial_pos *pos)
 {
-	int i;
-	cs_error_t error = CS_OK;
+	cs_error_t error;
 	struct iovec iov[2];
-	struct req_lib_cpg_partial_mcast req_lib_cpg_mcast;
-	struct res_lib_cpg_partial_send res_lib_cpg_partial_send;
-	size_t sent = 0;
-	size_t iov_sent = 0;
-	int retry_count;
+	struct res_lib_cpg_partial_send_credit res_lib_cpg_partial_send_credit;
+	struct cpg_partial_pos in_flight[CPG_PARTIAL_WINDOW];
+	size_t msg_len = req_lib_cpg_mcast->msglen;
+	uint32_t seq_base = req_lib_cpg_mcast->seq;
+	uint32_t sent = 0;
+	uint32_t acked = 0;
+	uint32_t i;
+	int32_t rc;
+	int retry_count = 0;
+
+	iov[0].iov_base = (void *)req_lib_cpg_mcast;
+	iov[0].iov_len = sizeof (struct req_lib_cpg_partial_mcast_pipelined);
+
+	while ((pos->sent < msg_len && sent < CPG_PARTIAL_WINDOW) || acked < sent) {
+		if (pos->sent < msg_len && sent < CPG_PARTIAL_WINDOW) {
+			if ((iovec[pos->i].iov_len - pos->iov_sent) > frag_size) {
+				iov[1].iov_len = frag_size;
+			} else {
+				iov[1].iov_len = iovec[pos->i].iov_len - pos->iov_sent;
+			}
 
-	req_lib_cpg_mcast.header.id = MESSAGE_REQ_CPG_PARTIAL_MCAST;
-	req_lib_cpg_mcast.guarantee = guarantee;
-	req_lib_cpg_mcast.msglen = msg_len;
+			if (pos->sent == 0) {
+				req_lib_cpg_mcast->type = LIBCPG_PARTIAL_FIRST;
+			} else if ((pos->sent + iov[1].iov_len) == msg_len) {
+				req_lib_cpg_mcast->type = LIBCPG_PARTIAL_LAST;
+			} else {
+				req_lib_cpg_mcast->type = LIBCPG_PARTIAL_CONTINUED;
+			}
 
-	iov[0].iov_base = (void *)&req_lib_cpg_mcast;
-	iov[0].iov_len = sizeof (struct req_lib_cpg_partial_mcast);
+			req_lib_cpg_mcast->seq = seq_base + sent;
+			req_lib_cpg_mcast->fraglen = iov[1].iov_len;
+			req_lib_cpg_mcast->header.size = sizeof (struct req_lib_cpg_partial_mcast_pipelined) +
+				iov[1].iov_len;
+			iov[1].iov_base = (char *)iovec[pos->i].iov_base + pos->iov_sent;
 
-	i=0;
-	iov_sent = 0 ;
-	qb_ipcc_fc_enable_max_set(cpg_inst->c,  2);
+			rc = qb_ipcc_sendv (cpg_inst->c, iov, 2);
+			if (rc >= 0) {
+				in_flight[sent] = *pos;
+				sent++;
 
-	while (error == CS_OK && sent < msg_len) {
+				pos->iov_sent += iov[1].iov_len;
+				pos->sent += iov[1].iov_len;
 
-		retry_count = 0;
-		if ( (iovec[i].iov_len - iov_sent) > cpg_inst->max_msg_size) {
-			iov[1].iov_len = cpg_inst->max_msg_size;
+				/* Next iovec */
+				if (pos->iov_sent >= iovec[pos->i].iov_len) {
+					pos->i++;
+					pos->iov_sent = 0;
+				}
+				continue;
+			}
+
+			if (rc != -EAGAIN) {
+				return (qb_to_cs_error (rc));
+			}
+			if (acked == sent) {
+				/*
+				 * Nothing is in flight, so there is no credit to
+				 * wait for. This happens only when executive turned
+				 * on flow control (sync in progress).
+				 */
+				if (++retry_count > MAX_RETRIES) {
+					return (CS_ERR_TRY_AGAIN);
+				}
+				error = send_fragments_credit_wait (cpg_inst);
+				if (error != CS_OK) {
+					return (error);
+				}
+				continue;
+			}
+			/*
+			 * Request buffer is full, wait for credit
+			 */
 		}
-		else {
-			iov[1].iov_len = iovec[i].iov_len - iov_sent;
+
+		error = send_fragments_credit_recv (cpg_inst, &res_lib_cpg_partial_send_credit);
+		if (error == CS_OK) {
+			acked++;
+			retry_count = 0;
+			continue;
 		}
 
-		if (sent == 0) {
-			req_lib_cpg_mcast.type = LIBCPG_PARTIAL_FIRST;
+		/*
+		 * Executive refuses all fragments after the failed one, collect
+		 * their responses
+		 */
+		for (i = acked + 1; i < sent; i++) {
+			(void)send_fragments_credit_recv (cpg_inst, &res_lib_cpg_partial_send_credit);
 		}
-		else if ((sent + iov[1].iov_len) == msg_len) {
-			req_lib_cpg_mcast.type = LIBCPG_PARTIAL_LAST;
+
+		if (error != CS_ERR_TRY_AGAIN || ++retry_count > MAX_RETRIES) {
+			return (error);
 		}
-		else {
-			req_lib_cpg_mcast.type = LIBCPG_PARTIAL_CONTINUED;
+
+		/*
+		 * Executive was overloaded, wait until it accepts fragments
+		 * again and resend from the refused one
+		 */
+		error = send_fragments_credit_wait (cpg_inst);
+		if (error != CS_OK) {
+			return (error);
 		}
+		sent = acked;
+		*pos = in_flight[acked];
+	}
 
-		req_lib_cpg_mcast.fraglen = iov[1].iov_len;
-		req_lib_cpg_mcast.header.size = sizeof (struct req_lib_cpg_partial_mcast) + iov[1].iov_len;
-		iov[1].iov_base = (char *)iovec[i].iov_base + iov_sent;
+	req_lib_cpg_mcast->seq = seq_base + sent;
 
-	resend:
-		error = coroipcc_msg_send_reply_receive (cpg_inst->c, iov, 2,
-							 &res_lib_cpg_partial_send,
-							 sizeof (res_lib_cpg_partial_send));
+	return (CS_OK);
+}
 
-		if (error == CS_ERR_TRY_AGAIN) {
-			fprintf(stderr, "sleep. counter=%d\n", retry_count);
-			if (++retry_count > MAX_RETRIES) {
-				goto error_exit;
-			}
-			usleep(10000);
-			goto resend;
-		}
+static cs_error_t send_fragments (
+	struct cpg_inst *cpg_inst,
+	cpg_guarantee_t guarantee,
+	size_t msg_len,
+	const struct iovec *iovec,
+	unsigned int iov_len)
+{
+	cs_error_t error = CS_OK;
+	struct req_lib_cpg_partial_mcast_pipelined req_lib_cpg_mcast;
+	struct cpg_partial_pos pos;
+	size_t frag_size;
 
-		iov_sent += iov[1].iov_len;
-		sent += iov[1].iov_len;
+	frag_size = cpg_inst->max_msg_size / CPG_PARTIAL_WINDOW -
+		sizeof (struct req_lib_cpg_partial_mcast_pipelined);
+
+	pthread_mutex_lock (&cpg_inst->send_mutex);
+
+	req_lib_cpg_mcast.header.id = MESSAGE_REQ_CPG_PARTIAL_MCAST_PIPELINED;
+	req_lib_cpg_mcast.guarantee = guarantee;
+	req_lib_cpg_mcast.msglen = msg_len;
+	req_lib_cpg_mcast.msgid = ++cpg_inst->partial_msgid;
+	req_lib_cpg_mcast.seq = 0;
+
+	memset (&pos, 0, sizeof (pos));
+
+	while (pos.sent < msg_len) {
+		/*
+		 * Credits come on the response channel, keep other synchronous
+		 * calls out until all credits of the window are collected
+		 */
+		pthread_mutex_lock (&cpg_inst->response_mutex);
+		qb_ipcc_fc_enable_max_set(cpg_inst->c,  2);
+		error = send_fragments_window (cpg_inst, &req_lib_cpg_mcast, frag_size, iovec, &pos);
+		qb_ipcc_fc_enable_max_set(cpg_inst->c,  1);
+		pthread_mutex_unlock (&cpg_inst->response_mutex);
 
-		/* Next iovec */
-		if (iov_sent >= iovec[i].iov_len) {
-			i++;
-			iov_sent = 0;
+		if (error != CS_OK) {
+			break;
 		}
-		error = res_lib_cpg_partial_send.header.error;
 	}
-error_exit:
-	qb_ipcc_fc_enable_max_set(cpg_inst->c,  1);
+
+	pthread_mutex_unlock (&cpg_inst->send_mutex);
 
 	return error;
 }
@@ -1154,7 +2155,32 @@ cs_error_t cpg_mcast_joined (
 		msg_len += iovec[i].iov_len;
 	}
 
+	/*
+	 * Total length of message is transferred as 32-bit value
+	 */
+	if (msg_len > UINT32_MAX) {
+		error = CS_ERR_TOO_BIG;
+		goto error_exit;
+	}
+
+	/*
+	 * Messages queued by cpg_mcast_joined_async go first, so this message
+	 * doesn't overtake them
+	 */
+	pthread_mutex_lock (&cpg_inst->send_queue_mutex);
+	if (!list_empty (&cpg_inst->send_queue_list_head)) {
+		error = cpg_send_queue_flush (cpg_inst);
+		if (error == CS_OK && !list_empty (&cpg_inst->send_queue_list_head)) {
+			error = CS_ERR_TRY_AGAIN;
+		}
+		if (error != CS_OK) {
+			pthread_mutex_unlock (&cpg_inst->send_queue_mutex);
+			goto error_exit;
+		}
+	}
+
 	if (msg_len > cpg_inst->max_msg_size) {
+		pthread_mutex_unlock (&cpg_inst->send_queue_mutex);
 		error = send_fragments(cpg_inst, guarantee, msg_len, iovec, iov_len);
 		goto error_exit;
 	}
@@ -1173,13 +2199,146 @@ cs_error_t cpg_mcast_joined (
 	qb_ipcc_fc_enable_max_set(cpg_inst->c,  2);
 	error = qb_to_cs_error(qb_ipcc_sendv(cpg_inst->c, iov, iov_len + 1));
 	qb_ipcc_fc_enable_max_set(cpg_inst->c,  1);
+	pthread_mutex_unlock (&cpg_inst->send_queue_mutex);
+
+error_exit:
+	hdb_handle_put (&cpg_handle_t_db, handle);
+
+	return (error);
+}
+
+cs_error_t cpg_mcast_joined_async (
+	cpg_handle_t handle,
+	cpg_guarantee_t guarantee,
+	const struct iovec *iovec,
+	unsigned int iov_len)
+{
+	int i;
+	cs_error_t error;
+	struct cpg_inst *cpg_inst;
+	struct iovec iov[64];
+	struct req_lib_cpg_mcast req_lib_cpg_mcast;
+	struct cpg_send_queued *queued;
+	size_t msg_len = 0;
+	size_t pos;
+	int32_t res;
+
+	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	if (iov_len > 63) {
+		error = CS_ERR_INVALID_PARAM;
+		goto error_exit;
+	}
+
+	for (i = 0; i < iov_len; i++ ) {
+		msg_len += iovec[i].iov_len;
+	}
+
+	if (msg_len > cpg_inst->max_msg_size) {
+		error = CS_ERR_TOO_BIG;
+		goto error_exit;
+	}
+
+	req_lib_cpg_mcast.header.size = sizeof (struct req_lib_cpg_mcast) +
+		msg_len;
+	req_lib_cpg_mcast.header.id = MESSAGE_REQ_CPG_MCAST;
+	req_lib_cpg_mcast.guarantee = guarantee;
+	req_lib_cpg_mcast.msglen = msg_len;
+
+	iov[0].iov_base = (void *)&req_lib_cpg_mcast;
+	iov[0].iov_len = sizeof (struct req_lib_cpg_mcast);
+	memcpy (&iov[1], iovec, iov_len * sizeof (struct iovec));
+
+	pthread_mutex_lock (&cpg_inst->send_queue_mutex);
+	if (list_empty (&cpg_inst->send_queue_list_head)) {
+		qb_ipcc_fc_enable_max_set(cpg_inst->c,  2);
+		res = qb_ipcc_sendv(cpg_inst->c, iov, iov_len + 1);
+		qb_ipcc_fc_enable_max_set(cpg_inst->c,  1);
+		if (res != -EAGAIN) {
+			error = qb_to_cs_error (res);
+			goto error_unlock;
+		}
+	}
+
+	/*
+	 * Executive doesn't accept messages now (or there are older messages
+	 * waiting), so queue copy of message
+	 */
+	if (cpg_inst->send_queue_bytes + req_lib_cpg_mcast.header.size > CPG_SEND_QUEUE_MAX_BYTES) {
+		error = CS_ERR_TRY_AGAIN;
+		goto error_unlock;
+	}
+
+	queued = malloc (sizeof (struct cpg_send_queued) + req_lib_cpg_mcast.header.size);
+	if (queued == NULL) {
+		error = CS_ERR_NO_MEMORY;
+		goto error_unlock;
+	}
+	queued->len = req_lib_cpg_mcast.header.size;
+	pos = 0;
+	for (i = 0; i < iov_len + 1; i++) {
+		memcpy (queued->data + pos, iov[i].iov_base, iov[i].iov_len);
+		pos += iov[i].iov_len;
+	}
+	list_add_tail (&queued->list, &cpg_inst->send_queue_list_head);
+	cpg_inst->send_queue_msgs++;
+	cpg_inst->send_queue_bytes += queued->len;
 
+	error = cpg_send_queue_flush (cpg_inst);
+
+error_unlock:
+	pthread_mutex_unlock (&cpg_inst->send_queue_mutex);
 error_exit:
 	hdb_handle_put (&cpg_handle_t_db, handle);
 
 	return (error);
 }
 
+cs_error_t cpg_send_ready_callback_set (
+	cpg_handle_t handle,
+	cpg_send_ready_fn_t send_ready_fn)
+{
+	cs_error_t error;
+	struct cpg_inst *cpg_inst;
+
+	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	cpg_inst->send_ready_fn = send_ready_fn;
+
+	hdb_handle_put (&cpg_handle_t_db, handle);
+
+	return (CS_OK);
+}
+
+cs_error_t cpg_send_queue_get (
+	cpg_handle_t handle,
+	uint32_t *msgs,
+	size_t *bytes)
+{
+	cs_error_t error;
+	struct cpg_inst *cpg_inst;
+
+	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	pthread_mutex_lock (&cpg_inst->send_queue_mutex);
+	*msgs = cpg_inst->send_queue_msgs;
+	*bytes = cpg_inst->send_queue_bytes;
+	pthread_mutex_unlock (&cpg_inst->send_queue_mutex);
+
+	hdb_handle_put (&cpg_handle_t_db, handle);
+
+	return (CS_OK);
+}
+
 cs_error_t cpg_iteration_initialize(
 	cpg_handle_t handle,
 	cpg_iteration_type_t iteration_type,
@@ -1229,6 +2388,7 @@ cs_error_t cpg_iteration_initialize(
 	}
 
 	cpg_iteration_instance->conn = cpg_inst->c;
+	cpg_iteration_instance->response_mutex = &cpg_inst->response_mutex;
 
 	list_init (&cpg_iteration_instance->list);
 
@@ -1242,7 +2402,7 @@ cs_error_t cpg_iteration_initialize(
 	iov.iov_base = (void *)&req_lib_cpg_iterationinitialize;
 	iov.iov_len = sizeof (struct req_lib_cpg_iterationinitialize);
 
-	error = coroipcc_msg_send_reply_receive (cpg_inst->c,
+	error = coroipcc_msg_send_reply_receive (cpg_inst->c, &cpg_inst->response_mutex,
 		&iov,
 		1,
 		&res_lib_cpg_iterationinitialize,
@@ -1296,16 +2456,16 @@ cs_error_t cpg_iteration_next(
 	req_lib_cpg_iterationnext.header.id = MESSAGE_REQ_CPG_ITERATIONNEXT;
 	req_lib_cpg_iterationnext.iteration_handle = cpg_iteration_instance->executive_iteration_handle;
 
+	pthread_mutex_lock (cpg_iteration_instance->response_mutex);
 	error = qb_to_cs_error (qb_ipcc_send (cpg_iteration_instance->conn,
 				&req_lib_cpg_iterationnext,
 				req_lib_cpg_iterationnext.header.size));
-	if (error != CS_OK) {
-		goto error_put;
+	if (error == CS_OK) {
+		error = qb_to_cs_error (qb_ipcc_recv (cpg_iteration_instance->conn,
+					&res_lib_cpg_iterationnext,
+					sizeof(struct res_lib_cpg_iterationnext), -1));
 	}
-
-	error = qb_to_cs_error (qb_ipcc_recv (cpg_iteration_instance->conn,
-				&res_lib_cpg_iterationnext,
-				sizeof(struct res_lib_cpg_iterationnext), -1));
+	pthread_mutex_unlock (cpg_iteration_instance->response_mutex);
 	if (error != CS_OK) {
 		goto error_put;
 	}
@@ -1346,6 +2506,7 @@ cs_error_t cpg_iteration_finalize (
 	iov.iov_len = sizeof (struct req_lib_cpg_iterationfinalize);
 
 	error = coroipcc_msg_send_reply_receive (cpg_iteration_instance->conn,
+		cpg_iteration_instance->response_mutex,
 		&iov,
 		1,
 		&res_lib_cpg_iterationfinalize,
@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Same as cpgbench, but messages are sent by cpg_mcast_joined_async. When
+ * the send queue is full, sender waits for cpg_send_ready_fn_t callback
+ * instead of retrying. Every 16th message is sent by cpg_mcast_joined to
+ * check that synchronous and asynchronous sends are not reordered.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#include <qb/qblog.h>
+#include <qb/qbutil.h>
+
+#include <corosync/corotypes.h>
+#include <corosync/cpg.h>
+
+static cpg_handle_t handle;
+
+static pthread_t thread;
+
+#ifndef timersub
+#define timersub(a, b, result)						\
+	do {								\
+		(result)->tv_sec = (a)->tv_sec - (b)->tv_sec;		\
+		(result)->tv_usec = (a)->tv_usec - (b)->tv_usec;	\
+		if ((result)->tv_usec < 0) {				\
+			--(result)->tv_sec;				\
+			(result)->tv_usec += 1000000;			\
+		}							\
+	} while (0)
+#endif /* timersub */
+
+/*
+ * Every SYNC_EVERY-th message is sent by cpg_mcast_joined
+ */
+#define SYNC_EVERY 16
+
+/*
+ * Send ready callback is waited for at most this long, so lost wakeup
+ * can't hang the benchmark
+ */
+#define SEND_READY_WAIT_MS 100
+
+static int alarm_notice;
+
+static unsigned int local_nodeid;
+
+static pthread_mutex_t send_ready_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t send_ready_cond = PTHREAD_COND_INITIALIZER;
+static int send_ready;
+
+static void cpg_bm_confchg_fn (
+	cpg_handle_t handle_in,
+	const struct cpg_name *group_name,
+	const struct cpg_address *member_list, size_t member_list_entries,
+	const struct cpg_address *left_list, size_t left_list_entries,
+	const struct cpg_address *joined_list, size_t joined_list_entries)
+{
+}
+
+static unsigned int write_count;
+static uint32_t expected_seq;
+static unsigned int out_of_order;
+
+static void cpg_bm_deliver_fn (
+        cpg_handle_t handle_in,
+        const struct cpg_name *group_name,
+        uint32_t nodeid,
+        uint32_t pid,
+        void *msg,
+        size_t msg_len)
+{
+	uint32_t seq;
+
+	write_count++;
+
+	if (nodeid != local_nodeid || pid != getpid () || msg_len < sizeof (seq)) {
+		return ;
+	}
+
+	memcpy (&seq, msg, sizeof (seq));
+	if (seq != expected_seq) {
+		out_of_order++;
+	}
+	expected_seq = seq + 1;
+}
+
+static void cpg_bm_send_ready_fn (
+	cpg_handle_t handle_in)
+{
+	pthread_mutex_lock (&send_ready_mutex);
+	send_ready = 1;
+	pthread_cond_signal (&send_ready_cond);
+	pthread_mutex_unlock (&send_ready_mutex);
+}
+
+static cpg_callbacks_t callbacks = {
+	.cpg_deliver_fn 	= cpg_bm_deliver_fn,
+	.cpg_confchg_fn		= cpg_bm_confchg_fn
+};
+
+static void send_ready_wait (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_REALTIME, &ts);
+	ts.tv_nsec += SEND_READY_WAIT_MS * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock (&send_ready_mutex);
+	while (!send_ready) {
+		if (pthread_cond_timedwait (&send_ready_cond, &send_ready_mutex, &ts) == ETIMEDOUT) {
+			break;
+		}
+	}
+	send_ready = 0;
+	pthread_mutex_unlock (&send_ready_mutex);
+}
+
+#define ONE_MEG 1048576
+static char data[ONE_MEG];
+
+static void cpg_benchmark (
+	cpg_handle_t handle_in,
+	int write_size)
+{
+	struct timeval tv1, tv2, tv_elapsed;
+	struct iovec iov;
+	unsigned int res;
+	unsigned int waits = 0;
+	uint32_t seq = 0;
+	uint32_t queued_msgs;
+	size_t queued_bytes;
+
+	alarm_notice = 0;
+	iov.iov_base = data;
+	iov.iov_len = write_size;
+
+	write_count = 0;
+	expected_seq = 0;
+	out_of_order = 0;
+	alarm (10);
+
+	gettimeofday (&tv1, NULL);
+	do {
+		memcpy (data, &seq, sizeof (seq));
+		if (seq % SYNC_EVERY == SYNC_EVERY - 1) {
+			res = cpg_mcast_joined (handle_in, CPG_TYPE_AGREED, &iov, 1);
+		} else {
+			res = cpg_mcast_joined_async (handle_in, CPG_TYPE_AGREED, &iov, 1);
+		}
+		if (res == CS_OK) {
+			seq++;
+		} else if (res == CS_ERR_TRY_AGAIN) {
+			waits++;
+			send_ready_wait ();
+		}
+	} while (alarm_notice == 0 && (res == CS_OK || res == CS_ERR_TRY_AGAIN));
+
+	/*
+	 * Let queued messages go out
+	 */
+	while (cpg_send_queue_get (handle_in, &queued_msgs, &queued_bytes) == CS_OK &&
+	    queued_msgs > 0) {
+		send_ready_wait ();
+	}
+	gettimeofday (&tv2, NULL);
+	timersub (&tv2, &tv1, &tv_elapsed);
+
+	printf ("%5d messages received ", write_count);
+	printf ("%5d bytes per write ", write_size);
+	printf ("%7.3f Seconds runtime ",
+		(tv_elapsed.tv_sec + (tv_elapsed.tv_usec / 1000000.0)));
+	printf ("%9.3f TP/s ",
+		((float)write_count) /  (tv_elapsed.tv_sec + (tv_elapsed.tv_usec / 1000000.0)));
+	printf ("%7.3f MB/s ",
+		((float)write_count) * ((float)write_size) /  ((tv_elapsed.tv_sec + (tv_elapsed.tv_usec / 1000000.0)) * 1000000.0));
+	printf ("%5d queue full waits %5d out of order.\n", waits, out_of_order);
+}
+
+static void sigalrm_handler (int num)
+{
+	alarm_notice = 1;
+}
+
+static struct cpg_name group_name = {
+	.value = "cpg_bm",
+	.length = 6
+};
+
+static void* dispatch_thread (void *arg)
+{
+	cpg_dispatch (handle, CS_DISPATCH_BLOCKING);
+	return NULL;
+}
+
+int main (void) {
+	unsigned int size;
+	int i;
+	unsigned int res;
+	unsigned int errors = 0;
+
+	qb_log_init("cpgbenchasync", LOG_USER, LOG_EMERG);
+	qb_log_ctl(QB_LOG_SYSLOG, QB_LOG_CONF_ENABLED, QB_FALSE);
+	qb_log_filter_ctl(QB_LOG_STDERR, QB_LOG_FILTER_ADD,
+			  QB_LOG_FILTER_FILE, "*", LOG_DEBUG);
+	qb_log_ctl(QB_LOG_STDERR, QB_LOG_CONF_ENABLED, QB_TRUE);
+
+	size = 64;
+	signal (SIGALRM, sigalrm_handler);
+	res = cpg_initialize (&handle, &callbacks);
+	if (res != CS_OK) {
+		printf ("cpg_initialize failed with result %d\n", res);
+		exit (1);
+	}
+
+	res = cpg_send_ready_callback_set (handle, cpg_bm_send_ready_fn);
+	if (res != CS_OK) {
+		printf ("cpg_send_ready_callback_set failed with result %d\n", res);
+		exit (1);
+	}
+
+	res = cpg_local_get (handle, &local_nodeid);
+	if (res != CS_OK) {
+		printf ("cpg_local_get failed with result %d\n", res);
+		exit (1);
+	}
+	pthread_create (&thread, NULL, dispatch_thread, NULL);
+
+	res = cpg_join (handle, &group_name);
+	if (res != CS_OK) {
+		printf ("cpg_join failed with result %d\n", res);
+		exit (1);
+	}
+
+	for (i = 0; i < 10; i++) { /* number of repetitions - up to 50k */
+		cpg_benchmark (handle, size);
+		errors += out_of_order;
+		signal (SIGALRM, sigalrm_handler);
+		size *= 5;
+		if (size >= (ONE_MEG - 100)) {
+			break;
+		}
+	}
+
+	res = cpg_finalize (handle);
+	if (res != CS_OK) {
+		printf ("cpg_finalize failed with result %d\n", res);
+		exit (1);
+	}
+	return (errors == 0 ? 0 : 1);
+}
@@ -0,0 +1,127 @@
+#!@BASHPATH@
+
+set -e
+
+node_counts="16 128 384"
+out_dir="."
+local_addr="127.0.0.1"
+reload_conf=""
+
+usage() {
+	echo "nodelistbench [options]"
+	echo ""
+	echo "Generates corosync.conf files with nodelist of given sizes. First node"
+	echo "uses local address, others are unreachable 10.x.y.z addresses."
+	echo ""
+	echo "Startup time is measured by running corosync with generated file"
+	echo "(COROSYNC_MAIN_CONFIG_FILE=file corosync -f) and looking for"
+	echo "\"Nodelist with N nodes loaded in\" debug message."
+	echo ""
+	echo "Options:"
+	echo " -n node_counts  Space separated sizes of nodelist (default \"$node_counts\")"
+	echo " -o out_dir      Directory for generated files    (default $out_dir)"
+	echo " -a local_addr   ring0_addr of first (local) node  (default $local_addr)"
+	echo " -r config_file  Config file of running corosync. Every generated"
+	echo "                 nodelist is copied there, reloaded by corosync-cfgtool -R"
+	echo "                 and reload times are printed. Original file is restored."
+	echo " -h              display this help"
+}
+
+gen_config() {
+	count="$1"
+	conf="$2"
+
+	cat > "$conf" << EOF
+totem {
+	version: 2
+	cluster_name: nodelistbench
+	transport: udpu
+	crypto_cipher: none
+	crypto_hash: none
+}
+
+logging {
+	to_stderr: yes
+	debug: on
+}
+
+quorum {
+	provider: corosync_votequorum
+}
+
+nodelist {
+	node {
+		ring0_addr: $local_addr
+		nodeid: 1
+	}
+EOF
+
+	i=2
+	while [ "$i" -le "$count" ]; do
+		cat >> "$conf" << EOF
+	node {
+		ring0_addr: 10.$((i / 65536 % 256)).$((i / 256 % 256)).$((i % 256))
+		nodeid: $i
+	}
+EOF
+		i=$((i + 1))
+	done
+
+	echo "}" >> "$conf"
+}
+
+reload_stats() {
+	for key in duration parse_time diff_time apply_time keys_added keys_modified keys_deleted; do
+		echo -n "$key $(corosync-cmapctl -g runtime.services.cfg.reload.$key | sed -e 's/.* = //') "
+	done
+	echo ""
+}
+
+while getopts "hn:o:a:r:" optflag; do
+		case "$optflag" in
+		h)
+			usage
+			exit 0
+		;;
+		n)
+			node_counts="$OPTARG"
+		;;
+		o)
+			out_dir="$OPTARG"
+		;;
+		a)
+			local_addr="$OPTARG"
+		;;
+		r)
+			reload_conf="$OPTARG"
+		;;
+		\?|:)
+			usage
+			exit 1
+		;;
+		esac
+done
+
+mkdir -p "$out_dir"
+
+for count in $node_counts; do
+	gen_config "$count" "$out_dir/corosync-nodelist-$count.conf"
+	echo "Generated $out_dir/corosync-nodelist-$count.conf"
+done
+
+[ -n "$reload_conf" ] || exit 0
+
+cp -p "$reload_conf" "$out_dir/corosync-nodelist-orig.conf"
+trap 'cp -p "$out_dir/corosync-nodelist-orig.conf" "$reload_conf"; corosync-cfgtool -R > /dev/null' EXIT
+
+for count in $node_counts; do
+	cp "$out_dir/corosync-nodelist-$count.conf" "$reload_conf"
+
+	corosync-cfgtool -R > /dev/null
+	echo -n "$count nodes changed: "
+	reload_stats
+
+	corosync-cfgtool -R > /dev/null
+	echo -n "$count nodes unchanged: "
+	reload_stats
+done
@@ -46,10 +46,13 @@
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <inttypes.h>
+#include <time.h>
 
 #include <corosync/corotypes.h>
 #include <corosync/totem/totem.h>
 #include <corosync/cfg.h>
+#include <corosync/cmap.h>
 
 #define cs_repeat(result, max, code)				\
 	do {							\
@@ -251,9 +254,112 @@ static void killnode_do(unsigned int nodeid)
 }
 
 
+#define SYNC_HISTORY_PREFIX "runtime.sync.history."
+
+static void synchistory_print_key (cmap_handle_t handle, const char *key_name,
+	const char *key_suffix, cmap_value_types_t type)
+{
+	uint8_t u8;
+	uint32_t u32;
+	uint64_t u64;
+	time_t t;
+	char time_str[64];
+
+	switch (type) {
+	case CMAP_VALUETYPE_UINT8:
+		if (cmap_get_uint8 (handle, key_name, &u8) == CS_OK) {
+			printf ("\t%-32s= %u\n", key_suffix, u8);
+		}
+		break;
+	case CMAP_VALUETYPE_UINT32:
+		if (cmap_get_uint32 (handle, key_name, &u32) == CS_OK) {
+			printf ("\t%-32s= %u\n", key_suffix, u32);
+		}
+		break;
+	case CMAP_VALUETYPE_UINT64:
+		if (cmap_get_uint64 (handle, key_name, &u64) != CS_OK) {
+			break;
+		}
+		if (strcmp (key_suffix, "time") == 0) {
+			t = u64 / 1000;
+			strftime (time_str, sizeof (time_str), "%F %T", localtime (&t));
+			printf ("\t%-32s= %s.%03u\n", key_suffix, time_str, (unsigned int)(u64 % 1000));
+		} else {
+			printf ("\t%-32s= %"PRIu64"\n", key_suffix, u64);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static int synchistory_do (void)
+{
+	cs_error_t result;
+	cmap_handle_t handle;
+	cmap_iter_handle_t iter;
+	char prefix[CMAP_KEYNAME_MAXLEN];
+	char key_name[CMAP_KEYNAME_MAXLEN];
+	cmap_value_types_t type;
+	uint64_t last;
+	uint64_t first;
+	uint64_t seq;
+	uint32_t members;
+	int found = 0;
+
+	result = cmap_initialize (&handle);
+	if (result != CS_OK) {
+		printf ("Could not initialize corosync cmap API error %s\n", cs_strerror(result));
+		exit (1);
+	}
+
+	result = cmap_get_uint64 (handle, SYNC_HISTORY_PREFIX "last", &last);
+	if (result != CS_OK) {
+		printf ("No membership change recorded yet\n");
+		(void)cmap_finalize (handle);
+		return (0);
+	}
+
+	printf ("Printing timing of recent membership changes.\n");
+	printf ("Times are in microseconds from the start of membership change.\n");
+
+	/*
+	 * History is bounded, find oldest change still kept
+	 */
+	first = last;
+	while (first > 0) {
+		snprintf (key_name, sizeof (key_name), SYNC_HISTORY_PREFIX "%"PRIu64".members", first - 1);
+		if (cmap_get_uint32 (handle, key_name, &members) != CS_OK) {
+			break;
+		}
+		first--;
+	}
+
+	for (seq = first; seq <= last; seq++) {
+		snprintf (prefix, sizeof (prefix), SYNC_HISTORY_PREFIX "%"PRIu64".", seq);
+		if (cmap_iter_init (handle, prefix, &iter) != CS_OK) {
+			continue;
+		}
+
+		found = 0;
+		while (cmap_iter_next (handle, iter, key_name, NULL, &type) == CS_OK) {
+			if (!found) {
+				printf ("MEMBERSHIP CHANGE %"PRIu64"\n", seq);
+				found = 1;
+			}
+			synchistory_print_key (handle, key_name, key_name + strlen (prefix), type);
+		}
+		(void)cmap_iter_finalize (handle, iter);
+	}
+
+	(void)cmap_finalize (handle);
+
+	return (0);
+}
+
 static void usage_do (void)
 {
-	printf ("corosync-cfgtool [-i <interface ip>] -s] [-r] [-H] [service_name] [-k] [nodeid] [-a] [nodeid]\n\n");
+	printf ("corosync-cfgtool [-i <interface ip>] -s] [-r] [-H] [service_name] [-k] [nodeid] [-a] [nodeid] [-t]\n\n");
 	printf ("A tool for displaying and configuring active parameters within corosync.\n");
 	printf ("options:\n");
 	printf ("\t-s\tDisplays the status of the current rings on this node.\n");
@@ -263,10 +369,11 @@ static void usage_do (void)
 	printf ("\t-k\tKill a node identified by node id.\n");
 	printf ("\t-R\tReload corosync.conf on all nodes.\n");
 	printf ("\t-H\tShutdown corosync cleanly on this node.\n");
+	printf ("\t-t\tDisplay timing of recent membership changes on this node.\n");
 }
 
 int main (int argc, char *argv[]) {
-	const char *options = "i:srRk:a:hH";
+	const char *options = "i:srRk:a:hHt";
 	int opt;
 	unsigned int nodeid;
 	char interface_name[128] = "";
@@ -299,6 +406,9 @@ int main (int argc, char *argv[]) {
 		case 'a':
 			showaddrs_do( atoi(optarg) );
 			break;
+		case 't':
+			rc = synchistory_do ();
+			break;
 		case 'h':
 			usage_do();
 			break;
@@ -48,6 +48,12 @@
 
 #define MAX_TRY_AGAIN 10
 
+/*
+ * Keys and values are read in pages to save IPC round trips
+ */
+#define PAGE_ITEMS 256
+#define PAGE_BUF_SIZE (64 * 1024)
+
 enum user_action {
 	ACTION_GET,
 	ACTION_SET,
@@ -57,6 +63,7 @@ enum user_action {
 	ACTION_PRINT_PREFIX,
 	ACTION_TRACK,
 	ACTION_LOAD,
+	ACTION_STATS,
 };
 
 struct name_to_type_item {
@@ -96,7 +103,7 @@ static int convert_name_to_type(const char *name)
 static int print_help(void)
 {
 	printf("\n");
-	printf("usage:  corosync-cmapctl [-b] [-dghsTtp] [params...]\n");
+	printf("usage:  corosync-cmapctl [-b] [-dghsSTtp] [params...]\n");
 	printf("\n");
 	printf("    -b show binary values\n");
 	printf("\n");
@@ -137,6 +144,9 @@ static int print_help(void)
 	printf("Track changes on keys with key prefix:\n");
 	printf("    corosync-cmapctl [-b] -T key_prefix\n");
 	printf("\n");
+	printf("Display runtime statistics from shared memory segment (without IPC):\n");
+	printf("    corosync-cmapctl -S\n");
+	printf("\n");
 
 	return (0);
 }
@@ -365,21 +375,234 @@ static void print_key(cmap_handle_t handle,
 static void print_iter(cmap_handle_t handle, const char *prefix)
 {
 	cmap_iter_handle_t iter_handle;
-	char key_name[CMAP_KEYNAME_MAXLEN + 1];
-	size_t value_len;
-	cmap_value_types_t type;
+	struct cmap_key_value *items;
+	void *buf;
+	size_t items_count;
+	size_t i;
 	cs_error_t err;
 
+	items = malloc(PAGE_ITEMS * sizeof(*items));
+	buf = malloc(PAGE_BUF_SIZE);
+	if (items == NULL || buf == NULL) {
+		fprintf(stderr, "Can't alloc memory\n");
+		exit(EXIT_FAILURE);
+	}
+
 	err = cmap_iter_init(handle, prefix, &iter_handle);
 	if (err != CS_OK) {
 		fprintf (stderr, "Failed to initialize iteration. Error %s\n", cs_strerror(err));
 		exit (EXIT_FAILURE);
 	}
 
-	while ((err = cmap_iter_next(handle, iter_handle, key_name, &value_len, &type)) == CS_OK) {
-		print_key(handle, key_name, value_len, NULL, type);
+	items_count = PAGE_ITEMS;
+	while ((err = cmap_iter_next_page(handle, iter_handle, items, &items_count,
+	    buf, PAGE_BUF_SIZE)) == CS_OK) {
+		for (i = 0; i < items_count; i++) {
+			/*
+			 * Value which didn't fit into page is NULL and print_key gets it
+			 */
+			print_key(handle, items[i].key_name, items[i].value_len, items[i].value,
+			    items[i].type);
+		}
+		items_count = PAGE_ITEMS;
 	}
 	cmap_iter_finalize(handle, iter_handle);
+
+	free(items);
+	free(buf);
+}
+
+static void get_keys(cmap_handle_t handle, int argc, char *argv[])
+{
+	struct cmap_key_value *items;
+	void *buf;
+	size_t items_count;
+	size_t i;
+	cs_error_t err;
+
+	items = calloc(argc, sizeof(*items));
+	buf = malloc(PAGE_BUF_SIZE);
+	if (items == NULL || buf == NULL) {
+		fprintf(stderr, "Can't alloc memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	items_count = 0;
+	for (i = 0; i < (size_t)argc; i++) {
+		if (strlen(argv[i]) > CMAP_KEYNAME_MAXLEN) {
+			fprintf(stderr, "Can't get key %s. Error %s\n", argv[i],
+			    cs_strerror(CS_ERR_NAME_TOO_LONG));
+			continue;
+		}
+		strcpy(items[items_count++].key_name, argv[i]);
+	}
+
+	err = cmap_get_multi(handle, items, items_count, buf, PAGE_BUF_SIZE);
+	if (err != CS_OK) {
+		fprintf(stderr, "Can't get keys. Error %s\n", cs_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < items_count; i++) {
+		if (items[i].error == CS_OK || items[i].error == CS_ERR_NO_SPACE) {
+			print_key(handle, items[i].key_name, items[i].value_len, items[i].value,
+			    items[i].type);
+		} else {
+			fprintf(stderr, "Can't get key %s. Error %s\n", items[i].key_name,
+			    cs_strerror(items[i].error));
+		}
+	}
+
+	free(items);
+	free(buf);
+}
+
+static void print_stats_u64(const char *prefix, const char *name, uint64_t u64)
+{
+
+	printf("%s%s (u64) = %"PRIu64"\n", prefix, name, u64);
+}
+
+static void print_stats_u32(const char *prefix, const char *name, uint32_t u32)
+{
+
+	printf("%s%s (u32) = %u\n", prefix, name, u32);
+}
+
+#define PRINT_STATS_U64(prefix, s, field) print_stats_u64(prefix, #field, (s)->field)
+#define PRINT_STATS_U32(prefix, s, field) print_stats_u32(prefix, #field, (s)->field)
+
+static int print_stats(void)
+{
+	cmap_stats_handle_t handle;
+	struct cmap_stats *stats;
+	const struct cmap_stats_totem *totem;
+	const struct cmap_stats_service *service;
+	const struct cmap_stats_connection *conn;
+	char prefix[CMAP_KEYNAME_MAXLEN + 1];
+	cs_error_t err;
+	int i, j;
+
+	stats = malloc(sizeof(*stats));
+	if (stats == NULL) {
+		fprintf(stderr, "Can't alloc memory\n");
+		return (EXIT_FAILURE);
+	}
+
+	err = cmap_stats_open(&handle);
+	if (err == CS_OK) {
+		err = cmap_stats_read(handle, stats);
+		(void)cmap_stats_close(handle);
+	}
+
+	if (err != CS_OK) {
+		fprintf(stderr, "Can't read statistics segment. Error %s\n", cs_strerror(err));
+		free(stats);
+		return (EXIT_FAILURE);
+	}
+
+	totem = &stats->totem;
+
+	print_stats_u64("runtime.stats.", "update_time", stats->update_time);
+
+	PRINT_STATS_U32("runtime.totem.pg.", totem, msg_reserved);
+	PRINT_STATS_U32("runtime.totem.pg.", totem, msg_queue_avail);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, orf_token_tx);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, orf_token_rx);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, memb_merge_detect_tx);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, memb_merge_detect_rx);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, memb_join_tx);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, memb_join_rx);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, mcast_tx);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, mcast_retx);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, mcast_rx);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, memb_commit_token_tx);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, memb_commit_token_rx);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, token_hold_cancel_tx);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, token_hold_cancel_rx);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, operational_entered);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, operational_token_lost);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, gather_entered);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, gather_token_lost);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, commit_entered);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, commit_token_lost);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, recovery_entered);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, recovery_token_lost);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, consensus_timeouts);
+	PRINT_STATS_U64("runtime.totem.pg.mrp.srp.", totem, rx_msg_dropped);
+	PRINT_STATS_U32("runtime.totem.pg.mrp.srp.", totem, continuous_gather);
+	PRINT_STATS_U32("runtime.totem.pg.mrp.srp.", totem, continuous_sendmsg_failures);
+	PRINT_STATS_U32("runtime.totem.pg.mrp.srp.", totem, firewall_enabled_or_nic_failure);
+	PRINT_STATS_U32("runtime.totem.pg.mrp.srp.", totem, mtt_rx_token);
+	PRINT_STATS_U32("runtime.totem.pg.mrp.srp.", totem, avg_token_workload);
+	PRINT_STATS_U32("runtime.totem.pg.mrp.srp.", totem, avg_backlog_calc);
+
+	for (i = 0; i < totem->interface_count && i < CMAP_STATS_INTERFACE_MAX; i++) {
+		snprintf(prefix, sizeof(prefix), "runtime.totem.pg.mrp.rrp.%u.", i);
+		print_stats_u32(prefix, "faulty", totem->faulty[i]);
+	}
+
+	/*
+	 * Token ring from latest to earliest entry
+	 */
+	for (i = totem->latest_token, j = 0; j < CMAP_STATS_TOKEN_MAX && i != totem->earliest_token; j++) {
+		if (i < 0 || i >= CMAP_STATS_TOKEN_MAX) {
+			break;
+		}
+		snprintf(prefix, sizeof(prefix), "runtime.totem.pg.mrp.srp.token.%u.", j);
+		PRINT_STATS_U32(prefix, &totem->token[i], rx);
+		PRINT_STATS_U32(prefix, &totem->token[i], tx);
+		PRINT_STATS_U32(prefix, &totem->token[i], backlog_calc);
+		i = (i == 0 ? CMAP_STATS_TOKEN_MAX - 1 : i - 1);
+	}
+
+	for (i = 0; i < CMAP_STATS_SERVICES_MAX; i++) {
+		service = &stats->services[i];
+		if (service->name[0] == '\0') {
+			continue;
+		}
+
+		for (j = 0; j < CMAP_STATS_SERVICE_FN_MAX; j++) {
+			if (service->rx[j] == 0 && service->tx[j] == 0) {
+				continue;
+			}
+			snprintf(prefix, sizeof(prefix), "runtime.services.%.*s.%u.",
+			    (int)sizeof(service->name), service->name, j);
+			print_stats_u64(prefix, "rx", service->rx[j]);
+			print_stats_u64(prefix, "tx", service->tx[j]);
+		}
+	}
+
+	for (i = 0; i < CMAP_STATS_CONNECTIONS_MAX; i++) {
+		conn = &stats->connections[i];
+		if (conn->name[0] == '\0') {
+			continue;
+		}
+
+		snprintf(prefix, sizeof(prefix), "runtime.connections.%.*s.",
+		    (int)sizeof(conn->name), conn->name);
+		PRINT_STATS_U32(prefix, conn, client_pid);
+		PRINT_STATS_U32(prefix, conn, service_id);
+		PRINT_STATS_U64(prefix, conn, requests);
+		PRINT_STATS_U64(prefix, conn, responses);
+		PRINT_STATS_U64(prefix, conn, dispatched);
+		PRINT_STATS_U64(prefix, conn, send_retries);
+		PRINT_STATS_U64(prefix, conn, recv_retries);
+		PRINT_STATS_U32(prefix, conn, flow_control);
+		PRINT_STATS_U64(prefix, conn, flow_control_count);
+		PRINT_STATS_U32(prefix, conn, queue_size);
+		PRINT_STATS_U32(prefix, conn, queue_size_max);
+		PRINT_STATS_U64(prefix, conn, queue_bytes);
+		PRINT_STATS_U64(prefix, conn, queue_bytes_max);
+		PRINT_STATS_U64(prefix, conn, invalid_request);
+		PRINT_STATS_U64(prefix, conn, overload);
+		PRINT_STATS_U32(prefix, conn, fc_weight);
+		PRINT_STATS_U64(prefix, conn, fc_deferred);
+	}
+
+	free(stats);
+
+	return (EXIT_SUCCESS);
 }
 
 static void delete_with_prefix(cmap_handle_t handle, const char *prefix)
@@ -743,8 +966,6 @@ int main(int argc, char *argv[])
 	cs_error_t err;
 	cmap_handle_t handle;
 	int i;
-	size_t value_len;
-	cmap_value_types_t type;
 	int track_prefix;
 	int no_retries;
 	char * settings_file = NULL;
@@ -752,7 +973,7 @@ int main(int argc, char *argv[])
 	action = ACTION_PRINT_PREFIX;
 	track_prefix = 1;
 
-	while ((c = getopt(argc, argv, "hgsdDtTbp:")) != -1) {
+	while ((c = getopt(argc, argv, "hgsSdDtTbp:")) != -1) {
 		switch (c) {
 		case 'h':
 			return print_help();
@@ -766,6 +987,9 @@ int main(int argc, char *argv[])
 		case 's':
 			action = ACTION_SET;
 			break;
+		case 'S':
+			action = ACTION_STATS;
+			break;
 		case 'd':
 			action = ACTION_DELETE;
 			break;
@@ -799,6 +1023,10 @@ int main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
+	if (action == ACTION_STATS) {
+		return (print_stats());
+	}
+
 	if (argc == 0 &&
 	    action != ACTION_LOAD &&
 	    action != ACTION_PRINT_ALL) {
@@ -826,14 +1054,7 @@ int main(int argc, char *argv[])
 		}
 		break;
 	case ACTION_GET:
-		for (i = 0; i < argc; i++) {
-			err = cmap_get(handle, argv[i], NULL, &value_len, &type);
-			if (err == CS_OK) {
-				print_key(handle, argv[i], value_len, NULL, type);
-			} else {
-				fprintf(stderr, "Can't get key %s. Error %s\n", argv[i], cs_strerror(err));
-			}
-		}
+		get_keys(handle, argc, argv);
 		break;
 	case ACTION_DELETE:
 		for (i = 0; i < argc; i++) {
@@ -857,6 +1078,11 @@ int main(int argc, char *argv[])
 		}
 		track_changes(handle);
 		break;
+	case ACTION_STATS:
+		/*
+		 * Handled before connecting to executive
+		 */
+		break;
 	case ACTION_SET:
 		if (argc < 3) {
 			fprintf(stderr, "At least 3 parameters are expected for set\n");